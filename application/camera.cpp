@@ -20,6 +20,8 @@ static infrastructure::CameraType to_camera_type(const std::string& type) {
 
 static infrastructure::EncoderType to_encoder_type(const std::string& type) {
     if (type == "SW") return infrastructure::EncoderType::SW;
+    else if (type == "SW_STRIPS") return infrastructure::EncoderType::SW_STRIPS;
+    else if (type == "TURBO") return infrastructure::EncoderType::TURBO;
     else if (type == "NONE") return infrastructure::EncoderType::NONE;
     throw std::runtime_error("Unknown encoder type: " + type);
 }
@@ -42,12 +44,18 @@ int main(int argc, char* argv[]) {
         config.value("cameraLensPosition", 0.5f),
         config.value("cameraFramesPerSecond", 30.0f),
         to_encoder_type(config.value("encoderType", "SW")),
-        config.value("encoderBuffersDownstream", 4)
+        config.value("encoderBuffersDownstream", 4),
+        config.value("encoderStreamChunkSize", 16384),
+        config.value("encoderStripCount", 4),
+        config.value("encoderFramesInFlight", 2)
     );
     auto service = service::CameraStreamer::Create(camera_config);
     service->Start();
 
-    application::WaitForShutdown();
+    application::WaitForShutdown(
+        config.value("latencyReportSeconds", 0),
+        [&service]() { std::cout << service->GetLatencyReport() << std::flush; }
+    );
 
     service->Stop();
     std::this_thread::sleep_for(500ms);
@@ -23,6 +23,13 @@ static infrastructure::GraphicsType to_graphics_type(const std::string& type) {
     throw std::runtime_error("Unknown graphics type: " + type);
 }
 
+static infrastructure::GraphicsFramePath to_graphics_frame_path(const std::string &path) {
+    if (path == "AUTO") return infrastructure::GraphicsFramePath::AUTO;
+    else if (path == "DMABUF") return infrastructure::GraphicsFramePath::DMABUF;
+    else if (path == "UPLOAD") return infrastructure::GraphicsFramePath::UPLOAD;
+    throw std::runtime_error("Unknown graphics frame path: " + path);
+}
+
 
 int main(int argc, char* argv[]) {
 
@@ -45,7 +52,9 @@ int main(int argc, char* argv[]) {
             config.value("decoderBuffersDownstream", 4),
             to_decoder_type(config.value("decoderType", "SW")),
             to_graphics_type(config.value("graphicsType", "DISPLAY")),
-            config.value("displayRotateTimeout", 10)
+            to_graphics_frame_path(config.value("graphicsFramePath", "AUTO")),
+            config.value("displayRotateTimeout", 10),
+            config.value("decoderOutputScale", 1u)
     );
     auto service = service::DisplayStreamer::Create(display_config);
     service->Start();
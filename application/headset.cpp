@@ -12,10 +12,20 @@ using namespace std::literals;
 
 static infrastructure::DecoderType to_decoder_type(const std::string& type) {
     if (type == "SW") return infrastructure::DecoderType::SW;
+    else if (type == "TURBO") return infrastructure::DecoderType::TURBO;
     else if (type == "NONE") return infrastructure::DecoderType::NONE;
     throw std::runtime_error("Unknown decoder type: " + type);
 }
 
+static infrastructure::DecoderAllocatorType to_decoder_allocator_type(const std::string &type) {
+    if (type == "V4L2") return infrastructure::DecoderAllocatorType::V4L2;
+    else if (type == "DMA_HEAP") return infrastructure::DecoderAllocatorType::DMA_HEAP;
+    else if (type == "UDMABUF") return infrastructure::DecoderAllocatorType::UDMABUF;
+    else if (type == "HEAP") return infrastructure::DecoderAllocatorType::HEAP;
+    else if (type == "AUTO") return infrastructure::DecoderAllocatorType::AUTO;
+    throw std::runtime_error("Unknown decoder allocator type: " + type);
+}
+
 static infrastructure::GraphicsType to_graphics_type(const std::string& type) {
     if (type == "HEADSET") return infrastructure::GraphicsType::HEADSET;
     if (type == "DISPLAY") return infrastructure::GraphicsType::DISPLAY;
@@ -23,6 +33,25 @@ static infrastructure::GraphicsType to_graphics_type(const std::string& type) {
     throw std::runtime_error("Unknown graphics type: " + type);
 }
 
+static infrastructure::GraphicsFramePath to_graphics_frame_path(const std::string &path) {
+    if (path == "AUTO") return infrastructure::GraphicsFramePath::AUTO;
+    else if (path == "DMABUF") return infrastructure::GraphicsFramePath::DMABUF;
+    else if (path == "UPLOAD") return infrastructure::GraphicsFramePath::UPLOAD;
+    throw std::runtime_error("Unknown graphics frame path: " + path);
+}
+
+static infrastructure::LensDistortion to_lens_distortion(const nlohmann::json &config) {
+    infrastructure::LensDistortion lens;
+    lens.enabled = config.value("enabled", lens.enabled);
+    lens.k1 = config.value("k1", lens.k1);
+    lens.k2 = config.value("k2", lens.k2);
+    lens.lens_center_offset = config.value("lensCenterOffset", lens.lens_center_offset);
+    lens.scale = config.value("scale", lens.scale);
+    lens.columns = config.value("columns", lens.columns);
+    lens.rows = config.value("rows", lens.rows);
+    return lens;
+}
+
 static infrastructure::GpioType to_gpio_type(const std::string &type) {
     if (type == "PIGPIO") return infrastructure::GpioType::PIGPIO;
     else if (type == "NONE") return infrastructure::GpioType::NONE;
@@ -50,12 +79,23 @@ int main(int argc, char* argv[]) {
         config.value("decoderBuffersDownstream", 4),
         to_decoder_type(config.value("decoderType", "SW")),
         to_graphics_type(config.value("graphicsType", "GLFW")),
-        to_gpio_type(config.value("gpioType", "PIGPIO"))
+        to_graphics_frame_path(config.value("graphicsFramePath", "AUTO")),
+        to_gpio_type(config.value("gpioType", "PIGPIO")),
+        config.value("clientStreamReceive", true),
+        config.value("decoderThreadCount", 3u),
+        config.value("decoderFramesInFlight", 2u),
+        to_decoder_allocator_type(config.value("decoderAllocator", "AUTO")),
+        config.value("decoderOutputScale", 1u),
+        to_lens_distortion(config.value("lensDistortion", nlohmann::json::object())),
+        config.value("graphicsCacheDir", (std::filesystem::path(APPLICATION_DIR).parent_path() / "cache").string())
      );
     auto service = service::HeadsetStreamer::Create(headset_config);
     service->Start();
 
-    application::WaitForShutdown();
+    application::WaitForShutdown(
+        config.value("latencyReportSeconds", 0),
+        [&service]() { std::cout << service->GetLatencyReport() << std::flush; }
+    );
 
     service->Stop();
     std::this_thread::sleep_for(500ms);
@@ -41,7 +41,7 @@ namespace application {
         std::cout << "Requested a hangup? " << signal << std::endl;
     }
 
-    void WaitForShutdown() {
+    void WaitForShutdown(const int report_seconds, const std::function<void()> &report) {
         bool exit = false;
 
         shutdown_handler = [&](int signal) {
@@ -53,8 +53,13 @@ namespace application {
         signal(SIGTERM, signal_handler);
         signal(SIGHUP, ignore_handler);
 
+        int seconds_waited = 0;
         while(!exit){
             std::this_thread::sleep_for(1s);
+            seconds_waited += 1;
+            if (report && report_seconds > 0 && seconds_waited % report_seconds == 0) {
+                report();
+            }
         }
     }
 }
\ No newline at end of file
@@ -2,11 +2,14 @@
 #ifndef AUGMENTEDNORMALCY_APPLICATION_RUNTIME_HPP
 #define AUGMENTEDNORMALCY_APPLICATION_RUNTIME_HPP
 
+#include <functional>
+
 namespace application {
     void RemoveSuccessFile();
     void CreateSuccessFile();
 
-    void WaitForShutdown();
+    // optionally calls report every report_seconds while waiting
+    void WaitForShutdown(int report_seconds = 0, const std::function<void()> &report = nullptr);
 }
 
 #endif
\ No newline at end of file
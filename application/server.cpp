@@ -25,6 +25,25 @@ static service::CameraSwitchingStrategy to_camera_switching_strategy(const std::
     throw std::runtime_error("Unknown CameraSwitchingStrategy: " + type);
 }
 
+static infrastructure::TcpServerBackend to_tcp_server_backend(const std::string& type) {
+    if (type == "ASIO") return infrastructure::TcpServerBackend::ASIO;
+    if (type == "URING") return infrastructure::TcpServerBackend::URING;
+    throw std::runtime_error("Unknown TcpServerBackend: " + type);
+}
+
+/* headsetBuffersCount was the old name, and counted the frame being written along with the ones waiting behind it */
+static int to_headset_queue_depth(const nlohmann::json &config) {
+    if (config.contains("headsetQueueDepth")) {
+        return config["headsetQueueDepth"].get<int>();
+    }
+    if (config.contains("headsetBuffersCount")) {
+        const int depth = std::max(config["headsetBuffersCount"].get<int>() - 1, 1);
+        std::cout << "headsetBuffersCount is deprecated; using it as a headsetQueueDepth of " << depth << std::endl;
+        return depth;
+    }
+    return 4;
+}
+
 int main(int argc, char* argv[]) {
 
     application::RemoveSuccessFile();
@@ -33,11 +52,16 @@ int main(int argc, char* argv[]) {
 
     const service::ServerStreamerConfig conf(
         config.value("tcpPoolSize", 6),
+        config.value("tcpShardCount", 0),
         config.value("serverPort", 6969),
         config.value("serverTimeoutOnRead", 3),
         config.value("cameraBuffersCount", 8),
-        config.value("headsetBuffersCount", 5),
+        to_headset_queue_depth(config),
+        config.value("headsetQueueConflating", false),
+        config.value("serverCutThrough", false),
         config.value("cameraBufferSize", 1536 * 864 * 3 * 0.5),
+        to_tcp_server_backend(config.value("serverBackend", "ASIO")),
+        config.value("headsetZeroCopy", false),
         config.value("websocketPort", 8008),
         config.value("websocketTimeout", 6),
         to_client_assignment_strategy(config.value("serverClientAssignmentStrategy", "IP_BOUNDS")),
@@ -49,7 +73,10 @@ int main(int argc, char* argv[]) {
 
     bool exit = false;
 
-    application::WaitForShutdown();
+    application::WaitForShutdown(
+        config.value("latencyReportSeconds", 0),
+        [&service]() { std::cout << service->GetLatencyReport() << std::flush; }
+    );
 
     service->Stop();
     std::this_thread::sleep_for(500ms);
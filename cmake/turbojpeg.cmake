@@ -0,0 +1,13 @@
+
+if (FEATURE_ENCODER OR FEATURE_DECODER)
+    find_path(TURBOJPEG_INCLUDE_DIR NAMES turbojpeg.h)
+    find_library(TURBOJPEG_LIBRARY NAMES turbojpeg)
+    # optional; without it, the TURBO encoder and decoder types just aren't there
+    if (TURBOJPEG_INCLUDE_DIR AND TURBOJPEG_LIBRARY)
+        message(STATUS "turbojpeg library found:")
+        message(STATUS "    libraries: ${TURBOJPEG_LIBRARY}")
+        message(STATUS "    include path: ${TURBOJPEG_INCLUDE_DIR}")
+        set(TURBOJPEG_AVAILABLE 1)
+        set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -D_TURBOJPEG_")
+    endif()
+endif()
@@ -0,0 +1,25 @@
+
+if (NOT AN_PLATFORM_TYPE STREQUAL RPI)
+    find_path(URING_INCLUDE_DIR NAMES liburing.h)
+    find_library(URING_LIBRARY NAMES uring)
+    # optional; without it, the server's URING backend just falls back to asio
+    if (URING_INCLUDE_DIR AND URING_LIBRARY)
+        # the registered buffer table needs liburing 2.2 or newer; an older one gets treated like none at all
+        include(CheckCXXSymbolExists)
+        set(CMAKE_REQUIRED_INCLUDES ${URING_INCLUDE_DIR})
+        set(CMAKE_REQUIRED_LIBRARIES ${URING_LIBRARY})
+        check_cxx_symbol_exists(io_uring_register_buffers_sparse liburing.h URING_HAS_BUFFERS_SPARSE)
+        check_cxx_symbol_exists(io_uring_register_buffers_update_tag liburing.h URING_HAS_BUFFERS_UPDATE_TAG)
+        unset(CMAKE_REQUIRED_INCLUDES)
+        unset(CMAKE_REQUIRED_LIBRARIES)
+        if (URING_HAS_BUFFERS_SPARSE AND URING_HAS_BUFFERS_UPDATE_TAG)
+            message(STATUS "liburing library found:")
+            message(STATUS "    libraries: ${URING_LIBRARY}")
+            message(STATUS "    include path: ${URING_INCLUDE_DIR}")
+            set(URING_AVAILABLE 1)
+            set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -D_URING_")
+        else()
+            message(STATUS "liburing at ${URING_LIBRARY} is older than 2.2; the server stays on asio")
+        endif()
+    endif()
+endif()
@@ -6,6 +6,7 @@
 #define INFRASTRUCTURE_CAMERA_HPP
 
 #include "utils/buffers.hpp"
+#include "utils/latency.hpp"
 
 namespace infrastructure {
 
@@ -25,7 +26,7 @@ namespace infrastructure {
     };
 
 
-    class Camera {
+    class Camera: public LatencyStatsSink {
     public:
         [[nodiscard]] static std::shared_ptr<Camera> Create(
             const CameraConfig &config, CameraBufferCallback &&send_callback
@@ -181,8 +181,6 @@ namespace infrastructure {
             // request failed, probably closing
             return;
         }
-        static long ctr = 0;
-
         // I can't believe I need all this to get the memory location
         const Stream *stream = _configuration->at(0).stream();
         auto &buffers = request->buffers();
@@ -198,6 +196,12 @@ namespace infrastructure {
         auto *out_buffer = new CameraBuffer(
             static_cast<void *>(request), mem, fd, span.size(), timestamp_ns
         );
+        auto *metadata = out_buffer->GetMetadata();
+        metadata->sequence_number = _frame_sequence++;
+        metadata->width = _configuration->at(0).size.width;
+        metadata->height = _configuration->at(0).size.height;
+        // the sensor stamps with the same monotonic clock, so this is exposure start to buffer in hand
+        metadata->stage_timestamp_us = recordLatencySince(LatencyStage::CAPTURE, timestamp_ns);
         {
             std::lock_guard<std::mutex> lock(_camera_buffers_mutex);
             _camera_buffers.insert(out_buffer);
@@ -58,6 +58,7 @@ namespace infrastructure {
         bool _camera_started = false;
 
         float _frame_rate = 0.0;
+        uint32_t _frame_sequence = 0;
         float _lens_position = 0.0;
 
         std::unique_ptr<libcamera::FrameBufferAllocator> _allocator;
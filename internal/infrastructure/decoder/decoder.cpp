@@ -11,6 +11,10 @@ namespace infrastructure {
         switch(config.get_decoder_type()) {
             case DecoderType::SW:
                 return std::make_shared<SwDecoder>(config, std::move(send_callback));
+#ifdef _TURBOJPEG_
+            case DecoderType::TURBO:
+                return std::make_shared<SwDecoder>(config, std::move(send_callback));
+#endif
             case DecoderType::NONE:
                 return std::make_shared<NullDecoder>(config, std::move(send_callback));
             default:
@@ -21,4 +25,15 @@ namespace infrastructure {
     Decoder::Decoder(const DecoderConfig &config, DecoderBufferCallback &&send_callback):
         _send_callback(std::move(send_callback))
     {}
+
+    double Decoder::GetSkippedFrameRate() {
+        const auto now = monotonicClockMicros();
+        const auto skipped_frames = GetSkippedFrameCount();
+        const auto elapsed_us = now - _last_rate_us;
+        const auto rate = elapsed_us <= 0 ?
+            0.0 : (double) (skipped_frames - _last_rate_skipped_frames) * 1000000.0 / (double) elapsed_us;
+        _last_rate_skipped_frames = skipped_frames;
+        _last_rate_us = now;
+        return rate;
+    }
 }
\ No newline at end of file
@@ -6,11 +6,15 @@
 #define INFRASTRUCTURE_DECODER_HPP
 
 #include "utils/buffers.hpp"
+#include "utils/latency.hpp"
+#include "decoder_allocator.hpp"
 
 namespace infrastructure {
 
     enum class DecoderType {
         SW,
+        /* SW, but decompressing through TurboJPEG's plane api; only there when built with it */
+        TURBO,
         NONE,
     };
 
@@ -18,9 +22,17 @@ namespace infrastructure {
         [[nodiscard]] virtual DecoderType get_decoder_type() const = 0;
         [[nodiscard]] virtual unsigned int get_decoder_downstream_buffer_count() const = 0;
         [[nodiscard]] virtual std::pair<int, int> get_decoder_width_height() const = 0;
+        /* threads a frame with restart markers gets split across; 1 decodes everything on one thread, 0 is one per core */
+        [[nodiscard]] virtual unsigned int get_decoder_thread_count() const = 0;
+        /* frames SW decodes at once, each on its own thread; 1 is one at a time, 0 is one per core */
+        [[nodiscard]] virtual unsigned int get_decoder_frames_in_flight() const = 0;
+        /* where SW gets the buffers it decodes into */
+        [[nodiscard]] virtual DecoderAllocatorType get_decoder_allocator_type() const = 0;
+        /* SW decodes at 1 / this of the width and height; 1, 2, 4 or 8 */
+        [[nodiscard]] virtual unsigned int get_decoder_output_scale() const = 0;
     };
 
-    class Decoder {
+    class Decoder: public LatencyStatsSink {
     public:
         [[nodiscard]] static std::shared_ptr<Decoder> Create(
             const DecoderConfig &config, DecoderBufferCallback &&send_callback
@@ -30,14 +42,27 @@ namespace infrastructure {
             StartDecoder();
         }
         virtual void PostJpegBuffer(std::shared_ptr<SizedBuffer> &&buffer) = 0;
+        /* every buffer a frame can come back in, so graphics can import them up front; empty if unknown */
+        [[nodiscard]] virtual std::vector<DecoderBufferLayout> GetBufferLayouts() const {
+            return {};
+        }
         void Stop() {
             StopDecoder();
         }
+        /* frames that a newer one replaced before anyone started decoding them */
+        [[nodiscard]] unsigned long GetSkippedFrameCount() const {
+            return _skipped_frames;
+        }
+        /* skips per second since the last call; for reporting on demand, from one thread */
+        [[nodiscard]] double GetSkippedFrameRate();
     protected:
         DecoderBufferCallback _send_callback;
+        std::atomic<unsigned long> _skipped_frames = { 0 };
     private:
         virtual void StartDecoder() = 0;
         virtual void StopDecoder() = 0;
+        unsigned long _last_rate_skipped_frames = 0;
+        int64_t _last_rate_us = monotonicClockMicros();
     };
 
 }
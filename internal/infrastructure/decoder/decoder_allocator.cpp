@@ -0,0 +1,355 @@
+//
+// Created by brucegoose on 7/22/23.
+//
+
+#include "decoder_allocator.hpp"
+
+#include <fcntl.h>
+#include <iostream>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <linux/udmabuf.h>
+#include <linux/videodev2.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace infrastructure {
+
+    static int xioctl(int fd, unsigned long ctl, void *arg) {
+        int ret, num_tries = 10;
+        do
+        {
+            ret = ioctl(fd, ctl, arg);
+        } while (ret == -1 && errno == EINTR && num_tries-- > 0);
+        return ret;
+    }
+
+    static std::size_t frameSize(const std::pair<int, int> &width_height) {
+        return width_height.first * width_height.second * 3 / 2;
+    }
+
+    static std::size_t pageAligned(const std::size_t size) {
+        const auto page = (std::size_t) sysconf(_SC_PAGESIZE);
+        return (size + page - 1) / page * page;
+    }
+
+    /* dmabufs the cpu writes into need their caches synced around it, or the gpu may read stale lines */
+    class DmaBufAllocator: public DecoderAllocator {
+    public:
+        void StartWrite(DecoderBuffer *buffer) override {
+            syncBuffer(buffer, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+        }
+        void FinishWrite(DecoderBuffer *buffer) override {
+            syncBuffer(buffer, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+        }
+    private:
+        static void syncBuffer(DecoderBuffer *buffer, const uint64_t flags) {
+            dma_buf_sync sync = {};
+            sync.flags = flags;
+            xioctl(buffer->GetFd(), DMA_BUF_IOCTL_SYNC, &sync);
+        }
+    };
+
+    class V4l2DecoderAllocator: public DecoderAllocator {
+    public:
+        explicit V4l2DecoderAllocator(const std::pair<int, int> &width_height) {
+            _decoder_fd = open(_device_name, O_RDWR, 0);
+            if (_decoder_fd < 0) {
+                throw std::runtime_error("failed to open the v4l2 decoder");
+            }
+
+            v4l2_format fmt = {0};
+            fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+            fmt.fmt.pix_mp.width = width_height.first;
+            fmt.fmt.pix_mp.height = width_height.second;
+            fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_YUV420;
+            fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+            fmt.fmt.pix_mp.colorspace = V4L2_COLORSPACE_REC709;
+            fmt.fmt.pix_mp.num_planes = 1;
+            fmt.fmt.pix_mp.plane_fmt[0].bytesperline = width_height.first;
+            fmt.fmt.pix_mp.plane_fmt[0].sizeimage = frameSize(width_height);
+
+            if (xioctl(_decoder_fd, VIDIOC_S_FMT, &fmt)) {
+                close(_decoder_fd);
+                throw std::runtime_error("failed to set capture caps");
+            }
+        }
+        std::vector<DecoderBuffer *> Allocate(unsigned int count) override {
+            v4l2_requestbuffers reqbufs = {};
+            reqbufs.count = count;
+            reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+            reqbufs.memory = V4L2_MEMORY_MMAP;
+            if (xioctl(_decoder_fd, VIDIOC_REQBUFS, &reqbufs) < 0) {
+                throw std::runtime_error("request for output buffers failed");
+            } else if (reqbufs.count != count) {
+                std::stringstream out_str;
+                out_str << "Unable to return " << count << " capture buffers; only got " << reqbufs.count;
+                throw std::runtime_error(out_str.str());
+            }
+
+            std::vector<DecoderBuffer *> buffers;
+            v4l2_plane planes[VIDEO_MAX_PLANES];
+            v4l2_buffer buffer = {};
+            v4l2_exportbuffer expbuf = {};
+
+            for (unsigned int i = 0; i < count; i++) {
+
+                /*
+                 * Get buffer
+                 */
+
+                buffer = {};
+                memset(planes, 0, sizeof(planes));
+                buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+                buffer.memory = V4L2_MEMORY_MMAP;
+                buffer.index = i;
+                buffer.length = 1;
+                buffer.m.planes = planes;
+
+                if (xioctl(_decoder_fd, VIDIOC_QUERYBUF, &buffer) < 0)
+                    throw std::runtime_error("failed to query output buffer");
+
+                /*
+                 * mmap
+                 */
+
+                auto capture_size = buffer.m.planes[0].length;
+                auto capture_offset = buffer.m.planes[0].m.mem_offset;
+                auto capture_mem = mmap(
+                    nullptr, capture_size, PROT_READ | PROT_WRITE, MAP_SHARED, _decoder_fd, capture_offset
+                );
+                if (capture_mem == MAP_FAILED)
+                    throw std::runtime_error("failed to mmap output buffer");
+
+                /*
+                 * export to dmabuf
+                 */
+
+                memset(&expbuf, 0, sizeof(expbuf));
+                expbuf.type = buffer.type;
+                expbuf.index = buffer.index;
+                expbuf.flags = O_RDWR;
+
+                if (xioctl(_decoder_fd, VIDIOC_EXPBUF, &expbuf) < 0)
+                    throw std::runtime_error("failed to export the capture buffer");
+
+                buffers.push_back(new DecoderBuffer(buffer.index, expbuf.fd, capture_mem, capture_size));
+            }
+            return buffers;
+        }
+        void Free(std::vector<DecoderBuffer *> &buffers) override {
+            for (auto *buffer : buffers) {
+                munmap(buffer->GetMemory(), buffer->GetSize());
+                close(buffer->GetFd());
+                delete buffer;
+            }
+            buffers.clear();
+
+            v4l2_requestbuffers reqbufs = {};
+            reqbufs.count = 0;
+            reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+            reqbufs.memory = V4L2_MEMORY_MMAP;
+            if (xioctl(_decoder_fd, VIDIOC_REQBUFS, &reqbufs) < 0) {
+                std::cout << "Failed to free capture buffers" << std::endl;
+            }
+        }
+        [[nodiscard]] const char *GetName() const override {
+            return "v4l2";
+        }
+        ~V4l2DecoderAllocator() override {
+            close(_decoder_fd);
+        }
+    private:
+        static constexpr char _device_name[] = "/dev/video10";
+        int _decoder_fd = -1;
+    };
+
+    class DmaHeapDecoderAllocator: public DmaBufAllocator {
+    public:
+        explicit DmaHeapDecoderAllocator(const std::pair<int, int> &width_height):
+            _buffer_size(pageAligned(frameSize(width_height)))
+        {
+            _heap_fd = open(_heap_name, O_RDWR | O_CLOEXEC, 0);
+            if (_heap_fd < 0) {
+                throw std::runtime_error("failed to open the system dma heap");
+            }
+        }
+        std::vector<DecoderBuffer *> Allocate(unsigned int count) override {
+            std::vector<DecoderBuffer *> buffers;
+            for (unsigned int i = 0; i < count; i++) {
+                dma_heap_allocation_data allocation = {};
+                allocation.len = _buffer_size;
+                allocation.fd_flags = O_RDWR | O_CLOEXEC;
+                if (xioctl(_heap_fd, DMA_HEAP_IOCTL_ALLOC, &allocation) < 0) {
+                    Free(buffers);
+                    throw std::runtime_error("failed to allocate from the system dma heap");
+                }
+                const int fd = (int) allocation.fd;
+                auto memory = mmap(nullptr, _buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (memory == MAP_FAILED) {
+                    close(fd);
+                    Free(buffers);
+                    throw std::runtime_error("failed to mmap a dma heap buffer");
+                }
+                buffers.push_back(new DecoderBuffer(i, fd, memory, _buffer_size));
+            }
+            return buffers;
+        }
+        void Free(std::vector<DecoderBuffer *> &buffers) override {
+            for (auto *buffer : buffers) {
+                munmap(buffer->GetMemory(), buffer->GetSize());
+                close(buffer->GetFd());
+                delete buffer;
+            }
+            buffers.clear();
+        }
+        [[nodiscard]] const char *GetName() const override {
+            return "dma heap";
+        }
+        ~DmaHeapDecoderAllocator() override {
+            close(_heap_fd);
+        }
+    private:
+        static constexpr char _heap_name[] = "/dev/dma_heap/system";
+        const std::size_t _buffer_size;
+        int _heap_fd = -1;
+    };
+
+    class UdmabufDecoderAllocator: public DmaBufAllocator {
+    public:
+        explicit UdmabufDecoderAllocator(const std::pair<int, int> &width_height):
+            _buffer_size(pageAligned(frameSize(width_height)))
+        {
+            _udmabuf_fd = open(_device_name, O_RDWR | O_CLOEXEC, 0);
+            if (_udmabuf_fd < 0) {
+                throw std::runtime_error("failed to open udmabuf");
+            }
+        }
+        std::vector<DecoderBuffer *> Allocate(unsigned int count) override {
+            std::vector<DecoderBuffer *> buffers;
+            for (unsigned int i = 0; i < count; i++) {
+                // udmabuf only takes memfds that can't shrink out from under the dmabuf
+                const int memfd = memfd_create("decoder-buffer", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+                if (memfd < 0) {
+                    Free(buffers);
+                    throw std::runtime_error("failed to create a decoder memfd");
+                }
+                if (
+                    ftruncate(memfd, (off_t) _buffer_size) < 0 ||
+                    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0
+                ) {
+                    close(memfd);
+                    Free(buffers);
+                    throw std::runtime_error("failed to size and seal a decoder memfd");
+                }
+
+                udmabuf_create create = {};
+                create.memfd = memfd;
+                create.flags = UDMABUF_FLAGS_CLOEXEC;
+                create.offset = 0;
+                create.size = _buffer_size;
+                const int fd = xioctl(_udmabuf_fd, UDMABUF_CREATE, &create);
+                if (fd < 0) {
+                    close(memfd);
+                    Free(buffers);
+                    throw std::runtime_error("failed to turn a decoder memfd into a dmabuf");
+                }
+
+                // the dmabuf holds the pages, so the cpu maps the memfd and the memfd itself can go
+                auto memory = mmap(nullptr, _buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+                close(memfd);
+                if (memory == MAP_FAILED) {
+                    close(fd);
+                    Free(buffers);
+                    throw std::runtime_error("failed to mmap a decoder memfd");
+                }
+                buffers.push_back(new DecoderBuffer(i, fd, memory, _buffer_size));
+            }
+            return buffers;
+        }
+        void Free(std::vector<DecoderBuffer *> &buffers) override {
+            for (auto *buffer : buffers) {
+                munmap(buffer->GetMemory(), buffer->GetSize());
+                close(buffer->GetFd());
+                delete buffer;
+            }
+            buffers.clear();
+        }
+        [[nodiscard]] const char *GetName() const override {
+            return "udmabuf";
+        }
+        ~UdmabufDecoderAllocator() override {
+            close(_udmabuf_fd);
+        }
+    private:
+        static constexpr char _device_name[] = "/dev/udmabuf";
+        const std::size_t _buffer_size;
+        int _udmabuf_fd = -1;
+    };
+
+    class HeapDecoderAllocator: public DecoderAllocator {
+    public:
+        explicit HeapDecoderAllocator(const std::pair<int, int> &width_height):
+            _buffer_size(pageAligned(frameSize(width_height)))
+        {}
+        std::vector<DecoderBuffer *> Allocate(unsigned int count) override {
+            std::vector<DecoderBuffer *> buffers;
+            for (unsigned int i = 0; i < count; i++) {
+                auto memory = std::aligned_alloc(sysconf(_SC_PAGESIZE), _buffer_size);
+                if (memory == nullptr) {
+                    Free(buffers);
+                    throw std::runtime_error("failed to allocate a decoder buffer");
+                }
+                buffers.push_back(new DecoderBuffer(i, -1, memory, _buffer_size));
+            }
+            return buffers;
+        }
+        void Free(std::vector<DecoderBuffer *> &buffers) override {
+            for (auto *buffer : buffers) {
+                std::free(buffer->GetMemory());
+                delete buffer;
+            }
+            buffers.clear();
+        }
+        [[nodiscard]] const char *GetName() const override {
+            return "heap";
+        }
+    private:
+        const std::size_t _buffer_size;
+    };
+
+    std::unique_ptr<DecoderAllocator> DecoderAllocator::Create(
+        const DecoderAllocatorType type, const std::pair<int, int> &width_height
+    ) {
+        switch(type) {
+            case DecoderAllocatorType::V4L2:
+                return std::make_unique<V4l2DecoderAllocator>(width_height);
+            case DecoderAllocatorType::DMA_HEAP:
+                return std::make_unique<DmaHeapDecoderAllocator>(width_height);
+            case DecoderAllocatorType::UDMABUF:
+                return std::make_unique<UdmabufDecoderAllocator>(width_height);
+            case DecoderAllocatorType::HEAP:
+                return std::make_unique<HeapDecoderAllocator>(width_height);
+            case DecoderAllocatorType::AUTO:
+                // only opening the device can fail here; allocating from one that opened is not expected to
+                for (const auto fallback : { DecoderAllocatorType::DMA_HEAP, DecoderAllocatorType::UDMABUF }) {
+                    try {
+                        return Create(fallback, width_height);
+                    } catch (std::runtime_error &err) {
+                        std::cout << "DecoderAllocator::Create skipping: " << err.what() << std::endl;
+                    }
+                }
+                return Create(DecoderAllocatorType::HEAP, width_height);
+            default:
+                throw std::runtime_error("Selected decoder allocator unavailable... ");
+        }
+    }
+
+}
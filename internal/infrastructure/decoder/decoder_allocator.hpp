@@ -0,0 +1,47 @@
+//
+// Created by brucegoose on 7/22/23.
+//
+
+#ifndef INFRASTRUCTURE_DECODER_ALLOCATOR_HPP
+#define INFRASTRUCTURE_DECODER_ALLOCATOR_HPP
+
+#include <memory>
+#include <vector>
+
+#include "utils/buffers.hpp"
+
+namespace infrastructure {
+
+    enum class DecoderAllocatorType {
+        /* capture buffers from the pi's codec, exported as dmabufs; needs /dev/video10 */
+        V4L2,
+        /* straight from /dev/dma_heap/system */
+        DMA_HEAP,
+        /* a sealed memfd, turned into a dmabuf by /dev/udmabuf */
+        UDMABUF,
+        /* plain memory; nothing graphics can import, so only good for headless runs and benchmarks */
+        HEAP,
+        /* the first of DMA_HEAP, UDMABUF, HEAP that works on this box */
+        AUTO,
+    };
+
+    /*
+     * hands the decoder the buffers it decodes into. Anything with an fd >= 0 is a dmabuf the graphics can import as
+     * is; the cpu writes to it through GetMemory(), bracketed by StartWrite / FinishWrite so caches stay honest
+     */
+    class DecoderAllocator {
+    public:
+        [[nodiscard]] static std::unique_ptr<DecoderAllocator> Create(
+            DecoderAllocatorType type, const std::pair<int, int> &width_height
+        );
+        [[nodiscard]] virtual std::vector<DecoderBuffer *> Allocate(unsigned int count) = 0;
+        virtual void Free(std::vector<DecoderBuffer *> &buffers) = 0;
+        virtual void StartWrite(DecoderBuffer *buffer) {}
+        virtual void FinishWrite(DecoderBuffer *buffer) {}
+        [[nodiscard]] virtual const char *GetName() const = 0;
+        virtual ~DecoderAllocator() = default;
+    };
+
+}
+
+#endif //INFRASTRUCTURE_DECODER_ALLOCATOR_HPP
@@ -4,56 +4,118 @@
 
 #include "sw_decoder.hpp"
 
-#include <fcntl.h>
 #include <iostream>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
 #include <unistd.h>
-#include <linux/dma-heap.h>
-#include <linux/videodev2.h>
 
 #include <cstring>
 #include <sstream>
 
+#include <jerror.h>
+
 #include <chrono>
 using namespace std::literals;
 typedef std::chrono::high_resolution_clock Clock;
 
 namespace infrastructure {
 
-    int xioctl(int fd, unsigned long ctl, void *arg) {
-        int ret, num_tries = 10;
-        do
-        {
-            ret = ioctl(fd, ctl, arg);
-        } while (ret == -1 && errno == EINTR && num_tries-- > 0);
-        return ret;
+    enum class HeaderScan {
+        INCOMPLETE,
+        SPLITTABLE,
+        UNSPLITTABLE,
+    };
+
+    /* only a single scan, baseline, 4:2:0 frame with a restart interval can be cut up and put back into our planes */
+    static HeaderScan scanHeader(const uint8_t *data, const std::size_t landed, RestartLayout &layout) {
+        if (landed < 2) {
+            return HeaderScan::INCOMPLETE;
+        } else if (data[0] != 0xFF || data[1] != 0xD8) {
+            return HeaderScan::UNSPLITTABLE;
+        }
+        bool has_frame = false;
+        std::size_t position = 2;
+        while (true) {
+            if (position + 4 > landed) {
+                return HeaderScan::INCOMPLETE;
+            } else if (data[position] != 0xFF) {
+                return HeaderScan::UNSPLITTABLE;
+            }
+            const auto marker = data[position + 1];
+            if (marker == 0xFF) {
+                position += 1;
+                continue;
+            }
+            const std::size_t length = (data[position + 2] << 8) | data[position + 3];
+            if (position + 2 + length > landed) {
+                return HeaderScan::INCOMPLETE;
+            }
+            const auto *segment = data + position + 4;
+            if (marker == 0xC0 || marker == 0xC1) {
+                if (segment[5] != 3 || segment[7] != 0x22 || segment[10] != 0x11 || segment[13] != 0x11) {
+                    return HeaderScan::UNSPLITTABLE;
+                }
+                layout.height_at = position + 5;
+                layout.height = (segment[1] << 8) | segment[2];
+                layout.width = (segment[3] << 8) | segment[4];
+                has_frame = true;
+            } else if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+                // progressive, lossless, or arithmetic coded
+                return HeaderScan::UNSPLITTABLE;
+            } else if (marker == 0xDD) {
+                layout.restart_interval = (segment[0] << 8) | segment[1];
+            } else if (marker == 0xDA) {
+                layout.scan_start = position + 2 + length;
+                const bool is_interleaved = segment[0] == 3;
+                return has_frame && is_interleaved && layout.restart_interval > 0 ?
+                    HeaderScan::SPLITTABLE : HeaderScan::UNSPLITTABLE;
+            }
+            position += 2 + length;
+        }
+    }
+
+    static unsigned int checkedScale(const unsigned int scale_denom) {
+        if (scale_denom != 1 && scale_denom != 2 && scale_denom != 4 && scale_denom != 8) {
+            throw std::runtime_error("SwDecoder can only scale by 1, 1/2, 1/4 or 1/8");
+        }
+        return scale_denom;
     }
 
-    const char SwDecoder::_device_name[] = "/dev/video10";
+    static std::pair<int, int> scaledWidthHeight(const std::pair<int, int> &width_height, const unsigned int scale_denom) {
+        // what libjpeg's jpeg_calc_output_dimensions comes up with
+        const int denom = (int) scale_denom;
+        return { (width_height.first + denom - 1) / denom, (width_height.second + denom - 1) / denom };
+    }
 
     SwDecoder::SwDecoder(const DecoderConfig &config, DecoderBufferCallback send_callback):
         Decoder(config, std::move(send_callback)),
-        _width_height(config.get_decoder_width_height())
+        _width_height(config.get_decoder_width_height()),
+        _scale_denom(checkedScale(config.get_decoder_output_scale())),
+        _output_width_height(scaledWidthHeight(_width_height, _scale_denom)),
+        _band_thread_count(
+            config.get_decoder_thread_count() != 0 ?
+                config.get_decoder_thread_count() : std::max(1u, std::thread::hardware_concurrency())
+        ),
+        _is_turbo(config.get_decoder_type() == DecoderType::TURBO)
     {
-        auto downstream_count = config.get_decoder_downstream_buffer_count();
-
-        _decoder_fd = open(_device_name, O_RDWR, 0);
-
-        v4l2_format fmt = {0};
-        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-        fmt.fmt.pix_mp.width = _width_height.first;
-        fmt.fmt.pix_mp.height = _width_height.second;
-        fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_YUV420;
-        fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
-        fmt.fmt.pix_mp.colorspace = V4L2_COLORSPACE_REC709;
-        fmt.fmt.pix_mp.num_planes = 1;
-        fmt.fmt.pix_mp.plane_fmt[0].bytesperline = _width_height.first;
-        fmt.fmt.pix_mp.plane_fmt[0].sizeimage = _width_height.first * _width_height.second * 3 / 2;
+        auto frames_in_flight = config.get_decoder_frames_in_flight();
+        if (frames_in_flight == 0) {
+            frames_in_flight = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned int i = 0; i < frames_in_flight; i++) {
+            auto worker = std::make_unique<DecoderWorker>();
+            worker->decoder = this;
+#ifdef _TURBOJPEG_
+            if (_is_turbo && (worker->turbo = tjInitDecompress()) == nullptr) {
+                throw std::runtime_error("failed to set up turbojpeg decompressor");
+            }
+#endif
+            _workers.push_back(std::move(worker));
+        }
 
-        if (xioctl(_decoder_fd, VIDIOC_S_FMT, &fmt))
-            throw std::runtime_error("failed to set capture caps");
+        auto downstream_count = config.get_decoder_downstream_buffer_count();
 
+        _allocator = DecoderAllocator::Create(config.get_decoder_allocator_type(), _output_width_height);
+        std::cout << "SwDecoder decoding " << _output_width_height.first << "x" << _output_width_height.second <<
+            " into " << _allocator->GetName() << " buffers" << std::endl;
         setupDownstreamBuffers(downstream_count);
     }
 
@@ -64,9 +126,18 @@ namespace infrastructure {
         }
 
         _work_stop = false;
+        _next_sequence = 0;
+        _send_sequence = 0;
 
         auto self(shared_from_this());
-        _work_thread = std::make_unique<std::thread>([this, self]() mutable { run(); });
+        // a single band thread would just be the work thread with extra steps
+        for (unsigned int i = 0; _band_thread_count > 1 && i < _band_thread_count; i++) {
+            _band_threads.push_back(std::make_unique<std::thread>([this, self]() mutable { runBands(); }));
+        }
+        for (auto &worker : _workers) {
+            auto *w = worker.get();
+            worker->thread = std::make_unique<std::thread>([this, self, w]() mutable { run(*w); });
+        }
 
     }
 
@@ -75,35 +146,62 @@ namespace infrastructure {
             return;
         }
 
-        if (_work_thread) {
-            if (_work_thread->joinable()) {
-                {
-                    std::unique_lock<std::mutex> lock(_work_mutex);
-                    _work_stop = true;
-                    _work_cv.notify_one();
-                }
-                _work_thread->join();
+        {
+            std::unique_lock<std::mutex> lock(_work_mutex);
+            std::unique_lock<std::mutex> band_lock(_band_mutex);
+            _work_stop = true;
+            _work_cv.notify_all();
+            _band_cv.notify_all();
+            _band_done_cv.notify_all();
+        }
+        for (auto &worker : _workers) {
+            if (worker->thread && worker->thread->joinable()) {
+                worker->thread->join();
             }
-            _work_thread.reset();
+            worker->thread.reset();
+            worker->current_buffer = nullptr;
+            worker->last_buffer.reset();
+            worker->bands_pending = 0;
         }
-        // just in case we skipped above
-        _work_stop = true;
 
-        while(!_work_queue.empty()) {
-            _work_queue.pop();
+        for (auto &thread : _band_threads) {
+            if (thread->joinable()) {
+                thread->join();
+            }
         }
+        _band_threads.clear();
+        while (!_band_queue.empty()) {
+            _band_queue.pop();
+        }
+
+        _pending_buffer = nullptr;
     }
 
     void SwDecoder::PostJpegBuffer(std::shared_ptr<SizedBuffer> &&buffer) {
         if (buffer == nullptr || _work_stop) {
             return;
         }
-        std::unique_lock<std::mutex> lock(_work_mutex);
-        _work_queue.push(std::move(buffer));
-        _work_cv.notify_one();
+        // swapped out under the lock, but let go after it, so handing it back to its pool never happens in here
+        std::shared_ptr<SizedBuffer> superseded = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(_work_mutex);
+            // more of a frame we already have just landed, so all the decoder needs is a nudge
+            bool is_known = buffer == _pending_buffer;
+            for (auto &worker : _workers) {
+                is_known = is_known || buffer == worker->current_buffer || buffer == worker->last_buffer.lock();
+            }
+            if (!is_known) {
+                if (_pending_buffer != nullptr) {
+                    _skipped_frames += 1;
+                }
+                superseded = std::exchange(_pending_buffer, std::move(buffer));
+            }
+            // whoever is waiting on bytes shares the cv with whoever is waiting on work
+            _work_cv.notify_all();
+        }
     }
 
-    void SwDecoder::run() {
+    void SwDecoder::run(DecoderWorker &worker) {
 
         while(!_work_stop) {
 
@@ -114,29 +212,51 @@ namespace infrastructure {
 
             try {
                 jpeg_create_decompress(&cinfo);
+                cinfo.client_data = &worker;
+
+                auto &source = worker.source;
+                source.manager.init_source = &SwDecoder::initSource;
+                source.manager.fill_input_buffer = &SwDecoder::fillSource;
+                source.manager.skip_input_data = &SwDecoder::skipSource;
+                source.manager.resync_to_restart = &jpeg_resync_to_restart;
+                source.manager.term_source = &SwDecoder::termSource;
+                cinfo.src = &source.manager;
 
                 while (!_work_stop) {
                     std::shared_ptr<SizedBuffer> buffer;
                     {
                         std::unique_lock<std::mutex> lock(_work_mutex);
                         _work_cv.wait(lock, [this]() {
-                            return !_work_queue.empty() || _work_stop;
+                            return _pending_buffer != nullptr || _work_stop;
                         });
                         if (_work_stop) {
                             return;
-                        } else if (_work_queue.empty()) {
+                        } else if (_pending_buffer == nullptr) {
                             continue;
                         }
-                        buffer = std::move(_work_queue.front());
-                        _work_queue.pop();
+                        buffer = std::move(_pending_buffer);
+                        _pending_buffer = nullptr;
+                        worker.current_buffer = buffer;
+                        // taken in arrival order, so numbered in arrival order
+                        worker.sequence = _next_sequence++;
+                    }
+                    decodeBuffer(worker, cinfo, std::move(buffer));
+                    {
+                        std::unique_lock<std::mutex> lock(_work_mutex);
+                        worker.last_buffer = worker.current_buffer;
+                        worker.current_buffer = nullptr;
                     }
-                    decodeBuffer(cinfo, std::move(buffer));
                 }
 
                 jpeg_destroy_decompress(&cinfo);
 
             } catch (struct jpeg_error_mgr *err) {
                 jpeg_destroy_decompress(&cinfo);
+                {
+                    std::unique_lock<std::mutex> lock(_work_mutex);
+                    worker.last_buffer = worker.current_buffer;
+                    worker.current_buffer = nullptr;
+                }
                 char pszErr[1024];
                 (cinfo.err->format_message)((j_common_ptr) &cinfo, pszErr);
                 std::cout << "SwDecoder::run encountered an error: " << pszErr << std::endl;
@@ -147,48 +267,456 @@ namespace infrastructure {
 
     }
 
-    void SwDecoder::decodeBuffer(struct jpeg_decompress_struct &cinfo, std::shared_ptr<SizedBuffer> &&sz_buffer) {
+    void SwDecoder::decodeBuffer(
+        DecoderWorker &worker, struct jpeg_decompress_struct &cinfo, std::shared_ptr<SizedBuffer> &&sz_buffer
+    ) {
+        // a streamed frame's stage timestamp is when it started landing, so decode covers waiting on the network
+        auto *in_metadata = sz_buffer->GetMetadata();
+        const auto decode_start_us = in_metadata != nullptr ?
+            recordLatencySince(LatencyStage::DECODER_QUEUE, in_metadata->stage_timestamp_us) : monotonicClockMicros();
+
+        auto &source = worker.source;
+        source.buffer = sz_buffer.get();
+        source.progress = sz_buffer->GetProgress();
+
+        if (_is_turbo) {
+            // turbojpeg wants the whole frame in one go, so a streamed one waits until it has all landed
+            while (source.progress != nullptr && source.progress->IsFilling()) {
+                if (!waitForBytes(source, landedBytes(source))) {
+                    return;
+                }
+            }
+            if (source.progress != nullptr && source.progress->IsAborted()) {
+                return;
+            }
+            auto *buffer = takeDownstreamBuffer();
+            if (buffer == nullptr) {
+                return;
+            }
+            if (!decompressTurbo(worker, buffer)) {
+                queueDownstreamBuffer(buffer);
+                return;
+            }
+            sendDownstreamBuffer(worker, buffer, in_metadata, decode_start_us);
+            return;
+        }
 
-        jpeg_mem_src(&cinfo, (unsigned char*)sz_buffer->GetMemory(), sz_buffer->GetSize());
-        jpeg_read_header(&cinfo, TRUE);
+        RestartLayout layout;
+        if (!_band_threads.empty() && readRestartLayout(worker, layout)) {
+            auto *buffer = takeDownstreamBuffer();
+            if (buffer == nullptr) {
+                return;
+            }
+            if (!decodeBands(worker, layout, buffer)) {
+                queueDownstreamBuffer(buffer);
+                return;
+            }
+            sendDownstreamBuffer(worker, buffer, in_metadata, decode_start_us);
+            return;
+        }
+
+        while (jpeg_read_header(&cinfo, TRUE) == JPEG_SUSPENDED) {
+            if (!waitForBytes(source, source.offered)) {
+                jpeg_abort_decompress(&cinfo);
+                return;
+            }
+        }
         cinfo.out_color_space = JCS_YCbCr;
         cinfo.raw_data_out = TRUE;
-        jpeg_start_decompress(&cinfo);
-
-        DecoderBuffer *buffer = nullptr;
-        {
-            std::unique_lock<std::mutex> lock(_downstream_buffers_mutex);
-            if (!_downstream_buffers.empty()) {
-                buffer = _downstream_buffers.front();
-                _downstream_buffers.pop();
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = _scale_denom;
+        while (!jpeg_start_decompress(&cinfo)) {
+            if (!waitForBytes(source, source.offered)) {
+                jpeg_abort_decompress(&cinfo);
+                return;
             }
         }
+
+        auto *buffer = takeDownstreamBuffer();
         if (buffer == nullptr) {
-            jpeg_finish_decompress(&cinfo);
+            jpeg_abort_decompress(&cinfo);
             return;
         }
 
-        int stride2 = _width_height.first / 2;
-        uint8_t *Y = (uint8_t *) buffer->GetMemory();
-        uint8_t *U = Y + _width_height.first * _width_height.second;
-        uint8_t *V = U + stride2 * (_width_height.second / 2);
+        while (cinfo.output_scanline < cinfo.output_height) {
+            // a suspended read hands back nothing, so the rows come from where libjpeg is, not where we were
+            if (readRawRows(cinfo, buffer, 0, worker.chroma) == 0 && !waitForBytes(source, source.offered)) {
+                jpeg_abort_decompress(&cinfo);
+                queueDownstreamBuffer(buffer);
+                return;
+            }
+        }
+        while (!jpeg_finish_decompress(&cinfo)) {
+            if (!waitForBytes(source, source.offered)) {
+                jpeg_abort_decompress(&cinfo);
+                queueDownstreamBuffer(buffer);
+                return;
+            }
+        }
+
+        sendDownstreamBuffer(worker, buffer, in_metadata, decode_start_us);
+    }
 
-        JSAMPROW y_rows[16];
-        JSAMPROW u_rows[8];
-        JSAMPROW v_rows[8];
-        JSAMPARRAY data[] = { y_rows, u_rows, v_rows };
+    bool SwDecoder::decompressTurbo(DecoderWorker &worker, DecoderBuffer *buffer) {
+#ifdef _TURBOJPEG_
+        const auto *jpeg = (const unsigned char *) worker.source.buffer->GetMemory();
+        const auto size = worker.source.buffer->GetSize();
+        int width, height, subsampling, colorspace;
+        if (tjDecompressHeader3(worker.turbo, jpeg, size, &width, &height, &subsampling, &colorspace) != 0) {
+            std::cout << "SwDecoder::decompressTurbo encountered an error: " << tjGetErrorStr2(worker.turbo) << std::endl;
+            return false;
+        } else if (width != _width_height.first || height != _width_height.second || subsampling != TJSAMP_420) {
+            std::cout << "SwDecoder::decompressTurbo got a " << width << "x" << height << " frame it can't use" << std::endl;
+            return false;
+        }
+        // turbojpeg picks the scaling factor that fits the size it's asked for, which is the same one libjpeg gets
+        const int out_width = _output_width_height.first;
+        const int out_height = _output_width_height.second;
+        auto *Y = (unsigned char *) buffer->GetMemory();
+        unsigned char *planes[] = {
+            Y, Y + out_width * out_height, Y + out_width * out_height + (out_width / 2) * (out_height / 2)
+        };
+        int strides[] = { out_width, out_width / 2, out_width / 2 };
+        if (
+            tjDecompressToYUVPlanes(worker.turbo, jpeg, size, planes, out_width, strides, out_height, 0) != 0 &&
+            tjGetErrorCode(worker.turbo) != TJERR_WARNING
+        ) {
+            std::cout << "SwDecoder::decompressTurbo encountered an error: " << tjGetErrorStr2(worker.turbo) << std::endl;
+            return false;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool SwDecoder::readRestartLayout(DecoderWorker &worker, RestartLayout &layout) {
+        const auto &source = worker.source;
+        const auto *data = (const uint8_t *) source.buffer->GetMemory();
+        HeaderScan scan;
+        while (true) {
+            const bool is_filling = source.progress != nullptr && source.progress->IsFilling();
+            const auto landed = landedBytes(source);
+            scan = scanHeader(data, landed, layout);
+            if (scan != HeaderScan::INCOMPLETE) {
+                break;
+            }
+            // whatever is wrong with it, the single threaded decode gets to say so
+            if (!is_filling || !waitForBytes(source, landed)) {
+                return false;
+            }
+        }
+        if (scan != HeaderScan::SPLITTABLE) {
+            return false;
+        }
+
+        const int mcu_columns = (layout.width + 15) / 16;
+        const int mcu_rows = (layout.height + 15) / 16;
+        if (layout.width != _width_height.first || layout.height != _width_height.second) {
+            return false;
+        } else if (layout.restart_interval % mcu_columns != 0) {
+            // intervals that end partway across a row can't be cut into bands
+            return false;
+        }
+        const int interval_mcu_rows = layout.restart_interval / mcu_columns;
+        layout.interval_count = (mcu_rows + interval_mcu_rows - 1) / interval_mcu_rows;
+        const int band_count = std::min((int) _band_thread_count, layout.interval_count);
+        layout.intervals_per_band = (layout.interval_count + band_count - 1) / band_count;
+        layout.band_count = (layout.interval_count + layout.intervals_per_band - 1) / layout.intervals_per_band;
+        layout.band_mcu_rows = layout.intervals_per_band * interval_mcu_rows;
+        return layout.band_count > 1;
+    }
+
+    bool SwDecoder::decodeBands(DecoderWorker &worker, const RestartLayout &layout, DecoderBuffer *buffer) {
+        const auto &source = worker.source;
+        const auto *data = (const uint8_t *) source.buffer->GetMemory();
+        {
+            std::unique_lock<std::mutex> lock(_band_mutex);
+            worker.band_source = data;
+            worker.band_header_size = layout.scan_start;
+            worker.band_height_at = layout.height_at;
+            worker.band_output = buffer;
+            worker.band_failed = false;
+        }
+
+        // bands go out as soon as the restart marker after their last interval lands, so decoding keeps up with the
+        // network instead of waiting for the whole frame
+        std::vector<std::pair<std::size_t, std::size_t>> segments;
+        std::size_t position = layout.scan_start;
+        std::size_t segment_start = position;
+        int next_band = 0;
+        bool is_ended = false;
+        bool is_broken = false;
+        bool is_aborted = false;
+        const auto dispatch = [&]() {
+            while (next_band < layout.band_count) {
+                const auto first = (std::size_t) next_band * layout.intervals_per_band;
+                const auto last = std::min<std::size_t>(first + layout.intervals_per_band, layout.interval_count);
+                if (!is_ended && segments.size() < last) {
+                    return;
+                }
+                if (segments.size() < last) {
+                    is_broken = true;
+                    return;
+                }
+                DecoderBand band;
+                band.worker = &worker;
+                band.first_row = next_band * layout.band_mcu_rows * 16;
+                band.rows = std::min(layout.band_mcu_rows * 16, layout.height - band.first_row);
+                band.segments.assign(segments.begin() + first, segments.begin() + last);
+                dispatchBand(std::move(band));
+                next_band += 1;
+            }
+        };
+
+        while (!is_ended && !_work_stop) {
+            const bool is_filling = source.progress != nullptr && source.progress->IsFilling();
+            const auto landed = landedBytes(source);
+            while (position + 1 < landed) {
+                const auto *found = (const uint8_t *) memchr(data + position, 0xFF, landed - 1 - position);
+                if (found == nullptr) {
+                    position = landed - 1;
+                    break;
+                }
+                position = found - data;
+                const auto marker = data[position + 1];
+                if (marker == 0x00 || marker == 0xFF) {
+                    // a stuffed byte, or fill before a marker
+                    position += marker == 0x00 ? 2 : 1;
+                    continue;
+                }
+                segments.emplace_back(segment_start, position);
+                position += 2;
+                segment_start = position;
+                if (marker == JPEG_EOI) {
+                    is_ended = true;
+                    break;
+                } else if (marker < JPEG_RST0 || marker > JPEG_RST0 + 7) {
+                    is_ended = true;
+                    is_broken = true;
+                    break;
+                }
+                dispatch();
+            }
+            if (is_ended) {
+                break;
+            } else if (source.progress != nullptr && source.progress->IsAborted()) {
+                is_aborted = true;
+                break;
+            } else if (!is_filling) {
+                // whole, but its EOI never showed up; what's left is the last interval
+                segments.emplace_back(segment_start, landed);
+                is_ended = true;
+                break;
+            } else if (!waitForBytes(source, position + 1)) {
+                is_aborted = true;
+                break;
+            }
+        }
+        if (is_ended && !is_broken) {
+            dispatch();
+            is_broken = is_broken || segments.size() != (std::size_t) layout.interval_count;
+        }
+
+        std::unique_lock<std::mutex> lock(_band_mutex);
+        _band_done_cv.wait(lock, [this, &worker]() { return worker.bands_pending == 0 || _work_stop; });
+        return is_ended && !is_broken && !is_aborted && !worker.band_failed && !_work_stop;
+    }
+
+    void SwDecoder::dispatchBand(DecoderBand &&band) {
+        std::unique_lock<std::mutex> lock(_band_mutex);
+        band.worker->bands_pending += 1;
+        _band_queue.push(std::move(band));
+        _band_cv.notify_one();
+    }
 
-        while (cinfo.output_scanline < _width_height.second) {
-            for (int i = 0; i < 16 && cinfo.output_scanline < _width_height.second; ++i, Y += _width_height.first) {
-                y_rows[i] = Y;
+    void SwDecoder::runBands() {
+        struct jpeg_decompress_struct cinfo;
+        struct jpeg_error_mgr jerr;
+        cinfo.err = jpeg_std_error(&jerr);
+        jerr.error_exit = [](j_common_ptr cinfo) { throw cinfo->err; };
+        jpeg_create_decompress(&cinfo);
+        std::vector<uint8_t> scratch;
+        std::vector<uint8_t> chroma;
+
+        while (true) {
+            DecoderBand band;
+            {
+                std::unique_lock<std::mutex> lock(_band_mutex);
+                _band_cv.wait(lock, [this]() { return !_band_queue.empty() || _work_stop; });
+                if (_work_stop) {
+                    break;
+                }
+                band = std::move(_band_queue.front());
+                _band_queue.pop();
             }
-            for (int i = 0; i < 8 && cinfo.output_scanline < _width_height.second; ++i, U += stride2, V += stride2) {
-                u_rows[i] = U;
-                v_rows[i] = V;
+            bool is_decoded = true;
+            try {
+                decodeBand(cinfo, scratch, chroma, band);
+            } catch (struct jpeg_error_mgr *err) {
+                char pszErr[1024];
+                (cinfo.err->format_message)((j_common_ptr) &cinfo, pszErr);
+                std::cout << "SwDecoder::runBands encountered an error: " << pszErr << std::endl;
+                jpeg_abort_decompress(&cinfo);
+                is_decoded = false;
+            }
+            {
+                std::unique_lock<std::mutex> lock(_band_mutex);
+                auto *worker = band.worker;
+                worker->band_failed = worker->band_failed || !is_decoded;
+                worker->bands_pending -= 1;
+                if (worker->bands_pending == 0) {
+                    // every frame in flight waits on the same cv
+                    _band_done_cv.notify_all();
+                }
             }
-            jpeg_read_raw_data(&cinfo, data, 16);
+        }
+
+        jpeg_destroy_decompress(&cinfo);
+    }
+
+    void SwDecoder::decodeBand(
+        struct jpeg_decompress_struct &cinfo, std::vector<uint8_t> &scratch, std::vector<uint8_t> &chroma,
+        const DecoderBand &band
+    ) {
+        const auto &worker = *band.worker;
+        // the frame's headers with the band's height, then its intervals with their restart markers counted from 0
+        std::size_t size = worker.band_header_size + 2;
+        for (const auto &segment : band.segments) {
+            size += segment.second - segment.first + 2;
+        }
+        if (scratch.size() < size) {
+            scratch.resize(size);
+        }
+        auto *out = scratch.data();
+        std::memcpy(out, worker.band_source, worker.band_header_size);
+        out[worker.band_height_at] = (band.rows >> 8) & 0xFF;
+        out[worker.band_height_at + 1] = band.rows & 0xFF;
+        out += worker.band_header_size;
+        for (std::size_t i = 0; i < band.segments.size(); i++) {
+            if (i != 0) {
+                *out++ = 0xFF;
+                *out++ = JPEG_RST0 + (i - 1) % 8;
+            }
+            const auto &segment = band.segments[i];
+            std::memcpy(out, worker.band_source + segment.first, segment.second - segment.first);
+            out += segment.second - segment.first;
+        }
+        *out++ = 0xFF;
+        *out++ = JPEG_EOI;
+
+        jpeg_mem_src(&cinfo, scratch.data(), out - scratch.data());
+        jpeg_read_header(&cinfo, TRUE);
+        cinfo.out_color_space = JCS_YCbCr;
+        cinfo.raw_data_out = TRUE;
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = _scale_denom;
+        jpeg_start_decompress(&cinfo);
+
+        // bands are whole MCU rows, so they start on a whole output row at any scale
+        const int first_row = band.first_row / (int) _scale_denom;
+        while (cinfo.output_scanline < cinfo.output_height) {
+            (void) readRawRows(cinfo, worker.band_output, first_row, chroma);
         }
         jpeg_finish_decompress(&cinfo);
+    }
+
+    JDIMENSION SwDecoder::readRawRows(
+        struct jpeg_decompress_struct &cinfo, DecoderBuffer *buffer, const int first_row, std::vector<uint8_t> &chroma
+    ) const {
+        JSAMPROW y_rows[16];
+        JSAMPROW u_rows[16];
+        JSAMPROW v_rows[16];
+        JSAMPARRAY data[] = { y_rows, u_rows, v_rows };
+        const int row = first_row + (int) cinfo.output_scanline;
+        const auto rows_per_read = (JDIMENSION) (16 / _scale_denom);
+
+        // scaled down, libjpeg-turbo grows the chroma DCT to skip upsampling, so 4:2:0 chroma comes out at luma size
+        const auto width = (int) cinfo.output_width;
+        const bool is_chroma_full = cinfo.comp_info[1].downsampled_width == cinfo.output_width;
+        // the first row is where the rows past the bottom of the frame go; the full width chroma rows follow it
+        const std::size_t chroma_size = (is_chroma_full ? 2 * rows_per_read + 1 : 1) * width;
+        if (chroma.size() < chroma_size) {
+            chroma.resize(chroma_size);
+        }
+        auto *padding = chroma.data();
+        planeRows(buffer, row, padding, y_rows, u_rows, v_rows);
+        if (!is_chroma_full) {
+            return jpeg_read_raw_data(&cinfo, data, rows_per_read);
+        }
+        for (int i = 0; i < (int) rows_per_read; i++) {
+            u_rows[i] = chroma.data() + (1 + i) * width;
+            v_rows[i] = chroma.data() + (1 + rows_per_read + i) * width;
+        }
+        const auto read = jpeg_read_raw_data(&cinfo, data, rows_per_read);
+        if (read == 0) {
+            return read;
+        }
+        // the halved rows past the bottom go to the padding row too, same as planeRows sets them up
+        JSAMPROW planes[16];
+        planeRows(buffer, row, padding, y_rows, planes, planes + 8);
+        for (int plane = 0; plane < 2; plane++) {
+            auto **full = plane == 0 ? u_rows : v_rows;
+            auto **half = planes + plane * 8;
+            for (int i = 0; i < (int) rows_per_read / 2; i++) {
+                const auto *top = full[i * 2];
+                const auto *bottom = full[i * 2 + 1];
+                auto *out = half[i];
+                for (int x = 0; x < width / 2; x++) {
+                    out[x] = (top[x * 2] + top[x * 2 + 1] + bottom[x * 2] + bottom[x * 2 + 1] + 2) >> 2;
+                }
+            }
+        }
+        return read;
+    }
+
+    void SwDecoder::planeRows(
+        DecoderBuffer *buffer, const int row, uint8_t *padding, JSAMPROW *y_rows, JSAMPROW *u_rows, JSAMPROW *v_rows
+    ) const {
+        /*
+         * libjpeg fills whole MCU rows, so on the last one it writes rows past the bottom of the frame after the real
+         * ones; they all go to padding, a full width row that nothing reads, so they can't land on real output
+         */
+        const int width = _output_width_height.first;
+        const int height = _output_width_height.second;
+        const int stride2 = width / 2;
+        auto *Y = (uint8_t *) buffer->GetMemory();
+        auto *U = Y + width * height;
+        auto *V = U + stride2 * (height / 2);
+        for (int i = 0; i < 16; ++i) {
+            y_rows[i] = row + i < height ? Y + (row + i) * width : padding;
+        }
+        for (int i = 0; i < 8; ++i) {
+            const int chroma_row = row / 2 + i;
+            u_rows[i] = chroma_row < height / 2 ? U + chroma_row * stride2 : padding;
+            v_rows[i] = chroma_row < height / 2 ? V + chroma_row * stride2 : padding;
+        }
+    }
+
+    DecoderBuffer *SwDecoder::takeDownstreamBuffer() {
+        std::unique_lock<std::mutex> lock(_downstream_buffers_mutex);
+        if (_downstream_buffers.empty()) {
+            return nullptr;
+        }
+        auto *buffer = _downstream_buffers.front();
+        _downstream_buffers.pop();
+        _allocator->StartWrite(buffer);
+        return buffer;
+    }
+
+    void SwDecoder::sendDownstreamBuffer(
+        const DecoderWorker &worker, DecoderBuffer *buffer, FrameMetadata *in_metadata, int64_t decode_start_us
+    ) {
+        _allocator->FinishWrite(buffer);
+        auto *out_metadata = buffer->GetMetadata();
+        if (in_metadata != nullptr) {
+            *out_metadata = *in_metadata;
+            out_metadata->pixel_format = FOURCC_YUV420;
+        }
+        // what's in the buffer, which is smaller than what was sent when decoding scaled
+        out_metadata->width = _output_width_height.first;
+        out_metadata->height = _output_width_height.second;
+        out_metadata->stage_timestamp_us = recordLatencySince(LatencyStage::DECODE, decode_start_us);
 
         auto self(shared_from_this());
         auto output_buffer = std::shared_ptr<DecoderBuffer>(
@@ -196,103 +724,124 @@ namespace infrastructure {
                     queueDownstreamBuffer(e);
                 }
         );
+        // held across the callback, so frames go downstream one at a time and in order
+        std::unique_lock<std::mutex> lock(_send_mutex);
+        if (worker.sequence < _send_sequence) {
+            return;
+        }
+        _send_sequence = worker.sequence + 1;
         _send_callback(std::move(output_buffer));
     }
 
+    std::size_t SwDecoder::landedBytes(const StreamingSource &source) {
+        const bool is_filling = source.progress != nullptr && source.progress->IsFilling();
+        return is_filling ? source.progress->Landed() : source.buffer->GetSize();
+    }
+
+    bool SwDecoder::waitForBytes(const StreamingSource &source, const std::size_t seen) {
+        // false means the frame is never going to finish, or we are shutting down
+        auto *progress = source.progress;
+        if (progress == nullptr) {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(_work_mutex);
+        _work_cv.wait(lock, [progress, seen, this]() {
+            return _work_stop || !progress->IsFilling() || progress->Landed() > seen;
+        });
+        return !_work_stop && !progress->IsAborted();
+    }
+
+    bool SwDecoder::refreshSource(StreamingSource &source) {
+        // libjpeg only asks once it has used up everything it was handed, so it only ever gets what's landed since
+        const auto landed = landedBytes(source);
+        if (landed <= source.offered) {
+            return false;
+        }
+        const auto skipped = std::min(source.skip, landed - source.offered);
+        source.manager.next_input_byte = (const JOCTET *) source.buffer->GetMemory() + source.offered + skipped;
+        source.manager.bytes_in_buffer = landed - source.offered - skipped;
+        source.offered = landed;
+        source.skip -= skipped;
+        return source.manager.bytes_in_buffer > 0;
+    }
+
+    void SwDecoder::initSource(j_decompress_ptr cinfo) {
+        auto &source = static_cast<DecoderWorker *>(cinfo->client_data)->source;
+        source.manager.next_input_byte = (const JOCTET *) source.buffer->GetMemory();
+        source.manager.bytes_in_buffer = 0;
+        source.offered = 0;
+        source.skip = 0;
+    }
+
+    boolean SwDecoder::fillSource(j_decompress_ptr cinfo) {
+        static const JOCTET fake_eoi[] = { 0xFF, JPEG_EOI };
+        auto &source = static_cast<DecoderWorker *>(cinfo->client_data)->source;
+        if (refreshSource(source)) {
+            return TRUE;
+        }
+        auto *progress = source.progress;
+        if (progress != nullptr && (progress->IsFilling() || progress->IsAborted())) {
+            return FALSE;
+        }
+        WARNMS(cinfo, JWRN_JPEG_EOF);
+        source.manager.next_input_byte = fake_eoi;
+        source.manager.bytes_in_buffer = 2;
+        return TRUE;
+    }
+
+    void SwDecoder::skipSource(j_decompress_ptr cinfo, long num_bytes) {
+        if (num_bytes <= 0) {
+            return;
+        }
+        auto &source = static_cast<DecoderWorker *>(cinfo->client_data)->source;
+        // this can't suspend, so whatever hasn't landed yet gets skipped once it does
+        const auto skipped = std::min<std::size_t>(num_bytes, source.manager.bytes_in_buffer);
+        source.manager.next_input_byte += skipped;
+        source.manager.bytes_in_buffer -= skipped;
+        source.skip += num_bytes - skipped;
+    }
+
+    void SwDecoder::termSource(j_decompress_ptr cinfo) {}
+
     void SwDecoder::queueDownstreamBuffer(DecoderBuffer *d) {
         std::unique_lock<std::mutex> lock(_downstream_buffers_mutex);
         _downstream_buffers.push(d);
     }
 
     void SwDecoder::setupDownstreamBuffers(unsigned int request_downstream_buffers) {
+        _allocated_buffers = _allocator->Allocate(request_downstream_buffers);
+        for (auto *buffer : _allocated_buffers) {
+            _downstream_buffers.push(buffer);
+        }
+    }
 
-        v4l2_requestbuffers reqbufs = {};
-        reqbufs.count = request_downstream_buffers;
-        reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-        reqbufs.memory = V4L2_MEMORY_MMAP;
-        if (xioctl(_decoder_fd, VIDIOC_REQBUFS, &reqbufs) < 0) {
-            throw std::runtime_error("request for output buffers failed");
-        } else if (reqbufs.count != request_downstream_buffers) {
-            std::stringstream out_str;
-            out_str << "Unable to return " << request_downstream_buffers << " capture buffers; only got " << reqbufs.count;
-            throw std::runtime_error(out_str.str());
-        }
-
-        v4l2_plane planes[VIDEO_MAX_PLANES];
-        v4l2_buffer buffer = {};
-        v4l2_exportbuffer expbuf = {};
-
-        for (int i = 0; i < request_downstream_buffers; i++) {
-
-            /*
-             * Get buffer
-             */
-
-            buffer = {};
-            memset(planes, 0, sizeof(planes));
-            buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-            buffer.memory = V4L2_MEMORY_MMAP;
-            buffer.index = i;
-            buffer.length = 1;
-            buffer.m.planes = planes;
-
-            if (xioctl(_decoder_fd, VIDIOC_QUERYBUF, &buffer) < 0)
-                throw std::runtime_error("failed to query output buffer");
-
-            /*
-             * mmap
-             */
-
-            auto capture_size = buffer.m.planes[0].length;
-            auto capture_offset = buffer.m.planes[0].m.mem_offset;
-            auto capture_mem = mmap(
-                    nullptr, capture_size, PROT_READ | PROT_WRITE, MAP_SHARED, _decoder_fd, capture_offset
-            );
-            if (capture_mem == MAP_FAILED)
-                throw std::runtime_error("failed to mmap output buffer");
-
-            /*
-             * export to dmabuf
-             */
-
-            memset(&expbuf, 0, sizeof(expbuf));
-            expbuf.type = buffer.type;
-            expbuf.index = buffer.index;
-            expbuf.flags = O_RDWR;
-
-            if (xioctl(_decoder_fd, VIDIOC_EXPBUF, &expbuf) < 0)
-                throw std::runtime_error("failed to export the capture buffer");
-
-            /*
-             * setup proxy
-             */
-
-            auto downstream_buffer = new DecoderBuffer(buffer.index, expbuf.fd, capture_mem, capture_size);
-            _downstream_buffers.push(downstream_buffer);
+    std::vector<DecoderBufferLayout> SwDecoder::GetBufferLayouts() const {
+        std::vector<DecoderBufferLayout> layouts;
+        layouts.reserve(_allocated_buffers.size());
+        for (auto *buffer : _allocated_buffers) {
+            layouts.push_back({
+                buffer->GetFd(), buffer->GetSize(), _output_width_height.first, _output_width_height.second
+            });
         }
+        return layouts;
     }
 
     SwDecoder::~SwDecoder() {
         Stop();
+#ifdef _TURBOJPEG_
+        for (auto &worker : _workers) {
+            if (worker->turbo != nullptr) {
+                tjDestroy(worker->turbo);
+            }
+        }
+#endif
         teardownDownstreamBuffers();
-        close(_decoder_fd);
     }
 
     void SwDecoder::teardownDownstreamBuffers() {
         while(!_downstream_buffers.empty()) {
-            auto buffer = _downstream_buffers.front();
             _downstream_buffers.pop();
-            munmap(buffer->GetMemory(), buffer->GetSize());
-            close(buffer->GetFd());
-            delete buffer;
-        }
-
-        v4l2_requestbuffers reqbufs = {};
-        reqbufs.count = 0;
-        reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-        reqbufs.memory = V4L2_MEMORY_MMAP;
-        if (xioctl(_decoder_fd, VIDIOC_REQBUFS, &reqbufs) < 0) {
-            std::cout << "Failed to free capture buffers" << std::endl;
         }
+        _allocator->Free(_allocated_buffers);
     }
 }
\ No newline at end of file
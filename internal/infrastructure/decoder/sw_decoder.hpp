@@ -13,6 +13,8 @@
 #include <thread>
 #include <iostream>
 #include <condition_variable>
+#include <vector>
+#include <utility>
 
 
 #include <jpeglib.h>
@@ -21,11 +23,83 @@ typedef size_t jpeg_mem_len_t;
 #else
 typedef unsigned long jpeg_mem_len_t;
 #endif
+#ifdef _TURBOJPEG_
+#include <turbojpeg.h>
+#endif
 
 #include "decoder.hpp"
 
 namespace infrastructure {
 
+    /*
+     * libjpeg source for a frame that may still be landing. When the decoder catches up with what has arrived, libjpeg
+     * suspends, the decoder sleeps until the tcp client posts the frame again, and picks up where it left off. A whole
+     * frame never suspends; if it runs out early, it gets a fake EOI like jpeg_mem_src gives it
+     */
+    struct StreamingSource {
+        struct jpeg_source_mgr manager = {};
+        SizedBuffer *buffer = nullptr;
+        FrameProgress *progress = nullptr;
+        /* how much of the buffer libjpeg has been handed */
+        std::size_t offered = 0;
+        /* what skip_input_data wanted to jump past that hasn't landed yet */
+        std::size_t skip = 0;
+    };
+
+    /* where a frame with restart markers can be cut into bands of whole MCU rows, read off its headers */
+    struct RestartLayout {
+        std::size_t scan_start = 0;
+        std::size_t height_at = 0;
+        int width = 0;
+        int height = 0;
+        int restart_interval = 0;
+        int interval_count = 0;
+        int intervals_per_band = 0;
+        int band_count = 0;
+        int band_mcu_rows = 0;
+    };
+
+    class SwDecoder;
+    struct DecoderWorker;
+
+    /* a run of restart intervals, decoded as a jpeg of its own straight into its rows of the output planes */
+    struct DecoderBand {
+        DecoderWorker *worker = nullptr;
+        int first_row = 0;
+        int rows = 0;
+        std::vector<std::pair<std::size_t, std::size_t>> segments;
+    };
+
+    /* one frame in flight, and everything needed to decode it */
+    struct DecoderWorker {
+        SwDecoder *decoder = nullptr;
+        /* only touched by the worker's own thread */
+        StreamingSource source;
+#ifdef _TURBOJPEG_
+        tjhandle turbo = nullptr;
+#endif
+        uint64_t sequence = 0;
+        std::unique_ptr<std::thread> thread;
+        /* a streamed frame gets posted again for every chunk; these tell the decoder it already has it */
+        std::shared_ptr<SizedBuffer> current_buffer = nullptr;
+        std::weak_ptr<SizedBuffer> last_buffer;
+        /* a row for whatever libjpeg writes past the bottom of the frame, then full width chroma rows to be halved */
+        std::vector<uint8_t> chroma;
+        /* the frame's bands; set before its first one goes out, and left alone until its last one is done */
+        int bands_pending = 0;
+        bool band_failed = false;
+        const uint8_t *band_source = nullptr;
+        std::size_t band_header_size = 0;
+        std::size_t band_height_at = 0;
+        DecoderBuffer *band_output = nullptr;
+    };
+
+    /*
+     * decodes up to frames_in_flight frames at once, one per worker. Only the newest frame waits for a worker; when a
+     * newer one arrives first, the waiting one is skipped and its buffer goes straight back to whoever owns it. Frames
+     * are numbered as workers take them, and go downstream strictly in that order; a frame that finishes after a newer
+     * one already went out is out of date, and is dropped instead of shown
+     */
     class SwDecoder: public std::enable_shared_from_this<SwDecoder>, public Decoder {
     public:
         static std::shared_ptr<SwDecoder>Create(
@@ -35,6 +109,7 @@ namespace infrastructure {
             return std::move(decoder);
         }
         void PostJpegBuffer(std::shared_ptr<SizedBuffer> &&buffer) override;
+        [[nodiscard]] std::vector<DecoderBufferLayout> GetBufferLayouts() const override;
         SwDecoder(const DecoderConfig &config, DecoderBufferCallback output_callback);
         ~SwDecoder();
     private:
@@ -43,22 +118,68 @@ namespace infrastructure {
         void StopDecoder() override;
 
         void setupDownstreamBuffers(unsigned int request_downstream_buffers);
-        void run();
-        void decodeBuffer(struct jpeg_decompress_struct &cinfo, std::shared_ptr<SizedBuffer> &&buffer);
+        void run(DecoderWorker &worker);
+        void decodeBuffer(
+            DecoderWorker &worker, struct jpeg_decompress_struct &cinfo, std::shared_ptr<SizedBuffer> &&buffer
+        );
+        [[nodiscard]] bool decompressTurbo(DecoderWorker &worker, DecoderBuffer *buffer);
+        [[nodiscard]] bool readRestartLayout(DecoderWorker &worker, RestartLayout &layout);
+        [[nodiscard]] bool decodeBands(DecoderWorker &worker, const RestartLayout &layout, DecoderBuffer *buffer);
+        void dispatchBand(DecoderBand &&band);
+        void runBands();
+        void decodeBand(
+            struct jpeg_decompress_struct &cinfo, std::vector<uint8_t> &scratch, std::vector<uint8_t> &chroma,
+            const DecoderBand &band
+        );
+        [[nodiscard]] JDIMENSION readRawRows(
+            struct jpeg_decompress_struct &cinfo, DecoderBuffer *buffer, int first_row, std::vector<uint8_t> &chroma
+        ) const;
+        void planeRows(
+            DecoderBuffer *buffer, int row, uint8_t *padding, JSAMPROW *y_rows, JSAMPROW *u_rows, JSAMPROW *v_rows
+        ) const;
+        [[nodiscard]] DecoderBuffer *takeDownstreamBuffer();
+        void sendDownstreamBuffer(
+            const DecoderWorker &worker, DecoderBuffer *buffer, FrameMetadata *in_metadata, int64_t decode_start_us
+        );
+        [[nodiscard]] static std::size_t landedBytes(const StreamingSource &source);
+        [[nodiscard]] bool waitForBytes(const StreamingSource &source, std::size_t seen);
+        [[nodiscard]] static bool refreshSource(StreamingSource &source);
+        static void initSource(j_decompress_ptr cinfo);
+        static boolean fillSource(j_decompress_ptr cinfo);
+        static void skipSource(j_decompress_ptr cinfo, long num_bytes);
+        static void termSource(j_decompress_ptr cinfo);
         void queueDownstreamBuffer(DecoderBuffer *d);
         void teardownDownstreamBuffers();
 
-        static const char _device_name[];
-        int _decoder_fd = -1;
-
         const std::pair<int, int> _width_height;
+        /* libjpeg scales in the DCT by 1 / _scale_denom, so smaller outputs are cheaper to decode, not just to show */
+        const unsigned int _scale_denom;
+        const std::pair<int, int> _output_width_height;
+        const unsigned int _band_thread_count;
+        const bool _is_turbo;
+        std::vector<std::unique_ptr<DecoderWorker>> _workers;
 
         std::mutex _work_mutex;
         std::condition_variable _work_cv;
-        std::queue<std::shared_ptr<SizedBuffer>> _work_queue;
-        std::unique_ptr<std::thread> _work_thread;
+        /* only ever the newest frame; one that hasn't been started by the time the next arrives is skipped */
+        std::shared_ptr<SizedBuffer> _pending_buffer = nullptr;
         std::atomic<bool> _work_stop = { true };
-
+        uint64_t _next_sequence = 0;
+
+        /* the lowest sequence that can still go downstream; anything under it is out of date */
+        std::mutex _send_mutex;
+        uint64_t _send_sequence = 0;
+
+        /* frames with restart markers get cut into bands and spread over these */
+        std::vector<std::unique_ptr<std::thread>> _band_threads;
+        std::mutex _band_mutex;
+        std::condition_variable _band_cv;
+        std::condition_variable _band_done_cv;
+        std::queue<DecoderBand> _band_queue;
+
+        std::unique_ptr<DecoderAllocator> _allocator;
+        /* every buffer the allocator gave us, so they can all go back, whether or not they're home */
+        std::vector<DecoderBuffer *> _allocated_buffers;
         std::mutex _downstream_buffers_mutex;
         std::queue<DecoderBuffer *> _downstream_buffers;
 
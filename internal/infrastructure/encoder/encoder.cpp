@@ -4,6 +4,7 @@
 
 #include "encoder.hpp"
 #include "sw_encoder.hpp"
+#include "sw_strip_encoder.hpp"
 #include "null_encoder.hpp"
 
 namespace infrastructure {
@@ -11,6 +12,12 @@ namespace infrastructure {
         switch(config.get_encoder_type()) {
             case EncoderType::SW:
                 return std::make_shared<SwEncoder>(config, std::move(send_callback));
+#ifdef _TURBOJPEG_
+            case EncoderType::TURBO:
+                return std::make_shared<SwEncoder>(config, std::move(send_callback));
+#endif
+            case EncoderType::SW_STRIPS:
+                return std::make_shared<SwStripEncoder>(config, std::move(send_callback));
             case EncoderType::NONE:
                 return std::make_shared<NullEncoder>(config, std::move(send_callback));
             default:
@@ -6,11 +6,15 @@
 #define INFRASTRUCTURE_ENCODER_HPP
 
 #include "utils/buffers.hpp"
+#include "utils/latency.hpp"
 
 namespace infrastructure {
 
     enum class EncoderType {
         SW,
+        SW_STRIPS,
+        /* SW, but compressing through TurboJPEG's plane api; only there when built with it */
+        TURBO,
         NONE,
     };
 
@@ -18,9 +22,15 @@ namespace infrastructure {
         [[nodiscard]] virtual EncoderType get_encoder_type() const = 0;
         [[nodiscard]] virtual unsigned int get_encoder_downstream_buffer_count() const = 0;
         [[nodiscard]] virtual std::pair<int, int> get_encoder_width_height() const = 0;
+        /* 0 sends each frame once it's whole; otherwise it goes out every time this many more bytes are compressed */
+        [[nodiscard]] virtual unsigned int get_encoder_stream_chunk_size() const = 0;
+        /* threads SW_STRIPS splits each frame across; 0 is one per core */
+        [[nodiscard]] virtual unsigned int get_encoder_strip_count() const = 0;
+        /* frames SW compresses at once, each on its own thread; 1 is one at a time, 0 is one per core */
+        [[nodiscard]] virtual unsigned int get_encoder_frames_in_flight() const = 0;
     };
 
-    class Encoder {
+    class Encoder: public LatencyStatsSink {
     public:
         [[nodiscard]] static std::shared_ptr<Encoder> Create(
             const EncoderConfig &config, SizedBufferCallback &&send_callback
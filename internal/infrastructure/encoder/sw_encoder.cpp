@@ -4,17 +4,61 @@
 
 #include "sw_encoder.hpp"
 
+#include <jerror.h>
+
+#include "utils/clock.hpp"
+
 
 namespace infrastructure {
 
     SwEncoder::SwEncoder(const EncoderConfig &config, SizedBufferCallback send_callback):
             Encoder(config, std::move(send_callback)),
-            _width_height(config.get_encoder_width_height())
+            _width_height(config.get_encoder_width_height()),
+            _stream_chunk_size(config.get_encoder_stream_chunk_size()),
+            _is_turbo(config.get_encoder_type() == EncoderType::TURBO)
     {
+        setupWorkers(config.get_encoder_frames_in_flight());
         auto downstream_count = config.get_encoder_downstream_buffer_count();
         setupDownstreamBuffers(downstream_count);
     }
 
+    void SwEncoder::setupWorkers(unsigned int request_frames_in_flight) {
+        if (request_frames_in_flight == 0) {
+            request_frames_in_flight = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned int i = 0; i < request_frames_in_flight; i++) {
+            auto worker = std::make_unique<EncoderWorker>();
+            worker->encoder = this;
+            auto &cinfo = worker->cinfo;
+            cinfo.err = jpeg_std_error(&worker->jerr);
+            // a frame that doesn't fit in its output buffer gets dropped, instead of taking the process down
+            worker->jerr.error_exit = [](j_common_ptr cinfo) { throw cinfo->err; };
+            jpeg_create_compress(&cinfo);
+            cinfo.client_data = worker.get();
+
+            worker->destination.manager.init_destination = &SwEncoder::initDestination;
+            worker->destination.manager.empty_output_buffer = &SwEncoder::emptyDestination;
+            worker->destination.manager.term_destination = &SwEncoder::termDestination;
+            cinfo.dest = &worker->destination.manager;
+
+            cinfo.image_width = _width_height.first;
+            cinfo.image_height = _width_height.second;
+            cinfo.input_components = 3;
+            cinfo.in_color_space = JCS_YCbCr;
+            cinfo.restart_interval = 0;
+
+            jpeg_set_defaults(&cinfo);
+            cinfo.raw_data_in = TRUE;
+            jpeg_set_quality(&cinfo, 75, TRUE);
+#ifdef _TURBOJPEG_
+            if (_is_turbo && (worker->turbo = tjInitCompress()) == nullptr) {
+                throw std::runtime_error("failed to set up turbojpeg compressor");
+            }
+#endif
+            _workers.push_back(std::move(worker));
+        }
+    }
+
     void SwEncoder::StartEncoder() {
 
         if (!_work_stop) {
@@ -22,9 +66,14 @@ namespace infrastructure {
         }
 
         _work_stop = false;
+        _next_sequence = 0;
+        _send_sequence = 0;
 
         auto self(shared_from_this());
-        _work_thread = std::make_unique<std::thread>([this, self]() mutable { run(); });
+        for (auto &worker : _workers) {
+            auto *w = worker.get();
+            worker->thread = std::make_unique<std::thread>([this, self, w]() mutable { run(*w); });
+        }
 
     }
 
@@ -33,19 +82,19 @@ namespace infrastructure {
             return;
         }
 
-        if (_work_thread) {
-            if (_work_thread->joinable()) {
-                {
-                    std::unique_lock<std::mutex> lock(_work_mutex);
-                    _work_stop = true;
-                    _work_cv.notify_one();
-                }
-                _work_thread->join();
+        {
+            std::unique_lock<std::mutex> lock(_work_mutex);
+            std::unique_lock<std::mutex> send_lock(_send_mutex);
+            _work_stop = true;
+            _work_cv.notify_all();
+            _send_cv.notify_all();
+        }
+        for (auto &worker : _workers) {
+            if (worker->thread && worker->thread->joinable()) {
+                worker->thread->join();
             }
-            _work_thread.reset();
+            worker->thread.reset();
         }
-        // just in case we skipped above
-        _work_stop = true;
 
         while(!_work_queue.empty()) {
             _work_queue.pop();
@@ -57,28 +106,13 @@ namespace infrastructure {
         if (buffer == nullptr || _work_stop) {
             return;
         }
+        buffer->GetMetadata()->stage_timestamp_us = monotonicClockMicros();
         std::unique_lock<std::mutex> lock(_work_mutex);
         _work_queue.push(std::move(buffer));
         _work_cv.notify_one();
     }
 
-    void SwEncoder::run() {
-
-        struct jpeg_compress_struct cinfo;
-        struct jpeg_error_mgr jerr;
-        cinfo.err = jpeg_std_error(&jerr);
-        jpeg_create_compress(&cinfo);
-
-        cinfo.image_width = _width_height.first;
-        cinfo.image_height = _width_height.second;
-        cinfo.input_components = 3;
-        cinfo.in_color_space = JCS_YCbCr;
-        cinfo.restart_interval = 0;
-
-        jpeg_set_defaults(&cinfo);
-        cinfo.raw_data_in = TRUE;
-        jpeg_set_quality(&cinfo, 75, TRUE);
-
+    void SwEncoder::run(EncoderWorker &worker) {
         while(!_work_stop) {
             std::shared_ptr<CameraBuffer> buffer;
             {
@@ -93,14 +127,14 @@ namespace infrastructure {
                 }
                 buffer = std::move(_work_queue.front());
                 _work_queue.pop();
+                // taken off the queue in capture order, so numbered in capture order
+                worker.sequence = _next_sequence++;
             }
-            encodeBuffer(cinfo, std::move(buffer));
+            encodeBuffer(worker, std::move(buffer));
         }
-
-        jpeg_destroy_compress(&cinfo);
     }
 
-    void SwEncoder::encodeBuffer(struct jpeg_compress_struct &cinfo, std::shared_ptr<CameraBuffer> &&cam_buffer) {
+    void SwEncoder::encodeBuffer(EncoderWorker &worker, std::shared_ptr<CameraBuffer> &&cam_buffer) {
         EncoderBuffer *buffer = nullptr;
         {
             std::unique_lock<std::mutex> lock(_downstream_buffers_mutex);
@@ -110,14 +144,98 @@ namespace infrastructure {
             }
         }
         if (buffer == nullptr) {
+            // a dropped frame still holds its place in line, or the frames after it would wait on it forever
+            if (waitForTurn(worker)) {
+                finishTurn();
+            }
             return;
         }
-        buffer->ResetSize();
-        jpeg_mem_dest(&cinfo, buffer->GetMemoryPointer(), buffer->GetSizePointer());
+        const auto encode_start_us = recordLatencySince(
+            LatencyStage::ENCODER_QUEUE, cam_buffer->GetMetadata()->stage_timestamp_us
+        );
+
+        // a streamed frame is read downstream from its first chunk on, so everything but its size is set up front;
+        // that makes its send time start with the encode, since the two overlap
+        const bool is_streaming = _stream_chunk_size != 0;
+        auto *metadata = buffer->GetMetadata();
+        *metadata = *cam_buffer->GetMetadata();
+        metadata->width = _width_height.first;
+        metadata->height = _width_height.second;
+        metadata->pixel_format = FOURCC_MJPEG;
+        metadata->encode_timestamp_us = wallClockMicros();
+        metadata->stage_timestamp_us = encode_start_us;
+        if (is_streaming) {
+            buffer->SetSize(0);
+            buffer->GetProgress()->Reset();
+        }
+
+        auto self(shared_from_this());
+        worker.output_buffer = std::shared_ptr<EncoderBuffer>(
+            buffer, [this, self](EncoderBuffer * e) mutable {
+                queueDownstreamBuffer(e);
+            }
+        );
+        if (_is_turbo) {
+            if (!compressTurbo(worker, *cam_buffer, buffer)) {
+                worker.output_buffer = nullptr;
+                if (waitForTurn(worker)) {
+                    finishTurn();
+                }
+                return;
+            }
+        } else if (!compressRaw(worker, *cam_buffer, buffer)) {
+            // a streamed frame may have chunks out already; downstream hears it was given up on, in its turn
+            if (waitForTurn(worker)) {
+                if (is_streaming) {
+                    buffer->GetProgress()->Abort();
+                    _send_callback(std::move(worker.output_buffer));
+                }
+                finishTurn();
+            }
+            worker.output_buffer = nullptr;
+            return;
+        }
+        // the camera buffer can go back as soon as it's compressed, not once the frames ahead of it are out
+        cam_buffer.reset();
+
+        const auto encode_end_us = recordLatencySince(LatencyStage::ENCODE, encode_start_us);
+        if (!waitForTurn(worker)) {
+            worker.output_buffer = nullptr;
+            return;
+        }
+        if (!is_streaming) {
+            // nobody has seen a whole frame yet, so it leaves with the time it was finished
+            metadata->encode_timestamp_us = wallClockMicros();
+            metadata->stage_timestamp_us = encode_end_us;
+        }
+        _send_callback(std::move(worker.output_buffer));
+        worker.output_buffer = nullptr;
+        finishTurn();
+    }
+
+    bool SwEncoder::compressRaw(EncoderWorker &worker, CameraBuffer &cam_buffer, EncoderBuffer *buffer) {
+        auto &cinfo = worker.cinfo;
+        worker.destination.buffer = buffer;
+        try {
+            writeRaw(worker, cam_buffer);
+        } catch (struct jpeg_error_mgr *err) {
+            char pszErr[1024];
+            (cinfo.err->format_message)((j_common_ptr) &cinfo, pszErr);
+            std::cout << "SwEncoder::compressRaw encountered an error: " << pszErr << std::endl;
+            jpeg_abort_compress(&cinfo);
+            worker.destination.buffer = nullptr;
+            return false;
+        }
+        worker.destination.buffer = nullptr;
+        return true;
+    }
+
+    void SwEncoder::writeRaw(EncoderWorker &worker, CameraBuffer &cam_buffer) {
+        auto &cinfo = worker.cinfo;
         jpeg_start_compress(&cinfo, TRUE);
 
         int stride2 = _width_height.first / 2;
-        uint8_t *Y = (uint8_t *) cam_buffer->GetMemory();
+        uint8_t *Y = (uint8_t *) cam_buffer.GetMemory();
         uint8_t *U = (uint8_t *)Y + _width_height.first * _width_height.second;
         uint8_t *V = (uint8_t *)U + stride2 * (_width_height.second / 2);
         uint8_t *Y_max = U - _width_height.first;
@@ -140,14 +258,89 @@ namespace infrastructure {
         }
 
         jpeg_finish_compress(&cinfo);
-        auto self(shared_from_this());
-        auto output_buffer = std::shared_ptr<EncoderBuffer>(
-            buffer, [this, self](EncoderBuffer * e) mutable {
-                queueDownstreamBuffer(e);
+    }
+
+    bool SwEncoder::compressTurbo(EncoderWorker &worker, CameraBuffer &cam_buffer, EncoderBuffer *buffer) {
+#ifdef _TURBOJPEG_
+        // turbojpeg takes the planes as they are and compresses the frame in one go, so a streamed one lands all at once
+        const int width = _width_height.first;
+        const int height = _width_height.second;
+        const auto *Y = (const unsigned char *) cam_buffer.GetMemory();
+        const unsigned char *planes[] = { Y, Y + width * height, Y + width * height + (width / 2) * (height / 2) };
+        const int strides[] = { width, width / 2, width / 2 };
+        auto *output = (unsigned char *) buffer->GetMemory();
+        unsigned long size = buffer->GetMaxSize();
+        if (tjCompressFromYUVPlanes(
+            worker.turbo, planes, width, strides, height, TJSAMP_420, &output, &size, 75, TJFLAG_NOREALLOC
+        ) != 0) {
+            std::cout << "SwEncoder::compressTurbo encountered an error: " << tjGetErrorStr2(worker.turbo) << std::endl;
+            return false;
+        }
+        buffer->SetSize(size);
+        buffer->GetProgress()->Complete(size);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool SwEncoder::waitForTurn(const EncoderWorker &worker) {
+        // false means we are shutting down, and the frame never goes out
+        std::unique_lock<std::mutex> lock(_send_mutex);
+        _send_cv.wait(lock, [this, &worker]() {
+            return _send_sequence == worker.sequence || _work_stop;
+        });
+        return !_work_stop;
+    }
+
+    void SwEncoder::finishTurn() {
+        std::unique_lock<std::mutex> lock(_send_mutex);
+        _send_sequence += 1;
+        _send_cv.notify_all();
+    }
+
+    void SwEncoder::nextWindow(EncoderWorker &worker) {
+        auto &destination = worker.destination;
+        auto *memory = (JOCTET *) destination.buffer->GetMemory();
+        const auto room = destination.buffer->GetMaxSize() - destination.landed;
+        destination.window = _stream_chunk_size == 0 ? room : std::min(_stream_chunk_size, room);
+        if (destination.window == 0) {
+            ERREXIT(&worker.cinfo, JERR_BUFFER_SIZE);
+        }
+        destination.manager.next_output_byte = memory + destination.landed;
+        destination.manager.free_in_buffer = destination.window;
+    }
+
+    void SwEncoder::initDestination(j_compress_ptr cinfo) {
+        auto *worker = static_cast<EncoderWorker *>(cinfo->client_data);
+        worker->destination.landed = 0;
+        worker->encoder->nextWindow(*worker);
+    }
+
+    boolean SwEncoder::emptyDestination(j_compress_ptr cinfo) {
+        // libjpeg only calls this once the whole window is full
+        auto *worker = static_cast<EncoderWorker *>(cinfo->client_data);
+        auto *encoder = worker->encoder;
+        auto &destination = worker->destination;
+        destination.landed += destination.window;
+        if (encoder->_stream_chunk_size != 0) {
+            destination.buffer->GetProgress()->Land(destination.landed);
+            // a frame behind others in line keeps its chunks; they go out with its next post once it's up
+            if (encoder->_send_sequence == worker->sequence) {
+                auto output_buffer = worker->output_buffer;
+                encoder->_send_callback(std::move(output_buffer));
             }
-        );
-        _send_callback(std::move(output_buffer));
+        }
+        encoder->nextWindow(*worker);
+        return TRUE;
+    }
 
+    void SwEncoder::termDestination(j_compress_ptr cinfo) {
+        auto *worker = static_cast<EncoderWorker *>(cinfo->client_data);
+        auto &destination = worker->destination;
+        destination.landed += destination.window - destination.manager.free_in_buffer;
+        destination.buffer->SetSize(destination.landed);
+        destination.buffer->GetProgress()->Complete(destination.landed);
     }
 
     void SwEncoder::queueDownstreamBuffer(EncoderBuffer *e) {
@@ -156,7 +349,13 @@ namespace infrastructure {
     }
 
     void SwEncoder::setupDownstreamBuffers(unsigned int request_downstream_buffers) {
-        const auto max_size = _width_height.first * _width_height.second * 3 / 2;
+        std::size_t max_size = _width_height.first * _width_height.second * 3 / 2;
+#ifdef _TURBOJPEG_
+        // with NOREALLOC, turbojpeg wants room for the worst case up front
+        if (_is_turbo) {
+            max_size = tjBufSize(_width_height.first, _width_height.second, TJSAMP_420);
+        }
+#endif
         for (int i = 0; i < request_downstream_buffers; i++) {
             auto downstream_buffer = new EncoderBuffer(max_size);
             _downstream_buffers.push(downstream_buffer);
@@ -165,6 +364,14 @@ namespace infrastructure {
 
     SwEncoder::~SwEncoder() {
         StopEncoder();
+        for (auto &worker : _workers) {
+            jpeg_destroy_compress(&worker->cinfo);
+#ifdef _TURBOJPEG_
+            if (worker->turbo != nullptr) {
+                tjDestroy(worker->turbo);
+            }
+#endif
+        }
         teardownDownstreamBuffers();
     }
 
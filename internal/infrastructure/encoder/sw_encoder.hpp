@@ -11,17 +11,15 @@
 #include <queue>
 #include <mutex>
 #include <map>
+#include <vector>
 #include <atomic>
 #include <thread>
 #include <iostream>
 #include <condition_variable>
 
 #include <jpeglib.h>
-
-#if JPEG_LIB_VERSION_MAJOR > 9 || (JPEG_LIB_VERSION_MAJOR == 9 && JPEG_LIB_VERSION_MINOR >= 4)
-typedef size_t jpeg_mem_len_t;
-#else
-typedef unsigned long jpeg_mem_len_t;
+#ifdef _TURBOJPEG_
+#include <turbojpeg.h>
 #endif
 
 #include "utils/buffers.hpp"
@@ -39,30 +37,65 @@ namespace infrastructure {
         [[nodiscard]] void *GetMemory() override {
             return _memory;
         }
-        [[nodiscard]] uint8_t **GetMemoryPointer() {
-            return &_memory;
-        };
         [[nodiscard]] std::size_t GetSize() override {
-            return _size;
-        }
-        [[nodiscard]] std::size_t *GetSizePointer() {
-            return &_size;
+            return _size.load(std::memory_order_relaxed);
         }
-        void ResetSize() {
-            _size = _max_size;
+        [[nodiscard]] std::size_t GetMaxSize() const {
+            return _max_size;
         }
         void SetSize(const std::size_t &size) {
-            _size = size;
+            _size.store(size, std::memory_order_relaxed);
+        }
+        [[nodiscard]] FrameMetadata *GetMetadata() override {
+            return &_metadata;
+        }
+        [[nodiscard]] FrameProgress *GetProgress() override {
+            return &_progress;
         }
         ~EncoderBuffer() {
             delete []_memory;
         }
     private:
         uint8_t *_memory = nullptr;
-        std::size_t _max_size;
-        std::size_t _size;
+        const std::size_t _max_size;
+        std::atomic<std::size_t> _size;
+        FrameMetadata _metadata;
+        FrameProgress _progress;
+    };
+
+    /*
+     * libjpeg hands its output over in windows of chunk_size bytes; every time one fills, the frame goes downstream
+     * again with that much more of it landed, so the top of the image is on the wire while the bottom is still being
+     * compressed. A chunk size of 0 is one window for the whole buffer, and the frame only goes down once it's whole
+     */
+    struct StreamingDestination {
+        struct jpeg_destination_mgr manager = {};
+        EncoderBuffer *buffer = nullptr;
+        std::size_t landed = 0;
+        std::size_t window = 0;
     };
 
+    class SwEncoder;
+
+    /* one frame in flight; everything here is only touched by the worker's own thread */
+    struct EncoderWorker {
+        SwEncoder *encoder = nullptr;
+        struct jpeg_compress_struct cinfo = {};
+        struct jpeg_error_mgr jerr = {};
+        StreamingDestination destination;
+#ifdef _TURBOJPEG_
+        tjhandle turbo = nullptr;
+#endif
+        std::shared_ptr<SizedBuffer> output_buffer = nullptr;
+        uint64_t sequence = 0;
+        std::unique_ptr<std::thread> thread;
+    };
+
+    /*
+     * keeps up to frames_in_flight frames compressing at once, one per worker. Frames are numbered as workers take
+     * them off the queue, and each one waits for the frames before it to go downstream first, so the callback still
+     * sees them in capture order. A streaming frame only sends its chunks once it's the oldest one left
+     */
     class SwEncoder: public std::enable_shared_from_this<SwEncoder>, public Encoder {
     public:
         SwEncoder(const EncoderConfig &config, SizedBufferCallback output_callback);
@@ -72,19 +105,37 @@ namespace infrastructure {
         void StartEncoder() override;
         void StopEncoder() override;
 
+        void setupWorkers(unsigned int request_frames_in_flight);
         void setupDownstreamBuffers(unsigned int request_downstream_buffers);
-        void run();
-        void encodeBuffer(struct jpeg_compress_struct &cinfo, std::shared_ptr<CameraBuffer> &&buffer);
+        void run(EncoderWorker &worker);
+        void encodeBuffer(EncoderWorker &worker, std::shared_ptr<CameraBuffer> &&buffer);
+        [[nodiscard]] bool compressRaw(EncoderWorker &worker, CameraBuffer &cam_buffer, EncoderBuffer *buffer);
+        void writeRaw(EncoderWorker &worker, CameraBuffer &cam_buffer);
+        [[nodiscard]] bool compressTurbo(EncoderWorker &worker, CameraBuffer &cam_buffer, EncoderBuffer *buffer);
+        [[nodiscard]] bool waitForTurn(const EncoderWorker &worker);
+        void finishTurn();
+        void nextWindow(EncoderWorker &worker);
+        static void initDestination(j_compress_ptr cinfo);
+        static boolean emptyDestination(j_compress_ptr cinfo);
+        static void termDestination(j_compress_ptr cinfo);
         void queueDownstreamBuffer(EncoderBuffer *e);
         void teardownDownstreamBuffers();
 
         const std::pair<int, int> _width_height;
+        const std::size_t _stream_chunk_size;
+        const bool _is_turbo;
+        std::vector<std::unique_ptr<EncoderWorker>> _workers;
 
         std::mutex _work_mutex;
         std::condition_variable _work_cv;
         std::queue<std::shared_ptr<CameraBuffer>> _work_queue;
-        std::unique_ptr<std::thread> _work_thread;
         std::atomic<bool> _work_stop = { true };
+        uint64_t _next_sequence = 0;
+
+        /* the sequence of the oldest frame still in flight; only it may call downstream */
+        std::mutex _send_mutex;
+        std::condition_variable _send_cv;
+        std::atomic<uint64_t> _send_sequence = { 0 };
 
         std::mutex _downstream_buffers_mutex;
         std::queue<EncoderBuffer*> _downstream_buffers;
@@ -0,0 +1,412 @@
+//
+// Created by brucegoose on 7/16/23.
+//
+
+#include "sw_strip_encoder.hpp"
+
+#include <cstring>
+
+#include <jerror.h>
+
+#include "utils/clock.hpp"
+
+
+namespace infrastructure {
+
+    SwStripEncoder::SwStripEncoder(const EncoderConfig &config, SizedBufferCallback send_callback):
+            Encoder(config, std::move(send_callback)),
+            _width_height(config.get_encoder_width_height()),
+            _stream_chunk_size(config.get_encoder_stream_chunk_size())
+    {
+        setupStrips(config.get_encoder_strip_count());
+        setupDownstreamBuffers(config.get_encoder_downstream_buffer_count());
+    }
+
+    void SwStripEncoder::setupStrips(unsigned int request_strip_count) {
+        const unsigned int strip_count = request_strip_count != 0 ?
+            request_strip_count : std::max(1u, std::thread::hardware_concurrency());
+        const int mcu_rows = (_width_height.second + 15) / 16;
+        const int mcus_per_row = (_width_height.first + 15) / 16;
+        _strip_mcu_rows = (mcu_rows + (int) strip_count - 1) / (int) strip_count;
+        const int restart_interval = _strip_mcu_rows * mcus_per_row;
+        if (restart_interval > 65535) {
+            throw std::runtime_error("SwStripEncoder: strips are too tall for a restart interval; use more of them");
+        }
+
+        for (int first_row = 0; first_row < _width_height.second; first_row += _strip_mcu_rows * 16) {
+            auto strip = std::make_unique<EncoderStrip>();
+            const int rows = std::min(_strip_mcu_rows * 16, _width_height.second - first_row);
+            strip->first_row = first_row;
+            // the raw 4:2:0 size is plenty at quality 75; a noisy strip that needs more grows it in emptyDestination
+            strip->output.resize(_width_height.first * rows * 3 / 2 + 4096);
+
+            auto &cinfo = strip->cinfo;
+            cinfo.err = jpeg_std_error(&strip->jerr);
+            strip->jerr.error_exit = [](j_common_ptr cinfo) { throw cinfo->err; };
+            jpeg_create_compress(&cinfo);
+            cinfo.client_data = strip.get();
+
+            strip->destination.init_destination = &SwStripEncoder::initDestination;
+            strip->destination.empty_output_buffer = &SwStripEncoder::emptyDestination;
+            strip->destination.term_destination = &SwStripEncoder::termDestination;
+            cinfo.dest = &strip->destination;
+
+            cinfo.image_width = _width_height.first;
+            cinfo.image_height = rows;
+            cinfo.input_components = 3;
+            cinfo.in_color_space = JCS_YCbCr;
+
+            jpeg_set_defaults(&cinfo);
+            cinfo.raw_data_in = TRUE;
+            jpeg_set_quality(&cinfo, 75, TRUE);
+            // one interval per strip, so no strip ever writes a restart marker of its own
+            cinfo.restart_interval = restart_interval;
+
+            _strips.push_back(std::move(strip));
+        }
+    }
+
+    void SwStripEncoder::StartEncoder() {
+
+        if (!_work_stop) {
+            return;
+        }
+
+        _work_stop = false;
+
+        auto self(shared_from_this());
+        const auto generation = _strip_generation;
+        for (std::size_t i = 1; i < _strips.size(); i++) {
+            _strips[i]->thread = std::make_unique<std::thread>(
+                [this, self, i, generation]() mutable { runStrip(i, generation); }
+            );
+        }
+        _work_thread = std::make_unique<std::thread>([this, self]() mutable { run(); });
+
+    }
+
+    void SwStripEncoder::StopEncoder() {
+        if (_work_stop) {
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> work_lock(_work_mutex);
+            std::unique_lock<std::mutex> strip_lock(_strip_mutex);
+            _work_stop = true;
+            _work_cv.notify_one();
+            _strip_cv.notify_all();
+            _strip_done_cv.notify_all();
+        }
+        if (_work_thread && _work_thread->joinable()) {
+            _work_thread->join();
+        }
+        _work_thread.reset();
+        for (auto &strip : _strips) {
+            if (strip->thread && strip->thread->joinable()) {
+                strip->thread->join();
+            }
+            strip->thread.reset();
+            strip->is_done = true;
+        }
+        _strip_frame = nullptr;
+
+        while(!_work_queue.empty()) {
+            _work_queue.pop();
+        }
+
+    }
+
+    void SwStripEncoder::PostCameraBuffer(std::shared_ptr<CameraBuffer> &&buffer) {
+        if (buffer == nullptr || _work_stop) {
+            return;
+        }
+        buffer->GetMetadata()->stage_timestamp_us = monotonicClockMicros();
+        std::unique_lock<std::mutex> lock(_work_mutex);
+        _work_queue.push(std::move(buffer));
+        _work_cv.notify_one();
+    }
+
+    void SwStripEncoder::run() {
+        while(!_work_stop) {
+            std::shared_ptr<CameraBuffer> buffer;
+            {
+                std::unique_lock<std::mutex> lock(_work_mutex);
+                _work_cv.wait(lock, [this]() {
+                    return !_work_queue.empty() || _work_stop;
+                });
+                if (_work_stop) {
+                    return;
+                } else if (_work_queue.empty()) {
+                    continue;
+                }
+                buffer = std::move(_work_queue.front());
+                _work_queue.pop();
+            }
+            encodeBuffer(std::move(buffer));
+        }
+    }
+
+    void SwStripEncoder::runStrip(const std::size_t index, uint64_t generation) {
+        auto &strip = *_strips[index];
+        while (true) {
+            std::shared_ptr<CameraBuffer> frame;
+            {
+                std::unique_lock<std::mutex> lock(_strip_mutex);
+                _strip_cv.wait(lock, [this, generation]() {
+                    return _work_stop || _strip_generation != generation;
+                });
+                if (_work_stop) {
+                    return;
+                }
+                generation = _strip_generation;
+                frame = _strip_frame;
+            }
+            encodeStrip(strip, *frame);
+            {
+                std::unique_lock<std::mutex> lock(_strip_mutex);
+                strip.is_done = true;
+                _strip_done_cv.notify_one();
+            }
+        }
+    }
+
+    void SwStripEncoder::encodeBuffer(std::shared_ptr<CameraBuffer> &&cam_buffer) {
+        EncoderBuffer *buffer = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(_downstream_buffers_mutex);
+            if (!_downstream_buffers.empty()) {
+                buffer = _downstream_buffers.front();
+                _downstream_buffers.pop();
+            }
+        }
+        if (buffer == nullptr) {
+            return;
+        }
+        const auto encode_start_us = recordLatencySince(
+            LatencyStage::ENCODER_QUEUE, cam_buffer->GetMetadata()->stage_timestamp_us
+        );
+
+        // same as SwEncoder: a streamed frame is read downstream from its first strip on
+        const bool is_streaming = _stream_chunk_size != 0;
+        auto *metadata = buffer->GetMetadata();
+        *metadata = *cam_buffer->GetMetadata();
+        metadata->width = _width_height.first;
+        metadata->height = _width_height.second;
+        metadata->pixel_format = FOURCC_MJPEG;
+        metadata->encode_timestamp_us = wallClockMicros();
+        metadata->stage_timestamp_us = encode_start_us;
+        if (is_streaming) {
+            buffer->SetSize(0);
+            buffer->GetProgress()->Reset();
+        }
+
+        auto self(shared_from_this());
+        std::shared_ptr<SizedBuffer> output_buffer = std::shared_ptr<EncoderBuffer>(
+            buffer, [this, self](EncoderBuffer * e) mutable {
+                queueDownstreamBuffer(e);
+            }
+        );
+
+        {
+            std::unique_lock<std::mutex> lock(_strip_mutex);
+            for (std::size_t i = 1; i < _strips.size(); i++) {
+                _strips[i]->is_done = false;
+            }
+            _strip_frame = cam_buffer;
+            _strip_generation += 1;
+            _strip_cv.notify_all();
+        }
+        encodeStrip(*_strips[0], *cam_buffer);
+
+        std::size_t landed = 0;
+        bool is_whole = true;
+        for (std::size_t i = 0; i < _strips.size(); i++) {
+            auto &strip = *_strips[i];
+            {
+                std::unique_lock<std::mutex> lock(_strip_mutex);
+                _strip_done_cv.wait(lock, [this, &strip]() { return _work_stop || strip.is_done; });
+                if (_work_stop) {
+                    return;
+                }
+            }
+            is_whole = is_whole && stitchStrip(strip, i, *buffer, landed);
+            if (is_whole && is_streaming && i + 1 < _strips.size()) {
+                buffer->GetProgress()->Land(landed);
+                auto copy_buffer = output_buffer;
+                _send_callback(std::move(copy_buffer));
+            }
+        }
+        {
+            std::unique_lock<std::mutex> lock(_strip_mutex);
+            _strip_frame = nullptr;
+        }
+
+        if (!is_whole) {
+            std::cout << "SwStripEncoder: frame doesn't fit in an output buffer; dropping it" << std::endl;
+            if (is_streaming) {
+                buffer->GetProgress()->Abort();
+                _send_callback(std::move(output_buffer));
+            }
+            return;
+        }
+
+        buffer->SetSize(landed);
+        buffer->GetProgress()->Complete(landed);
+        const auto encode_end_us = recordLatencySince(LatencyStage::ENCODE, encode_start_us);
+        if (!is_streaming) {
+            metadata->encode_timestamp_us = wallClockMicros();
+            metadata->stage_timestamp_us = encode_end_us;
+        }
+        _send_callback(std::move(output_buffer));
+    }
+
+    void SwStripEncoder::encodeStrip(EncoderStrip &strip, CameraBuffer &cam_buffer) {
+        auto &cinfo = strip.cinfo;
+        try {
+            compressStrip(strip, cam_buffer);
+        } catch (struct jpeg_error_mgr *err) {
+            char pszErr[1024];
+            (cinfo.err->format_message)((j_common_ptr) &cinfo, pszErr);
+            std::cout << "SwStripEncoder::encodeStrip encountered an error: " << pszErr << std::endl;
+            jpeg_abort_compress(&cinfo);
+            // stitching finds no scan in it, and drops the frame
+            strip.size = 0;
+        }
+    }
+
+    void SwStripEncoder::compressStrip(EncoderStrip &strip, CameraBuffer &cam_buffer) {
+        auto &cinfo = strip.cinfo;
+        jpeg_start_compress(&cinfo, TRUE);
+
+        int stride2 = _width_height.first / 2;
+        uint8_t *Y = (uint8_t *) cam_buffer.GetMemory();
+        uint8_t *U = (uint8_t *)Y + _width_height.first * _width_height.second;
+        uint8_t *V = (uint8_t *)U + stride2 * (_width_height.second / 2);
+        uint8_t *Y_max = U - _width_height.first;
+        uint8_t *U_max = V - stride2;
+        uint8_t *V_max = U_max + stride2 * (_width_height.second / 2);
+
+        JSAMPROW y_rows[16];
+        JSAMPROW u_rows[8];
+        JSAMPROW v_rows[8];
+
+        uint8_t *Y_row = Y + strip.first_row * _width_height.first;
+        uint8_t *U_row = U + strip.first_row / 2 * stride2;
+        uint8_t *V_row = V + strip.first_row / 2 * stride2;
+        while (cinfo.next_scanline < cinfo.image_height)
+        {
+            for (int i = 0; i < 16; i++, Y_row += _width_height.first)
+                y_rows[i] = std::min(Y_row, Y_max);
+            for (int i = 0; i < 8; i++, U_row += stride2, V_row += stride2)
+                u_rows[i] = std::min(U_row, U_max), v_rows[i] = std::min(V_row, V_max);
+
+            JSAMPARRAY rows[] = { y_rows, u_rows, v_rows };
+            jpeg_write_raw_data(&cinfo, rows, 16);
+        }
+
+        jpeg_finish_compress(&cinfo);
+    }
+
+    bool SwStripEncoder::stitchStrip(
+        EncoderStrip &strip, const std::size_t index, EncoderBuffer &buffer, std::size_t &landed
+    ) {
+        // walk the markers to where the entropy coded data starts, noting where the frame height lives on the way
+        const auto *data = strip.output.data();
+        std::size_t position = 2;
+        std::size_t height_at = 0;
+        std::size_t scan_start = 0;
+        while (scan_start == 0 && position + 4 <= strip.size && data[position] == 0xFF) {
+            const auto marker = data[position + 1];
+            const std::size_t length = (data[position + 2] << 8) | data[position + 3];
+            if (marker == 0xC0) {
+                height_at = position + 5;
+            }
+            position += 2 + length;
+            if (marker == 0xDA) {
+                scan_start = position;
+            }
+        }
+        if (scan_start == 0 || height_at == 0 || scan_start + 2 > strip.size) {
+            return false;
+        }
+
+        const bool is_first = index == 0;
+        const bool is_last = index + 1 == _strips.size();
+        const std::size_t scan_size = strip.size - 2 - scan_start;
+        const std::size_t size = (is_first ? scan_start : 2) + scan_size + (is_last ? 2 : 0);
+        if (landed + size > buffer.GetMaxSize()) {
+            return false;
+        }
+
+        auto *out = (uint8_t *) buffer.GetMemory() + landed;
+        if (is_first) {
+            // the first strip's headers stand in for the whole frame's, once they have its height
+            std::memcpy(out, data, scan_start);
+            out[height_at] = (_width_height.second >> 8) & 0xFF;
+            out[height_at + 1] = _width_height.second & 0xFF;
+            out += scan_start;
+        } else {
+            *out++ = 0xFF;
+            *out++ = JPEG_RST0 + (index - 1) % 8;
+        }
+        std::memcpy(out, data + scan_start, scan_size);
+        out += scan_size;
+        if (is_last) {
+            *out++ = 0xFF;
+            *out++ = JPEG_EOI;
+        }
+        landed += size;
+        return true;
+    }
+
+    void SwStripEncoder::initDestination(j_compress_ptr cinfo) {
+        auto *strip = static_cast<EncoderStrip *>(cinfo->client_data);
+        strip->destination.next_output_byte = strip->output.data();
+        strip->destination.free_in_buffer = strip->output.size();
+    }
+
+    /* jpeg can come out bigger than the raw frame; double the strip's output and carry on where it left off */
+    boolean SwStripEncoder::emptyDestination(j_compress_ptr cinfo) {
+        auto *strip = static_cast<EncoderStrip *>(cinfo->client_data);
+        const auto written = strip->output.size();
+        strip->output.resize(written * 2);
+        strip->destination.next_output_byte = strip->output.data() + written;
+        strip->destination.free_in_buffer = strip->output.size() - written;
+        return TRUE;
+    }
+
+    void SwStripEncoder::termDestination(j_compress_ptr cinfo) {
+        auto *strip = static_cast<EncoderStrip *>(cinfo->client_data);
+        strip->size = strip->output.size() - strip->destination.free_in_buffer;
+    }
+
+    void SwStripEncoder::queueDownstreamBuffer(EncoderBuffer *e) {
+        std::unique_lock<std::mutex> lock(_downstream_buffers_mutex);
+        _downstream_buffers.push(e);
+    }
+
+    void SwStripEncoder::setupDownstreamBuffers(unsigned int request_downstream_buffers) {
+        const auto max_size = _width_height.first * _width_height.second * 3 / 2;
+        for (unsigned int i = 0; i < request_downstream_buffers; i++) {
+            auto downstream_buffer = new EncoderBuffer(max_size);
+            _downstream_buffers.push(downstream_buffer);
+        }
+    }
+
+    SwStripEncoder::~SwStripEncoder() {
+        StopEncoder();
+        for (auto &strip : _strips) {
+            jpeg_destroy_compress(&strip->cinfo);
+        }
+        teardownDownstreamBuffers();
+    }
+
+    void SwStripEncoder::teardownDownstreamBuffers() {
+        while(!_downstream_buffers.empty()) {
+            auto buffer = _downstream_buffers.front();
+            _downstream_buffers.pop();
+            delete buffer;
+        }
+    }
+}
@@ -0,0 +1,81 @@
+//
+// Created by brucegoose on 7/16/23.
+//
+
+#ifndef INFRASTRUCTURE_ENCODER_SW_STRIP_ENCODER_HPP
+#define INFRASTRUCTURE_ENCODER_SW_STRIP_ENCODER_HPP
+
+#include "sw_encoder.hpp"
+
+#include <vector>
+
+namespace infrastructure {
+
+    /*
+     * one horizontal band of the frame, compressed as a jpeg of its own. Bands are a whole number of MCU rows and
+     * exactly one restart interval tall, so each one's entropy data can be dropped into the full frame as is
+     */
+    struct EncoderStrip {
+        struct jpeg_compress_struct cinfo = {};
+        struct jpeg_error_mgr jerr = {};
+        struct jpeg_destination_mgr destination = {};
+        std::vector<uint8_t> output;
+        std::size_t size = 0;
+        int first_row = 0;
+        bool is_done = true;
+        std::unique_ptr<std::thread> thread;
+    };
+
+    /*
+     * splits each frame into strips and compresses them on a thread per strip; the strips are stitched back together
+     * into one baseline jpeg, with a restart marker where each one starts. When streaming, the frame goes downstream
+     * a strip at a time, in order
+     */
+    class SwStripEncoder: public std::enable_shared_from_this<SwStripEncoder>, public Encoder {
+    public:
+        SwStripEncoder(const EncoderConfig &config, SizedBufferCallback output_callback);
+        void PostCameraBuffer(std::shared_ptr<CameraBuffer> &&buffer) override;
+        ~SwStripEncoder();
+    private:
+        void StartEncoder() override;
+        void StopEncoder() override;
+
+        void setupStrips(unsigned int request_strip_count);
+        void setupDownstreamBuffers(unsigned int request_downstream_buffers);
+        void run();
+        void runStrip(std::size_t index, uint64_t generation);
+        void encodeBuffer(std::shared_ptr<CameraBuffer> &&buffer);
+        void encodeStrip(EncoderStrip &strip, CameraBuffer &buffer);
+        void compressStrip(EncoderStrip &strip, CameraBuffer &buffer);
+        [[nodiscard]] bool stitchStrip(EncoderStrip &strip, std::size_t index, EncoderBuffer &buffer, std::size_t &landed);
+        static void initDestination(j_compress_ptr cinfo);
+        static boolean emptyDestination(j_compress_ptr cinfo);
+        static void termDestination(j_compress_ptr cinfo);
+        void queueDownstreamBuffer(EncoderBuffer *e);
+        void teardownDownstreamBuffers();
+
+        const std::pair<int, int> _width_height;
+        const std::size_t _stream_chunk_size;
+        int _strip_mcu_rows = 0;
+        std::vector<std::unique_ptr<EncoderStrip>> _strips;
+
+        std::mutex _work_mutex;
+        std::condition_variable _work_cv;
+        std::queue<std::shared_ptr<CameraBuffer>> _work_queue;
+        std::unique_ptr<std::thread> _work_thread;
+        std::atomic<bool> _work_stop = { true };
+
+        /* the run thread hands every strip but the first to its worker, and waits on them in order */
+        std::mutex _strip_mutex;
+        std::condition_variable _strip_cv;
+        std::condition_variable _strip_done_cv;
+        std::shared_ptr<CameraBuffer> _strip_frame = nullptr;
+        uint64_t _strip_generation = 0;
+
+        std::mutex _downstream_buffers_mutex;
+        std::queue<EncoderBuffer*> _downstream_buffers;
+    };
+
+}
+
+#endif //INFRASTRUCTURE_ENCODER_SW_STRIP_ENCODER_HPP
@@ -4,6 +4,7 @@
 
 #include <iostream>
 #include <chrono>
+#include <cstring>
 using namespace std::literals;
 typedef std::chrono::high_resolution_clock Clock;
 
@@ -69,7 +70,7 @@ static GLint link_program(GLint vs, GLint fs)
     return prog;
 }
 
-static void displaySetup(int width, int height, int window_width, int window_height)
+static GLint displaySetup(int width, int height, int window_width, int window_height)
 {
     float w_factor = width / (float)window_width;
     float h_factor = height / (float)window_height;
@@ -116,6 +117,33 @@ static void displaySetup(int width, int height, int window_width, int window_hei
     GLint prog = link_program(vs_s, fs_s);
 
     glUseProgram(prog);
+    return prog;
+}
+
+static GLint uploadShader() {
+    char vs[512];
+    snprintf(vs, sizeof(vs),
+             "#version 310 es\n"
+             "layout (location = 0) in vec3 v_pos;\n"
+             "layout (location = 1) in vec3 v_color;\n"
+             "layout (location = 2) in vec2 v_tex;\n"
+             "out vec2 texcoord;\n"
+             "out float c_pos;\n"
+             "\n"
+             "void main() {\n"
+             "  gl_Position = vec4(v_pos, 1.0);\n"
+             "  texcoord.x = v_tex.x;\n"
+             "  texcoord.y = 1.0 - v_tex.y;\n"
+             "  c_pos = v_color.x;\n"
+             "}\n"
+    );
+    vs[sizeof(vs) - 1] = 0;
+    GLint vs_s = compile_shader(GL_VERTEX_SHADER, vs);
+    GLint fs_s = compile_shader(GL_FRAGMENT_SHADER, infrastructure::PlaneUploader::UPLOAD_FRAGMENT_SHADER);
+    GLint prog = link_program(vs_s, fs_s);
+    infrastructure::PlaneUploader::SetSamplers(prog);
+
+    return prog;
 }
 
 namespace infrastructure {
@@ -123,7 +151,8 @@ namespace infrastructure {
     DisplayGraphics::DisplayGraphics(const GraphicsConfig &conf):
             Graphics(conf),
             _image_width(conf.get_image_width_height().first),
-            _image_height(conf.get_image_width_height().second)
+            _image_height(conf.get_image_width_height().second),
+            _frame_path(conf.get_graphics_frame_path())
     {}
     DisplayGraphics::~DisplayGraphics() {
         StopGraphics();
@@ -134,6 +163,7 @@ namespace infrastructure {
             return;
         }
         _stop_running = false;
+        _render_scheduler.Start();
         auto self(shared_from_this());
         graphics_thread = std::make_unique<std::thread>([this, self]() {
             run();
@@ -146,6 +176,7 @@ namespace infrastructure {
         }
         _is_ready = false;
         _stop_running = true;
+        _render_scheduler.Stop();
         if (graphics_thread != nullptr) {
             if (graphics_thread->joinable()) {
                 graphics_thread->join();
@@ -161,9 +192,25 @@ namespace infrastructure {
     }
     void DisplayGraphics::PostImage(std::shared_ptr<DecoderBuffer>&& buffer) {
         if (_is_ready) {
-            std::unique_lock<std::mutex> lock(_image_mutex);
-            _image_queue.push(std::move(buffer));
+            {
+                std::unique_lock<std::mutex> lock(_image_mutex);
+                _image_queue.push(std::move(buffer));
+            }
+            _render_scheduler.Notify();
+        }
+    }
+
+    void DisplayGraphics::PostBufferLayouts(std::vector<DecoderBufferLayout> &&layouts) {
+        std::unique_lock<std::mutex> lock(_layouts_mutex);
+        _buffer_layouts = std::move(layouts);
+    }
+
+    std::string DisplayGraphics::GetRenderReport() {
+        auto report = _render_scheduler.Report("display");
+        if (_use_upload) {
+            report += _plane_uploader.Report("display");
         }
+        return report;
     }
 
     void DisplayGraphics::PostGraphicsHeadsetState(const domain::HeadsetStates state) {}
@@ -224,14 +271,29 @@ namespace infrastructure {
             if (!eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context)) {
                 std::cout << "Failed to make egl current" << std::endl;
             }
+            _fenced_buffers.Setup(egl_display);
+            const char *egl_extensions = eglQueryString(egl_display, EGL_EXTENSIONS);
+            const bool can_import = egl_extensions != nullptr &&
+                std::strstr(egl_extensions, "EGL_EXT_image_dma_buf_import") != nullptr;
+            _use_upload = _frame_path == GraphicsFramePath::UPLOAD ||
+                (_frame_path == GraphicsFramePath::AUTO && !can_import);
+            _plane_uploader.Setup();
 
             /* setup window */
 
             glViewport(0, 0, _width, _height);
-            glfwSwapInterval(0);
+            // swaps wait for vblank, and the loop only swaps when something changed, so it never spins
+            glfwSwapInterval(1);
             glfwSwapBuffers(_window);
+            if (mode->refreshRate > 0) {
+                _render_scheduler.SetFramePeriod(1000000 / mode->refreshRate);
+            }
 
-            displaySetup(_image_width, _image_height, _width, _height);
+            const auto upload_shader = uploadShader();
+            const auto image_shader = displaySetup(_image_width, _image_height, _width, _height);
+            if (!_use_upload) {
+                importBuffers();
+            }
             glfwSetKeyCallback(_window,
                 [](GLFWwindow * w, int key, int scancode, int action, int mods) {
                     if(key == GLFW_KEY_ESCAPE) {
@@ -248,12 +310,13 @@ namespace infrastructure {
 
             /* setup output */
 
+            // color.r masks uploaded frames; the whole quad shows
             float vertices[] = {
                     // positions                // colors                 // texture coords
-                    disp_width, disp_height,    0.0f, 0.0f, 0.0f, 0.0f,     1.0f, 1.0f, // top right
-                    disp_width, -disp_height,   0.0f, 0.0f, 0.0f, 0.0f,     1.0f, 0.0f, // bottom right,
-                    -disp_width, -disp_height,  0.0f, 0.0f, 0.0f, 0.0f,     0.0f, 0.0f, // bottom left,
-                    -disp_width, disp_height,   0.0f, 0.0f, 0.0f, 0.0f,     0.0f, 1.0f, // top left,
+                    disp_width, disp_height,    0.0f, 1.0f, 0.0f, 0.0f,     1.0f, 1.0f, // top right
+                    disp_width, -disp_height,   0.0f, 1.0f, 0.0f, 0.0f,     1.0f, 0.0f, // bottom right,
+                    -disp_width, -disp_height,  0.0f, 1.0f, 0.0f, 0.0f,     0.0f, 0.0f, // bottom left,
+                    -disp_width, disp_height,   0.0f, 1.0f, 0.0f, 0.0f,     0.0f, 1.0f, // top left,
             };
 
             unsigned int indices[] = {
@@ -289,9 +352,17 @@ namespace infrastructure {
             std::cout << "At graphics loop" << std::endl;
             _is_ready = true;
 
-            EglBuffer *egl_buffer = nullptr;
+            bool has_drawn = false;
+            bool is_showing_upload = false;
             while (!glfwWindowShouldClose(_window) && !_stop_running) {
+                // asleep until there's a new frame, or until a vblank deadline to poll window events on
+                const bool is_woken = _render_scheduler.Wait();
                 glfwPollEvents();
+                if (!is_woken && has_drawn) {
+                    _fenced_buffers.Release();
+                    _render_scheduler.Skipped();
+                    continue;
+                }
                 std::shared_ptr<DecoderBuffer> data = nullptr;
                 {
                     std::unique_lock<std::mutex> lock(_image_mutex);
@@ -300,24 +371,58 @@ namespace infrastructure {
                         _image_queue.pop();
                     }
                 }
+                if (has_drawn && !data) {
+                    // nothing new, so what's on screen is still right
+                    _fenced_buffers.Release();
+                    _render_scheduler.Skipped();
+                    continue;
+                }
                 glClearColor(0, 0, 0, 1.0);
                 glClear(GL_COLOR_BUFFER_BIT);
+                // a decoder scaling its output says so in the metadata; the planes are laid out for that size
+                const auto *metadata = data ? data->GetMetadata() : nullptr;
+                const int width = metadata && metadata->width != 0 ? metadata->width : _image_width;
+                const int height = metadata && metadata->height != 0 ? metadata->height : _image_height;
+                if (data && (_use_upload || data->GetFd() < 0)) {
+                    // copied, the buffer can go straight back to the decoder
+                    if (_plane_uploader.Upload(*data, width, height)) {
+                        is_showing_upload = true;
+                        _fenced_buffers.Hide();
+                    }
+                    data = nullptr;
+                }
                 if (data) {
                     EglBuffer &tmp_egl_buffer = _buffers[data->GetFd()];
                     if (tmp_egl_buffer.fd == -1) {
-                        makeBuffer(data->GetFd(), data->GetSize(), tmp_egl_buffer);
+                        // only for buffers the decoder didn't announce up front
+                        makeBuffer(data->GetFd(), data->GetSize(), width, height, tmp_egl_buffer);
                     }
-                    egl_buffer = &tmp_egl_buffer;
+                    is_showing_upload = false;
+                    // the one on screen until now goes back to the decoder once the gpu is done with it
+                    _fenced_buffers.Show(std::move(data));
                 }
-                if (egl_buffer) {
-                    glBindTexture(GL_TEXTURE_EXTERNAL_OES, egl_buffer->texture);
+                const auto &displayed = _fenced_buffers.Displayed();
+                if (is_showing_upload && _plane_uploader.HasFrame()) {
+                    glUseProgram(upload_shader);
+                    _plane_uploader.Bind();
                     glBindVertexArray(VAO);
                     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+                } else if (displayed) {
+                    glUseProgram(image_shader);
+                    glBindTexture(GL_TEXTURE_EXTERNAL_OES, _buffers[displayed->GetFd()].texture);
+                    glBindVertexArray(VAO);
+                    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+                    _fenced_buffers.Drawn();
                 }
                 EGLBoolean success [[maybe_unused]] = eglSwapBuffers(egl_display, egl_surface);
+                _render_scheduler.Presented();
+                _fenced_buffers.Presented();
+                has_drawn = true;
             }
 
             _is_ready = false;
+            _fenced_buffers.Clear();
+            _plane_uploader.Teardown();
             glDeleteVertexArrays(1, &VAO);
             glDeleteBuffers(1, &VBO);
             glDeleteBuffers(1, &EBO);
@@ -344,7 +449,21 @@ namespace infrastructure {
         glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
     }
 
-    void DisplayGraphics::makeBuffer(int fd, size_t size, EglBuffer &buffer)
+    void DisplayGraphics::importBuffers() {
+        std::unique_lock<std::mutex> lock(_layouts_mutex);
+        for (const auto &layout : _buffer_layouts) {
+            // heap buffers have nothing to import
+            if (layout.fd < 0) {
+                continue;
+            }
+            EglBuffer &egl_buffer = _buffers[layout.fd];
+            if (egl_buffer.fd == -1) {
+                makeBuffer(layout.fd, layout.size, layout.width, layout.height, egl_buffer);
+            }
+        }
+    }
+
+    void DisplayGraphics::makeBuffer(int fd, size_t size, const int width, const int height, EglBuffer &buffer)
     {
 
         std::cout << "making buffer for: " << fd << std::endl;
@@ -356,18 +475,18 @@ namespace infrastructure {
         GLint range = EGL_YUV_NARROW_RANGE_EXT;
 
         EGLint attribs[] = {
-                EGL_WIDTH, static_cast<EGLint>(_image_width),
-                EGL_HEIGHT, static_cast<EGLint>(_image_height),
+                EGL_WIDTH, static_cast<EGLint>(width),
+                EGL_HEIGHT, static_cast<EGLint>(height),
                 EGL_LINUX_DRM_FOURCC_EXT, DRM_FORMAT_YUV420,
                 EGL_DMA_BUF_PLANE0_FD_EXT, fd,
                 EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
-                EGL_DMA_BUF_PLANE0_PITCH_EXT, static_cast<EGLint>(_image_width),
+                EGL_DMA_BUF_PLANE0_PITCH_EXT, static_cast<EGLint>(width),
                 EGL_DMA_BUF_PLANE1_FD_EXT, fd,
-                EGL_DMA_BUF_PLANE1_OFFSET_EXT, static_cast<EGLint>(_image_width * _image_height),
-                EGL_DMA_BUF_PLANE1_PITCH_EXT, static_cast<EGLint>(_image_width / 2),
+                EGL_DMA_BUF_PLANE1_OFFSET_EXT, static_cast<EGLint>(width * height),
+                EGL_DMA_BUF_PLANE1_PITCH_EXT, static_cast<EGLint>(width / 2),
                 EGL_DMA_BUF_PLANE2_FD_EXT, fd,
-                EGL_DMA_BUF_PLANE2_OFFSET_EXT, static_cast<EGLint>(_image_width * _image_height + (_image_width / 2) * (_image_height / 2)),
-                EGL_DMA_BUF_PLANE2_PITCH_EXT, static_cast<EGLint>(_image_width / 2),
+                EGL_DMA_BUF_PLANE2_OFFSET_EXT, static_cast<EGLint>(width * height + (width / 2) * (height / 2)),
+                EGL_DMA_BUF_PLANE2_PITCH_EXT, static_cast<EGLint>(width / 2),
                 EGL_YUV_COLOR_SPACE_HINT_EXT, encoding,
                 EGL_SAMPLE_RANGE_HINT_EXT, range,
                 EGL_NONE
@@ -11,8 +11,12 @@
 #include <mutex>
 #include <atomic>
 #include <map>
+#include <vector>
 
 #include "graphics.hpp"
+#include "render_scheduler.hpp"
+#include "fenced_buffers.hpp"
+#include "plane_uploader.hpp"
 
 
 namespace infrastructure {
@@ -23,6 +27,8 @@ namespace infrastructure {
         ~DisplayGraphics();
 
         void PostImage(std::shared_ptr<DecoderBuffer>&& buffer) override;
+        void PostBufferLayouts(std::vector<DecoderBufferLayout> &&layouts) override;
+        [[nodiscard]] std::string GetRenderReport() override;
 
         // not used
         void PostGraphicsHeadsetState(const domain::HeadsetStates state) override;
@@ -34,13 +40,22 @@ namespace infrastructure {
         void run();
 
         static void setWindowHints();
-        void makeBuffer(int fd, size_t size, EglBuffer &buffer);
+        void makeBuffer(int fd, size_t size, int width, int height, EglBuffer &buffer);
+        void importBuffers();
 
         std::atomic_bool _stop_running = true;
         std::atomic_bool _is_ready = false;
         std::unique_ptr<std::thread> graphics_thread = nullptr;
         std::mutex _image_mutex;
         std::queue<std::shared_ptr<DecoderBuffer>> _image_queue;
+        RenderScheduler _render_scheduler;
+        std::mutex _layouts_mutex;
+        std::vector<DecoderBufferLayout> _buffer_layouts;
+        FencedBuffers _fenced_buffers;
+        const GraphicsFramePath _frame_path;
+        /* when frames can't be imported, they're copied in */
+        std::atomic_bool _use_upload = false;
+        PlaneUploader _plane_uploader;
 
         const int _image_width;
         const int _image_height;
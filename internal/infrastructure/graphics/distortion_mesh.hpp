@@ -0,0 +1,202 @@
+//
+// Created by brucegoose on 7/26/23.
+//
+
+#ifndef INFRASTRUCTURE_GRAPHICS_DISTORTION_MESH_HPP
+#define INFRASTRUCTURE_GRAPHICS_DISTORTION_MESH_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace infrastructure {
+
+    /* how the headset's lenses bend the screen; with enabled off, the image is drawn as one flat quad */
+    struct LensDistortion {
+        bool enabled = false;
+        /* radial terms, r' = r * (1 + k1 r^2 + k2 r^4), with r in units of half the eye's height */
+        float k1 = 0.22f;
+        float k2 = 0.24f;
+        /* how far each lens center sits toward the nose, as a share of half the eye's width */
+        float lens_center_offset = 0.0f;
+        /* shrinks the warped image so more of it lands on screen */
+        float scale = 1.0f;
+        /* grid cells per eye */
+        int columns = 40;
+        int rows = 40;
+    };
+
+    /*
+     * a side by side stereo mesh, pre-warped so the lenses straighten it back out. Vertices use the same layout as
+     * the flat quad, position (3), color (3) and texture coords (2); color.r is 1 where the warped image exists and 0
+     * where it would sample outside of it, so the shaders can black that out without any per-fragment lens math
+     */
+    struct DistortionMesh {
+        static constexpr int VERTEX_FLOATS = 8;
+        std::vector<float> vertices;
+        std::vector<unsigned int> indices;
+
+        [[nodiscard]] std::size_t VertexCount() const {
+            return vertices.size() / VERTEX_FLOATS;
+        }
+        [[nodiscard]] bool operator==(const DistortionMesh &other) const {
+            return vertices == other.vertices && indices == other.indices;
+        }
+    };
+
+    [[nodiscard]] inline DistortionMesh GenerateDistortionMesh(
+        const LensDistortion &lens, const std::pair<int, int> &screen_width_height,
+        const std::pair<int, int> &image_width_height
+    ) {
+        const int columns = std::max(lens.columns, 1);
+        const int rows = std::max(lens.rows, 1);
+        const float scale = lens.scale > 0 ? lens.scale : 1.0f;
+        // everything in units of half the eye's height, so the lens is round
+        const float eye_aspect = (float) screen_width_height.first / 2.0f / (float) screen_width_height.second;
+        const float image_aspect = (float) image_width_height.first / (float) image_width_height.second;
+        // the undistorted image, letterboxed into the eye
+        const float image_half_width = image_aspect > eye_aspect ? eye_aspect : image_aspect;
+        const float image_half_height = image_aspect > eye_aspect ? eye_aspect / image_aspect : 1.0f;
+
+        DistortionMesh mesh;
+        const int eye_vertices = (columns + 1) * (rows + 1);
+        mesh.vertices.reserve(2 * eye_vertices * DistortionMesh::VERTEX_FLOATS);
+        mesh.indices.reserve(2 * columns * rows * 6);
+
+        for (int eye = 0; eye < 2; eye++) {
+            // left eye covers x in [-1, 0], right eye [0, 1]; both lens centers lean toward the middle
+            const float eye_offset = eye == 0 ? -0.5f : 0.5f;
+            const float lens_center = eye == 0 ? lens.lens_center_offset : -lens.lens_center_offset;
+            const auto base = (unsigned int) (eye * eye_vertices);
+            for (int row = 0; row <= rows; row++) {
+                const float v = -1.0f + 2.0f * (float) row / (float) rows;
+                for (int column = 0; column <= columns; column++) {
+                    const float u = -1.0f + 2.0f * (float) column / (float) columns;
+                    const float x = (u - lens_center) * eye_aspect;
+                    const float y = v;
+                    const float r2 = x * x + y * y;
+                    const float warp = (1.0f + lens.k1 * r2 + lens.k2 * r2 * r2) / scale;
+                    const float s = 0.5f + x * warp / (2.0f * image_half_width);
+                    const float t = 0.5f + y * warp / (2.0f * image_half_height);
+                    const bool is_inside = s >= 0.0f && s <= 1.0f && t >= 0.0f && t <= 1.0f;
+                    const float vertex[DistortionMesh::VERTEX_FLOATS] = {
+                        eye_offset + u * 0.5f, v, 0.0f,
+                        is_inside ? 1.0f : 0.0f, 0.0f, 0.0f,
+                        std::clamp(s, 0.0f, 1.0f), std::clamp(t, 0.0f, 1.0f)
+                    };
+                    mesh.vertices.insert(mesh.vertices.end(), vertex, vertex + DistortionMesh::VERTEX_FLOATS);
+                }
+            }
+            for (int row = 0; row < rows; row++) {
+                for (int column = 0; column < columns; column++) {
+                    const unsigned int bottom_left = base + row * (columns + 1) + column;
+                    const unsigned int top_left = bottom_left + columns + 1;
+                    mesh.indices.insert(mesh.indices.end(), {
+                        bottom_left, bottom_left + 1, top_left,
+                        bottom_left + 1, top_left + 1, top_left
+                    });
+                }
+            }
+        }
+        return mesh;
+    }
+
+    /* everything the mesh depends on; the cache file is named after its hash, and keeps it to rule out collisions */
+    [[nodiscard]] inline std::string distortionMeshKey(
+        const LensDistortion &lens, const std::pair<int, int> &screen_width_height,
+        const std::pair<int, int> &image_width_height
+    ) {
+        std::stringstream key;
+        key.precision(9);
+        key << "v1 k1=" << lens.k1 << " k2=" << lens.k2 << " center=" << lens.lens_center_offset
+            << " scale=" << lens.scale << " grid=" << lens.columns << "x" << lens.rows
+            << " screen=" << screen_width_height.first << "x" << screen_width_height.second
+            << " image=" << image_width_height.first << "x" << image_width_height.second;
+        return key.str();
+    }
+
+    /*
+     * the mesh for this lens and screen from cache_dir, generating and storing it on a miss. A cache that can't be
+     * read or written only costs the generation time; is_cached says which way it went
+     */
+    [[nodiscard]] inline DistortionMesh LoadDistortionMesh(
+        const LensDistortion &lens, const std::pair<int, int> &screen_width_height,
+        const std::pair<int, int> &image_width_height, const std::filesystem::path &cache_dir,
+        bool *is_cached = nullptr
+    ) {
+        const auto key = distortionMeshKey(lens, screen_width_height, image_width_height);
+        const auto key_hash = std::to_string(std::hash<std::string>{}(key));
+        const auto cache_file = cache_dir / ("distortion_mesh_" + key_hash + ".bin");
+        if (is_cached != nullptr) {
+            *is_cached = false;
+        }
+
+        std::ifstream in(cache_file, std::ios::in | std::ios::binary);
+        if (in) {
+            uint64_t key_size = 0, vertex_count = 0, index_count = 0;
+            in.read((char *) &key_size, sizeof(key_size));
+            // anything but this key's length means some other mesh, or garbage
+            std::string stored_key(in && key_size == key.size() ? key_size : 0, '\0');
+            in.read(stored_key.data(), (std::streamsize) stored_key.size());
+            in.read((char *) &vertex_count, sizeof(vertex_count));
+            in.read((char *) &index_count, sizeof(index_count));
+            const uint64_t columns = std::max(lens.columns, 1);
+            const uint64_t rows = std::max(lens.rows, 1);
+            const bool is_sized = vertex_count == 2 * (columns + 1) * (rows + 1) * DistortionMesh::VERTEX_FLOATS &&
+                index_count == 2 * columns * rows * 6;
+            if (in && stored_key == key && is_sized) {
+                DistortionMesh mesh;
+                mesh.vertices.resize(vertex_count);
+                mesh.indices.resize(index_count);
+                in.read((char *) mesh.vertices.data(), (std::streamsize) (vertex_count * sizeof(float)));
+                in.read((char *) mesh.indices.data(), (std::streamsize) (index_count * sizeof(unsigned int)));
+                if (in) {
+                    if (is_cached != nullptr) {
+                        *is_cached = true;
+                    }
+                    return mesh;
+                }
+            }
+            std::cout << "LoadDistortionMesh: ignoring stale or broken cache at " << cache_file << std::endl;
+        }
+
+        auto mesh = GenerateDistortionMesh(lens, screen_width_height, image_width_height);
+
+        // written aside and renamed into place, so a crash never leaves half a mesh behind
+        std::error_code ec;
+        std::filesystem::create_directories(cache_dir, ec);
+        const auto tmp_file = cache_file.string() + ".tmp";
+        {
+            std::ofstream out(tmp_file, std::ios::out | std::ios::binary | std::ios::trunc);
+            const uint64_t key_size = key.size();
+            const uint64_t vertex_count = mesh.vertices.size();
+            const uint64_t index_count = mesh.indices.size();
+            out.write((const char *) &key_size, sizeof(key_size));
+            out.write(key.data(), (std::streamsize) key.size());
+            out.write((const char *) &vertex_count, sizeof(vertex_count));
+            out.write((const char *) &index_count, sizeof(index_count));
+            out.write((const char *) mesh.vertices.data(), (std::streamsize) (vertex_count * sizeof(float)));
+            out.write((const char *) mesh.indices.data(), (std::streamsize) (index_count * sizeof(unsigned int)));
+            if (!out) {
+                std::cout << "LoadDistortionMesh: couldn't write cache at " << cache_file << std::endl;
+                std::filesystem::remove(tmp_file, ec);
+                return mesh;
+            }
+        }
+        std::filesystem::rename(tmp_file, cache_file, ec);
+        if (ec) {
+            std::filesystem::remove(tmp_file, ec);
+        }
+        return mesh;
+    }
+
+}
+
+#endif //INFRASTRUCTURE_GRAPHICS_DISTORTION_MESH_HPP
@@ -0,0 +1,150 @@
+//
+// Created by brucegoose on 7/25/23.
+//
+
+#ifndef INFRASTRUCTURE_GRAPHICS_FENCED_BUFFERS_HPP
+#define INFRASTRUCTURE_GRAPHICS_FENCED_BUFFERS_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+
+#include "graphics.hpp"
+
+// glad's egl is generated without EGL_KHR_fence_sync, so its bits come from eglGetProcAddress
+#ifndef EGL_SYNC_FENCE_KHR
+#define EGL_SYNC_FENCE_KHR 0x30F9
+#endif
+#ifndef EGL_SYNC_FLUSH_COMMANDS_BIT_KHR
+#define EGL_SYNC_FLUSH_COMMANDS_BIT_KHR 0x0001
+#endif
+#ifndef EGL_CONDITION_SATISFIED_KHR
+#define EGL_CONDITION_SATISFIED_KHR 0x30F6
+#endif
+#ifndef EGL_NO_SYNC_KHR
+#define EGL_NO_SYNC_KHR ((EGLSyncKHR) 0)
+#endif
+
+namespace infrastructure {
+
+    /*
+     * holds on to decoder buffers until the gpu is done sampling them. The buffer on screen gets a fresh fence after
+     * every draw; once a newer one replaces it, it waits in line until that fence signals, and only then goes back to
+     * the decoder. Without EGL_KHR_fence_sync, a retired buffer is held for two more swaps instead. Render thread only
+     */
+    class FencedBuffers {
+    public:
+        /* with the egl context current */
+        void Setup(EGLDisplay display) {
+            _display = display;
+            _presents = 0;
+            const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+            _has_fence_sync = extensions != nullptr && std::strstr(extensions, "EGL_KHR_fence_sync") != nullptr;
+            if (_has_fence_sync) {
+                _create_sync = (CreateSync) eglGetProcAddress("eglCreateSyncKHR");
+                _client_wait_sync = (ClientWaitSync) eglGetProcAddress("eglClientWaitSyncKHR");
+                _destroy_sync = (DestroySync) eglGetProcAddress("eglDestroySyncKHR");
+                _has_fence_sync = _create_sync != nullptr && _client_wait_sync != nullptr && _destroy_sync != nullptr;
+            }
+            if (!_has_fence_sync) {
+                std::cout << "FencedBuffers: no EGL_KHR_fence_sync; holding decoder buffers for two swaps" << std::endl;
+            }
+        }
+        /* the buffer about to be drawn; whatever was on screen before waits for the gpu to finish with it */
+        void Show(std::shared_ptr<DecoderBuffer> &&buffer) {
+            retire();
+            _displayed.buffer = std::move(buffer);
+        }
+        /* nothing drawn from here on samples a decoder buffer */
+        void Hide() {
+            retire();
+        }
+        [[nodiscard]] const std::shared_ptr<DecoderBuffer> &Displayed() const {
+            return _displayed.buffer;
+        }
+        /* right after a draw that sampled the displayed buffer */
+        void Drawn() {
+            if (!_displayed.buffer || !_has_fence_sync) {
+                return;
+            }
+            destroyFence(_displayed);
+            _displayed.fence = _create_sync(_display, EGL_SYNC_FENCE_KHR, nullptr);
+        }
+        /* right after a swap */
+        void Presented() {
+            _presents += 1;
+            Release();
+        }
+        /* hands back what the gpu is done with, without blocking; also worth calling on idle wakes */
+        void Release() {
+            // fences on one context signal in order, so the first one still pending holds up the rest
+            while (!_retiring.empty() && isDone(_retiring.front(), 0)) {
+                destroyFence(_retiring.front());
+                _retiring.pop_front();
+            }
+        }
+        /* before the context goes away; waits a bounded time on each fence, then lets everything go regardless */
+        void Clear() {
+            retire();
+            for (auto &entry : _retiring) {
+                if (_has_fence_sync && entry.fence != EGL_NO_SYNC_KHR) {
+                    _client_wait_sync(_display, entry.fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, CLEAR_TIMEOUT_NS);
+                }
+                destroyFence(entry);
+            }
+            _retiring.clear();
+        }
+    private:
+        typedef EGLSyncKHR (*CreateSync)(EGLDisplay dpy, EGLenum type, const EGLint *attrib_list);
+        typedef EGLint (*ClientWaitSync)(EGLDisplay dpy, EGLSyncKHR sync, EGLint flags, EGLTimeKHR timeout);
+        typedef EGLBoolean (*DestroySync)(EGLDisplay dpy, EGLSyncKHR sync);
+
+        struct Entry {
+            std::shared_ptr<DecoderBuffer> buffer = nullptr;
+            EGLSyncKHR fence = EGL_NO_SYNC_KHR;
+            uint64_t retired_at = 0;
+        };
+
+        static constexpr EGLTimeKHR CLEAR_TIMEOUT_NS = 100000000;
+
+        void retire() {
+            if (!_displayed.buffer) {
+                return;
+            }
+            _displayed.retired_at = _presents;
+            _retiring.push_back(std::move(_displayed));
+            _displayed = Entry();
+        }
+        [[nodiscard]] bool isDone(const Entry &entry, const EGLTimeKHR timeout_ns) const {
+            if (!_has_fence_sync) {
+                return _presents >= entry.retired_at + 2;
+            }
+            // never drawn, so never sampled
+            if (entry.fence == EGL_NO_SYNC_KHR) {
+                return true;
+            }
+            const auto result = _client_wait_sync(_display, entry.fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, timeout_ns);
+            return result == EGL_CONDITION_SATISFIED_KHR;
+        }
+        void destroyFence(Entry &entry) {
+            if (entry.fence != EGL_NO_SYNC_KHR) {
+                _destroy_sync(_display, entry.fence);
+                entry.fence = EGL_NO_SYNC_KHR;
+            }
+        }
+
+        EGLDisplay _display = nullptr;
+        bool _has_fence_sync = false;
+        CreateSync _create_sync = nullptr;
+        ClientWaitSync _client_wait_sync = nullptr;
+        DestroySync _destroy_sync = nullptr;
+        uint64_t _presents = 0;
+        Entry _displayed;
+        std::deque<Entry> _retiring;
+    };
+
+}
+
+#endif //INFRASTRUCTURE_GRAPHICS_FENCED_BUFFERS_HPP
@@ -5,10 +5,15 @@
 #ifndef INFRASTRUCTURE_GRAPHICS_HPP
 #define INFRASTRUCTURE_GRAPHICS_HPP
 
+#include <vector>
+
 #include "utils/buffers.hpp"
+#include "utils/latency.hpp"
 
 #include "domain/headset_domain.hpp"
 
+#include "distortion_mesh.hpp"
+
 #if _HEADSET_GRAPHICS_ || _DISPLAY_GRAPHICS_
 
 #define GLAD_GL_IMPLEMENTATION
@@ -40,18 +45,36 @@ namespace infrastructure {
         NONE,
     };
 
+    enum class GraphicsFramePath {
+        /* dmabuf import where the egl has it and the buffer has an fd, uploads otherwise */
+        AUTO,
+        DMABUF,
+        /* always copy through pbos, say to compare against import */
+        UPLOAD,
+    };
+
     struct GraphicsConfig {
         [[nodiscard]] virtual GraphicsType get_graphics_type() const = 0;
         [[nodiscard]] virtual std::pair<int, int> get_image_width_height() const = 0;
+        [[nodiscard]] virtual GraphicsFramePath get_graphics_frame_path() const = 0;
+        [[nodiscard]] virtual LensDistortion get_lens_distortion() const = 0;
+        /* where generated meshes are kept between runs */
+        [[nodiscard]] virtual std::string get_graphics_cache_dir() const = 0;
     };
 
-    class Graphics {
+    class Graphics: public LatencyStatsSink {
     public:
         [[nodiscard]] static std::shared_ptr<Graphics> Create(const GraphicsConfig &config);
         Graphics(const GraphicsConfig &config);
         virtual void PostImage(std::shared_ptr<DecoderBuffer>&& buffer) = 0;
+        /* the decoder's buffers, before start, so graphics that import them can do it before the first frame */
+        virtual void PostBufferLayouts(std::vector<DecoderBufferLayout> &&layouts) {}
 
         virtual void PostGraphicsHeadsetState(const domain::HeadsetStates state) = 0;
+        /* render fps, idle time and present jitter since the last call, for graphics that draw at all */
+        [[nodiscard]] virtual std::string GetRenderReport() {
+            return "";
+        }
         void Start() {
             StartGraphics();
         void PostGraphicsState(const domain::HeadsetStates state);
@@ -4,6 +4,7 @@
 
 #include <iostream>
 #include <chrono>
+#include <cstring>
 using namespace std::literals;
 typedef std::chrono::high_resolution_clock Clock;
 
@@ -108,7 +109,7 @@ static GLint displaySetup(int width, int height, int window_width, int window_he
             "	return c.z * mix( vec3(1.0), rgb, c.y);\n"
             "}\n"
             "void main() {\n"
-            "  fragColor = texture2D(s, texcoord);\n"
+            "  fragColor = vec4(texture2D(s, texcoord).rgb * c_pos, 1.0);\n"
             "}\n";
     GLint fs_s = compile_shader(GL_FRAGMENT_SHADER, fs);
     GLint prog = link_program(vs_s, fs_s);
@@ -116,6 +117,32 @@ static GLint displaySetup(int width, int height, int window_width, int window_he
     return prog;
 }
 
+static GLint uploadShader() {
+    char vs[512];
+    snprintf(vs, sizeof(vs),
+             "#version 310 es\n"
+             "layout (location = 0) in vec3 v_pos;\n"
+             "layout (location = 1) in vec3 v_color;\n"
+             "layout (location = 2) in vec2 v_tex;\n"
+             "out vec2 texcoord;\n"
+             "out float c_pos;\n"
+             "\n"
+             "void main() {\n"
+             "  gl_Position = vec4(v_pos, 1.0);\n"
+             "  texcoord.x = v_tex.x;\n"
+             "  texcoord.y = 1.0 - v_tex.y;\n"
+             "  c_pos = v_color.x;\n"
+             "}\n"
+    );
+    vs[sizeof(vs) - 1] = 0;
+    GLint vs_s = compile_shader(GL_VERTEX_SHADER, vs);
+    GLint fs_s = compile_shader(GL_FRAGMENT_SHADER, infrastructure::PlaneUploader::UPLOAD_FRAGMENT_SHADER);
+    GLint prog = link_program(vs_s, fs_s);
+    infrastructure::PlaneUploader::SetSamplers(prog);
+
+    return prog;
+}
+
 static GLint simpleShader() {
     char vs[512];
     snprintf(vs, sizeof(vs),
@@ -144,7 +171,7 @@ static GLint simpleShader() {
             "uniform sampler2D our_texture;\n"
             "out vec4 frag_color;\n"
             "void main() {\n"
-            "  frag_color = texture(our_texture, tex_coord);\n"
+            "  frag_color = vec4(texture(our_texture, tex_coord).rgb * our_color.r, 1.0);\n"
             "}\n";
     GLint fs_s = compile_shader(GL_FRAGMENT_SHADER, fs);
     GLint prog = link_program(vs_s, fs_s);
@@ -157,7 +184,10 @@ namespace infrastructure {
     HeadsetGraphics::HeadsetGraphics(const GraphicsConfig &conf):
             Graphics(conf),
             _image_width(conf.get_image_width_height().first),
-            _image_height(conf.get_image_width_height().second)
+            _image_height(conf.get_image_width_height().second),
+            _lens_distortion(conf.get_lens_distortion()),
+            _graphics_cache_dir(conf.get_graphics_cache_dir()),
+            _frame_path(conf.get_graphics_frame_path())
     {}
     HeadsetGraphics::~HeadsetGraphics() {
         StopGraphics();
@@ -168,6 +198,7 @@ namespace infrastructure {
             return;
         }
         _stop_running = false;
+        _render_scheduler.Start();
         auto self(shared_from_this());
         graphics_thread = std::make_unique<std::thread>([this, self]() {
             run();
@@ -180,6 +211,7 @@ namespace infrastructure {
         }
         _is_ready = false;
         _stop_running = true;
+        _render_scheduler.Stop();
         if (graphics_thread != nullptr) {
             if (graphics_thread->joinable()) {
                 graphics_thread->join();
@@ -195,14 +227,33 @@ namespace infrastructure {
     }
     void HeadsetGraphics::PostImage(std::shared_ptr<DecoderBuffer>&& buffer) {
         if (_is_ready && _is_display) {
-            std::unique_lock<std::mutex> lock(_image_mutex);
-            _image_queue.push(std::move(buffer));
+            {
+                std::unique_lock<std::mutex> lock(_image_mutex);
+                _image_queue.push(std::move(buffer));
+            }
+            _render_scheduler.Notify();
         }
     }
 
+    void HeadsetGraphics::PostBufferLayouts(std::vector<DecoderBufferLayout> &&layouts) {
+        std::unique_lock<std::mutex> lock(_layouts_mutex);
+        _buffer_layouts = std::move(layouts);
+    }
+
     void HeadsetGraphics::PostGraphicsHeadsetState(const domain::HeadsetStates state) {
-        std::unique_lock lk(_state_mutex);
-        _state = state;
+        {
+            std::unique_lock lk(_state_mutex);
+            _state = state;
+        }
+        _render_scheduler.Notify();
+    }
+
+    std::string HeadsetGraphics::GetRenderReport() {
+        auto report = _render_scheduler.Report("headset");
+        if (_use_upload) {
+            report += _plane_uploader.Report("headset");
+        }
+        return report;
     }
 
     void HeadsetGraphics::run() {
@@ -261,15 +312,31 @@ namespace infrastructure {
             if (!eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context)) {
                 std::cout << "Failed to make egl current" << std::endl;
             }
+            _fenced_buffers.Setup(egl_display);
+            const char *egl_extensions = eglQueryString(egl_display, EGL_EXTENSIONS);
+            const bool can_import = egl_extensions != nullptr &&
+                std::strstr(egl_extensions, "EGL_EXT_image_dma_buf_import") != nullptr;
+            _use_upload = _frame_path == GraphicsFramePath::UPLOAD ||
+                (_frame_path == GraphicsFramePath::AUTO && !can_import);
+            _is_showing_upload = false;
+            _plane_uploader.Setup();
 
             /* setup window */
 
             glViewport(0, 0, _width, _height);
-            glfwSwapInterval(0);
+            // swaps wait for vblank, and the loop only swaps when something changed, so it never spins
+            glfwSwapInterval(1);
             glfwSwapBuffers(_window);
+            if (mode->refreshRate > 0) {
+                _render_scheduler.SetFramePeriod(1000000 / mode->refreshRate);
+            }
 
             _image_shader = displaySetup(_image_width, _image_height, _width, _height);
             _screen_shader = simpleShader();
+            _upload_shader = uploadShader();
+            if (!_use_upload) {
+                importBuffers();
+            }
             glfwSetKeyCallback(_window,
                 [](GLFWwindow * w, int key, int scancode, int action, int mods) {
                     if(key == GLFW_KEY_ESCAPE) {
@@ -286,12 +353,13 @@ namespace infrastructure {
 
             /* setup output */
 
+            // color.r masks the image; the flat quad shows all of it
             float vertices[] = {
                     // positions                // colors                 // texture coords
-                    disp_width, disp_height,    0.0f, 0.0f, 0.0f, 0.0f,     1.0f, 1.0f, // top right
-                    disp_width, -disp_height,   0.0f, 0.0f, 0.0f, 0.0f,     1.0f, 0.0f, // bottom right,
-                    -disp_width, -disp_height,  0.0f, 0.0f, 0.0f, 0.0f,     0.0f, 0.0f, // bottom left,
-                    -disp_width, disp_height,   0.0f, 0.0f, 0.0f, 0.0f,     0.0f, 1.0f, // top left,
+                    disp_width, disp_height,    0.0f, 1.0f, 0.0f, 0.0f,     1.0f, 1.0f, // top right
+                    disp_width, -disp_height,   0.0f, 1.0f, 0.0f, 0.0f,     1.0f, 0.0f, // bottom right,
+                    -disp_width, -disp_height,  0.0f, 1.0f, 0.0f, 0.0f,     0.0f, 0.0f, // bottom left,
+                    -disp_width, disp_height,   0.0f, 1.0f, 0.0f, 0.0f,     0.0f, 1.0f, // top left,
             };
 
             unsigned int indices[] = {
@@ -324,6 +392,10 @@ namespace infrastructure {
             glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
             glEnableVertexAttribArray(2);
 
+            _draw_vao = IMAGE_VAO;
+            _draw_index_count = 6;
+            setupDistortionMesh();
+
             // load textures
             std::filesystem::path assets_dir = ASSETS_DIR;
             _connecting_screen.LoadTexture(assets_dir / "connecting_screen.jpg");
@@ -334,11 +406,17 @@ namespace infrastructure {
             std::cout << "At graphics loop" << std::endl;
             _is_ready = true;
             auto last_state = domain::HeadsetStates::CONNECTING;
+            bool has_drawn = false;
 
             while (!glfwWindowShouldClose(_window) && !_stop_running) {
+                // asleep until there's a new frame or state, or until a vblank deadline to poll window events on
+                const bool is_woken = _render_scheduler.Wait();
                 glfwPollEvents();
-                glClearColor(0, 0, 0, 1.0);
-                glClear(GL_COLOR_BUFFER_BIT);
+                if (!is_woken && has_drawn) {
+                    _fenced_buffers.Release();
+                    _render_scheduler.Skipped();
+                    continue;
+                }
 
                 // get the state
                 auto state = domain::HeadsetStates::CONNECTING;
@@ -353,12 +431,29 @@ namespace infrastructure {
                     _is_display = true;
                 } else if (last_state == domain::HeadsetStates::RUNNING){
                     _is_display = false;
+                    _fenced_buffers.Hide();
+                    _is_showing_upload = false;
                     std::unique_lock<std::mutex> lock(_image_mutex);
                     while (!_image_queue.empty()) {
                         _image_queue.pop();
                     }
                 }
 
+                bool has_image;
+                {
+                    std::unique_lock<std::mutex> lock(_image_mutex);
+                    has_image = !_image_queue.empty();
+                }
+                if (has_drawn && !is_transition && !has_image) {
+                    // nothing new, so what's on screen is still right
+                    _fenced_buffers.Release();
+                    _render_scheduler.Skipped();
+                    last_state = state;
+                    continue;
+                }
+
+                glClearColor(0, 0, 0, 1.0);
+                glClear(GL_COLOR_BUFFER_BIT);
                 switch (state) {
                     case domain::HeadsetStates::CONNECTING:
                         handleConnectingState(is_transition);
@@ -374,13 +469,33 @@ namespace infrastructure {
                         break;
                 }
                 EGLBoolean success [[maybe_unused]] = eglSwapBuffers(egl_display, egl_surface);
+                _render_scheduler.Presented();
+                _fenced_buffers.Presented();
+                has_drawn = true;
+                if (_swap_metadata) {
+                    recordLatencySince(LatencyStage::SWAP, _swap_metadata->stage_timestamp_us);
+                    recordLatency(LatencyStage::END_TO_END, wallClockMicros() - _swap_metadata->encode_timestamp_us);
+                    _swap_metadata.reset();
+                }
+                if (is_transition) {
+                    // images are only let in once a transition has been drawn, so come straight back to let them
+                    _render_scheduler.Notify();
+                }
                 last_state = state;
             }
 
             _is_ready = false;
+            _fenced_buffers.Clear();
+            _plane_uploader.Teardown();
             glDeleteVertexArrays(1, &IMAGE_VAO);
             glDeleteBuffers(1, &IMAGE_VBO);
             glDeleteBuffers(1, &IMAGE_EBO);
+            if (MESH_VAO != 0) {
+                glDeleteVertexArrays(1, &MESH_VAO);
+                glDeleteBuffers(1, &MESH_VBO);
+                glDeleteBuffers(1, &MESH_EBO);
+                MESH_VAO = 0;
+            }
 
             // unload
             _connecting_screen.UnloadTexture();
@@ -393,19 +508,16 @@ namespace infrastructure {
     void HeadsetGraphics::handleConnectingState(const bool is_transition) {
         glUseProgram(_screen_shader);
         glBindTexture(GL_TEXTURE_2D, _connecting_screen.texture);
-        glBindVertexArray(IMAGE_VAO);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        drawImage();
     }
 
     void HeadsetGraphics::handleReadyState(const bool is_transition) {
         glUseProgram(_screen_shader);
         glBindTexture(GL_TEXTURE_2D, _ready_screen.texture);
-        glBindVertexArray(IMAGE_VAO);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        drawImage();
     }
 
     void HeadsetGraphics::handleRunningState(const bool is_transition) {
-        static EglBuffer *egl_buffer = nullptr;
         std::shared_ptr<DecoderBuffer> data = nullptr;
         {
             std::unique_lock<std::mutex> lock(_image_mutex);
@@ -415,34 +527,101 @@ namespace infrastructure {
             }
         }
 
+        // a decoder scaling its output says so in the metadata; the planes are laid out for that size
+        const auto *metadata = data ? data->GetMetadata() : nullptr;
+        const int width = metadata && metadata->width != 0 ? metadata->width : _image_width;
+        const int height = metadata && metadata->height != 0 ? metadata->height : _image_height;
+
+        if (data && (_use_upload || data->GetFd() < 0)) {
+            // heap buffers have no dmabuf to import; copied, the buffer can go straight back to the decoder
+            if (_plane_uploader.Upload(*data, width, height)) {
+                _swap_metadata = *metadata;
+                _is_showing_upload = true;
+                _fenced_buffers.Hide();
+            }
+            data = nullptr;
+        }
+
         if (data) {
             EglBuffer &tmp_egl_buffer = _buffers[data->GetFd()];
             if (tmp_egl_buffer.fd == -1) {
-                makeBuffer(data->GetFd(), data->GetSize(), tmp_egl_buffer);
+                // only for buffers the decoder didn't announce up front
+                makeBuffer(data->GetFd(), data->GetSize(), width, height, tmp_egl_buffer);
             }
-            egl_buffer = &tmp_egl_buffer;
+            _swap_metadata = *metadata;
+            _is_showing_upload = false;
+            // the one on screen until now goes back to the decoder once the gpu is done with it
+            _fenced_buffers.Show(std::move(data));
         }
 
-        if (egl_buffer) {
+        const auto &displayed = _fenced_buffers.Displayed();
+        if (_is_showing_upload && _plane_uploader.HasFrame()) {
+            glUseProgram(_upload_shader);
+            _plane_uploader.Bind();
+            drawImage();
+        } else if (displayed) {
             glUseProgram(_image_shader);
-            glBindTexture(GL_TEXTURE_EXTERNAL_OES, egl_buffer->texture);
-            glBindVertexArray(IMAGE_VAO);
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            glBindTexture(GL_TEXTURE_EXTERNAL_OES, _buffers[displayed->GetFd()].texture);
+            drawImage();
+            _fenced_buffers.Drawn();
         }
     }
 
     void HeadsetGraphics::handlePluggedInState(const bool is_transition) {
         glUseProgram(_screen_shader);
         glBindTexture(GL_TEXTURE_2D, _plugged_in_screen.texture);
-        glBindVertexArray(IMAGE_VAO);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        drawImage();
     }
 
     void HeadsetGraphics::handleDyingState(const bool is_transition) {
         glUseProgram(_screen_shader);
         glBindTexture(GL_TEXTURE_2D, _dying_screen.texture);
-        glBindVertexArray(IMAGE_VAO);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        drawImage();
+    }
+
+    void HeadsetGraphics::drawImage() {
+        glBindVertexArray(_draw_vao);
+        glDrawElements(GL_TRIANGLES, _draw_index_count, GL_UNSIGNED_INT, 0);
+    }
+
+    void HeadsetGraphics::setupDistortionMesh() {
+        if (!_lens_distortion.enabled) {
+            return;
+        }
+        // generated once per lens and screen, then read straight off disk
+        bool is_cached = false;
+        const auto t1 = Clock::now();
+        const auto mesh = LoadDistortionMesh(
+            _lens_distortion, { _width, _height }, { _image_width, _image_height }, _graphics_cache_dir, &is_cached
+        );
+        const auto t2 = Clock::now();
+        std::cout << "HeadsetGraphics: distortion mesh with " << mesh.VertexCount() << " vertices " <<
+            (is_cached ? "loaded" : "generated") << " in " <<
+            std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() << "us" << std::endl;
+
+        glGenVertexArrays(1, &MESH_VAO);
+        glGenBuffers(1, &MESH_VBO);
+        glGenBuffers(1, &MESH_EBO);
+        glBindVertexArray(MESH_VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, MESH_VBO);
+        glBufferData(
+            GL_ARRAY_BUFFER, (GLsizeiptr) (mesh.vertices.size() * sizeof(float)), mesh.vertices.data(), GL_STATIC_DRAW
+        );
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, MESH_EBO);
+        glBufferData(
+            GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr) (mesh.indices.size() * sizeof(unsigned int)), mesh.indices.data(),
+            GL_STATIC_DRAW
+        );
+        const auto stride = DistortionMesh::VERTEX_FLOATS * sizeof(float);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
+        glEnableVertexAttribArray(2);
+
+        _draw_vao = MESH_VAO;
+        _draw_index_count = (GLsizei) mesh.indices.size();
     }
 
     void HeadsetGraphics::setWindowHints() {
@@ -465,7 +644,7 @@ namespace infrastructure {
         glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
     }
 
-    void HeadsetGraphics::makeBuffer(int fd, size_t size, EglBuffer &buffer)
+    void HeadsetGraphics::makeBuffer(int fd, size_t size, const int width, const int height, EglBuffer &buffer)
     {
 
         std::cout << "making buffer for: " << fd << std::endl;
@@ -477,18 +656,18 @@ namespace infrastructure {
         GLint range = EGL_YUV_NARROW_RANGE_EXT;
 
         EGLint attribs[] = {
-                EGL_WIDTH, static_cast<EGLint>(_image_width),
-                EGL_HEIGHT, static_cast<EGLint>(_image_height),
+                EGL_WIDTH, static_cast<EGLint>(width),
+                EGL_HEIGHT, static_cast<EGLint>(height),
                 EGL_LINUX_DRM_FOURCC_EXT, DRM_FORMAT_YUV420,
                 EGL_DMA_BUF_PLANE0_FD_EXT, fd,
                 EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
-                EGL_DMA_BUF_PLANE0_PITCH_EXT, static_cast<EGLint>(_image_width),
+                EGL_DMA_BUF_PLANE0_PITCH_EXT, static_cast<EGLint>(width),
                 EGL_DMA_BUF_PLANE1_FD_EXT, fd,
-                EGL_DMA_BUF_PLANE1_OFFSET_EXT, static_cast<EGLint>(_image_width * _image_height),
-                EGL_DMA_BUF_PLANE1_PITCH_EXT, static_cast<EGLint>(_image_width / 2),
+                EGL_DMA_BUF_PLANE1_OFFSET_EXT, static_cast<EGLint>(width * height),
+                EGL_DMA_BUF_PLANE1_PITCH_EXT, static_cast<EGLint>(width / 2),
                 EGL_DMA_BUF_PLANE2_FD_EXT, fd,
-                EGL_DMA_BUF_PLANE2_OFFSET_EXT, static_cast<EGLint>(_image_width * _image_height + (_image_width / 2) * (_image_height / 2)),
-                EGL_DMA_BUF_PLANE2_PITCH_EXT, static_cast<EGLint>(_image_width / 2),
+                EGL_DMA_BUF_PLANE2_OFFSET_EXT, static_cast<EGLint>(width * height + (width / 2) * (height / 2)),
+                EGL_DMA_BUF_PLANE2_PITCH_EXT, static_cast<EGLint>(width / 2),
                 EGL_YUV_COLOR_SPACE_HINT_EXT, encoding,
                 EGL_SAMPLE_RANGE_HINT_EXT, range,
                 EGL_NONE
@@ -513,6 +692,20 @@ namespace infrastructure {
         eglDestroyImageKHR(display, image);
     }
 
+    void HeadsetGraphics::importBuffers() {
+        std::unique_lock<std::mutex> lock(_layouts_mutex);
+        for (const auto &layout : _buffer_layouts) {
+            // heap buffers have nothing to import
+            if (layout.fd < 0) {
+                continue;
+            }
+            EglBuffer &egl_buffer = _buffers[layout.fd];
+            if (egl_buffer.fd == -1) {
+                makeBuffer(layout.fd, layout.size, layout.width, layout.height, egl_buffer);
+            }
+        }
+    }
+
     void HeadsetGraphics::Screen::LoadTexture(const std::string &image_path) {
         if (has_loaded) return;
         data = stbi_load(image_path.c_str(), &width, &height, &nrChannels, 0);
@@ -11,11 +11,16 @@
 #include <mutex>
 #include <atomic>
 #include <map>
+#include <optional>
+#include <vector>
 
 
 #include "domain/headset_domain.hpp"
 
 #include "graphics.hpp"
+#include "render_scheduler.hpp"
+#include "fenced_buffers.hpp"
+#include "plane_uploader.hpp"
 
 
 namespace infrastructure {
@@ -41,6 +46,8 @@ namespace infrastructure {
         ~HeadsetGraphics();
 
         void PostImage(std::shared_ptr<DecoderBuffer>&& buffer) override;
+        void PostBufferLayouts(std::vector<DecoderBufferLayout> &&layouts) override;
+        [[nodiscard]] std::string GetRenderReport() override;
 
         void PostGraphicsHeadsetState(const domain::HeadsetStates state) override;
     private:
@@ -51,7 +58,10 @@ namespace infrastructure {
         void run();
 
         static void setWindowHints();
-        void makeBuffer(int fd, size_t size, EglBuffer &buffer);
+        void makeBuffer(int fd, size_t size, int width, int height, EglBuffer &buffer);
+        void importBuffers();
+        void setupDistortionMesh();
+        void drawImage();
 
         void handleConnectingState(const bool is_transition);
         void handleReadyState(const bool is_transition);
@@ -67,6 +77,18 @@ namespace infrastructure {
         domain::HeadsetStates _state = domain::HeadsetStates::CONNECTING;
         std::mutex _image_mutex;
         std::queue<std::shared_ptr<DecoderBuffer>> _image_queue;
+        RenderScheduler _render_scheduler;
+        std::mutex _layouts_mutex;
+        std::vector<DecoderBufferLayout> _buffer_layouts;
+        FencedBuffers _fenced_buffers;
+        const GraphicsFramePath _frame_path;
+        /* when frames can't be imported, they're copied in */
+        std::atomic_bool _use_upload = false;
+        bool _is_showing_upload = false;
+        PlaneUploader _plane_uploader;
+        GLint _upload_shader;
+        /* the frame drawn since the last swap, if any */
+        std::optional<FrameMetadata> _swap_metadata;
         GLint _image_shader;
 
         GLint _screen_shader;
@@ -77,12 +99,18 @@ namespace infrastructure {
 
         const int _image_width;
         const int _image_height;
+        const LensDistortion _lens_distortion;
+        const std::string _graphics_cache_dir;
         int _width = 0;
         int _height = 0;
         GLFWwindow *_window = nullptr;
         std::map<int, EglBuffer> _buffers;
 
         unsigned int IMAGE_VBO, IMAGE_VAO, IMAGE_EBO;
+        unsigned int MESH_VBO = 0, MESH_VAO = 0, MESH_EBO = 0;
+        /* the flat quad, or the stereo mesh when the lenses want one */
+        unsigned int _draw_vao = 0;
+        GLsizei _draw_index_count = 6;
     };
 }
 
@@ -0,0 +1,184 @@
+//
+// Created by brucegoose on 7/27/23.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "plane_uploader.hpp"
+
+namespace infrastructure {
+
+    static bool hasGlExtension(const char *name) {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++) {
+            const auto *extension = (const char *) glGetStringi(GL_EXTENSIONS, i);
+            if (extension != nullptr && std::strcmp(extension, name) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    PlaneUploader::PlaneUploader(const int ring_size):
+        _ring_size(std::max(ring_size, 2))
+    {}
+
+    void PlaneUploader::Setup() {
+        // core on desktop gl, an extension on gles; glad only loads the gles side
+        _buffer_storage = glad_glBufferStorage;
+        if (_buffer_storage == nullptr && hasGlExtension("GL_EXT_buffer_storage")) {
+            _buffer_storage = (PFNGLBUFFERSTORAGEPROC) glfwGetProcAddress("glBufferStorageEXT");
+        }
+        _is_persistent = _buffer_storage != nullptr;
+        _upload_us.Reset();
+        std::cout << "PlaneUploader: " << _ring_size << " pbos, " <<
+            (_is_persistent ? "persistently mapped" : "mapped per frame") << std::endl;
+    }
+
+    bool PlaneUploader::Upload(DecoderBuffer &buffer, const int width, const int height) {
+        const auto t1 = monotonicClockMicros();
+        if (width != _width || height != _height) {
+            resize(width, height);
+        }
+        if (buffer.GetSize() < _frame_size) {
+            return false;
+        }
+
+        auto &slot = _slots[_next_slot];
+        _next_slot = (_next_slot + 1) % _ring_size;
+        // with a ring this deep, the gpu is long done with the slot; the wait only guards a stall
+        if (slot.fence != nullptr) {
+            glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+        void *staging = slot.mapped;
+        if (staging == nullptr) {
+            staging = glMapBufferRange(
+                GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr) _frame_size,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+            );
+        }
+        if (staging == nullptr) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return false;
+        }
+        std::memcpy(staging, buffer.GetMemory(), _frame_size);
+        if (slot.mapped == nullptr) {
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+
+        // the planes sit back to back, as the decoder writes them
+        const int chroma_width = _width / 2;
+        const int chroma_height = _height / 2;
+        const std::size_t luma_size = (std::size_t) _width * _height;
+        const std::size_t chroma_size = (std::size_t) chroma_width * chroma_height;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, _textures[0]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _width, _height, GL_RED, GL_UNSIGNED_BYTE, (void *) 0);
+        glBindTexture(GL_TEXTURE_2D, _textures[1]);
+        glTexSubImage2D(
+            GL_TEXTURE_2D, 0, 0, 0, chroma_width, chroma_height, GL_RED, GL_UNSIGNED_BYTE, (void *) luma_size
+        );
+        glBindTexture(GL_TEXTURE_2D, _textures[2]);
+        glTexSubImage2D(
+            GL_TEXTURE_2D, 0, 0, 0, chroma_width, chroma_height, GL_RED, GL_UNSIGNED_BYTE,
+            (void *) (luma_size + chroma_size)
+        );
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        _has_frame = true;
+        _upload_us.Record(monotonicClockMicros() - t1);
+        return true;
+    }
+
+    void PlaneUploader::Bind() const {
+        for (int plane = 2; plane >= 0; plane--) {
+            glActiveTexture(GL_TEXTURE0 + plane);
+            glBindTexture(GL_TEXTURE_2D, _textures[plane]);
+        }
+    }
+
+    void PlaneUploader::SetSamplers(const GLuint program) {
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "y_plane"), 0);
+        glUniform1i(glGetUniformLocation(program, "u_plane"), 1);
+        glUniform1i(glGetUniformLocation(program, "v_plane"), 2);
+    }
+
+    std::string PlaneUploader::Report(const std::string &label) const {
+        std::stringstream out;
+        out << label << " upload: " << (_is_persistent ? "persistent" : "mapped") << ", count=" << _upload_us.Count()
+            << ", p50=" << _upload_us.Percentile(50) << "us, p99=" << _upload_us.Percentile(99) << "us, max="
+            << _upload_us.Max() << "us\n";
+        return out.str();
+    }
+
+    void PlaneUploader::Teardown() {
+        release();
+        _width = 0;
+        _height = 0;
+    }
+
+    void PlaneUploader::resize(const int width, const int height) {
+        release();
+        _width = width;
+        _height = height;
+        _frame_size = (std::size_t) width * height + 2 * (std::size_t) (width / 2) * (height / 2);
+
+        glGenTextures(3, _textures);
+        for (int plane = 0; plane < 3; plane++) {
+            glBindTexture(GL_TEXTURE_2D, _textures[plane]);
+            glTexStorage2D(
+                GL_TEXTURE_2D, 1, GL_R8, plane == 0 ? width : width / 2, plane == 0 ? height : height / 2
+            );
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+
+        _slots.resize(_ring_size);
+        for (auto &slot : _slots) {
+            glGenBuffers(1, &slot.pbo);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+            if (_is_persistent) {
+                const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                _buffer_storage(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) _frame_size, nullptr, flags);
+                slot.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr) _frame_size, flags);
+            } else {
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) _frame_size, nullptr, GL_STREAM_DRAW);
+            }
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        _next_slot = 0;
+    }
+
+    void PlaneUploader::release() {
+        for (auto &slot : _slots) {
+            if (slot.fence != nullptr) {
+                glDeleteSync(slot.fence);
+            }
+            if (slot.mapped != nullptr) {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            }
+            glDeleteBuffers(1, &slot.pbo);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        _slots.clear();
+        if (_textures[0] != 0) {
+            glDeleteTextures(3, _textures);
+            _textures[0] = _textures[1] = _textures[2] = 0;
+        }
+        _has_frame = false;
+    }
+
+}
@@ -0,0 +1,85 @@
+//
+// Created by brucegoose on 7/27/23.
+//
+
+#ifndef INFRASTRUCTURE_GRAPHICS_PLANE_UPLOADER_HPP
+#define INFRASTRUCTURE_GRAPHICS_PLANE_UPLOADER_HPP
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "graphics.hpp"
+
+namespace infrastructure {
+
+    /*
+     * the way to show a frame when there's no dmabuf to import: its Y, U and V planes are copied into a ring of pixel
+     * buffer objects, and textured from there, so the copy never waits on the gpu. The pbos are mapped once for good
+     * when EXT_buffer_storage is around, and mapped unsynchronized per frame otherwise; either way, a fence per slot
+     * keeps a slot from being rewritten while the gpu still reads it. The decoder buffer can go back as soon as
+     * Upload returns. Render thread only, with the gl context current
+     */
+    class PlaneUploader {
+    public:
+        explicit PlaneUploader(int ring_size = 3);
+        void Setup();
+        /* false if the frame couldn't be staged; the previous one stays bound */
+        bool Upload(DecoderBuffer &buffer, int width, int height);
+        /* the planes on texture units 0, 1 and 2, as UPLOAD_FRAGMENT_SHADER samples them */
+        void Bind() const;
+        [[nodiscard]] bool HasFrame() const {
+            return _has_frame;
+        }
+        [[nodiscard]] bool IsPersistent() const {
+            return _is_persistent;
+        }
+        /* cpu time per upload since Setup */
+        [[nodiscard]] std::string Report(const std::string &label) const;
+        void Teardown();
+
+        /* goes with either graphics' vertex shader; bt601 narrow range, to match what dmabuf import is told */
+        static constexpr const char *UPLOAD_FRAGMENT_SHADER =
+            "#version 310 es\n"
+            "precision mediump float;\n"
+            "uniform sampler2D y_plane;\n"
+            "uniform sampler2D u_plane;\n"
+            "uniform sampler2D v_plane;\n"
+            "in vec2 texcoord;\n"
+            "in float c_pos;\n"
+            "out vec4 fragColor;\n"
+            "void main() {\n"
+            "  float y = 1.164 * (texture(y_plane, texcoord).r - 0.0625);\n"
+            "  float u = texture(u_plane, texcoord).r - 0.5;\n"
+            "  float v = texture(v_plane, texcoord).r - 0.5;\n"
+            "  vec3 rgb = vec3(y + 1.596 * v, y - 0.392 * u - 0.813 * v, y + 2.017 * u);\n"
+            "  fragColor = vec4(clamp(rgb, 0.0, 1.0) * c_pos, 1.0);\n"
+            "}\n";
+        /* points the shader's samplers at the units Bind uses */
+        static void SetSamplers(GLuint program);
+    private:
+        struct Slot {
+            GLuint pbo = 0;
+            void *mapped = nullptr;
+            GLsync fence = nullptr;
+        };
+
+        void resize(int width, int height);
+        void release();
+
+        const int _ring_size;
+        std::atomic_bool _is_persistent = false;
+        PFNGLBUFFERSTORAGEPROC _buffer_storage = nullptr;
+        std::vector<Slot> _slots;
+        int _next_slot = 0;
+        GLuint _textures[3] = { 0, 0, 0 };
+        int _width = 0;
+        int _height = 0;
+        std::size_t _frame_size = 0;
+        bool _has_frame = false;
+        LatencyHistogram _upload_us;
+    };
+
+}
+
+#endif //INFRASTRUCTURE_GRAPHICS_PLANE_UPLOADER_HPP
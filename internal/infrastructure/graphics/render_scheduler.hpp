@@ -0,0 +1,160 @@
+//
+// Created by brucegoose on 7/24/23.
+//
+
+#ifndef INFRASTRUCTURE_GRAPHICS_RENDER_SCHEDULER_HPP
+#define INFRASTRUCTURE_GRAPHICS_RENDER_SCHEDULER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include "utils/clock.hpp"
+#include "utils/latency.hpp"
+
+namespace infrastructure {
+
+    struct RenderSummary {
+        double fps = 0;
+        /* share of the time the render thread spent waiting for something to draw */
+        double idle_fraction = 0;
+        uint64_t skipped_redraws = 0;
+        LatencySummary present_interval;
+        /* how much each present to present interval differed from the one before it */
+        LatencySummary present_jitter;
+    };
+
+    /*
+     * keeps a render loop asleep until there's something new to draw. The loop waits, and wakes for a posted frame or
+     * state change, or at the latest on the vblank grid (anchored at the last present) idle_frames out, so it can
+     * still poll window events. Counters for fps and idle time cover the time since the last summary; the present
+     * histograms cover everything since Start
+     */
+    class RenderScheduler {
+    public:
+        explicit RenderScheduler(const int64_t frame_period_us = 16667, const int idle_frames = 6):
+            _frame_period_us(frame_period_us), _idle_frames(idle_frames)
+        {}
+        /* once the window knows its refresh rate */
+        void SetFramePeriod(const int64_t frame_period_us) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _frame_period_us = std::max<int64_t>(frame_period_us, 1);
+        }
+        void Start() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _is_stopped = false;
+            _is_pending = true;
+            _last_present_us = monotonicClockMicros();
+            _window_start_us = _last_present_us;
+            _has_presented = false;
+            _last_interval_us = -1;
+            _presents = 0;
+            _idle_us = 0;
+            _skipped_redraws = 0;
+            _present_intervals.Reset();
+            _present_jitter.Reset();
+        }
+        void Stop() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _is_stopped = true;
+            _cv.notify_all();
+        }
+        /* from any thread */
+        void Notify() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _is_pending = true;
+            _cv.notify_all();
+        }
+        /* true when woken by Notify, false when the deadline passed or the scheduler stopped */
+        [[nodiscard]] bool Wait() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            const auto start_us = monotonicClockMicros();
+            const auto frames_since = std::max<int64_t>((start_us - _last_present_us) / _frame_period_us, 0);
+            const auto deadline_us = _last_present_us + (frames_since + _idle_frames) * _frame_period_us;
+            _cv.wait_for(lock, std::chrono::microseconds(deadline_us - start_us), [this]() {
+                return _is_pending || _is_stopped;
+            });
+            _idle_us += monotonicClockMicros() - start_us;
+            const bool is_notified = _is_pending && !_is_stopped;
+            _is_pending = false;
+            return is_notified;
+        }
+        /* woke, but nothing changed, so the last frame stays up */
+        void Skipped() {
+            _skipped_redraws += 1;
+        }
+        /* right after a swap */
+        void Presented() {
+            const auto now = monotonicClockMicros();
+            std::unique_lock<std::mutex> lock(_mutex);
+            // the first present has nothing before it to measure from
+            if (_has_presented) {
+                const auto interval_us = now - _last_present_us;
+                _present_intervals.Record(interval_us);
+                if (_last_interval_us >= 0) {
+                    _present_jitter.Record(std::abs(interval_us - _last_interval_us));
+                }
+                _last_interval_us = interval_us;
+            }
+            _has_presented = true;
+            _last_present_us = now;
+            _presents += 1;
+        }
+        /* resets the fps, idle and skip counters; for reporting on demand, from one thread */
+        [[nodiscard]] RenderSummary Summary() {
+            const auto now = monotonicClockMicros();
+            std::unique_lock<std::mutex> lock(_mutex);
+            RenderSummary summary;
+            const auto window_us = now - _window_start_us;
+            if (window_us > 0) {
+                summary.fps = (double) _presents * 1000000.0 / (double) window_us;
+                summary.idle_fraction = std::min(1.0, (double) _idle_us / (double) window_us);
+            }
+            summary.skipped_redraws = _skipped_redraws;
+            summary.present_interval = _present_intervals.Summary();
+            summary.present_jitter = _present_jitter.Summary();
+            _window_start_us = now;
+            _presents = 0;
+            _idle_us = 0;
+            _skipped_redraws = 0;
+            return summary;
+        }
+        [[nodiscard]] std::string Report(const std::string &label) {
+            const auto summary = Summary();
+            std::stringstream out;
+            out << label << " render: fps=" << summary.fps << ", idle=" << (int) (summary.idle_fraction * 100)
+                << "%, skipped_redraws=" << summary.skipped_redraws
+                << ", interval p50=" << summary.present_interval.p50_us << "us, p99="
+                << summary.present_interval.p99_us << "us, jitter p50=" << summary.present_jitter.p50_us
+                << "us, p99=" << summary.present_jitter.p99_us << "us, max=" << summary.present_jitter.max_us
+                << "us\n";
+            return out.str();
+        }
+    private:
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        int64_t _frame_period_us;
+        const int _idle_frames;
+        bool _is_pending = false;
+        bool _is_stopped = true;
+
+        bool _has_presented = false;
+        int64_t _last_present_us = 0;
+        int64_t _last_interval_us = -1;
+        int64_t _window_start_us = 0;
+        uint64_t _presents = 0;
+        int64_t _idle_us = 0;
+        std::atomic<uint64_t> _skipped_redraws = { 0 };
+        LatencyHistogram _present_intervals;
+        LatencyHistogram _present_jitter;
+    };
+
+}
+
+#endif //INFRASTRUCTURE_GRAPHICS_RENDER_SCHEDULER_HPP
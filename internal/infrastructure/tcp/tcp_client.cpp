@@ -21,7 +21,9 @@ namespace infrastructure {
         _use_fixed_port(config.get_tcp_client_used_fixed_port()),
         _connection_type(config.get_tcp_client_connection_type()),
         _read_timer(net::make_strand(context)),
-        _read_timeout(config.get_tcp_client_timeout_on_read())
+        _read_timeout(config.get_tcp_client_timeout_on_read()),
+        _send_buffer_queue(config.get_tcp_client_send_queue_depth(), config.get_tcp_client_send_queue_conflating()),
+        _stream_receive(config.get_tcp_client_stream_receive())
     {
         if (_connection_type == ConnectionType::UNKNOWN_CONNECTION) {
             throw std::runtime_error("TcpClient::TcpClient INVALID CONNECTION TYPE");
@@ -117,89 +119,127 @@ namespace infrastructure {
 
     void TcpClient::startWrite() {
         std::cout << "TcpClient connected; waiting to write" << std::endl;
+        readHello();
         _manager->CreateCameraClientConnection();
     }
 
-    void TcpClient::Post(std::shared_ptr<SizedBuffer> &&buffer) {
-        if (_is_stopped || !_is_connected) return;
-        bool write_in_progress = false;
-        {
-            std::unique_lock<std::mutex> lock(_send_buffer_mutex);
-            write_in_progress = !_send_buffer_queue.empty();
-            _send_buffer_queue.push(std::move(buffer));
-        }
-        if (!write_in_progress) {
-            _header.SetupHeader(_send_buffer_queue.front()->GetSize());
-            writeHeader(0);
-        }
+    void TcpClient::readHello() {
+        // older servers never say hello, so they keep getting version 1 headers
+        auto self(shared_from_this());
+        net::async_read(
+            *_socket, net::buffer(_hello.Data(), PacketHeader::HeaderSize),
+            [this, self](error_code ec, std::size_t bytes_written) mutable {
+                if (ec || _is_stopped || !_is_connected) return;
+                _peer_version = _hello.HelloVersion();
+                std::cout << "TcpClient: server speaks header version " << _peer_version << std::endl;
+            }
+        );
     }
 
-    void TcpClient::writeHeader(std::size_t last_bytes) {
+    void TcpClient::Post(std::shared_ptr<SizedBuffer> &&buffer) {
         if (_is_stopped || !_is_connected) return;
+        // a streaming encoder posts the same frame again every time more of it is compressed, so writes go through
+        // the strand like the reads do
         auto self(shared_from_this());
-        _socket->async_send(
-            net::buffer(_header.Data() + last_bytes, _header.Size() - last_bytes),
-            [this, self, last_bytes](error_code ec, std::size_t bytes_written) mutable {
+        net::post(
+            _read_timer.get_executor(),
+            [this, self, out_buffer = std::move(buffer)]() mutable {
                 if (_is_stopped || !_is_connected) return;
-                auto total_bytes = last_bytes + bytes_written;
-                if (!ec) {
-                    if (total_bytes == _header.Size()) {
-                        writeBody();
-                        return;
-                    } else if (total_bytes < _header.Size()) {
-                        writeHeader(total_bytes);
-                        return;
-                    }
-                }
-                std::cout << "TcpClient: error writing header: ";
-                if (ec) {
-                    std::cout << ec;
-                } else {
-                    std::cout << "unknown error";
+                static_cast<void>(_send_buffer_queue.Push(std::move(out_buffer)));
+                if (!_is_writing) {
+                    writeFrame();
                 }
-                std::cout << "; reconnecting" << std::endl;
-                reconnect(ec);
             }
         );
-
     }
 
-    void TcpClient::writeBody() {
+    void TcpClient::writeFrame() {
         if (_is_stopped || !_is_connected) return;
-        auto &buffer = _send_buffer_queue.front();
+        while (true) {
+            if (_send_buffer_queue.Size() == 0) {
+                return;
+            }
+            auto &buffer = _send_buffer_queue.Front();
+            auto *progress = buffer->GetProgress();
+            const bool is_filling = progress != nullptr && progress->IsFilling();
+            if (progress != nullptr && progress->IsAborted()) {
+                if (_frame_partly_sent) {
+                    writeAbort();
+                    return;
+                }
+                finishFrame();
+                continue;
+            }
+            if (!_frame_started) {
+                // only version 2 servers can take a frame before it's whole
+                if (is_filling && _peer_version < 2) {
+                    return;
+                }
+                const auto total_bytes = buffer->GetSize();
+                if (is_filling && total_bytes == 0) {
+                    _frame.BeginOpenEnded(_header, buffer, _peer_version);
+                } else {
+                    _frame.Begin(_header, buffer, total_bytes, _peer_version);
+                }
+                _frame_started = true;
+            }
+            if (_frame.Advance(_header, is_filling ? progress->Landed() : buffer->GetSize(), !is_filling)) {
+                break;
+            }
+            // nothing new yet; the encoder posts the frame again when there is
+            return;
+        }
+
+        _is_writing = true;
         auto self(shared_from_this());
-        _socket->async_send(
-            net::buffer((uint8_t *) buffer->GetMemory() + _header.BytesWritten(), _header.DataLength()),
+        net::async_write(
+            *_socket, _frame.Buffers(),
             [this, self](error_code ec, std::size_t bytes_written) mutable {
+                _is_writing = false;
                 if (_is_stopped || !_is_connected) return;
                 if (ec) {
-                    std::cout << "TcpClient: error writing body: " << ec << "; reconnecting" << std::endl;
+                    std::cout << "TcpClient: error writing frame: " << ec << "; reconnecting" << std::endl;
                     reconnect(ec);
                     return;
-                } else if (bytes_written != _header.DataLength()) {
-                    _header.OffsetPacket(bytes_written);
-                    writeBody();
-                    return;
                 }
-                if (_header.IsFinished()) {
-                    bool messages_remaining = false;
-                    {
-                        std::unique_lock<std::mutex> lock(_send_buffer_mutex);
-                        _send_buffer_queue.pop();
-                        messages_remaining = !_send_buffer_queue.empty();
+                _frame_partly_sent = true;
+                if (_frame.IsDone()) {
+                    if (auto *metadata = _send_buffer_queue.Front()->GetMetadata(); metadata != nullptr) {
+                        recordLatencySince(LatencyStage::TCP_SEND, metadata->stage_timestamp_us);
                     }
-                    if (!messages_remaining) {
-                        return;
-                    }
-                    _header.SetupHeader(_send_buffer_queue.front()->GetSize());
-                } else {
-                    _header.SetupNextHeader();
+                    finishFrame();
                 }
-                writeHeader(0);
+                writeFrame();
             }
         );
     }
 
+    void TcpClient::writeAbort() {
+        _header.SetupAbort();
+        _is_writing = true;
+        auto self(shared_from_this());
+        net::async_write(
+            *_socket, net::buffer(_header.Data(), _header.Size()),
+            [this, self](error_code ec, std::size_t bytes_written) mutable {
+                _is_writing = false;
+                if (_is_stopped || !_is_connected) return;
+                if (ec) {
+                    std::cout << "TcpClient: error writing abort: " << ec << "; reconnecting" << std::endl;
+                    reconnect(ec);
+                    return;
+                }
+                finishFrame();
+                writeFrame();
+            }
+        );
+    }
+
+    void TcpClient::finishFrame() {
+        static_cast<void>(_send_buffer_queue.Pop());
+        _frame_started = false;
+        _frame_partly_sent = false;
+    }
+
     void TcpClient::startRead() {
         std::cout << "TcpClient connected; starting to read" << std::endl;
         _manager->CreateHeadsetClientConnection();
@@ -208,11 +248,26 @@ namespace infrastructure {
             _socket->get_executor(),
             [this, self]() {
                 if (_is_stopped || !_is_connected) return;
+                sendHello();
                 readHeader(0);
             }
         );
     }
 
+    void TcpClient::sendHello() {
+        // older servers never read from a headset, so the hello just sits in their socket buffer
+        _hello.SetupHello();
+        auto self(shared_from_this());
+        net::async_write(
+            *_socket, net::buffer(_hello.Data(), PacketHeader::HeaderSize),
+            [this, self](error_code ec, std::size_t bytes_written) mutable {
+                if (ec && ec != net::error::operation_aborted) {
+                    std::cout << "TcpClient: error sending hello: " << ec << std::endl;
+                }
+            }
+        );
+    }
+
     void TcpClient::startTimer() {
         _read_timer.expires_from_now(boost::posix_time::seconds(_read_timeout));
         auto self(shared_from_this());
@@ -228,7 +283,7 @@ namespace infrastructure {
         startTimer();
         auto self(shared_from_this());
         _socket->async_receive(
-            net::buffer(_header.Data() + last_bytes, _header.Size() - last_bytes),
+            net::buffer(_header.Data() + last_bytes, _header.ReadSize(last_bytes) - last_bytes),
             [this, self, last_bytes] (error_code ec, std::size_t bytes_written) mutable {
                 if (ec == net::error::operation_aborted) {
                     std::cout << "TcpClient: readHeader aborted" << std::endl;
@@ -238,10 +293,23 @@ namespace infrastructure {
                 if (_is_stopped || !_is_connected) return;
 
                 auto total_bytes = last_bytes + bytes_written;
-                if (!ec && total_bytes == _header.Size() && _header.Ok()) {
-                    readBody();
+                if (!ec && total_bytes == _header.ReadSize(total_bytes) && _header.Ok()) {
+                    // the server gave up on the frame we were getting, or started a new one without finishing it;
+                    // either way, what we have of it never goes to the decoder
+                    if (_header.IsAborted() || (_header.IsFrameStart() && _header.BytesWritten() != 0)) {
+                        dropFrame();
+                    }
+                    if (_header.IsAborted()) {
+                        readHeader(0);
+                    } else {
+                        readBody();
+                    }
                     return;
-                } else if (!ec && total_bytes < _header.Size()) {
+                } else if (
+                    !ec && total_bytes < _header.ReadSize(total_bytes) &&
+                    // until the 24 bytes are in, the rest of them are still the last header's
+                    (total_bytes < PacketHeader::HeaderSize || _header.Ok())
+                ) {
                     readHeader(total_bytes);
                     return;
                 }
@@ -262,7 +330,14 @@ namespace infrastructure {
     void TcpClient::readBody() {
         if (_is_stopped || !_is_connected) return;
         if (_receive_buffer == nullptr) {
-            _receive_buffer = _receive_buffer_pool->GetReadBuffer();
+            _receive_buffer = _receive_buffer_pool->GetReadBuffer(_header.TotalBytes());
+            _receive_buffer->GetProgress()->Reset();
+            _receive_start_us = monotonicClockMicros();
+        }
+        if (_header.BytesWritten() + _header.DataLength() > _receive_buffer->GetCapacity()) {
+            std::cout << "TcpClient: frame doesn't fit in a receive buffer; reconnecting" << std::endl;
+            reconnect({});
+            return;
         }
         startTimer();
         auto self(shared_from_this());
@@ -285,12 +360,9 @@ namespace infrastructure {
                     return;
                 }
                 if (_header.IsFinished()) {
-                    if (!_receive_buffer->IsLeakyBuffer()) {
-                        _receive_buffer->SetSize(_header.BytesWritten());
-                        _manager->PostHeadsetClientBuffer(std::move(_receive_buffer));
-                    }
-                    _receive_buffer = nullptr;
-                    _header.ResetHeader();
+                    postFrame();
+                } else if (_stream_receive) {
+                    postChunk();
                 }
                 readHeader(0);
             }
@@ -298,6 +370,53 @@ namespace infrastructure {
 
     }
 
+    void TcpClient::postChunk() {
+        if (_receive_buffer->IsLeakyBuffer()) {
+            return;
+        }
+        if (!_is_streaming) {
+            // the decoder reads these as soon as the frame is posted, so they are set once, up front; an open ended
+            // frame has no size until its last chunk
+            _receive_buffer->SetSize(_header.TotalBytes());
+            auto *metadata = _receive_buffer->GetMetadata();
+            *metadata = _header.GetMetadata();
+            metadata->stage_timestamp_us = _receive_start_us;
+            _is_streaming = true;
+        }
+        _receive_buffer->GetProgress()->Land(_header.BytesWritten());
+        // the same buffer goes out again for every chunk; a decoder already holding it just wakes up
+        _manager->PostHeadsetClientBuffer(std::shared_ptr<SizedBuffer>(_receive_buffer));
+    }
+
+    void TcpClient::postFrame() {
+        if (!_receive_buffer->IsLeakyBuffer()) {
+            _receive_buffer->SetSize(_header.BytesWritten());
+            if (_is_streaming) {
+                recordLatencySince(LatencyStage::HEADSET_RECEIVE, _receive_start_us);
+            } else {
+                auto *metadata = _receive_buffer->GetMetadata();
+                *metadata = _header.GetMetadata();
+                metadata->stage_timestamp_us = recordLatencySince(LatencyStage::HEADSET_RECEIVE, _receive_start_us);
+            }
+            _receive_buffer->GetProgress()->Complete(_header.BytesWritten());
+            _manager->PostHeadsetClientBuffer(std::move(_receive_buffer));
+        }
+        _receive_buffer = nullptr;
+        _is_streaming = false;
+        _header.ResetHeader();
+    }
+
+    void TcpClient::dropFrame() {
+        if (_is_streaming) {
+            // a decoder partway through this frame needs to hear that it's never going to finish
+            _receive_buffer->GetProgress()->Abort();
+            _manager->PostHeadsetClientBuffer(std::move(_receive_buffer));
+        }
+        _receive_buffer = nullptr;
+        _is_streaming = false;
+        _header.ResetHeader();
+    }
+
     void TcpClient::reconnect(error_code ec) {
         std::cout << "TCP Client: Socket has error " << ec << "; attempting to reconnect" << std::endl;
         disconnect(ec);
@@ -306,21 +425,19 @@ namespace infrastructure {
 
     void TcpClient::disconnect(error_code ec) {
         _is_connected = false;
+        _peer_version = 1;
         if (_socket && _socket->is_open()) {
             _socket->shutdown(tcp::socket::shutdown_both, ec);
             _socket.reset();
             _socket = nullptr;
         }
         if (_connection_type == ConnectionType::CAMERA_CONNECTION) {
-            {
-                std::unique_lock<std::mutex> lock(_send_buffer_mutex);
-                while(!_send_buffer_queue.empty()) {
-                    _send_buffer_queue.pop();
-                }
-            }
+            _send_buffer_queue.Clear();
+            _frame_started = false;
+            _frame_partly_sent = false;
             _manager->DestroyCameraClientConnection();
         } else {
-            _receive_buffer = nullptr;
+            dropFrame();
             _manager->DestroyHeadsetClientConnection();
         }
     }
@@ -12,6 +12,7 @@
 
 #include "utils/buffers.hpp"
 #include "utils/asio_context.hpp"
+#include "utils/latency.hpp"
 #include "tcp_utils.hpp"
 
 
@@ -25,6 +26,10 @@ namespace infrastructure {
         [[nodiscard]] virtual int get_tcp_client_timeout_on_read() const = 0;
         [[nodiscard]] virtual int get_tcp_client_read_buffer_count() const = 0;
         [[nodiscard]] virtual int get_tcp_client_read_buffer_size() const = 0;
+        [[nodiscard]] virtual int get_tcp_client_send_queue_depth() const = 0;
+        [[nodiscard]] virtual bool get_tcp_client_send_queue_conflating() const = 0;
+        /* post each received frame as its chunks land, so the decoder can start on it before it's whole */
+        [[nodiscard]] virtual bool get_tcp_client_stream_receive() const = 0;
     };
 
 
@@ -40,7 +45,7 @@ namespace infrastructure {
         virtual void DestroyHeadsetClientConnection() = 0;
     };
 
-    class TcpClient: public std::enable_shared_from_this<TcpClient> {
+    class TcpClient: public std::enable_shared_from_this<TcpClient>, public LatencyStatsSink {
     public:
         static std::shared_ptr<TcpClient> Create(
             const TcpClientConfig &config, net::io_context &context, std::shared_ptr<TcpClientManager> manager
@@ -57,15 +62,24 @@ namespace infrastructure {
         void Start();
         void Stop();
         void Post(std::shared_ptr<SizedBuffer> &&buffer);
+        [[nodiscard]] unsigned long GetDroppedFrameCount() const {
+            return _send_buffer_queue.DroppedFrames();
+        }
     private:
         void startConnection(bool is_initial_connection);
         void startWrite();
-        void writeHeader(std::size_t last_bytes);
-        void writeBody();
+        void readHello();
+        void writeFrame();
+        void writeAbort();
+        void finishFrame();
         void startRead();
+        void sendHello();
         void startTimer();
         void readHeader(std::size_t last_bytes);
         void readBody();
+        void postChunk();
+        void postFrame();
+        void dropFrame();
         void disconnect(error_code ec);
         void reconnect(error_code ec);
         const ConnectionType _connection_type;
@@ -79,13 +93,21 @@ namespace infrastructure {
         const int _read_timeout;
         const bool _use_fixed_port;
 
+        PacketHeader _hello;
+        std::atomic<uint16_t> _peer_version = { 1 };
         PacketHeader _header;
+        PacketFrame _frame;
 
-        std::mutex _send_buffer_mutex;
-        std::queue<std::shared_ptr<SizedBuffer>> _send_buffer_queue = {};
+        TcpSendQueue _send_buffer_queue;
+        bool _is_writing = false;
+        bool _frame_started = false;
+        bool _frame_partly_sent = false;
 
         std::shared_ptr<TcpReadBufferPool> _receive_buffer_pool = nullptr;
         std::shared_ptr<TcpBuffer> _receive_buffer = nullptr;
+        int64_t _receive_start_us = 0;
+        const bool _stream_receive;
+        bool _is_streaming = false;
     };
 
 }
@@ -7,20 +7,43 @@
 
 #include <utility>
 
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
 namespace infrastructure {
 
+    namespace {
+        /* drops the first bytes of a buffer sequence, like asio does between the sends of an async_write */
+        void consumeBuffers(std::vector<net::const_buffer> &buffers, std::size_t bytes) {
+            auto sent_through = buffers.begin();
+            while (sent_through != buffers.end() && bytes >= sent_through->size()) {
+                bytes -= sent_through->size();
+                ++sent_through;
+            }
+            buffers.erase(buffers.begin(), sent_through);
+            if (!buffers.empty()) {
+                buffers.front() += bytes;
+            }
+        }
+    }
+
     TcpServer::TcpServer(
         const TcpServerConfig &config, net::io_context &context,
-        std::shared_ptr<TcpServerManager> manager
+        std::shared_ptr<TcpServerManager> manager, std::shared_ptr<ShardedAsioContext> shards
     ):
             _context(context),
+            _shards(std::move(shards)),
             _endpoint(tcp::v4(), config.get_tcp_server_port()),
             _acceptor(net::make_strand(context)),
             _manager(std::move(manager)),
             _read_write_timeout(config.get_tcp_server_timeout()),
             _tcp_camera_session_buffer_count(config.get_tcp_camera_session_buffer_count()),
-            _tcp_headset_session_buffer_count(config.get_tcp_headset_session_buffer_count()),
-            _tcp_session_buffer_size(config.get_tcp_server_buffer_size())
+            _tcp_headset_session_queue_depth(config.get_tcp_headset_session_queue_depth()),
+            _tcp_headset_session_queue_conflating(config.get_tcp_headset_session_queue_conflating()),
+            _tcp_session_buffer_size(config.get_tcp_server_buffer_size()),
+            _tcp_cut_through(config.get_tcp_server_cut_through()),
+            _tcp_headset_session_zero_copy(config.get_tcp_headset_session_zero_copy())
     {
         error_code ec;
 
@@ -57,11 +80,19 @@ namespace infrastructure {
         {
             failOut(ec, "listen");
         }
+
+        if (config.get_tcp_server_backend() == TcpServerBackend::URING) {
+            _uring = TcpUring::Create(uring_queue_depth, uring_fixed_buffer_count);
+        }
+        std::cout << "TcpServer: sessions on the " << (_uring ? "io_uring" : "asio") << " backend" << std::endl;
     }
 
     void TcpServer::Start() {
         if (_is_stopped) {
             _is_stopped = false;
+            if (_uring) {
+                _uring->Start();
+            }
             acceptConnections();
         }
     }
@@ -80,6 +111,9 @@ namespace infrastructure {
                 }
             );
             done_future.wait();
+            if (_uring) {
+                _uring->Stop();
+            }
         }
     }
 
@@ -95,40 +129,35 @@ namespace infrastructure {
         std::cout << "TcpServer: starting to accept connections" << std::endl;
 
         auto self(shared_from_this());
+        if (_shards == nullptr) {
+            _acceptor.async_accept(
+                net::make_strand(_context),
+                [this, self](error_code ec, tcp::socket socket) {
+                    std::cout << "TcpServer: attempting connection" << std::endl;
+                    if (_is_stopped) {
+                        return;
+                    }
+                    if (!ec) {
+                        startSession(std::move(socket), nullptr);
+                    }
+                    if (ec != net::error::operation_aborted) {
+                        acceptConnections();
+                    }
+                }
+            );
+            return;
+        }
+        // the shard runs on one thread, so its sessions need no strand
+        const auto shard = _shards->NextShard();
         _acceptor.async_accept(
-            net::make_strand(_context),
-            [this, self](error_code ec, tcp::socket socket) {
-                std::cout << "TcpServer: attempting connection" << std::endl;
+            _shards->GetContext(shard).get_executor(),
+            [this, self, shard](error_code ec, tcp::socket socket) {
+                std::cout << "TcpServer: attempting connection on shard " << shard << std::endl;
                 if (_is_stopped) {
                     return;
                 }
                 if (!ec) {
-                    socket.set_option(tcp::no_delay(true));
-                    net::socket_base::keep_alive option(true);
-                    socket.set_option(option);
-                    socket.set_option(reuse_port(true));
-                    socket.set_option(tcp::socket::reuse_address(true));
-                    const auto remote = socket.remote_endpoint();
-                    auto connection_type = _manager->GetConnectionType(remote);
-                    const auto addr = remote.address().to_v4();
-                    if (connection_type == ConnectionType::CAMERA_CONNECTION) {
-                        std::shared_ptr<TcpCameraSession>(
-                            new TcpCameraSession(
-                                    std::move(socket), _manager, addr, _read_write_timeout,
-                                    _tcp_camera_session_buffer_count, _tcp_session_buffer_size
-                            )
-                        )->Run();
-                    } else if (connection_type != ConnectionType::UNKNOWN_CONNECTION) {
-                        std::shared_ptr<TcpHeadsetSession>(
-                            new TcpHeadsetSession(
-                                    std::move(socket), _manager, addr, _read_write_timeout,
-                                    _tcp_headset_session_buffer_count, _tcp_session_buffer_size
-                            )
-                        )->ConnectAndWait();
-                    } else {
-                        std::cout << "TcpServer: Unknown connection, abort" << std::endl;
-                        socket.shutdown(tcp::socket::shutdown_both, ec);
-                    }
+                    startSession(std::move(socket), &_shards->GetMailbox(shard));
                 }
                 if (ec != net::error::operation_aborted) {
                     acceptConnections();
@@ -137,16 +166,61 @@ namespace infrastructure {
         );
     }
 
+    void TcpServer::startSession(tcp::socket &&socket, ShardMailbox *mailbox) {
+        error_code ec;
+        socket.set_option(tcp::no_delay(true));
+        net::socket_base::keep_alive option(true);
+        socket.set_option(option);
+        socket.set_option(reuse_port(true));
+        socket.set_option(tcp::socket::reuse_address(true));
+        const auto remote = socket.remote_endpoint();
+        auto connection_type = _manager->GetConnectionType(remote);
+        const auto addr = remote.address().to_v4();
+        if (connection_type == ConnectionType::CAMERA_CONNECTION) {
+            std::shared_ptr<TcpCameraSession>(
+                new TcpCameraSession(
+                        std::move(socket), _manager, addr, _read_write_timeout,
+                        _tcp_camera_session_buffer_count, _tcp_session_buffer_size, _tcp_cut_through, _uring,
+                        _headset_count, headsetHeldCount()
+                )
+            )->Run();
+        } else if (connection_type != ConnectionType::UNKNOWN_CONNECTION) {
+            std::shared_ptr<TcpHeadsetSession>(
+                new TcpHeadsetSession(
+                        std::move(socket), _manager, addr, _read_write_timeout,
+                        _tcp_headset_session_queue_depth, _tcp_headset_session_queue_conflating, mailbox,
+                        _uring, _tcp_headset_session_zero_copy, _headset_count
+                )
+            )->ConnectAndWait();
+        } else {
+            std::cout << "TcpServer: Unknown connection, abort" << std::endl;
+            socket.shutdown(tcp::socket::shutdown_both, ec);
+        }
+    }
+
     TcpCameraSession::TcpCameraSession(
             tcp::socket &&socket, std::shared_ptr<TcpServerManager> &manager,
             const tcp_addr addr, const int read_timeout, const int buffer_count,
-            const int buffer_size
+            const int buffer_size, const bool cut_through, std::shared_ptr<TcpUring> uring,
+            std::shared_ptr<std::atomic<int>> headset_count, const int headset_held_count
     ):
         _socket(std::move(socket)), _manager(manager), _addr(std::move(addr)),
         _read_timer(socket.get_executor()), _read_timeout(read_timeout),
-        _is_live(true)
+        _is_live(true), _buffer_count(buffer_count), _headset_count(std::move(headset_count)),
+        _headset_held_count(headset_held_count), _cut_through(cut_through), _uring(std::move(uring))
     {
         _receive_buffer_pool = TcpReadBufferPool::Create(buffer_count, buffer_size);
+        if (_uring) {
+            // a slab that doesn't make it into the table just gets read through asio; the pool can outlive the session
+            _receive_buffer_pool->SetSlabHooks({
+                [uring = _uring](TcpBuffer &buffer) {
+                    buffer.SetFixedIndex(uring->RegisterBuffer(buffer.GetMemory(), buffer.GetCapacity()));
+                },
+                [uring = _uring](TcpBuffer &buffer) {
+                    uring->UnregisterBuffer(buffer.GetFixedIndex());
+                }
+            });
+        }
     }
 
     void TcpCameraSession::Run() {
@@ -155,14 +229,30 @@ namespace infrastructure {
         _session_id = _manager->CreateCameraServerConnection(std::move(self));
 
         std::cout << "TcpCameraSession: running read" << std::endl;
+        // self went to the manager; on a shard this gets posted, so it needs its own hold on the session
         net::dispatch(
             _socket.get_executor(),
-            [this, self]() {
+            [this, self = shared_from_this()]() {
+                sendHello();
                 readHeader(0);
             }
         );
     }
 
+    void TcpCameraSession::sendHello() {
+        // older cameras never read from the socket, so they never upgrade past version 1 headers
+        _hello.SetupHello();
+        auto self(shared_from_this());
+        net::async_write(
+            _socket, net::buffer(_hello.Data(), PacketHeader::HeaderSize),
+            [this, self](error_code ec, std::size_t bytes_written) mutable {
+                if (ec && ec != boost::asio::error::operation_aborted) {
+                    std::cout << "TcpCameraSession: error sending hello: " << ec << std::endl;
+                }
+            }
+        );
+    }
+
     void TcpCameraSession::startTimer() {
         _read_timer.expires_from_now(boost::posix_time::seconds(_read_timeout));
         auto self(shared_from_this());
@@ -177,7 +267,7 @@ namespace infrastructure {
         startTimer();
         auto self(shared_from_this());
         _socket.async_receive(
-                net::buffer(_header.Data() + last_bytes, _header.Size() - last_bytes),
+                net::buffer(_header.Data() + last_bytes, _header.ReadSize(last_bytes) - last_bytes),
                 [this, self, last_bytes] (error_code ec, std::size_t bytes_written) mutable {
                     if (ec ==  boost::asio::error::operation_aborted) {
                         std::cout << "TcpCameraSession: readHeader aborted" << std::endl;
@@ -189,10 +279,22 @@ namespace infrastructure {
                     }
                     auto total_bytes = last_bytes + bytes_written;
                     if (!ec) {
-                        if (total_bytes == _header.Size() && _header.Ok()) {
-                            readBody();
+                        if (total_bytes == _header.ReadSize(total_bytes) && _header.Ok()) {
+                            // the camera gave up on its last frame, or started a new one without finishing it
+                            if (_header.IsAborted() || (_header.IsFrameStart() && _header.BytesWritten() != 0)) {
+                                dropFrame();
+                            }
+                            if (_header.IsAborted()) {
+                                readHeader(0);
+                            } else {
+                                readBody();
+                            }
                             return;
-                        } else if (total_bytes != _header.Size()) {
+                        } else if (
+                            total_bytes < _header.ReadSize(total_bytes) &&
+                            // until the 24 bytes are in, the rest of them are still the last header's
+                            (total_bytes < PacketHeader::HeaderSize || _header.Ok())
+                        ) {
                             readHeader(total_bytes);
                             return;
                         }
@@ -213,44 +315,119 @@ namespace infrastructure {
 
     void TcpCameraSession::readBody() {
         if (_receive_buffer == nullptr) {
-            _receive_buffer = _receive_buffer_pool->GetReadBuffer();
+            if (const int headset_count = *_headset_count; headset_count != _pooled_headset_count) {
+                _pooled_headset_count = headset_count;
+                _receive_buffer_pool->SetBufferCount(_buffer_count + headset_count * _headset_held_count);
+            }
+            _receive_buffer = _receive_buffer_pool->GetReadBuffer(_header.TotalBytes());
+            _receive_start_us = monotonicClockMicros();
+            if (!_receive_buffer->IsLeakyBuffer()) {
+                _receive_buffer->GetProgress()->Reset();
+            }
+        }
+        if (_header.BytesWritten() + _header.DataLength() > _receive_buffer->GetCapacity()) {
+            std::cout << "TcpCameraSession: frame doesn't fit in a receive buffer; closing" << std::endl;
+            TryClose(true);
+            return;
         }
 
         startTimer();
         auto self(shared_from_this());
+        auto *memory = (uint8_t *) _receive_buffer->GetMemory() + _header.BytesWritten();
+        if (_uring && _receive_buffer->GetFixedIndex() >= 0) {
+            _uring->ReadFixed(
+                _socket.native_handle(), memory, _header.DataLength(), _receive_buffer->GetFixedIndex(),
+                _socket.get_executor(), _receive_buffer,
+                [this, self] (error_code ec, std::size_t bytes_written) {
+                    onBody(ec, bytes_written);
+                }
+            );
+            return;
+        }
         _socket.async_receive(
-            boost::asio::buffer((uint8_t *) _receive_buffer->GetMemory() + _header.BytesWritten(), _header.DataLength()),
+            boost::asio::buffer(memory, _header.DataLength()),
             [this, self] (error_code ec, std::size_t bytes_written) mutable {
-                if (ec ==  boost::asio::error::operation_aborted) {
-                    std::cout << "TcpCameraSession: readBody aborted" << std::endl;
-                    return;
-                }
-                _read_timer.cancel();
-                if (!_is_live) {
-                    return;
-                }
-                if (ec) {
-                    std::cout << "TcpCameraSession: error reading body: " << ec << "; closing" << std::endl;
-                    TryClose(true);
-                    return;
-                } else if (bytes_written != _header.DataLength()) {
-                    _header.OffsetPacket(bytes_written);
-                    readBody();
-                    return;
-                }
-                if (_header.IsFinished()) {
-                    if (!_receive_buffer->IsLeakyBuffer()) {
-                        _receive_buffer->SetSize(_header.BytesWritten());
-                        _manager->PostCameraServerBuffer(_addr, std::move(_receive_buffer));
-                    }
-                    _receive_buffer = nullptr;
-                    _header.ResetHeader();
-                }
-                readHeader(0);
+                onBody(ec, bytes_written);
             }
         );
     }
 
+    void TcpCameraSession::onBody(error_code ec, std::size_t bytes_written) {
+        if (ec ==  boost::asio::error::operation_aborted) {
+            std::cout << "TcpCameraSession: readBody aborted" << std::endl;
+            return;
+        }
+        _read_timer.cancel();
+        if (!_is_live) {
+            return;
+        }
+        if (ec) {
+            std::cout << "TcpCameraSession: error reading body: " << ec << "; closing" << std::endl;
+            TryClose(true);
+            return;
+        } else if (bytes_written != _header.DataLength()) {
+            _header.OffsetPacket(bytes_written);
+            readBody();
+            return;
+        }
+        if (_header.IsFinished()) {
+            finishFrame();
+        } else if (_cut_through) {
+            forwardChunk();
+        }
+        readHeader(0);
+    }
+
+    void TcpCameraSession::forwardChunk() {
+        if (_receive_buffer->IsLeakyBuffer()) {
+            return;
+        }
+        if (!_is_forwarding) {
+            // headsets read these from other threads as soon as the frame is posted, so they are set once, up front;
+            // an open ended frame has no size yet, and a size of 0 tells the headsets to forward it open ended too
+            _receive_buffer->SetSize(_header.TotalBytes());
+            auto *metadata = _receive_buffer->GetMetadata();
+            *metadata = _header.GetMetadata();
+            metadata->stage_timestamp_us = _receive_start_us;
+            _is_forwarding = true;
+        }
+        _receive_buffer->GetProgress()->Land(_header.BytesWritten());
+        // the same buffer goes out again for every chunk; headset sessions already holding it just write the new bytes
+        _manager->PostCameraServerBuffer(_addr, std::shared_ptr<ResizableBuffer>(_receive_buffer));
+    }
+
+    void TcpCameraSession::finishFrame() {
+        if (!_receive_buffer->IsLeakyBuffer()) {
+            if (_is_forwarding) {
+                _receive_buffer->SetSize(_header.BytesWritten());
+                _latency_stats.RecordSince(LatencyStage::SERVER_RECEIVE, _receive_start_us);
+            } else {
+                _receive_buffer->SetSize(_header.BytesWritten());
+                auto *metadata = _receive_buffer->GetMetadata();
+                *metadata = _header.GetMetadata();
+                metadata->stage_timestamp_us = _latency_stats.RecordSince(
+                    LatencyStage::SERVER_RECEIVE, _receive_start_us
+                );
+            }
+            _receive_buffer->GetProgress()->Complete(_header.BytesWritten());
+            _manager->PostCameraServerBuffer(_addr, std::move(_receive_buffer));
+        }
+        _receive_buffer = nullptr;
+        _is_forwarding = false;
+        _header.ResetHeader();
+    }
+
+    void TcpCameraSession::dropFrame() {
+        if (_is_forwarding) {
+            // headsets partway through this frame need to hear that it's never going to finish
+            _receive_buffer->GetProgress()->Abort();
+            _manager->PostCameraServerBuffer(_addr, std::move(_receive_buffer));
+        }
+        _receive_buffer = nullptr;
+        _is_forwarding = false;
+        _header.ResetHeader();
+    }
+
     void TcpCameraSession::TryClose(bool internal_close) {
         if (!_is_live) return;
         _is_live = false;
@@ -270,6 +447,7 @@ namespace infrastructure {
     }
 
     void TcpCameraSession::doClose() {
+        dropFrame();
 
         if (_socket.is_open()) {
             error_code ec;
@@ -289,55 +467,93 @@ namespace infrastructure {
 
     TcpHeadsetSession::TcpHeadsetSession(
         tcp::socket &&socket, std::shared_ptr<TcpServerManager> &manager, tcp_addr addr,
-        const int write_timeout, const int buffer_count, const int buffer_size
+        const int write_timeout, const int queue_depth, const bool queue_is_conflating,
+        ShardMailbox *mailbox, std::shared_ptr<TcpUring> uring, const bool zero_copy,
+        std::shared_ptr<std::atomic<int>> headset_count
     ):
         _socket(std::move(socket)),
         _write_timer(socket.get_executor()),
         _write_timeout(write_timeout),
         _is_live(true),
         _manager(manager),
-        _addr(std::move(addr))
+        _addr(std::move(addr)),
+        _message_queue(queue_depth, queue_is_conflating),
+        _mailbox(mailbox),
+        _uring(std::move(uring)),
+        _headset_count(std::move(headset_count)),
+        _zero_copy(zero_copy)
     {
         std::cout << "TcpHeadsetSession: creating connection" << std::endl;
-        _copy_buffer_pool = TcpWriteBufferPool::Create(buffer_count, buffer_size);
+        *_headset_count += 1;
+        if (!_zero_copy) {
+            return;
+        }
+        const int enable = 1;
+        if (_uring) {
+            std::cout << "TcpHeadsetSession: zero copy sends are asio only; copying" << std::endl;
+            _zero_copy = false;
+        } else if (setsockopt(_socket.native_handle(), SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) != 0) {
+            std::cout << "TcpHeadsetSession: kernel won't zero copy (" << errno << "); copying" << std::endl;
+            _zero_copy = false;
+        }
     }
 
     void TcpHeadsetSession::ConnectAndWait() {
         auto self(shared_from_this());
         _session_id = _manager->CreateHeadsetServerConnection(std::move(self));
+        net::dispatch(
+            _socket.get_executor(),
+            [this, self = shared_from_this()]() {
+                readHello();
+            }
+        );
+    }
+
+    void TcpHeadsetSession::readHello() {
+        // older headsets never say hello, so they keep getting version 1 headers
+        auto self(shared_from_this());
+        net::async_read(
+            _socket, net::buffer(_hello.Data(), PacketHeader::HeaderSize),
+            [this, self](error_code ec, std::size_t bytes_written) mutable {
+                if (ec) {
+                    return;
+                }
+                _peer_version = _hello.HelloVersion();
+                std::cout << "TcpHeadsetSession: headset speaks header version " << _peer_version << std::endl;
+            }
+        );
     }
 
     void TcpHeadsetSession::Write(std::shared_ptr<SizedBuffer> &&buffer) {
-        // just post to the executor for synchronization
+        // just post to the executor for synchronization; sharded, the mailbox batches the wakeups
         auto self(shared_from_this());
+        if (_mailbox != nullptr) {
+            _mailbox->Post([this, self, out_buffer = std::move(buffer)]() mutable {
+                enqueue(std::move(out_buffer));
+            });
+            return;
+        }
         net::post(
             _socket.get_executor(),
-            [this, self, copy_buffer = std::move(buffer)]() mutable {
-                if (!_is_live) {
-                    return;
-                }
-                auto out_buffer = _copy_buffer_pool->CopyToWriteBuffer(copy_buffer);
-                if (out_buffer == nullptr) {
-                    // instead of closing the connection here, if the server is really stuck, it will signal a close
-                    // on write_timeout; that way, it can catch up if it needs to, or bail if the client really doesn't
-                    // exist anymore
-                    return;
-                }
-                // TODO: this is overkill; but I'm not confident I can remove it.
-                bool write_in_progress = false;
-                {
-                    std::unique_lock<std::mutex> lock(_message_mutex);
-                    write_in_progress = !_message_queue.empty();
-                    _message_queue.push(std::move(out_buffer));
-                }
-                if (!write_in_progress) {
-                    _header.SetupHeader(_message_queue.front()->GetSize());
-                    writeHeader(0);
-                }
+            [this, self, out_buffer = std::move(buffer)]() mutable {
+                enqueue(std::move(out_buffer));
             }
         );
     }
 
+    void TcpHeadsetSession::enqueue(std::shared_ptr<SizedBuffer> &&out_buffer) {
+        if (!_is_live) {
+            return;
+        }
+        // instead of closing the connection when the queue is full, if the server is really stuck, it
+        // will signal a close on write_timeout; that way, it can catch up if it needs to, or bail if the
+        // client really doesn't exist anymore
+        static_cast<void>(_message_queue.Push(std::move(out_buffer)));
+        if (!_is_writing) {
+            writeFrame();
+        }
+    }
+
     void TcpHeadsetSession::startTimer() {
         _write_timer.expires_from_now(boost::posix_time::seconds(_write_timeout));
         auto self(shared_from_this());
@@ -348,79 +564,248 @@ namespace infrastructure {
         });
     }
 
-    void TcpHeadsetSession::writeHeader(std::size_t last_bytes) {
+    void TcpHeadsetSession::writeFrame() {
+        while (true) {
+            if (_message_queue.Size() == 0) {
+                return;
+            }
+            auto &buffer = _message_queue.Front();
+            auto *progress = buffer->GetProgress();
+            const bool is_filling = progress != nullptr && progress->IsFilling();
+            // a newer frame waiting behind one that's still landing means we got switched off its camera
+            const bool is_dead = progress != nullptr && (
+                progress->IsAborted() || (is_filling && _message_queue.Size() > 1)
+            );
+            if (is_dead) {
+                if (_frame_partly_sent) {
+                    writeAbort();
+                    return;
+                }
+                finishFrame();
+                continue;
+            }
+            if (!_frame_started) {
+                // only version 2 headsets know to throw away a frame that gets cut off; the rest get whole frames
+                if (is_filling && _peer_version < 2) {
+                    return;
+                }
+                const auto total_bytes = buffer->GetSize();
+                if (is_filling && total_bytes == 0) {
+                    _frame.BeginOpenEnded(_header, buffer, _peer_version);
+                } else {
+                    _frame.Begin(_header, buffer, total_bytes, _peer_version);
+                }
+                _frame_started = true;
+            }
+            if (_frame.Advance(_header, is_filling ? progress->Landed() : buffer->GetSize(), !is_filling)) {
+                break;
+            }
+            // nothing new has landed; the camera session posts the frame again when it has
+            return;
+        }
+
         startTimer();
+        _is_writing = true;
         auto self(shared_from_this());
-        _socket.async_send(
-            net::buffer(_header.Data() + last_bytes, _header.Size() - last_bytes),
-            [this, self, last_bytes](error_code ec, std::size_t bytes_written) mutable {
+        // the frame holds its place at the front of the queue, but a close clears the queue out from under it
+        std::shared_ptr<void> keep_alive = _message_queue.Front();
+        if (_zero_copy) {
+            // the kernel may still be reading these headers after the next chunk's are laid out
+            keep_alive = std::make_shared<std::pair<std::shared_ptr<void>, std::shared_ptr<void>>>(
+                std::move(keep_alive), _frame.PinHeaders()
+            );
+        }
+        send(
+            _frame.Buffers(), std::move(keep_alive),
+            [this, self](error_code ec, std::size_t bytes_written) {
+                onFrameWritten(ec, bytes_written);
+            }
+        );
+    }
+
+    void TcpHeadsetSession::onFrameWritten(error_code ec, std::size_t bytes_written) {
+        if (ec ==  boost::asio::error::operation_aborted) {
+            std::cout << "TcpHeadsetSession: writeFrame aborted" << std::endl;
+            return;
+        }
+        _write_timer.cancel();
+        _is_writing = false;
+        // a close already cleared the queue
+        if (!_is_live) {
+            return;
+        }
+        if (ec) {
+            std::cout << "TcpHeadsetSession: error writing frame: " << ec << "; disconnecting" << std::endl;
+            TryClose(true);
+            return;
+        }
+        _frame_partly_sent = true;
+        if (_frame.IsDone()) {
+            // the frame is shared with the other headsets, so only read its receive stamp
+            if (auto *metadata = _message_queue.Front()->GetMetadata(); metadata != nullptr) {
+                _latency_stats.RecordSince(LatencyStage::FAN_OUT, metadata->stage_timestamp_us);
+            }
+            finishFrame();
+        }
+        writeFrame();
+    }
+
+    void TcpHeadsetSession::writeAbort() {
+        _header.SetupAbort();
+        startTimer();
+        _is_writing = true;
+        auto self(shared_from_this());
+        send(
+            { net::buffer(_header.Data(), _header.Size()) }, nullptr,
+            [this, self](error_code ec, std::size_t bytes_written) {
                 if (ec ==  boost::asio::error::operation_aborted) {
-                    std::cout << "TcpHeadsetSession: readHeader aborted" << std::endl;
+                    std::cout << "TcpHeadsetSession: writeAbort aborted" << std::endl;
                     return;
                 }
                 _write_timer.cancel();
-                auto total_bytes = last_bytes + bytes_written;
-                if (!ec) {
-                    if (total_bytes == _header.Size()) {
-                        writeBody();
-                        return;
-                    } else if (total_bytes < _header.Size()) {
-                        writeHeader(total_bytes);
-                        return;
-                    }
-                }
-                std::cout << "TcpHeadsetSession: error writing header: ";
+                _is_writing = false;
                 if (ec) {
-                    std::cout << ec;
-                } else {
-                    std::cout << "unknown error";
+                    std::cout << "TcpHeadsetSession: error writing abort: " << ec << "; disconnecting" << std::endl;
+                    TryClose(true);
+                    return;
                 }
-                std::cout << "; closing" << std::endl;
-                TryClose(true);
+                finishFrame();
+                writeFrame();
             }
         );
     }
 
-    void TcpHeadsetSession::writeBody() {
-        startTimer();
-        auto &buffer = _message_queue.front();
+    void TcpHeadsetSession::send(
+        const std::vector<net::const_buffer> &buffers, std::shared_ptr<void> keep_alive, TcpUring::Handler &&handler
+    ) {
+        if (_uring) {
+            _uring->Send(
+                _socket.native_handle(), buffers, _socket.get_executor(), std::move(keep_alive), std::move(handler)
+            );
+            return;
+        }
+        if (_zero_copy && net::buffer_size(buffers) >= zero_copy_min_bytes) {
+            sendZeroCopy(buffers, 0, std::move(keep_alive), std::move(handler));
+            return;
+        }
+        net::async_write(
+            _socket, buffers,
+            [handler = std::move(handler), keep_alive = std::move(keep_alive)](error_code ec, std::size_t bytes) {
+                handler(ec, bytes);
+            }
+        );
+    }
+
+    void TcpHeadsetSession::sendZeroCopy(
+        std::vector<net::const_buffer> buffers, std::size_t sent, std::shared_ptr<void> keep_alive,
+        TcpUring::Handler &&handler
+    ) {
         auto self(shared_from_this());
         _socket.async_send(
-                net::buffer((uint8_t *) buffer->GetMemory() + _header.BytesWritten(), _header.DataLength()),
-                [this, self](error_code ec, std::size_t bytes_written) mutable {
-                    if (ec ==  boost::asio::error::operation_aborted) {
-                        std::cout << "TcpHeadsetSession: readHeader aborted" << std::endl;
-                        return;
-                    }
-                    _write_timer.cancel();
-                    if (ec) {
-                        std::cout << "TcpHeadsetSession: error writing body: " << ec << "; disconnecting" << std::endl;
-                        TryClose(true);
-                        return;
-                    } else if (bytes_written != _header.DataLength()) {
-                        _header.OffsetPacket(bytes_written);
-                        writeBody();
-                        return;
-                    }
-                    if (_header.IsFinished()) {
-                        bool messages_remaining = false;
-                        {
-                            std::unique_lock<std::mutex> lock(_message_mutex);
-                            _message_queue.pop();
-                            messages_remaining = !_message_queue.empty();
-                        }
-                        if (!messages_remaining) {
-                            return;
+            buffers, MSG_ZEROCOPY,
+            [this, self, buffers, sent, keep_alive, handler = std::move(handler)](
+                error_code ec, std::size_t bytes_written
+            ) mutable {
+                sent += bytes_written;
+                if (bytes_written > 0) {
+                    _zero_copy_holds.push_back({ _zero_copy_next_id++, keep_alive });
+                    _zero_copy_stats.sends += 1;
+                    _zero_copy_stats.bytes += bytes_written;
+                    waitZeroCopy();
+                }
+                consumeBuffers(buffers, bytes_written);
+                if (ec == net::error::no_buffer_space) {
+                    // too many sends waiting on notifications for the socket's option memory; copy the rest
+                    net::async_write(
+                        _socket, buffers,
+                        [sent, keep_alive, handler = std::move(handler)](error_code ec, std::size_t bytes_written) {
+                            handler(ec, sent + bytes_written);
                         }
-                        _header.SetupHeader(_message_queue.front()->GetSize());
-                    } else {
-                        _header.SetupNextHeader();
-                    }
-                    writeHeader(0);
+                    );
+                } else if (ec || buffers.empty()) {
+                    handler(ec, sent);
+                } else {
+                    sendZeroCopy(std::move(buffers), sent, std::move(keep_alive), std::move(handler));
                 }
+            }
         );
     }
 
+    void TcpHeadsetSession::waitZeroCopy() {
+        if (_is_zero_copy_waiting || _zero_copy_holds.empty()) {
+            return;
+        }
+        // notifications show up on the error queue, which the socket reports as an error
+        _is_zero_copy_waiting = true;
+        auto self(shared_from_this());
+        _socket.async_wait(
+            tcp::socket::wait_error,
+            [this, self](error_code ec) {
+                _is_zero_copy_waiting = false;
+                if (ec == net::error::operation_aborted) {
+                    return;
+                }
+                reapZeroCopy();
+            }
+        );
+    }
+
+    void TcpHeadsetSession::reapZeroCopy() {
+        drainZeroCopy();
+        if (_zero_copy && _zero_copy_copied_streak >= zero_copy_copied_limit) {
+            std::cout << "TcpHeadsetSession: kernel keeps copying zero copy sends; copying instead" << std::endl;
+            _zero_copy = false;
+            _zero_copy_stats.is_fallen_back = true;
+        }
+        waitZeroCopy();
+    }
+
+    void TcpHeadsetSession::drainZeroCopy() {
+        // a wakeup can cover more than one notification, and the reactor won't say so again until another lands
+        while (!_zero_copy_holds.empty()) {
+            std::array<char, 128> control{};
+            msghdr message{};
+            message.msg_control = control.data();
+            message.msg_controllen = control.size();
+            if (recvmsg(_socket.native_handle(), &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                return;
+            }
+            for (auto *cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+                const bool is_recverr =
+                    (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                    (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+                if (!is_recverr) {
+                    continue;
+                }
+                const auto *error = (const sock_extended_err *) CMSG_DATA(cmsg);
+                if (error->ee_origin != SO_EE_ORIGIN_ZEROCOPY || error->ee_errno != 0) {
+                    continue;
+                }
+                // ids ee_info through ee_data are done; usually in order, but not on retransmits or teardown
+                const uint32_t first = error->ee_info;
+                const uint32_t span = error->ee_data - first;
+                const auto done = std::remove_if(
+                    _zero_copy_holds.begin(), _zero_copy_holds.end(),
+                    [first, span](const ZeroCopyHold &hold) { return hold.id - first <= span; }
+                );
+                const auto done_count = (uint64_t) std::distance(done, _zero_copy_holds.end());
+                _zero_copy_holds.erase(done, _zero_copy_holds.end());
+                _zero_copy_stats.completions += done_count;
+                if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    _zero_copy_stats.copied += done_count;
+                    _zero_copy_copied_streak += done_count;
+                } else {
+                    _zero_copy_copied_streak = 0;
+                }
+            }
+        }
+    }
+
+    void TcpHeadsetSession::finishFrame() {
+        static_cast<void>(_message_queue.Pop());
+        _frame_started = false;
+        _frame_partly_sent = false;
+    }
 
     void TcpHeadsetSession::TryClose(const bool internal_close) {
         if (!_is_live) return;
@@ -444,16 +829,28 @@ namespace infrastructure {
         if (_socket.is_open()) {
             error_code ec;
             _socket.shutdown(tcp::socket::shutdown_both, ec);
-        }
-        {
-            std::unique_lock<std::mutex> lock(_message_mutex);
-            while(!_message_queue.empty()) {
-                _message_queue.pop();
+            if (_is_zero_copy_waiting) {
+                // the wait holds the session; whatever the kernel hasn't let go of yet is dealt with on the way out
+                _socket.cancel(ec);
             }
         }
+        _message_queue.Clear();
     }
 
     TcpHeadsetSession::~TcpHeadsetSession() {
-        std::cout << "TcpHeadsetSession: Deconstructed" << std::endl;
+        *_headset_count -= 1;
+        drainZeroCopy();
+        if (!_zero_copy_holds.empty() && _socket.is_open()) {
+            // a reset throws away whatever the kernel still had queued, so it's done with the frames once close returns
+            error_code ec;
+            _socket.set_option(net::socket_base::linger(true, 0), ec);
+            _socket.close(ec);
+        }
+        std::cout << "TcpHeadsetSession: Deconstructed; dropped " << _message_queue.DroppedFrames() << " frames";
+        if (_zero_copy_stats.sends > 0) {
+            std::cout << "; " << _zero_copy_stats.sends << " zero copy sends, " << _zero_copy_stats.copied <<
+                " of " << _zero_copy_stats.completions << " copied anyway";
+        }
+        std::cout << std::endl;
     }
 }
\ No newline at end of file
@@ -9,8 +9,11 @@
 #include <queue>
 
 #include "utils/asio_context.hpp"
+#include "utils/sharded_asio_context.hpp"
 #include "utils/buffers.hpp"
+#include "utils/latency.hpp"
 #include "tcp_utils.hpp"
+#include "tcp_uring.hpp"
 
 
 namespace infrastructure {
@@ -20,11 +23,13 @@ namespace infrastructure {
         virtual void TryClose(bool internal_close) = 0;
         virtual tcp_addr GetAddr() = 0;
         virtual unsigned long GetSessionId() = 0;
+        [[nodiscard]] virtual const LatencyStats &GetLatencyStats() = 0;
     };
 
     class WritableTcpSession: public TcpSession {
     public:
         virtual void Write(std::shared_ptr<SizedBuffer> &&send_buffer) = 0;
+        virtual unsigned long GetDroppedFrameCount() = 0;
     };
 
     class TcpServerManager {
@@ -62,18 +67,28 @@ namespace infrastructure {
         unsigned long GetSessionId() override {
             return _session_id;
         }
+        [[nodiscard]] const LatencyStats &GetLatencyStats() override {
+            return _latency_stats;
+        }
         ~TcpCameraSession();
     protected:
         friend class TcpServer;
         TcpCameraSession(
             tcp::socket &&socket, std::shared_ptr<TcpServerManager> &_manager,
-            const tcp_addr addr, const int read_timeout, const int buffer_count, const int buffer_size
+            const tcp_addr addr, const int read_timeout, const int buffer_count, const int buffer_size,
+            const bool cut_through, std::shared_ptr<TcpUring> uring,
+            std::shared_ptr<std::atomic<int>> headset_count, const int headset_held_count
         );
         void Run();
     private:
         void startTimer();
+        void sendHello();
         void readHeader(std::size_t last_bytes);
         void readBody();
+        void onBody(error_code ec, std::size_t bytes_written);
+        void forwardChunk();
+        void finishFrame();
+        void dropFrame();
         void doClose();
         tcp::socket _socket;
         const tcp_addr _addr;
@@ -84,9 +99,25 @@ namespace infrastructure {
         boost::asio::deadline_timer _read_timer;
         const int _read_timeout;
 
+        PacketHeader _hello;
         PacketHeader _header;
         std::shared_ptr<TcpReadBufferPool> _receive_buffer_pool = nullptr;
+        /*
+         * every headset can hold on to up to headset_held_count of this session's frames while it's slow, so the pool
+         * gets that many slabs per headset on top of buffer_count; they only get made once frames are actually held
+         */
+        const int _buffer_count;
+        std::shared_ptr<std::atomic<int>> _headset_count;
+        const int _headset_held_count;
+        int _pooled_headset_count = 0;
         std::shared_ptr<TcpBuffer> _receive_buffer = nullptr;
+        int64_t _receive_start_us = 0;
+        /* cut-through posts every chunk as it lands, instead of the whole frame once it's in */
+        const bool _cut_through;
+        bool _is_forwarding = false;
+        LatencyStats _latency_stats;
+        /* bodies get read into registered buffers through the ring when there is one; headers stay on asio */
+        std::shared_ptr<TcpUring> _uring;
     };
 
     class TcpHeadsetSession : public std::enable_shared_from_this<TcpHeadsetSession>, public WritableTcpSession {
@@ -103,18 +134,45 @@ namespace infrastructure {
             return _session_id;
         }
         void Write(std::shared_ptr<SizedBuffer> &&send_buffer) override;
+        unsigned long GetDroppedFrameCount() override {
+            return _message_queue.DroppedFrames();
+        }
+        [[nodiscard]] const LatencyStats &GetLatencyStats() override {
+            return _latency_stats;
+        }
+        [[nodiscard]] const ZeroCopyStats &GetZeroCopyStats() const {
+            return _zero_copy_stats;
+        }
         ~TcpHeadsetSession();
     protected:
         friend class TcpServer;
         TcpHeadsetSession(
             tcp::socket &&socket, std::shared_ptr<TcpServerManager> &manager, tcp_addr addr,
-            const int write_timeout, const int buffer_count, const int buffer_size
+            const int write_timeout, const int queue_depth, const bool queue_is_conflating,
+            ShardMailbox *mailbox, std::shared_ptr<TcpUring> uring, const bool zero_copy,
+            std::shared_ptr<std::atomic<int>> headset_count
         );
         void ConnectAndWait();
     private:
+        void enqueue(std::shared_ptr<SizedBuffer> &&buffer);
         void startTimer();
-        void writeHeader(std::size_t last_bytes);
-        void writeBody();
+        void readHello();
+        void writeFrame();
+        void onFrameWritten(error_code ec, std::size_t bytes_written);
+        void writeAbort();
+        /* through the ring when there is one, batched with every other headset's; keep_alive lasts until handler */
+        void send(
+            const std::vector<net::const_buffer> &buffers, std::shared_ptr<void> keep_alive,
+            TcpUring::Handler &&handler
+        );
+        void sendZeroCopy(
+            std::vector<net::const_buffer> buffers, std::size_t sent, std::shared_ptr<void> keep_alive,
+            TcpUring::Handler &&handler
+        );
+        void waitZeroCopy();
+        void reapZeroCopy();
+        void drainZeroCopy();
+        void finishFrame();
         void doClose();
         tcp::socket _socket;
         const tcp_addr _addr;
@@ -126,47 +184,106 @@ namespace infrastructure {
         boost::asio::deadline_timer _write_timer;
         const int _write_timeout;
 
+        PacketHeader _hello;
+        std::atomic<uint16_t> _peer_version = { 1 };
         PacketHeader _header;
-        std::mutex _message_mutex;
-        std::shared_ptr<TcpWriteBufferPool> _copy_buffer_pool;
-        std::queue<std::shared_ptr<SizedBuffer>> _message_queue;
+        PacketFrame _frame;
+        bool _is_writing = false;
+        bool _frame_started = false;
+        bool _frame_partly_sent = false;
+        /*
+         * frames are shared with every other session pointed at the same camera, so they are never written to; the
+         * queue bound is what keeps a slow headset from pinning the camera session's read buffers
+         */
+        TcpSendQueue _message_queue;
+        LatencyStats _latency_stats;
+        /* frames get here through the shard's mailbox when sharded, and a plain post otherwise */
+        ShardMailbox *_mailbox;
+        std::shared_ptr<TcpUring> _uring;
+        /* the server's count of live headsets, which the camera sessions size their pools by */
+        std::shared_ptr<std::atomic<int>> _headset_count;
+
+        /*
+         * MSG_ZEROCOPY has the kernel send straight out of the frame, so the frame and its chunk headers have to stay
+         * put until the error queue says the kernel is done with them; each send that queues anything gets the next
+         * notification id. Small sends just get copied, and so does everything once the kernel keeps reporting that
+         * it copied anyway, like it always does on loopback
+         */
+        static constexpr std::size_t zero_copy_min_bytes = 16 * 1024;
+        static constexpr unsigned long zero_copy_copied_limit = 32;
+        struct ZeroCopyHold {
+            uint32_t id;
+            std::shared_ptr<void> keep_alive;
+        };
+        bool _zero_copy;
+        bool _is_zero_copy_waiting = false;
+        uint32_t _zero_copy_next_id = 0;
+        std::deque<ZeroCopyHold> _zero_copy_holds;
+        unsigned long _zero_copy_copied_streak = 0;
+        ZeroCopyStats _zero_copy_stats;
     };
 
     struct TcpServerConfig {
         [[nodiscard]] virtual int get_tcp_server_port() const = 0;
         [[nodiscard]] virtual int get_tcp_server_timeout() const = 0;
         [[nodiscard]] virtual int get_tcp_camera_session_buffer_count() const = 0;
-        [[nodiscard]] virtual int get_tcp_headset_session_buffer_count() const = 0;
+        [[nodiscard]] virtual int get_tcp_headset_session_queue_depth() const = 0;
+        [[nodiscard]] virtual bool get_tcp_headset_session_queue_conflating() const = 0;
         [[nodiscard]] virtual int get_tcp_server_buffer_size() const = 0;
+        [[nodiscard]] virtual bool get_tcp_server_cut_through() const = 0;
+        /* URING falls back to ASIO if the ring can't be set up */
+        [[nodiscard]] virtual TcpServerBackend get_tcp_server_backend() const = 0;
+        /* MSG_ZEROCOPY sends to headsets, where the kernel supports it; asio backend only */
+        [[nodiscard]] virtual bool get_tcp_headset_session_zero_copy() const = 0;
     };
 
     class TcpServer: public std::enable_shared_from_this<TcpServer>{
     public:
+        /* with shards, the acceptor stays on context, and every session it accepts goes to the next shard */
         static std::shared_ptr<TcpServer> Create(
-            const TcpServerConfig &config, net::io_context &context, std::shared_ptr<TcpServerManager> manager
+            const TcpServerConfig &config, net::io_context &context, std::shared_ptr<TcpServerManager> manager,
+            std::shared_ptr<ShardedAsioContext> shards = nullptr
         ) {
-            return std::make_shared<TcpServer>(config, context, std::move(manager));
+            return std::make_shared<TcpServer>(config, context, std::move(manager), std::move(shards));
         }
         TcpServer() = delete;
         TcpServer (const TcpServer&) = delete;
         TcpServer& operator= (const TcpServer&) = delete;
         TcpServer(
-            const TcpServerConfig &config, net::io_context &context, std::shared_ptr<TcpServerManager> manager
+            const TcpServerConfig &config, net::io_context &context, std::shared_ptr<TcpServerManager> manager,
+            std::shared_ptr<ShardedAsioContext> shards = nullptr
         );
         void Start();
         void Stop();
+        /* nullptr on the asio backend */
+        [[nodiscard]] std::shared_ptr<TcpUring> GetUring() const {
+            return _uring;
+        }
         ~TcpServer();
     private:
         void acceptConnections();
+        void startSession(tcp::socket &&socket, ShardMailbox *mailbox);
+        /* the frame a slow headset is writing and a full queue behind it; an unbounded queue can't be planned for */
+        [[nodiscard]] int headsetHeldCount() const {
+            return _tcp_headset_session_queue_depth > 0 ? _tcp_headset_session_queue_depth + 1 : 0;
+        }
+        static constexpr int uring_queue_depth = 256;
+        static constexpr int uring_fixed_buffer_count = 256;
         std::atomic<bool> _is_stopped = { true };
         net::io_context &_context;
+        std::shared_ptr<ShardedAsioContext> _shards;
         tcp::acceptor _acceptor;
         tcp::endpoint _endpoint;
         std::shared_ptr<TcpServerManager> _manager;
         const int _read_write_timeout;
         const int _tcp_camera_session_buffer_count;
-        const int _tcp_headset_session_buffer_count;
+        const int _tcp_headset_session_queue_depth;
+        const bool _tcp_headset_session_queue_conflating;
         const int _tcp_session_buffer_size;
+        const bool _tcp_cut_through;
+        const bool _tcp_headset_session_zero_copy;
+        std::shared_ptr<TcpUring> _uring = nullptr;
+        std::shared_ptr<std::atomic<int>> _headset_count = std::make_shared<std::atomic<int>>(0);
     };
 }
 
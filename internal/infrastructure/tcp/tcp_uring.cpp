@@ -0,0 +1,471 @@
+//
+// Created by brucegoose on 7/29/23.
+//
+
+#include <sstream>
+
+#include "tcp_uring.hpp"
+
+#ifdef _URING_
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <liburing.h>
+#include <boost/lockfree/queue.hpp>
+
+namespace infrastructure {
+
+    namespace {
+        struct UringOp {
+            enum class Kind {
+                SEND,
+                READ_FIXED,
+                WAKE
+            };
+            Kind kind = Kind::SEND;
+            int fd = -1;
+            /* waiting on the socket to be ready before going again */
+            bool is_polling = false;
+            // sends
+            std::vector<iovec> iovecs;
+            std::size_t iovec_offset = 0;
+            msghdr message{};
+            std::size_t sent = 0;
+            // reads
+            void *memory = nullptr;
+            std::size_t size = 0;
+            int fixed_index = -1;
+            // wherever the handler goes
+            net::any_io_executor executor;
+            std::shared_ptr<void> keep_alive;
+            TcpUring::Handler handler;
+        };
+
+        struct UringCompletion {
+            net::any_io_executor executor;
+            std::shared_ptr<void> keep_alive;
+            TcpUring::Handler handler;
+            error_code ec;
+            std::size_t bytes = 0;
+        };
+    }
+
+    class LinuxTcpUring: public TcpUring {
+    public:
+        LinuxTcpUring(const int queue_depth, const int fixed_buffer_count):
+            _incoming(128)
+        {
+            if (io_uring_queue_init(queue_depth, &_ring, 0) < 0) {
+                throw std::runtime_error("io_uring_queue_init failed");
+            }
+            _wake_fd = eventfd(0, EFD_CLOEXEC);
+            if (_wake_fd < 0) {
+                io_uring_queue_exit(&_ring);
+                throw std::runtime_error("eventfd failed");
+            }
+            // a sparse table fills in as camera sessions come and go; older kernels just don't get fixed reads
+            if (fixed_buffer_count > 0 && io_uring_register_buffers_sparse(&_ring, fixed_buffer_count) == 0) {
+                _fixed_slots.resize(fixed_buffer_count, false);
+            }
+        }
+
+        void Start() override {
+            if (_is_started) {
+                return;
+            }
+            _is_started = true;
+            _is_stopped = false;
+            _thread = std::thread([this]() { run(); });
+        }
+
+        void Stop() override {
+            if (!_is_started) {
+                return;
+            }
+            _is_stopped = true;
+            wake(true);
+            if (_thread.joinable()) {
+                _thread.join();
+            }
+            _is_started = false;
+        }
+
+        void Send(
+            const int fd, const std::vector<net::const_buffer> &buffers, const net::any_io_executor &executor,
+            std::shared_ptr<void> keep_alive, Handler &&handler
+        ) override {
+            auto *op = new UringOp();
+            op->kind = UringOp::Kind::SEND;
+            op->fd = fd;
+            op->iovecs.reserve(buffers.size());
+            for (const auto &buffer : buffers) {
+                if (buffer.size() != 0) {
+                    op->iovecs.push_back({ const_cast<void *>(buffer.data()), buffer.size() });
+                }
+            }
+            op->executor = executor;
+            op->keep_alive = std::move(keep_alive);
+            op->handler = std::move(handler);
+            push(op);
+        }
+
+        void ReadFixed(
+            const int fd, void *memory, const std::size_t size, const int fixed_index,
+            const net::any_io_executor &executor, std::shared_ptr<void> keep_alive, Handler &&handler
+        ) override {
+            auto *op = new UringOp();
+            op->kind = UringOp::Kind::READ_FIXED;
+            op->fd = fd;
+            op->memory = memory;
+            op->size = size;
+            op->fixed_index = fixed_index;
+            op->executor = executor;
+            op->keep_alive = std::move(keep_alive);
+            op->handler = std::move(handler);
+            push(op);
+        }
+
+        int RegisterBuffer(void *memory, const std::size_t size) override {
+            std::unique_lock<std::mutex> lock(_fixed_mutex);
+            for (std::size_t i = 0; i < _fixed_slots.size(); i++) {
+                if (_fixed_slots[i]) {
+                    continue;
+                }
+                iovec buffer = { memory, size };
+                __u64 tag = 0;
+                if (io_uring_register_buffers_update_tag(&_ring, (unsigned) i, &buffer, &tag, 1) != 1) {
+                    return -1;
+                }
+                _fixed_slots[i] = true;
+                return (int) i;
+            }
+            return -1;
+        }
+
+        void UnregisterBuffer(const int fixed_index) override {
+            std::unique_lock<std::mutex> lock(_fixed_mutex);
+            if (fixed_index < 0 || fixed_index >= (int) _fixed_slots.size() || !_fixed_slots[fixed_index]) {
+                return;
+            }
+            // reads still in flight keep their own hold on the old registration
+            iovec empty = { nullptr, 0 };
+            __u64 tag = 0;
+            static_cast<void>(io_uring_register_buffers_update_tag(&_ring, (unsigned) fixed_index, &empty, &tag, 1));
+            _fixed_slots[fixed_index] = false;
+        }
+
+        [[nodiscard]] Counters GetCounters() const override {
+            Counters counters;
+            counters.submits = _submits;
+            counters.wakes = _wakes;
+            counters.sends = _sends;
+            counters.fixed_reads = _fixed_reads;
+            counters.polls = _polls;
+            return counters;
+        }
+
+        ~LinuxTcpUring() override {
+            Stop();
+            UringOp *op = nullptr;
+            while (_incoming.pop(op)) {
+                delete op;
+            }
+            // closing the ring cancels whatever was still in flight, so only now can their buffers go
+            io_uring_queue_exit(&_ring);
+            for (auto *in_flight : _in_flight) {
+                delete in_flight;
+            }
+            close(_wake_fd);
+        }
+
+    private:
+        void push(UringOp *op) {
+            if (_is_stopped) {
+                complete(op, net::error::operation_aborted, 0);
+                return;
+            }
+            _incoming.push(op);
+            wake(false);
+        }
+
+        /* only the first push since the ring thread went to sleep has to wake it */
+        void wake(const bool force) {
+            if (_is_waiting.exchange(false) || force) {
+                const uint64_t one = 1;
+                static_cast<void>(!write(_wake_fd, &one, sizeof(one)));
+                _wakes.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        void run() {
+            armWake();
+            while (!_is_stopped) {
+                _is_waiting = true;
+                UringOp *op = nullptr;
+                while (_incoming.pop(op)) {
+                    prepare(op);
+                }
+                // everything prepared since the last pass goes in with this one call
+                const int ret = io_uring_submit_and_wait(&_ring, 1);
+                _submits.fetch_add(1, std::memory_order_relaxed);
+                _is_waiting = false;
+                if (ret < 0 && ret != -EINTR) {
+                    std::cout << "TcpUring: submit failed: " << ret << std::endl;
+                }
+                io_uring_cqe *cqe = nullptr;
+                while (io_uring_peek_cqe(&_ring, &cqe) == 0) {
+                    auto *done = (UringOp *) io_uring_cqe_get_data(cqe);
+                    const int res = cqe->res;
+                    io_uring_cqe_seen(&_ring, cqe);
+                    handle(done, res);
+                }
+                flushCompleted();
+            }
+            // call back whatever is still out, and wait for the kernel to let go of its buffers
+            for (auto *in_flight : _in_flight) {
+                cancel(in_flight);
+            }
+            if (_is_wake_armed) {
+                cancel(&_wake_op);
+            }
+            while (!_in_flight.empty() || _is_wake_armed) {
+                io_uring_submit_and_wait(&_ring, 1);
+                io_uring_cqe *cqe = nullptr;
+                while (io_uring_peek_cqe(&_ring, &cqe) == 0) {
+                    auto *done = (UringOp *) io_uring_cqe_get_data(cqe);
+                    const int res = cqe->res;
+                    io_uring_cqe_seen(&_ring, cqe);
+                    handle(done, res);
+                }
+                flushCompleted();
+            }
+            // nobody's going to get these done anymore
+            UringOp *op = nullptr;
+            while (_incoming.pop(op)) {
+                complete(op, net::error::operation_aborted, 0);
+            }
+        }
+
+        io_uring_sqe *getSqe() {
+            auto *sqe = io_uring_get_sqe(&_ring);
+            if (sqe == nullptr) {
+                // the submission queue filled up; flush it and go again
+                io_uring_submit(&_ring);
+                _submits.fetch_add(1, std::memory_order_relaxed);
+                sqe = io_uring_get_sqe(&_ring);
+            }
+            return sqe;
+        }
+
+        void cancel(UringOp *op) {
+            auto *sqe = getSqe();
+            io_uring_prep_cancel(sqe, op, 0);
+            io_uring_sqe_set_data(sqe, nullptr);
+        }
+
+        void armWake() {
+            auto *sqe = getSqe();
+            _wake_op.kind = UringOp::Kind::WAKE;
+            io_uring_prep_read(sqe, _wake_fd, &_wake_value, sizeof(_wake_value), 0);
+            io_uring_sqe_set_data(sqe, &_wake_op);
+            _is_wake_armed = true;
+        }
+
+        void prepare(UringOp *op) {
+            auto *sqe = getSqe();
+            if (sqe == nullptr) {
+                finish(op, net::error::no_buffer_space, 0);
+                return;
+            }
+            if (op->is_polling) {
+                io_uring_prep_poll_add(sqe, op->fd, op->kind == UringOp::Kind::SEND ? POLLOUT : POLLIN);
+            } else if (op->kind == UringOp::Kind::SEND) {
+                op->message = {};
+                op->message.msg_iov = op->iovecs.data() + op->iovec_offset;
+                op->message.msg_iovlen = op->iovecs.size() - op->iovec_offset;
+                io_uring_prep_sendmsg(sqe, op->fd, &op->message, MSG_NOSIGNAL);
+                _sends.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                io_uring_prep_read_fixed(sqe, op->fd, op->memory, (unsigned) op->size, 0, op->fixed_index);
+                _fixed_reads.fetch_add(1, std::memory_order_relaxed);
+            }
+            io_uring_sqe_set_data(sqe, op);
+            _in_flight.insert(op);
+        }
+
+        void handle(UringOp *op, const int res) {
+            if (op == nullptr) {
+                // the result of a cancel; whatever it cancelled shows up on its own
+                return;
+            } else if (op == &_wake_op) {
+                _is_wake_armed = false;
+                if (!_is_stopped) {
+                    armWake();
+                }
+                return;
+            }
+            _in_flight.erase(op);
+            if (_is_stopped) {
+                finish(op, net::error::operation_aborted, op->sent);
+                return;
+            }
+            if (op->is_polling) {
+                op->is_polling = false;
+                if (res < 0) {
+                    finish(op, error_code(-res, boost::system::system_category()), op->sent);
+                } else {
+                    prepare(op);
+                }
+                return;
+            }
+            if (res == -EAGAIN || res == -EINTR) {
+                // asio has the socket in non-blocking mode, so the kernel won't wait for it on our behalf
+                op->is_polling = true;
+                _polls.fetch_add(1, std::memory_order_relaxed);
+                prepare(op);
+                return;
+            }
+            if (res < 0) {
+                finish(op, error_code(-res, boost::system::system_category()), op->sent);
+                return;
+            }
+            if (op->kind == UringOp::Kind::READ_FIXED) {
+                if (res == 0 && op->size != 0) {
+                    finish(op, net::error::eof, 0);
+                } else {
+                    finish(op, {}, res);
+                }
+                return;
+            }
+            // a short send picks up where it left off, like async_write
+            op->sent += res;
+            auto left = (std::size_t) res;
+            while (op->iovec_offset < op->iovecs.size() && left >= op->iovecs[op->iovec_offset].iov_len) {
+                left -= op->iovecs[op->iovec_offset].iov_len;
+                op->iovec_offset++;
+            }
+            if (op->iovec_offset == op->iovecs.size()) {
+                finish(op, {}, op->sent);
+                return;
+            }
+            auto &partial = op->iovecs[op->iovec_offset];
+            partial.iov_base = (uint8_t *) partial.iov_base + left;
+            partial.iov_len -= left;
+            prepare(op);
+        }
+
+        /* ring thread; handed back with everything else that finished on this pass */
+        void finish(UringOp *op, const error_code ec, const std::size_t bytes) {
+            _completed.push_back({
+                std::move(op->executor), std::move(op->keep_alive), std::move(op->handler), ec, bytes
+            });
+            delete op;
+        }
+
+        /*
+         * one post per io_context for the whole pass, instead of one per op; the rest get posted from a thread that's
+         * already running the context, which doesn't have to wake anything up
+         */
+        void flushCompleted() {
+            std::map<net::execution_context *, std::vector<UringCompletion>> by_context;
+            for (auto &completion : _completed) {
+                auto *context = &net::query(completion.executor, net::execution::context);
+                by_context[context].push_back(std::move(completion));
+            }
+            _completed.clear();
+            for (auto &[context, completions] : by_context) {
+                auto executor = completions.front().executor;
+                net::post(executor, [completions = std::move(completions)]() mutable {
+                    for (auto &completion : completions) {
+                        net::post(
+                            completion.executor,
+                            [
+                                handler = std::move(completion.handler), keep_alive = std::move(completion.keep_alive),
+                                ec = completion.ec, bytes = completion.bytes
+                            ]() mutable {
+                                handler(ec, bytes);
+                            }
+                        );
+                    }
+                });
+            }
+        }
+
+        /* anywhere else; straight back to the op's executor */
+        static void complete(UringOp *op, const error_code ec, const std::size_t bytes) {
+            net::post(
+                op->executor,
+                [handler = std::move(op->handler), keep_alive = std::move(op->keep_alive), ec, bytes]() mutable {
+                    handler(ec, bytes);
+                }
+            );
+            delete op;
+        }
+
+        io_uring _ring{};
+        int _wake_fd = -1;
+        uint64_t _wake_value = 0;
+        UringOp _wake_op;
+        bool _is_wake_armed = false;
+        std::thread _thread;
+        std::atomic<bool> _is_started = { false };
+        std::atomic<bool> _is_stopped = { true };
+        std::atomic<bool> _is_waiting = { false };
+        boost::lockfree::queue<UringOp *> _incoming;
+        /* ring thread only */
+        std::set<UringOp *> _in_flight;
+        std::vector<UringCompletion> _completed;
+        std::mutex _fixed_mutex;
+        std::vector<bool> _fixed_slots;
+        std::atomic<uint64_t> _submits = { 0 };
+        std::atomic<uint64_t> _wakes = { 0 };
+        std::atomic<uint64_t> _sends = { 0 };
+        std::atomic<uint64_t> _fixed_reads = { 0 };
+        std::atomic<uint64_t> _polls = { 0 };
+    };
+
+    std::shared_ptr<TcpUring> TcpUring::Create(const int queue_depth, const int fixed_buffer_count) {
+        try {
+            return std::make_shared<LinuxTcpUring>(queue_depth, fixed_buffer_count);
+        } catch (std::exception &e) {
+            std::cout << "TcpUring: " << e.what() << "; staying on asio" << std::endl;
+            return nullptr;
+        }
+    }
+
+}
+
+#else
+
+namespace infrastructure {
+
+    std::shared_ptr<TcpUring> TcpUring::Create(const int queue_depth, const int fixed_buffer_count) {
+        std::cout << "TcpUring: built without liburing; staying on asio" << std::endl;
+        return nullptr;
+    }
+
+}
+
+#endif
+
+namespace infrastructure {
+
+    std::string TcpUring::Report(const std::string &label) const {
+        const auto counters = GetCounters();
+        std::stringstream out;
+        out << label << " io_uring: submits=" << counters.submits << ", wakes=" << counters.wakes << ", sends="
+            << counters.sends << ", fixed_reads=" << counters.fixed_reads << ", polls=" << counters.polls << "\n";
+        return out.str();
+    }
+
+}
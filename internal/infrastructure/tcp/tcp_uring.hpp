@@ -0,0 +1,74 @@
+//
+// Created by brucegoose on 7/29/23.
+//
+
+#ifndef AUGMENTEDNORMALCY_INFRASTRUCTURE_TCP_URING_HPP
+#define AUGMENTEDNORMALCY_INFRASTRUCTURE_TCP_URING_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils/asio_context.hpp"
+
+namespace infrastructure {
+
+    enum class TcpServerBackend {
+        ASIO,
+        URING
+    };
+
+    /*
+     * the server's socket io on io_uring instead of asio's reactor. One thread owns the ring; sessions hand it sends
+     * and reads from any thread, and everything handed over while it was busy goes to the kernel in one submit, so a
+     * frame fanned out to every headset costs one syscall instead of one per headset. Completions come back on the
+     * executor the op was started from, like any asio handler. Camera read buffers can be registered, so reading
+     * into them skips pinning their pages on every read
+     */
+    class TcpUring: public std::enable_shared_from_this<TcpUring> {
+    public:
+        typedef std::function<void(error_code, std::size_t)> Handler;
+        struct Counters {
+            /* io_uring_enter calls, and the eventfd writes that woke the ring thread up for more */
+            uint64_t submits = 0;
+            uint64_t wakes = 0;
+            uint64_t sends = 0;
+            uint64_t fixed_reads = 0;
+            /* ops that found the socket not ready, and waited on a poll before going again */
+            uint64_t polls = 0;
+        };
+
+        /* nullptr if io_uring can't be had, built without liburing or refused by the kernel; stay on asio then */
+        static std::shared_ptr<TcpUring> Create(int queue_depth, int fixed_buffer_count);
+        TcpUring (const TcpUring&) = delete;
+        TcpUring& operator= (const TcpUring&) = delete;
+        TcpUring() = default;
+        virtual ~TcpUring() = default;
+
+        virtual void Start() = 0;
+        /* anything still queued or in flight completes with operation_aborted */
+        virtual void Stop() = 0;
+
+        /* all of buffers, like net::async_write; keep_alive holds whatever they point into until the handler runs */
+        virtual void Send(
+            int fd, const std::vector<net::const_buffer> &buffers, const net::any_io_executor &executor,
+            std::shared_ptr<void> keep_alive, Handler &&handler
+        ) = 0;
+        /* some of size, like async_receive, into memory inside the registered buffer at fixed_index */
+        virtual void ReadFixed(
+            int fd, void *memory, std::size_t size, int fixed_index, const net::any_io_executor &executor,
+            std::shared_ptr<void> keep_alive, Handler &&handler
+        ) = 0;
+
+        /* the buffer's fixed index, or -1 if there's no room left; reads into it then just go through asio */
+        [[nodiscard]] virtual int RegisterBuffer(void *memory, std::size_t size) = 0;
+        virtual void UnregisterBuffer(int fixed_index) = 0;
+
+        [[nodiscard]] virtual Counters GetCounters() const = 0;
+        [[nodiscard]] std::string Report(const std::string &label) const;
+    };
+
+}
+
+#endif //AUGMENTEDNORMALCY_INFRASTRUCTURE_TCP_URING_HPP
@@ -9,6 +9,16 @@
 #include <iostream>
 #include <thread>
 #include <memory>
+#include <vector>
+#include <array>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+#include <boost/asio/buffer.hpp>
 
 #ifdef __GNUC__
 #define PACK( __Declaration__ ) __Declaration__ __attribute__((__packed__))
@@ -119,6 +129,13 @@ namespace infrastructure {
         std::shared_ptr<SizedBuffer> _buffer;
     };
 
+    /*
+     * version 1 is the bare 24 byte header with zeros at the front; version 2 puts a magic number in the front, its
+     * version in the old session number slot, and follows every chunk header with the frame's metadata.
+     *
+     * a writer only sends version 2 once the reader has said hello (SetupHello); old readers never say hello, and old
+     * writers never listen for it, so mixed fleets fall back to version 1
+     */
     struct PacketHeader {
     public:
         PacketHeader() {
@@ -126,15 +143,25 @@ namespace infrastructure {
         }
         /* common */
         static constexpr uint64_t MaxSize = 65536;
+        static constexpr std::size_t HeaderSize = 24;
+        static constexpr std::size_t ExtendedHeaderSize = 56;
+        static constexpr uint32_t Magic = make_fourcc('A', 'N', 'F', 'H');
+        static constexpr uint16_t LatestVersion = 2;
+        /* version 2 flags */
+        static constexpr uint32_t FlagAbort = 1;
+        static constexpr uint32_t FlagOpenEnded = 2;
         char *Data() {
             return _data;
         }
         [[nodiscard]] std::size_t Size() const {
-            return sizeof _data;
+            return _front == Magic && _version >= 2 ? ExtendedHeaderSize : HeaderSize;
         }
         [[nodiscard]] uint32_t DataLength() const {
             return _data_length;
         }
+        [[nodiscard]] uint32_t TotalBytes() const {
+            return _total_bytes;
+        }
         [[nodiscard]] uint32_t BytesWritten() const {
             return _bytes_written;
         }
@@ -144,27 +171,102 @@ namespace infrastructure {
         }
         [[nodiscard]] bool IsFinished() {
             _bytes_written += _data_length;
+            if (IsOpenEnded() && _total_bytes == 0) {
+                return false;
+            }
             return _bytes_written >= _total_bytes;
         }
         /* write methods */
-        void SetupHeader(uint64_t total_bytes) {
+        void SetupHeader(uint64_t total_bytes, const uint16_t version = 1, const FrameMetadata *metadata = nullptr) {
             std::memset(_data, 0, sizeof _data);
             _recall_packet_number += 1;
             _packet_number = _recall_packet_number;
             _total_bytes = total_bytes;
             _bytes_written = 0;
             _data_length = std::min(total_bytes, MaxSize);
+            if (version < 2) {
+                return;
+            }
+            _front = Magic;
+            _version = version;
+            _extension_size = ExtendedHeaderSize - HeaderSize;
+            if (metadata != nullptr) {
+                _frame_sequence = metadata->sequence_number;
+                _width = metadata->width;
+                _height = metadata->height;
+                _pixel_format = metadata->pixel_format;
+                _sensor_timestamp_us = metadata->sensor_timestamp_us;
+                _encode_timestamp_us = metadata->encode_timestamp_us;
+            }
         }
         void SetupNextHeader() {
             _sequence_number += 1;
-            _data_length = std::min(_total_bytes - _bytes_written, MaxSize);
+            _data_length = IsOpenEnded() ? 0 : std::min(_total_bytes - _bytes_written, MaxSize);
+        }
+        /*
+         * version 2 only; for frames that start going out before their writer knows how big they'll be. Chunks are
+         * whatever size is ready, and the total stays 0 until the last one
+         */
+        void SetupOpenEndedHeader(const uint16_t version, const FrameMetadata *metadata = nullptr) {
+            SetupHeader(0, version, metadata);
+            _flags |= FlagOpenEnded;
+        }
+        void SetupOpenEndedChunk(const uint32_t data_length, const uint32_t total_bytes) {
+            _data_length = data_length;
+            _total_bytes = total_bytes;
+        }
+        /* tells a version 2 reader to throw away the part of this frame it already has */
+        void SetupAbort() {
+            _flags |= FlagAbort;
+            _data_length = 0;
+        }
+        /* sent once by the reading side of a connection, with the highest version it understands */
+        void SetupHello() {
+            std::memset(_data, 0, sizeof _data);
+            _front = Magic;
+            _version = LatestVersion;
         }
         /* read methods */
         [[nodiscard]] bool Ok() const {
-            if (_front != 0 || _back != 0) {
+            if (_back != 0) {
                 return false;
+            } else if (_front == 0) {
+                return true;
             }
-            return true;
+            return _front == Magic && _version >= 2 && _extension_size == ExtendedHeaderSize - HeaderSize;
+        }
+        /* how much of the header to read, given what has come in so far; the front decides if there is more */
+        [[nodiscard]] std::size_t ReadSize(const std::size_t bytes_read) const {
+            return bytes_read < HeaderSize ? HeaderSize : Size();
+        }
+        /* the first chunk of a frame; if the last frame wasn't finished, it never will be */
+        [[nodiscard]] bool IsFrameStart() const {
+            return _sequence_number == 0;
+        }
+        [[nodiscard]] bool IsAborted() const {
+            return Size() == ExtendedHeaderSize && (_flags & FlagAbort) != 0;
+        }
+        [[nodiscard]] bool IsOpenEnded() const {
+            return Size() == ExtendedHeaderSize && (_flags & FlagOpenEnded) != 0;
+        }
+        [[nodiscard]] uint16_t HelloVersion() const {
+            if (_front != Magic || _data_length != 0 || _total_bytes != 0) {
+                return 1;
+            }
+            return std::min(_version, LatestVersion);
+        }
+        [[nodiscard]] FrameMetadata GetMetadata() const {
+            FrameMetadata metadata;
+            if (Size() != ExtendedHeaderSize) {
+                return metadata;
+            }
+            metadata.sequence_number = _frame_sequence;
+            metadata.width = _width;
+            metadata.height = _height;
+            metadata.pixel_format = _pixel_format;
+            metadata.sensor_timestamp_us = _sensor_timestamp_us;
+            metadata.encode_timestamp_us = _encode_timestamp_us;
+            return metadata;
         }
         void ResetHeader() {
             _bytes_written = 0;
@@ -178,13 +280,21 @@ namespace infrastructure {
                 uint32_t _front;
                 uint16_t _packet_number;
                 uint16_t _sequence_number;
-                uint16_t _session_number;
-                uint16_t _timestamp;
+                uint16_t _version;
+                uint16_t _extension_size;
                 uint32_t _data_length;
                 uint32_t _total_bytes;
                 uint32_t _back;
+                /* version 2 */
+                uint32_t _frame_sequence;
+                uint16_t _width;
+                uint16_t _height;
+                uint32_t _pixel_format;
+                uint32_t _flags;
+                int64_t _sensor_timestamp_us;
+                int64_t _encode_timestamp_us;
             };
-            char _data[24] = {};
+            char _data[ExtendedHeaderSize] = {};
         };
         uint64_t _bytes_written = 0;
 
@@ -197,6 +307,194 @@ namespace infrastructure {
 
     };
 
+    class PacketFrame {
+    public:
+        /*
+         * lays out every chunk header of a frame up front so the headers and the chunk bodies can go to the kernel as
+         * one gathered write; the headers come out of PacketHeader itself, so the wire format is unchanged
+         */
+        void Setup(PacketHeader &header, const std::shared_ptr<SizedBuffer> &buffer, const uint16_t version = 1) {
+            Begin(header, buffer, buffer->GetSize(), version);
+            static_cast<void>(Advance(header, buffer->GetSize(), true));
+        }
+        /* for frames that are still landing; Begin once, then Advance every time more of it shows up */
+        void Begin(
+            PacketHeader &header, const std::shared_ptr<SizedBuffer> &buffer, const std::size_t total_bytes,
+            const uint16_t version
+        ) {
+            _memory = (uint8_t *) buffer->GetMemory();
+            _is_done = false;
+            header.SetupHeader(total_bytes, version, buffer->GetMetadata());
+        }
+        /* for frames whose size isn't known yet; every Advance sends all that landed, the one after completion ends it */
+        void BeginOpenEnded(PacketHeader &header, const std::shared_ptr<SizedBuffer> &buffer, const uint16_t version) {
+            _memory = (uint8_t *) buffer->GetMemory();
+            _is_done = false;
+            header.SetupOpenEndedHeader(version, buffer->GetMetadata());
+        }
+        /* lays out the chunks that landed since the last call; returns false if there weren't any */
+        [[nodiscard]] bool Advance(PacketHeader &header, const std::size_t landed, const bool is_complete) {
+            _headers.clear();
+            _chunks.clear();
+            _buffers.clear();
+            if (header.IsOpenEnded()) {
+                advanceOpenEnded(header, landed, is_complete);
+            } else {
+                advanceWhole(header, landed);
+            }
+            for (std::size_t i = 0; i < _headers.size(); i++) {
+                _buffers.emplace_back(_headers[i].data(), header.Size());
+                _buffers.push_back(_chunks[i]);
+            }
+            return !_buffers.empty();
+        }
+        [[nodiscard]] bool IsDone() const {
+            return _is_done;
+        }
+        [[nodiscard]] const std::vector<boost::asio::const_buffer> &Buffers() const {
+            return _buffers;
+        }
+        /*
+         * hands over the chunk headers Buffers() points at, so the next Advance lays its headers out somewhere else;
+         * for sends where the kernel reads the headers after the send call returns
+         */
+        [[nodiscard]] std::shared_ptr<void> PinHeaders() {
+            // a moved vector keeps its storage, so Buffers() still points at the right bytes
+            auto pinned = std::make_shared<Headers>(std::move(_headers));
+            _headers = Headers();
+            return pinned;
+        }
+    private:
+        typedef std::vector<std::array<char, PacketHeader::ExtendedHeaderSize>> Headers;
+        void advanceWhole(PacketHeader &header, const std::size_t landed) {
+            while (!_is_done && header.BytesWritten() + header.DataLength() <= landed) {
+                pushChunk(header);
+                if (header.IsFinished()) {
+                    _is_done = true;
+                    break;
+                }
+                header.SetupNextHeader();
+            }
+        }
+        void advanceOpenEnded(PacketHeader &header, const std::size_t landed, const bool is_complete) {
+            while (!_is_done) {
+                const auto length = std::min<std::size_t>(landed - header.BytesWritten(), PacketHeader::MaxSize);
+                const bool is_last = is_complete && header.BytesWritten() + length == landed;
+                if (length == 0 && !is_last) {
+                    break;
+                }
+                header.SetupOpenEndedChunk(length, is_last ? landed : 0);
+                pushChunk(header);
+                if (header.IsFinished()) {
+                    _is_done = true;
+                    break;
+                }
+                header.SetupNextHeader();
+            }
+        }
+        void pushChunk(PacketHeader &header) {
+            _headers.emplace_back();
+            std::memcpy(_headers.back().data(), header.Data(), header.Size());
+            _chunks.emplace_back(_memory + header.BytesWritten(), header.DataLength());
+        }
+        uint8_t *_memory = nullptr;
+        bool _is_done = false;
+        Headers _headers;
+        std::vector<boost::asio::const_buffer> _chunks;
+        std::vector<boost::asio::const_buffer> _buffers;
+    };
+
+    /* what MSG_ZEROCOPY did for a headset session; written on the session's executor, read from anywhere */
+    struct ZeroCopyStats {
+        /* send calls made with MSG_ZEROCOPY, and the bytes they queued */
+        std::atomic<uint64_t> sends = { 0 };
+        std::atomic<uint64_t> bytes = { 0 };
+        /* sends the kernel has said it's done with, and how many of those it ended up copying anyway */
+        std::atomic<uint64_t> completions = { 0 };
+        std::atomic<uint64_t> copied = { 0 };
+        std::atomic<bool> is_fallen_back = { false };
+    };
+
+    class TcpSendQueue {
+    public:
+        /*
+         * the front of the queue is the frame being written, and it always finishes; depth bounds the unsent frames
+         * behind it (0 is unbounded). When full, a conflating queue swaps its unsent frames for the newest one,
+         * otherwise the newest one is dropped. With cut-through, a frame gets pushed again every time more of it
+         * lands; a frame that's already queued, or was dropped, is left as it is and counted once
+         */
+        TcpSendQueue(const int depth, const bool is_conflating):
+            _depth(std::max(depth, 0)), _is_conflating(is_conflating)
+        {}
+        /* returns true if the caller needs to start writing */
+        [[nodiscard]] bool Push(std::shared_ptr<SizedBuffer> &&buffer) {
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            const auto write_in_progress = !_queue.empty();
+            if (std::find(_queue.begin(), _queue.end(), buffer) != _queue.end() || isDropped(buffer)) {
+                return false;
+            }
+            if (_depth != 0 && _queue.size() > _depth) {
+                if (!_is_conflating) {
+                    drop(buffer);
+                    return false;
+                }
+                for (auto it = _queue.begin() + 1; it != _queue.end(); it++) {
+                    drop(*it);
+                }
+                _queue.erase(_queue.begin() + 1, _queue.end());
+            }
+            _queue.push_back(std::move(buffer));
+            return !write_in_progress;
+        }
+        [[nodiscard]] std::shared_ptr<SizedBuffer> &Front() {
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            return _queue.front();
+        }
+        /* drops the frame that finished writing; returns true if there is another one to write */
+        [[nodiscard]] bool Pop() {
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            if (!_queue.empty()) {
+                _queue.pop_front();
+            }
+            return !_queue.empty();
+        }
+        void Clear() {
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            _queue.clear();
+        }
+        [[nodiscard]] std::size_t Size() {
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            return _queue.size();
+        }
+        [[nodiscard]] unsigned long DroppedFrames() const {
+            return _dropped_frames;
+        }
+    private:
+        /* only frames still landing come back, and there's one of those per camera, so a few is plenty */
+        static constexpr std::size_t DroppedMemory = 8;
+
+        void drop(const std::shared_ptr<SizedBuffer> &buffer) {
+            _dropped_frames += 1;
+            _dropped.push_back(buffer);
+            if (_dropped.size() > DroppedMemory) {
+                _dropped.pop_front();
+            }
+        }
+        /* by owner, so a pooled buffer handed out again for a new frame isn't mistaken for the dropped one */
+        [[nodiscard]] bool isDropped(const std::shared_ptr<SizedBuffer> &buffer) const {
+            return std::any_of(_dropped.begin(), _dropped.end(), [&buffer](const std::weak_ptr<SizedBuffer> &dropped) {
+                return !dropped.owner_before(buffer) && !buffer.owner_before(dropped);
+            });
+        }
+
+        const std::size_t _depth;
+        const bool _is_conflating;
+        std::mutex _queue_mutex;
+        std::deque<std::shared_ptr<SizedBuffer>> _queue;
+        std::deque<std::weak_ptr<SizedBuffer>> _dropped;
+        std::atomic<unsigned long> _dropped_frames = { 0 };
+    };
+
     class TcpBuffer: public ResizableBuffer {
     public:
         TcpBuffer(std::size_t size, const bool is_leaky):
@@ -208,14 +506,31 @@ namespace infrastructure {
             return _buffer;
         }
         [[nodiscard]] std::size_t GetSize() final {
-            return _size;
+            return _size.load(std::memory_order_relaxed);
         }
+        /* a frame that is still landing may get its size set while headsets are reading it */
         void SetSize(std::size_t used_size) final {
-            _size = used_size;
+            _size.store(used_size, std::memory_order_relaxed);
         };
+        [[nodiscard]] std::size_t GetCapacity() const {
+            return _max_size;
+        }
         [[nodiscard]] bool IsLeakyBuffer() final {
             return _is_leaky;
         };
+        [[nodiscard]] FrameMetadata *GetMetadata() final {
+            return &_metadata;
+        }
+        [[nodiscard]] FrameProgress *GetProgress() final {
+            return &_progress;
+        }
+        /* where the buffer sits in the io_uring's registered buffer table, or -1 if it isn't in one */
+        void SetFixedIndex(const int fixed_index) {
+            _fixed_index = fixed_index;
+        }
+        [[nodiscard]] int GetFixedIndex() const {
+            return _fixed_index;
+        }
         ~TcpBuffer() {
             delete[] _buffer;
         }
@@ -223,104 +538,270 @@ namespace infrastructure {
         const std::size_t _max_size;
         const bool _is_leaky;
         unsigned char *_buffer;
-        std::size_t _size;
+        std::atomic<std::size_t> _size = { 0 };
+        FrameMetadata _metadata;
+        FrameProgress _progress;
+        int _fixed_index = -1;
     };
 
+    /*
+     * read buffers in size classes, powers of two from one chunk up to buffer_size, handed out by the length the
+     * frame's header says it has. Slabs get made on demand, and each class keeps its share of the recent frames times
+     * the most buffers that were out at once lately; a class over that gives slabs back only after it has stayed over
+     * for a while, so a frame size that wobbles around a class boundary doesn't churn allocations. There are never
+     * more than buffer_count slabs out or kept, so it never holds more than the old fixed pool did; when they're all
+     * out, everything goes to the leaky buffer, like before. The owner can move buffer_count as the number of readers
+     * that might hold on to buffers changes
+     */
     class TcpReadBufferPool: public std::enable_shared_from_this<TcpReadBufferPool> {
     public:
+        /* a slab was just made, or is about to be deleted */
+        struct SlabHooks {
+            std::function<void(TcpBuffer &)> on_create;
+            std::function<void(TcpBuffer &)> on_destroy;
+        };
+        struct Stats {
+            int slabs = 0;
+            std::size_t reserved_bytes = 0;
+            uint64_t allocations = 0;
+            uint64_t frees = 0;
+            uint64_t leaks = 0;
+        };
+        static constexpr std::size_t MinSlabSize = PacketHeader::MaxSize;
+        /*
+         * the frames a class's share is taken over, and the give backs it has to stay more than the slack over that
+         * share before losing a slab
+         */
+        static constexpr int HistoryLength = 64;
+        static constexpr int ShrinkAfter = 32;
+        static constexpr int ShrinkSlack = 1;
+
         static std::shared_ptr<TcpReadBufferPool> Create(const int buffer_count, const int buffer_size) {
             auto buffer_pool = std::make_shared<TcpReadBufferPool>(buffer_count, buffer_size);
             return buffer_pool;
         }
-        TcpReadBufferPool(const int buffer_count, const int buffer_size) {
-            for (int i = 0; i < buffer_count; i++) {
-                _buffers.push_back(new TcpBuffer(buffer_size, false));
+        TcpReadBufferPool(const int buffer_count, const int buffer_size):
+            _buffer_count(std::max(buffer_count, 1)), _buffer_size(std::max(buffer_size, 1))
+        {
+            std::size_t class_size = MinSlabSize;
+            while (class_size < _buffer_size) {
+                _classes.push_back({ class_size });
+                class_size *= 2;
             }
-            _leaky_buffer = std::make_shared<TcpBuffer>(buffer_size, true);
+            _classes.push_back({ _buffer_size });
+            _history_counts.resize(_classes.size(), 0);
         }
-        [[nodiscard]] std::shared_ptr<TcpBuffer> GetReadBuffer() {
+        /* the most slabs there can be; over it, slabs get deleted as they come back instead of kept */
+        void SetBufferCount(const int buffer_count) {
+            std::unique_lock<std::mutex> lock(_buffer_mutex);
+            _buffer_count = std::max(buffer_count, 1);
+        }
+        /* before the first GetReadBuffer; called outside the pool's lock, from whichever thread made or trimmed the slab */
+        void SetSlabHooks(SlabHooks &&hooks) {
+            _hooks = std::move(hooks);
+        }
+        /* frame_size is the whole frame, from its header; 0 if it doesn't say, which gets the biggest class */
+        [[nodiscard]] std::shared_ptr<TcpBuffer> GetReadBuffer(const std::size_t frame_size = 0) {
+            const int class_index = classOf(frame_size);
             TcpBuffer *buffer = nullptr;
+            TcpBuffer *evicted = nullptr;
+            bool is_created = false;
             {
                 std::unique_lock<std::mutex> lock(_buffer_mutex);
-                if (!_buffers.empty()) {
-                    buffer = _buffers.front();
-                    _buffers.pop_front();
+                buffer = takeFree(class_index);
+                const bool is_short = _classes[class_index].slab_count < targetOf(class_index);
+                if (buffer == nullptr && (!is_short || (int) _slabs.size() >= _buffer_count)) {
+                    // a bigger slab sitting free will do, unless the class is owed one of its own and there's room
+                    for (int i = class_index + 1; i < (int) _classes.size() && buffer == nullptr; i++) {
+                        buffer = takeFree(i);
+                    }
+                }
+                if (buffer == nullptr && (int) _slabs.size() >= _buffer_count) {
+                    // full up; make room from the class that needs its slabs least
+                    evicted = evictFree();
+                }
+                if (buffer == nullptr && (int) _slabs.size() < _buffer_count) {
+                    buffer = new TcpBuffer(_classes[class_index].size, false);
+                    _slabs.push_back(buffer);
+                    _classes[class_index].slab_count += 1;
+                    _stats.allocations += 1;
+                    is_created = true;
+                }
+                observe(class_index, buffer == nullptr ? _out_count : _out_count + 1);
+                if (buffer == nullptr) {
+                    _stats.leaks += 1;
+                    if (_leaky_buffer == nullptr) {
+                        _leaky_buffer = std::make_shared<TcpBuffer>(_buffer_size, true);
+                    }
+                    return _leaky_buffer;
                 }
+                _out_count += 1;
             }
-            if (buffer == nullptr) {
-                return _leaky_buffer;
+            destroy(evicted);
+            if (is_created && _hooks.on_create) {
+                _hooks.on_create(*buffer);
             }
             auto self(shared_from_this());
             auto wrapped_buffer = std::shared_ptr<TcpBuffer>(
                     buffer, [this, self](TcpBuffer * b) mutable {
-                        std::unique_lock<std::mutex> lock(_buffer_mutex);
-                        _buffers.push_back(b);
+                        giveBack(b);
                     }
             );
             return wrapped_buffer;
         };
-        ~TcpReadBufferPool() {
-            TcpBuffer *buffer;
+        [[nodiscard]] Stats GetStats() {
             std::unique_lock<std::mutex> lock(_buffer_mutex);
-            while (!_buffers.empty()) {
-                buffer = _buffers.front();
-                _buffers.pop_front();
-                delete buffer;
+            auto stats = _stats;
+            stats.slabs = (int) _slabs.size();
+            stats.reserved_bytes = 0;
+            for (auto *slab : _slabs) {
+                stats.reserved_bytes += slab->GetCapacity();
+            }
+            if (_leaky_buffer) {
+                stats.reserved_bytes += _leaky_buffer->GetCapacity();
+            }
+            return stats;
+        }
+        ~TcpReadBufferPool() {
+            // every slab handed out holds the pool, so they're all back by now
+            for (auto *slab : _slabs) {
+                destroy(slab);
             }
         }
     private:
-        std::mutex _buffer_mutex;
-        std::deque<TcpBuffer *> _buffers;
-        std::shared_ptr<TcpBuffer> _leaky_buffer;
-    };
+        struct SizeClass {
+            std::size_t size;
+            int slab_count = 0;
+            /* give backs in a row that found the class over its share */
+            int over_count = 0;
+            std::deque<TcpBuffer *> free;
+        };
+        /* a frame's class, and how many slabs were out once it had its buffer */
+        struct Observation {
+            int class_index;
+            int out_count;
+        };
 
-    class TcpWriteBufferPool: public std::enable_shared_from_this<TcpWriteBufferPool> {
-    public:
-        static std::shared_ptr<TcpWriteBufferPool> Create(const int buffer_count, const int buffer_size) {
-            auto buffer_pool = std::make_shared<TcpWriteBufferPool>(buffer_count, buffer_size);
-            return buffer_pool;
+        [[nodiscard]] int classOf(const std::size_t frame_size) const {
+            if (frame_size == 0) {
+                return (int) _classes.size() - 1;
+            }
+            for (int i = 0; i < (int) _classes.size(); i++) {
+                if (frame_size <= _classes[i].size) {
+                    return i;
+                }
+            }
+            // too big for any of them; the caller finds out when it checks the capacity
+            return (int) _classes.size() - 1;
+        }
+        [[nodiscard]] int classOf(const TcpBuffer *buffer) const {
+            return classOf(buffer->GetCapacity());
         }
-        TcpWriteBufferPool(const int buffer_count, const int buffer_size) {
-            for (int i = 0; i < buffer_count; i++) {
-                _buffers.push_back(new TcpBuffer(buffer_size, false));
+        void observe(const int class_index, const int out_count) {
+            if (_history.size() == HistoryLength) {
+                _history_counts[_history.front().class_index] -= 1;
+                _history.pop_front();
+            }
+            _history.push_back({ class_index, out_count });
+            _history_counts[class_index] += 1;
+            _peak_out_count = 0;
+            for (const auto &observed : _history) {
+                _peak_out_count = std::max(_peak_out_count, observed.out_count);
             }
         }
-        [[nodiscard]] std::shared_ptr<TcpBuffer> CopyToWriteBuffer(std::shared_ptr<SizedBuffer> copy_buffer) {
-            TcpBuffer *buffer = nullptr;
-            {
-                std::unique_lock<std::mutex> lock(_buffer_mutex);
-                if (!_buffers.empty()) {
-                    buffer = _buffers.front();
-                    _buffers.pop_front();
+        /* the slabs the recent frames say the class should keep, rounded up */
+        [[nodiscard]] int targetOf(const int class_index) const {
+            if (_history.empty()) {
+                return 0;
+            }
+            const int seen = _history_counts[class_index];
+            return (seen * _peak_out_count + (int) _history.size() - 1) / (int) _history.size();
+        }
+        TcpBuffer *takeFree(const int class_index) {
+            auto &free = _classes[class_index].free;
+            if (free.empty()) {
+                return nullptr;
+            }
+            auto *buffer = free.front();
+            free.pop_front();
+            return buffer;
+        }
+        /* a free slab from whichever class is furthest over its share, if any of them have one */
+        TcpBuffer *evictFree() {
+            int evict_index = -1;
+            int most_over = std::numeric_limits<int>::min();
+            for (int i = 0; i < (int) _classes.size(); i++) {
+                if (_classes[i].free.empty()) {
+                    continue;
+                }
+                const int over = _classes[i].slab_count - targetOf(i);
+                if (over > most_over) {
+                    most_over = over;
+                    evict_index = i;
                 }
             }
-            if (buffer == nullptr) {
-                // just being explicit
+            if (evict_index < 0) {
                 return nullptr;
             }
-            memcpy(buffer->GetMemory(), copy_buffer->GetMemory(), copy_buffer->GetSize());
-            buffer->SetSize(copy_buffer->GetSize());
-            auto self(shared_from_this());
-            auto wrapped_buffer = std::shared_ptr<TcpBuffer>(
-                buffer, [this, self](TcpBuffer * b) mutable {
-                    std::unique_lock<std::mutex> lock(_buffer_mutex);
-                    _buffers.push_back(b);
+            return release(takeFree(evict_index));
+        }
+        /* off the books; the caller destroys it once it's out of the lock */
+        TcpBuffer *release(TcpBuffer *slab) {
+            _classes[classOf(slab)].slab_count -= 1;
+            _slabs.erase(std::find(_slabs.begin(), _slabs.end(), slab));
+            _stats.frees += 1;
+            return slab;
+        }
+        void destroy(TcpBuffer *slab) {
+            if (slab == nullptr) {
+                return;
+            }
+            if (_hooks.on_destroy) {
+                _hooks.on_destroy(*slab);
+            }
+            delete slab;
+        }
+        /* every give back counts toward trimming whichever classes are over their share, used lately or not */
+        void giveBack(TcpBuffer *buffer) {
+            std::vector<TcpBuffer *> trimmed;
+            {
+                std::unique_lock<std::mutex> lock(_buffer_mutex);
+                _out_count -= 1;
+                _classes[classOf(buffer)].free.push_back(buffer);
+                if ((int) _slabs.size() > _buffer_count) {
+                    trimmed.push_back(release(takeFree(classOf(buffer))));
                 }
-            );
-            return wrapped_buffer;
-        };
-        ~TcpWriteBufferPool() {
-            TcpBuffer *buffer;
-            std::unique_lock<std::mutex> lock(_buffer_mutex);
-            while (!_buffers.empty()) {
-                buffer = _buffers.front();
-                _buffers.pop_front();
-                delete buffer;
+                for (int i = 0; i < (int) _classes.size(); i++) {
+                    auto &size_class = _classes[i];
+                    if (size_class.slab_count <= targetOf(i) + ShrinkSlack) {
+                        size_class.over_count = 0;
+                        continue;
+                    }
+                    size_class.over_count += 1;
+                    if (size_class.over_count >= ShrinkAfter && !size_class.free.empty()) {
+                        size_class.over_count = 0;
+                        trimmed.push_back(release(takeFree(i)));
+                    }
+                }
+            }
+            for (auto *slab : trimmed) {
+                destroy(slab);
             }
         }
-    private:
+
+        int _buffer_count;
+        const std::size_t _buffer_size;
         std::mutex _buffer_mutex;
-        std::deque<TcpBuffer *> _buffers;
+        std::vector<SizeClass> _classes;
+        /* every slab there is, out or free */
+        std::vector<TcpBuffer *> _slabs;
+        std::deque<Observation> _history;
+        std::vector<int> _history_counts;
+        int _out_count = 0;
+        int _peak_out_count = 0;
+        SlabHooks _hooks;
+        Stats _stats;
+        std::shared_ptr<TcpBuffer> _leaky_buffer;
     };
 }
 
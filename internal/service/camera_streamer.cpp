@@ -28,5 +28,8 @@ namespace service {
                 _encoder->PostCameraBuffer(std::move(camera_buffer));
             }
         );
+        _tcp_client->SetLatencyStats(_latency_stats);
+        _encoder->SetLatencyStats(_latency_stats);
+        _camera->SetLatencyStats(_latency_stats);
     }
 }
\ No newline at end of file
@@ -27,7 +27,10 @@ namespace service {
             float camera_lens_position,
             float camera_frames_per_second,
             infrastructure::EncoderType encoder_type,
-            int encoder_buffers_downstream
+            int encoder_buffers_downstream,
+            int encoder_stream_chunk_size,
+            int encoder_strip_count,
+            int encoder_frames_in_flight
         ):
             _tcp_server_host(std::move(tcp_server_host)),
             _tcp_server_port(tcp_server_port),
@@ -37,7 +40,10 @@ namespace service {
             _camera_lens_position(camera_lens_position),
             _camera_frames_per_second(camera_frames_per_second),
             _encoder_type(encoder_type),
-            _encoder_buffers_downstream(encoder_buffers_downstream)
+            _encoder_buffers_downstream(encoder_buffers_downstream),
+            _encoder_stream_chunk_size(encoder_stream_chunk_size),
+            _encoder_strip_count(encoder_strip_count),
+            _encoder_frames_in_flight(encoder_frames_in_flight)
         {}
         [[nodiscard]] int get_asio_pool_size() const override {
             return 1;
@@ -72,6 +78,16 @@ namespace service {
         [[nodiscard]] int get_tcp_client_timeout_on_read() const override {
             return 5;
         };
+        /* a camera that falls behind should skip to its newest frame instead of growing latency */
+        [[nodiscard]] int get_tcp_client_send_queue_depth() const override {
+            return 1;
+        };
+        [[nodiscard]] bool get_tcp_client_send_queue_conflating() const override {
+            return true;
+        };
+        [[nodiscard]] bool get_tcp_client_stream_receive() const override {
+            return false;
+        };
         [[nodiscard]] infrastructure::EncoderType get_encoder_type() const override {
             return _encoder_type;
         };
@@ -81,6 +97,15 @@ namespace service {
         [[nodiscard]] std::pair<int, int> get_encoder_width_height() const override {
             return _camera_width_height;
         };
+        [[nodiscard]] unsigned int get_encoder_stream_chunk_size() const override {
+            return _encoder_stream_chunk_size;
+        };
+        [[nodiscard]] unsigned int get_encoder_strip_count() const override {
+            return _encoder_strip_count;
+        };
+        [[nodiscard]] unsigned int get_encoder_frames_in_flight() const override {
+            return _encoder_frames_in_flight;
+        };
         /* not use but meh */
         [[nodiscard]] int get_tcp_client_read_buffer_count() const override {
             return _encoder_buffers_downstream;
@@ -98,6 +123,9 @@ namespace service {
         const float _camera_frames_per_second;
         const infrastructure::EncoderType _encoder_type;
         const int _encoder_buffers_downstream;
+        const int _encoder_stream_chunk_size;
+        const int _encoder_strip_count;
+        const int _encoder_frames_in_flight;
     };
 
     class CameraStreamer:
@@ -132,6 +160,9 @@ namespace service {
             _asio_context.reset();
             _camera.reset();
         }
+        [[nodiscard]] std::string GetLatencyReport() const {
+            return _latency_stats->Report("camera");
+        }
         // currently, we are just trying to get this thing streaming; we don't care about
         // holding sessions client side
         void CreateCameraClientConnection() override {};
@@ -146,6 +177,7 @@ namespace service {
         std::shared_ptr<infrastructure::Encoder> _encoder = nullptr;
         std::shared_ptr<AsioContext> _asio_context = nullptr;
         std::shared_ptr<infrastructure::TcpClient> _tcp_client = nullptr;
+        std::shared_ptr<LatencyStats> _latency_stats = std::make_shared<LatencyStats>();
     };
 }
 
@@ -34,6 +34,7 @@ namespace service {
                     _graphics->PostImage(std::move(buffer));
                 }
         );
+        _graphics->PostBufferLayouts(_decoder->GetBufferLayouts());
     }
 
     void DisplayStreamer::Start() {
@@ -32,7 +32,9 @@ namespace service {
                 int tcp_read_buffers, int decoder_buffers_downstream,
                 infrastructure::DecoderType decoder_type,
                 infrastructure::GraphicsType graphics_type,
-                int switch_automatic_timeout
+                infrastructure::GraphicsFramePath graphics_frame_path,
+                int switch_automatic_timeout,
+                unsigned int decoder_output_scale
         ):
                 _tcp_server_host(std::move(tcp_server_host)),
                 _tcp_server_port(tcp_server_port),
@@ -44,8 +46,10 @@ namespace service {
                 _decoder_type(decoder_type),
                 _decoder_buffers_downstream(decoder_buffers_downstream),
                 _graphics_type(graphics_type),
+                _graphics_frame_path(graphics_frame_path),
                 _image_width_height(std::move(image_width_height)),
-                _switch_automatic_timeout(switch_automatic_timeout)
+                _switch_automatic_timeout(switch_automatic_timeout),
+                _decoder_output_scale(decoder_output_scale)
         {}
         [[nodiscard]] int get_asio_pool_size() const override {
             return 3;
@@ -86,6 +90,16 @@ namespace service {
         [[nodiscard]] infrastructure::GraphicsType get_graphics_type() const override {
             return _graphics_type;
         };
+        [[nodiscard]] infrastructure::GraphicsFramePath get_graphics_frame_path() const override {
+            return _graphics_frame_path;
+        };
+        /* the display is a plain screen, no lenses */
+        [[nodiscard]] infrastructure::LensDistortion get_lens_distortion() const override {
+            return {};
+        };
+        [[nodiscard]] std::string get_graphics_cache_dir() const override {
+            return "";
+        };
         [[nodiscard]] infrastructure::DecoderType get_decoder_type() const override {
             return _decoder_type;
         };
@@ -95,6 +109,18 @@ namespace service {
         [[nodiscard]] std::pair<int, int> get_decoder_width_height() const override {
             return _image_width_height;
         };
+        [[nodiscard]] unsigned int get_decoder_thread_count() const override {
+            return 1;
+        };
+        [[nodiscard]] unsigned int get_decoder_frames_in_flight() const override {
+            return 1;
+        };
+        [[nodiscard]] infrastructure::DecoderAllocatorType get_decoder_allocator_type() const override {
+            return infrastructure::DecoderAllocatorType::V4L2;
+        };
+        [[nodiscard]] unsigned int get_decoder_output_scale() const override {
+            return _decoder_output_scale;
+        };
         [[nodiscard]] int get_tcp_client_timeout_on_read() const override {
             return _tcp_client_timeout_on_read;
         };
@@ -104,6 +130,16 @@ namespace service {
         [[nodiscard]] int get_tcp_client_read_buffer_size() const override {
             return _image_width_height.first * _image_width_height.second * 3 / 2;
         };
+        /* not use but meh */
+        [[nodiscard]] int get_tcp_client_send_queue_depth() const override {
+            return 1;
+        };
+        [[nodiscard]] bool get_tcp_client_send_queue_conflating() const override {
+            return true;
+        };
+        [[nodiscard]] bool get_tcp_client_stream_receive() const override {
+            return false;
+        };
         [[nodiscard]] int get_server_camera_switching_automatic_timeout() const {
             return _switch_automatic_timeout;
         }
@@ -119,7 +155,9 @@ namespace service {
         const int _decoder_buffers_downstream;
         const std::pair<int, int> _image_width_height;
         const infrastructure::GraphicsType _graphics_type;
+        const infrastructure::GraphicsFramePath _graphics_frame_path;
         const int _switch_automatic_timeout;
+        const unsigned int _decoder_output_scale;
     };
 
     class DisplayStreamer:
@@ -40,6 +40,10 @@ namespace service {
                 _graphics->PostImage(std::move(buffer));
             }
         );
+        _graphics->PostBufferLayouts(_decoder->GetBufferLayouts());
+        _tcp_client->SetLatencyStats(_latency_stats);
+        _decoder->SetLatencyStats(_latency_stats);
+        _graphics->SetLatencyStats(_latency_stats);
         _gpio = infrastructure::Gpio::Create(
             config,
             [this, self](const domain::ButtonAction action) {
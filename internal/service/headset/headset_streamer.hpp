@@ -34,7 +34,15 @@ namespace service {
                 int tcp_read_buffers, int decoder_buffers_downstream,
                 infrastructure::DecoderType decoder_type,
                 infrastructure::GraphicsType graphics_type,
-                infrastructure::GpioType gpio_type
+                infrastructure::GraphicsFramePath graphics_frame_path,
+                infrastructure::GpioType gpio_type,
+                bool tcp_client_stream_receive,
+                unsigned int decoder_thread_count,
+                unsigned int decoder_frames_in_flight,
+                infrastructure::DecoderAllocatorType decoder_allocator_type,
+                unsigned int decoder_output_scale,
+                infrastructure::LensDistortion lens_distortion,
+                std::string graphics_cache_dir
         ):
             _tcp_server_host(std::move(tcp_server_host)),
             _tcp_server_port(tcp_server_port),
@@ -46,8 +54,16 @@ namespace service {
             _decoder_type(decoder_type),
             _decoder_buffers_downstream(decoder_buffers_downstream),
             _graphics_type(graphics_type),
+            _graphics_frame_path(graphics_frame_path),
             _image_width_height(std::move(image_width_height)),
-            _gpio_type(gpio_type)
+            _gpio_type(gpio_type),
+            _tcp_client_stream_receive(tcp_client_stream_receive),
+            _decoder_thread_count(decoder_thread_count),
+            _decoder_frames_in_flight(decoder_frames_in_flight),
+            _decoder_allocator_type(decoder_allocator_type),
+            _decoder_output_scale(decoder_output_scale),
+            _lens_distortion(lens_distortion),
+            _graphics_cache_dir(std::move(graphics_cache_dir))
         {}
         [[nodiscard]] int get_asio_pool_size() const override {
             return 2;
@@ -88,6 +104,15 @@ namespace service {
         [[nodiscard]] infrastructure::GraphicsType get_graphics_type() const override {
             return _graphics_type;
         };
+        [[nodiscard]] infrastructure::GraphicsFramePath get_graphics_frame_path() const override {
+            return _graphics_frame_path;
+        };
+        [[nodiscard]] infrastructure::LensDistortion get_lens_distortion() const override {
+            return _lens_distortion;
+        };
+        [[nodiscard]] std::string get_graphics_cache_dir() const override {
+            return _graphics_cache_dir;
+        };
         [[nodiscard]] infrastructure::DecoderType get_decoder_type() const override {
             return _decoder_type;
         };
@@ -97,6 +122,18 @@ namespace service {
         [[nodiscard]] std::pair<int, int> get_decoder_width_height() const override {
             return _image_width_height;
         };
+        [[nodiscard]] unsigned int get_decoder_thread_count() const override {
+            return _decoder_thread_count;
+        };
+        [[nodiscard]] unsigned int get_decoder_frames_in_flight() const override {
+            return _decoder_frames_in_flight;
+        };
+        [[nodiscard]] infrastructure::DecoderAllocatorType get_decoder_allocator_type() const override {
+            return _decoder_allocator_type;
+        };
+        [[nodiscard]] unsigned int get_decoder_output_scale() const override {
+            return _decoder_output_scale;
+        };
         [[nodiscard]] int get_tcp_client_timeout_on_read() const override {
             return _tcp_client_timeout_on_read;
         };
@@ -106,6 +143,16 @@ namespace service {
         [[nodiscard]] int get_tcp_client_read_buffer_size() const override {
             return _image_width_height.first * _image_width_height.second * 3 / 2;
         };
+        /* not use but meh */
+        [[nodiscard]] int get_tcp_client_send_queue_depth() const override {
+            return 1;
+        };
+        [[nodiscard]] bool get_tcp_client_send_queue_conflating() const override {
+            return true;
+        };
+        [[nodiscard]] bool get_tcp_client_stream_receive() const override {
+            return _tcp_client_stream_receive;
+        };
         [[nodiscard]] infrastructure::GpioType get_gpio_type() const override {
             return _gpio_type;
         };
@@ -133,7 +180,15 @@ namespace service {
         const int _decoder_buffers_downstream;
         const std::pair<int, int> _image_width_height;
         const infrastructure::GraphicsType _graphics_type;
+        const infrastructure::GraphicsFramePath _graphics_frame_path;
         const infrastructure::GpioType _gpio_type;
+        const bool _tcp_client_stream_receive;
+        const unsigned int _decoder_thread_count;
+        const unsigned int _decoder_frames_in_flight;
+        const infrastructure::DecoderAllocatorType _decoder_allocator_type;
+        const unsigned int _decoder_output_scale;
+        const infrastructure::LensDistortion _lens_distortion;
+        const std::string _graphics_cache_dir;
     };
 
     class HeadsetStreamer:
@@ -178,6 +233,14 @@ namespace service {
             _decoder.reset();
             _gpio.reset();
         }
+        [[nodiscard]] std::string GetLatencyReport() {
+            std::stringstream out;
+            out << _latency_stats->Report("headset");
+            out << "headset decoder_skips: n=" << _decoder->GetSkippedFrameCount() << ", rate=" <<
+                _decoder->GetSkippedFrameRate() << "/s\n";
+            out << _graphics->GetRenderReport();
+            return out.str();
+        }
         // camera isn't an option so no need to initialize
         void CreateCameraClientConnection() override {};
         void DestroyCameraClientConnection() override {};
@@ -201,6 +264,7 @@ namespace service {
         std::shared_ptr<infrastructure::Graphics> _graphics = nullptr;
         std::shared_ptr<infrastructure::Decoder> _decoder = nullptr;
         std::shared_ptr<infrastructure::Gpio> _gpio = nullptr;
+        std::shared_ptr<LatencyStats> _latency_stats = std::make_shared<LatencyStats>();
         domain::HeadsetState _state;
     };
 }
@@ -33,9 +33,11 @@ namespace service {
                 new_reader_connections.push_back(writer);
             }
             _reader_connections[reader_addr] = new_reader_connections;
+            publishRouting();
         } else {
             std::unique_lock lk2(_connection_mutex);
             _reader_connections[reader_addr] = std::vector<Writer>{};
+            publishRouting();
         }
 
         if (reader_to_remove != nullptr) {
@@ -70,6 +72,7 @@ namespace service {
             _writer_connections.clear();
             _reader_connections.clear();
             _reader_sessions.clear();
+            publishRouting();
             return;
         }
         auto dead_reader_connections = _reader_connections.find(dead_addr);
@@ -85,6 +88,7 @@ namespace service {
              */
             _reader_connections.erase(dead_reader_connections);
             _reader_sessions.erase(dead_reader);
+            publishRouting();
             return;
         }
         /*
@@ -108,6 +112,7 @@ namespace service {
         // finally remove the connection / session stubs
         _reader_connections.erase(dead_reader_connections);
         _reader_sessions.erase(dead_reader);
+        publishRouting();
     }
 
     unsigned long ConnectionManager::AddWriterSession(Writer &&session) {
@@ -142,6 +147,7 @@ namespace service {
                     // reader is accepting connections
                     reader_connection->second.push_back(std::move(session));
                     _writer_connections[writer_addr] = reader_addr;
+                    publishRouting();
                 }
                 // if the above fails, we should throw an error...
             }
@@ -155,6 +161,7 @@ namespace service {
                 if (can_replace != connections.end()) {
                     can_replace->swap(session);
                     session.reset();
+                    publishRouting();
                 }
                 // if this fails, we should throw an error...
             }
@@ -194,6 +201,7 @@ namespace service {
                 connections.clear();
             }
             _writer_sessions.clear();
+            publishRouting();
             return;
         }
         auto dead_writer_connection = _writer_connections.find(dead_addr);
@@ -220,15 +228,17 @@ namespace service {
         connections.erase(remove);
         _writer_connections.erase(dead_writer_connection);
         _writer_sessions.erase(dead_writer);
+        publishRouting();
     }
 
     /*
      * Connection
      */
     void ConnectionManager::PostMessage(const tcp_addr &addr, std::shared_ptr<ResizableBuffer> &&buffer) {
-        std::shared_lock lk(_connection_mutex);
-        auto connections = _reader_connections.find(addr);
-        if (connections == _reader_connections.end()) {
+        // no lock; whatever routing was current when the frame came in is good enough for it
+        const auto routing = std::atomic_load(&_routing);
+        auto connections = routing->find(addr);
+        if (connections == routing->end()) {
             // should never get here
             return;
         }
@@ -249,6 +259,33 @@ namespace service {
         return { _reader_connections.size(), _writer_connections.size() };
     }
 
+    std::string ConnectionManager::GetLatencyReport() {
+        // hold onto the sessions so the report can be built outside of the locks
+        std::vector<Reader> readers;
+        std::vector<Writer> writers;
+        {
+            std::shared_lock lk1(_writer_mutex, std::defer_lock);
+            std::shared_lock lk2(_reader_mutex, std::defer_lock);
+            std::lock(lk1, lk2);
+            for (const auto &[addr, reader] : _reader_sessions) {
+                readers.push_back(reader);
+            }
+            for (const auto &[addr, writer] : _writer_sessions) {
+                writers.push_back(writer);
+            }
+        }
+        std::string report;
+        for (const auto &reader : readers) {
+            report += reader->GetLatencyStats().Report("camera " + reader->GetAddr().to_string());
+        }
+        for (const auto &writer : writers) {
+            const auto label = "headset " + writer->GetAddr().to_string();
+            report += writer->GetLatencyStats().Report(label);
+            report += label + " dropped frames: n=" + std::to_string(writer->GetDroppedFrameCount()) + "\n";
+        }
+        return report;
+    }
+
     bool ConnectionManager::RotateWriterConnection(const tcp_addr &writer_addr) {
         std::shared_lock lk1(_reader_mutex, std::defer_lock);
         std::unique_lock lk2(_connection_mutex, std::defer_lock);
@@ -300,6 +337,7 @@ namespace service {
         next_connection.push_back(std::move(*move_it));
         current_connection.erase(move_it);
         writer_connection->second = next_reader_addr;
+        publishRouting();
         return true;
     }
 
@@ -359,6 +397,7 @@ namespace service {
         first_connection.push_back(std::move(*move_it));
         current_connection.erase(move_it);
         writer_connection->second = first_reader_addr;
+        publishRouting();
         return true;
 
     }
@@ -402,6 +441,7 @@ namespace service {
         for (auto &writer_connection : _writer_connections) {
             writer_connection.second = new_addr;
         }
+        publishRouting();
         return true;
     }
 
@@ -430,6 +470,7 @@ namespace service {
             std::move(connections.begin(), connections.end(), std::back_inserter(move_to_connection));
             connections.erase(connections.begin(), connections.end());
         }
+        publishRouting();
 
         return true;
     }
@@ -444,6 +485,7 @@ namespace service {
             std::lock(lk1, lk2, lk3);
             _reader_connections.clear();
             _writer_connections.clear();
+            publishRouting();
             removed_readers.reserve(_reader_sessions.size());
             for (auto &[_, reader]: _reader_sessions) {
                 removed_readers.push_back(std::move(reader));
@@ -463,5 +505,10 @@ namespace service {
         }
     }
 
+    void ConnectionManager::publishRouting() {
+        // a full copy every time; control calls are rare and the tables are small, frames are neither
+        std::atomic_store(&_routing, std::make_shared<const Routing>(_reader_connections));
+    }
+
 
 }
\ No newline at end of file
@@ -5,6 +5,8 @@
 #ifndef AUGMENTEDNORMALCY_SERVICE_SERVER_CONNECTION_MANAGER_HPP
 #define AUGMENTEDNORMALCY_SERVICE_SERVER_CONNECTION_MANAGER_HPP
 
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <map>
 #include <shared_mutex>
@@ -20,6 +22,8 @@ namespace service {
 
     typedef std::shared_ptr<infrastructure::TcpSession> Reader;
     typedef std::shared_ptr<infrastructure::WritableTcpSession> Writer;
+    /* which writers each reader's frames go to; published whole, and never touched once it is */
+    typedef std::map<tcp_addr, std::vector<Writer>> Routing;
 
     class ConnectionManager {
     public:
@@ -32,12 +36,16 @@ namespace service {
         void PostMessage(const tcp_addr &addr, std::shared_ptr<ResizableBuffer> &&buffer);
         // connection management
         [[nodiscard]] std::pair<int, int> GetConnectionCounts();
+        // latency per camera and per headset
+        [[nodiscard]] std::string GetLatencyReport();
         bool RotateWriterConnection(const tcp_addr &writer_addr);
         bool ResetWriterConnection(const tcp_addr &writer_addr);
         bool RotateAllConnections();
         [[nodiscard]] bool PointReaderAtWriters(const tcp_addr &reader_addr);
         void Clear();
     private:
+        /* call with _connection_mutex held uniquely, after changing _reader_connections */
+        void publishRouting();
         std::atomic<unsigned long> _last_session_number = { 0 };
         std::map<tcp_addr, Reader> _reader_sessions;
         mutable std::shared_mutex _reader_mutex;
@@ -46,6 +54,12 @@ namespace service {
         std::map<tcp_addr, std::vector<Writer>> _reader_connections;
         std::map<tcp_addr, tcp_addr> _writer_connections;
         mutable std::shared_mutex _connection_mutex;
+        /*
+         * what PostMessage reads, every frame, without ever taking _connection_mutex; the control calls above edit
+         * _reader_connections under the mutex, then swap in a fresh copy of it. Only access through
+         * std::atomic_load / std::atomic_store
+         */
+        std::shared_ptr<const Routing> _routing = std::make_shared<const Routing>();
     };
 
 }
@@ -68,8 +68,11 @@ namespace service {
     void ServerStreamer::initialize() {
         assignStrategies();
         _asio_context = AsioContext::Create(_conf);
+        if (_conf.get_asio_shard_count() > 0) {
+            _asio_shards = ShardedAsioContext::Create(_conf);
+        }
         auto self(shared_from_this());
-        _tcp_server = infrastructure::TcpServer::Create(_conf, _asio_context->GetContext(), self);
+        _tcp_server = infrastructure::TcpServer::Create(_conf, _asio_context->GetContext(), self, _asio_shards);
         _websocket_server = infrastructure::WebsocketServer::Create(_conf, _asio_context->GetContext(), self);
     }
 
@@ -83,6 +86,9 @@ namespace service {
             _work_thread = std::make_unique<std::thread>(_camera_switching_strategy);
         }
         /* startup server */
+        if (_asio_shards) {
+            _asio_shards->Start();
+        }
         _asio_context->Start();
         _tcp_server->Start();
         _websocket_server->Start();
@@ -271,6 +277,9 @@ namespace service {
         _websocket_server->Stop();
         _tcp_server->Stop();
         _asio_context->Stop();
+        if (_asio_shards) {
+            _asio_shards->Stop();
+        }
         _is_started = false;
     }
 }
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include "connection_manager.hpp"
 
 #include "utils/asio_context.hpp"
+#include "utils/sharded_asio_context.hpp"
 #include "infrastructure/tcp/tcp_server.hpp"
 #include "infrastructure/websocket/websocket_server.hpp"
 
@@ -31,22 +32,29 @@ namespace service {
 
     struct ServerStreamerConfig :
             public AsioContextConfig,
+            public ShardedAsioContextConfig,
             public infrastructure::TcpServerConfig,
             public infrastructure::WebsocketServerConfig
     {
         ServerStreamerConfig(
-            int asio_pool_size, int tcp_server_port, int tcp_server_timeout_on_read,
-            int camera_buffer_count, int headset_buffer_count, int buffer_size,
+            int asio_pool_size, int asio_shard_count, int tcp_server_port, int tcp_server_timeout_on_read,
+            int camera_buffer_count, int headset_queue_depth, bool headset_queue_conflating, bool cut_through,
+            int buffer_size, infrastructure::TcpServerBackend server_backend, bool headset_zero_copy,
             int websocket_server_port, int websocket_server_timeout,
             ClientAssignmentStrategy assign_strategy, CameraSwitchingStrategy switch_strategy,
             int switch_automatic_timeout
         ):
                 _asio_pool_size(asio_pool_size),
+                _asio_shard_count(asio_shard_count),
                 _tcp_server_port(tcp_server_port),
                 _tcp_server_timeout_on_read(tcp_server_timeout_on_read),
                 _camera_buffer_count(camera_buffer_count),
-                _headset_buffer_count(headset_buffer_count),
+                _headset_queue_depth(headset_queue_depth),
+                _headset_queue_conflating(headset_queue_conflating),
+                _cut_through(cut_through),
                 _buffer_size(buffer_size),
+                _server_backend(server_backend),
+                _headset_zero_copy(headset_zero_copy),
                 _websocket_server_port(websocket_server_port),
                 _websocket_server_timeout(websocket_server_timeout),
                 _assign_strategy(assign_strategy),
@@ -57,6 +65,9 @@ namespace service {
         [[nodiscard]] int get_asio_pool_size() const override {
             return _asio_pool_size;
         };
+        [[nodiscard]] int get_asio_shard_count() const override {
+            return _asio_shard_count;
+        };
 
         [[nodiscard]] int get_tcp_server_port() const override {
             return _tcp_server_port;
@@ -65,13 +76,25 @@ namespace service {
             return _camera_buffer_count;
         }
 
-        [[nodiscard]] int get_tcp_headset_session_buffer_count() const override {
-            return _headset_buffer_count;
+        [[nodiscard]] int get_tcp_headset_session_queue_depth() const override {
+            return _headset_queue_depth;
+        };
+        [[nodiscard]] bool get_tcp_headset_session_queue_conflating() const override {
+            return _headset_queue_conflating;
         };
 
         [[nodiscard]] int get_tcp_server_buffer_size() const override {
             return _buffer_size;
         }
+        [[nodiscard]] bool get_tcp_server_cut_through() const override {
+            return _cut_through;
+        }
+        [[nodiscard]] infrastructure::TcpServerBackend get_tcp_server_backend() const override {
+            return _server_backend;
+        }
+        [[nodiscard]] bool get_tcp_headset_session_zero_copy() const override {
+            return _headset_zero_copy;
+        }
 
         [[nodiscard]] int get_tcp_server_timeout() const override {
             return _tcp_server_timeout_on_read;
@@ -94,11 +117,16 @@ namespace service {
         }
     private:
         const int _asio_pool_size;
+        const int _asio_shard_count;
         const int _tcp_server_port;
         const int _tcp_server_timeout_on_read;
         const int _camera_buffer_count;
-        const int _headset_buffer_count;
+        const int _headset_queue_depth;
+        const bool _headset_queue_conflating;
+        const bool _cut_through;
         const int _buffer_size;
+        const infrastructure::TcpServerBackend _server_backend;
+        const bool _headset_zero_copy;
         const int _websocket_server_port;
         const int _websocket_server_timeout;
         const ClientAssignmentStrategy _assign_strategy;
@@ -118,10 +146,14 @@ namespace service {
         explicit ServerStreamer(ServerStreamerConfig config);
         void Start();
         void Stop();
+        [[nodiscard]] std::string GetLatencyReport() {
+            return _connection_manager.GetLatencyReport();
+        }
         void Unset() {
             _websocket_server.reset();
             _tcp_server.reset();
             _asio_context.reset();
+            _asio_shards.reset();
         }
 
         // tcp / websocket server
@@ -159,6 +191,8 @@ namespace service {
         ServerStreamerConfig _conf;
         std::atomic_bool _is_started = false;
         std::shared_ptr<AsioContext> _asio_context = nullptr;
+        /* camera and headset sessions, when sharded; the acceptor and websockets stay on _asio_context */
+        std::shared_ptr<ShardedAsioContext> _asio_shards = nullptr;
         std::shared_ptr<infrastructure::TcpServer> _tcp_server = nullptr;
         std::shared_ptr<infrastructure::WebsocketServer> _websocket_server = nullptr;
 
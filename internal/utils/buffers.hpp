@@ -7,10 +7,81 @@
 
 #include <memory>
 #include <functional>
+#include <cstdint>
+#include <atomic>
+
+constexpr uint32_t make_fourcc(const char a, const char b, const char c, const char d) {
+    return (uint32_t) a | ((uint32_t) b << 8) | ((uint32_t) c << 16) | ((uint32_t) d << 24);
+}
+
+constexpr uint32_t FOURCC_YUV420 = make_fourcc('Y', 'U', '1', '2');
+constexpr uint32_t FOURCC_MJPEG = make_fourcc('M', 'J', 'P', 'G');
+
+/* travels with a frame from the camera to the headset; zeroed wherever the sender doesn't know it */
+struct FrameMetadata {
+    uint32_t sequence_number = 0;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint32_t pixel_format = 0;
+    /* camera's CLOCK_MONOTONIC; only comparable to other timestamps from the same camera */
+    int64_t sensor_timestamp_us = 0;
+    /* camera's wall clock */
+    int64_t encode_timestamp_us = 0;
+    /* monotonic time the frame entered its current stage; local to each device, never sent */
+    int64_t stage_timestamp_us = 0;
+};
+
+/*
+ * lets a frame go downstream before all of it has landed; the writer publishes how many bytes are good and whether
+ * the frame finished or got cut off, and readers never look past Landed(). A frame nobody called Reset on is whole.
+ * While it fills, the buffer's size is the final size if the writer knew it up front, and 0 if not
+ */
+class FrameProgress {
+public:
+    enum class State {
+        FILLING,
+        COMPLETE,
+        ABORTED,
+    };
+    void Reset() {
+        _landed.store(0, std::memory_order_relaxed);
+        _state.store(State::FILLING, std::memory_order_release);
+    }
+    void Land(const std::size_t landed) {
+        _landed.store(landed, std::memory_order_release);
+    }
+    void Complete(const std::size_t size) {
+        _landed.store(size, std::memory_order_relaxed);
+        _state.store(State::COMPLETE, std::memory_order_release);
+    }
+    void Abort() {
+        _state.store(State::ABORTED, std::memory_order_release);
+    }
+    [[nodiscard]] std::size_t Landed() const {
+        return _landed.load(std::memory_order_acquire);
+    }
+    [[nodiscard]] bool IsFilling() const {
+        return _state.load(std::memory_order_acquire) == State::FILLING;
+    }
+    [[nodiscard]] bool IsAborted() const {
+        return _state.load(std::memory_order_acquire) == State::ABORTED;
+    }
+private:
+    std::atomic<std::size_t> _landed = { 0 };
+    std::atomic<State> _state = { State::COMPLETE };
+};
 
 struct SizedBuffer {
     [[nodiscard]] virtual void *GetMemory() = 0;
     [[nodiscard]] virtual std::size_t GetSize() = 0;
+    /* buffers that don't carry a frame have nothing to report */
+    [[nodiscard]] virtual FrameMetadata *GetMetadata() {
+        return nullptr;
+    }
+    /* only buffers that can be posted before they are full have progress */
+    [[nodiscard]] virtual FrameProgress *GetProgress() {
+        return nullptr;
+    }
 };
 
 using SizedBufferCallback = std::function<void(std::shared_ptr<SizedBuffer>&&)>;
@@ -52,8 +123,11 @@ struct CameraBuffer: public SizedBuffer {
     CameraBuffer(
         void *request, void *buffer, int fd, std::size_t size, int64_t timestamp_us
     ):
-        _request(request), _buffer(buffer), _fd(fd), _size(size), _timestamp_us(timestamp_us)
-    {}
+        _request(request), _buffer(buffer), _fd(fd), _size(size)
+    {
+        _metadata.sensor_timestamp_us = timestamp_us;
+        _metadata.pixel_format = FOURCC_YUV420;
+    }
     [[nodiscard]] void *GetRequest() const {
         return _request;
     }
@@ -66,13 +140,19 @@ struct CameraBuffer: public SizedBuffer {
     [[nodiscard]] void *GetMemory() override {
         return _buffer;
     };
+    [[nodiscard]] int64_t GetTimestamp() const {
+        return _metadata.sensor_timestamp_us;
+    }
+    [[nodiscard]] FrameMetadata *GetMetadata() override {
+        return &_metadata;
+    }
 
 protected:
     void *_request;
     void * _buffer;
     int _fd;
     std::size_t _size;
-    int64_t _timestamp_us;
+    FrameMetadata _metadata;
 };
 
 using CameraBufferCallback = std::function<void(std::shared_ptr<CameraBuffer>&&)>;
@@ -97,14 +177,26 @@ struct DecoderBuffer: public SizedBuffer {
     [[nodiscard]] std::size_t GetIndex() const {
         return _buffer_index;
     };
+    [[nodiscard]] FrameMetadata *GetMetadata() override {
+        return &_metadata;
+    }
 private:
     const unsigned int _buffer_index;
     const int _fd;
     void *_memory;
     std::size_t _size;
+    FrameMetadata _metadata;
 };
 
 using DecoderBufferCallback = std::function<void(std::shared_ptr<DecoderBuffer>&&)>;
 
+/* one of the decoder's buffers as graphics would import it, before any frame lands in it */
+struct DecoderBufferLayout {
+    int fd = -1;
+    std::size_t size = 0;
+    int width = 0;
+    int height = 0;
+};
+
 
 #endif //UTILS_BUFFERS_HPP
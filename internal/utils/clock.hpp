@@ -11,4 +11,18 @@ using namespace std::literals;
 typedef std::chrono::high_resolution_clock Clock;
 typedef std::chrono::time_point<Clock> ClockPoint;
 
+/* the only clock that lines up across devices, as long as they are all synced to the same ntp server */
+inline int64_t wallClockMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+}
+
+/* CLOCK_MONOTONIC; the same clock the camera sensor timestamps come from */
+inline int64_t monotonicClockMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
 #endif //UTILS_CLOCK_HPP
@@ -0,0 +1,221 @@
+//
+// Created by brucegoose on 6/10/23.
+//
+
+#ifndef UTILS_LATENCY_HPP
+#define UTILS_LATENCY_HPP
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <algorithm>
+
+#include "clock.hpp"
+
+/* every hop a frame takes between the sensor and the headset's screen */
+enum class LatencyStage: std::size_t {
+    // camera
+    CAPTURE,
+    ENCODER_QUEUE,
+    ENCODE,
+    TCP_SEND,
+    // server
+    SERVER_RECEIVE,
+    FAN_OUT,
+    // headset
+    HEADSET_RECEIVE,
+    DECODER_QUEUE,
+    DECODE,
+    SWAP,
+    /* camera's encode to headset's swap on the wall clock; only as good as ntp */
+    END_TO_END,
+    COUNT
+};
+
+inline const char *latencyStageName(const LatencyStage stage) {
+    switch (stage) {
+        case LatencyStage::CAPTURE: return "capture";
+        case LatencyStage::ENCODER_QUEUE: return "encoder_queue";
+        case LatencyStage::ENCODE: return "encode";
+        case LatencyStage::TCP_SEND: return "tcp_send";
+        case LatencyStage::SERVER_RECEIVE: return "server_receive";
+        case LatencyStage::FAN_OUT: return "fan_out";
+        case LatencyStage::HEADSET_RECEIVE: return "headset_receive";
+        case LatencyStage::DECODER_QUEUE: return "decoder_queue";
+        case LatencyStage::DECODE: return "decode";
+        case LatencyStage::SWAP: return "swap";
+        case LatencyStage::END_TO_END: return "end_to_end";
+        default: return "unknown";
+    }
+}
+
+struct LatencySummary {
+    uint64_t count = 0;
+    int64_t mean_us = 0;
+    int64_t p50_us = 0;
+    int64_t p90_us = 0;
+    int64_t p99_us = 0;
+    int64_t max_us = 0;
+};
+
+/*
+ * hdr style log-linear histogram of microseconds: exact below 64us, then 32 buckets per power of two (~3% error) up
+ * to ~71 minutes. recording is a handful of relaxed atomic adds, so it is safe from any thread and cheap enough to
+ * leave on; reads are not a consistent snapshot, which is fine for percentiles
+ */
+class LatencyHistogram {
+public:
+    static constexpr int SubBucketBits = 5;
+    static constexpr uint64_t SubBucketCount = 1 << SubBucketBits;
+    static constexpr uint64_t LinearCount = SubBucketCount * 2;
+    static constexpr uint64_t MaxValue = (uint64_t(1) << 32) - 1;
+    static constexpr std::size_t BucketCount = LinearCount + (32 - SubBucketBits - 1) * SubBucketCount;
+
+    void Record(int64_t micros) {
+        // clocks across devices can disagree, so a negative hop is just a very fast one
+        const uint64_t value = std::min<uint64_t>(micros < 0 ? 0 : micros, MaxValue);
+        _buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        _count.fetch_add(1, std::memory_order_relaxed);
+        _sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t last_max = _max.load(std::memory_order_relaxed);
+        while (value > last_max && !_max.compare_exchange_weak(last_max, value, std::memory_order_relaxed)) {}
+    }
+    [[nodiscard]] uint64_t Count() const {
+        return _count.load(std::memory_order_relaxed);
+    }
+    [[nodiscard]] int64_t Max() const {
+        return static_cast<int64_t>(_max.load(std::memory_order_relaxed));
+    }
+    [[nodiscard]] int64_t Mean() const {
+        const auto count = Count();
+        return count == 0 ? 0 : static_cast<int64_t>(_sum.load(std::memory_order_relaxed) / count);
+    }
+    /* percentile in [0, 100]; reports the middle of the bucket it lands in */
+    [[nodiscard]] int64_t Percentile(const double percentile) const {
+        const auto count = Count();
+        if (count == 0) {
+            return 0;
+        }
+        const auto clamped = std::clamp(percentile, 0.0, 100.0);
+        if (clamped >= 100.0) {
+            return Max();
+        }
+        const auto target = std::max<uint64_t>(1, static_cast<uint64_t>(clamped / 100.0 * count + 0.5));
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < BucketCount; i++) {
+            seen += _buckets[i].load(std::memory_order_relaxed);
+            if (seen >= target) {
+                return std::min(bucketMiddle(i), Max());
+            }
+        }
+        return Max();
+    }
+    [[nodiscard]] LatencySummary Summary() const {
+        LatencySummary summary;
+        summary.count = Count();
+        summary.mean_us = Mean();
+        summary.p50_us = Percentile(50);
+        summary.p90_us = Percentile(90);
+        summary.p99_us = Percentile(99);
+        summary.max_us = Max();
+        return summary;
+    }
+    void Reset() {
+        for (auto &bucket : _buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        _count = 0;
+        _sum = 0;
+        _max = 0;
+    }
+private:
+    static std::size_t bucketIndex(const uint64_t value) {
+        if (value < LinearCount) {
+            return value;
+        }
+        const int msb = 63 - __builtin_clzll(value);
+        const int shift = msb - SubBucketBits;
+        return LinearCount + (shift - 1) * SubBucketCount + ((value >> shift) - SubBucketCount);
+    }
+    static int64_t bucketMiddle(const std::size_t index) {
+        if (index < LinearCount) {
+            return static_cast<int64_t>(index);
+        }
+        const auto shift = (index - LinearCount) / SubBucketCount + 1;
+        const auto sub_bucket = (index - LinearCount) % SubBucketCount + SubBucketCount;
+        return static_cast<int64_t>((sub_bucket << shift) + (uint64_t(1) << (shift - 1)));
+    }
+    std::array<std::atomic<uint64_t>, BucketCount> _buckets{};
+    std::atomic<uint64_t> _count = { 0 };
+    std::atomic<uint64_t> _sum = { 0 };
+    std::atomic<uint64_t> _max = { 0 };
+};
+
+/* one histogram per stage; a camera, a server session, or a headset only fills in the stages it sees */
+class LatencyStats {
+public:
+    void Record(const LatencyStage stage, const int64_t micros) {
+        _stages[static_cast<std::size_t>(stage)].Record(micros);
+    }
+    /* records the time since start_us, and hands back now so the next stage can start from it */
+    int64_t RecordSince(const LatencyStage stage, const int64_t start_us) {
+        const auto now = monotonicClockMicros();
+        Record(stage, now - start_us);
+        return now;
+    }
+    [[nodiscard]] const LatencyHistogram &Get(const LatencyStage stage) const {
+        return _stages[static_cast<std::size_t>(stage)];
+    }
+    [[nodiscard]] LatencySummary Summary(const LatencyStage stage) const {
+        return Get(stage).Summary();
+    }
+    void Reset() {
+        for (auto &stage : _stages) {
+            stage.Reset();
+        }
+    }
+    /* for logging on demand; never call this from the frame path */
+    [[nodiscard]] std::string Report(const std::string &label) const {
+        std::stringstream out;
+        for (std::size_t i = 0; i < _stages.size(); i++) {
+            const auto summary = _stages[i].Summary();
+            if (summary.count == 0) {
+                continue;
+            }
+            out << label << " " << latencyStageName(static_cast<LatencyStage>(i))
+                << ": n=" << summary.count << ", mean=" << summary.mean_us << "us, p50=" << summary.p50_us
+                << "us, p90=" << summary.p90_us << "us, p99=" << summary.p99_us << "us, max=" << summary.max_us
+                << "us\n";
+        }
+        return out.str();
+    }
+private:
+    std::array<LatencyHistogram, static_cast<std::size_t>(LatencyStage::COUNT)> _stages;
+};
+
+/*
+ * for components that feed stats owned by their service; hand the stats over before Start, they are read without a
+ * lock after that
+ */
+class LatencyStatsSink {
+public:
+    void SetLatencyStats(std::shared_ptr<LatencyStats> stats) {
+        _latency_stats = std::move(stats);
+    }
+protected:
+    void recordLatency(const LatencyStage stage, const int64_t micros) const {
+        if (_latency_stats) {
+            _latency_stats->Record(stage, micros);
+        }
+    }
+    int64_t recordLatencySince(const LatencyStage stage, const int64_t start_us) const {
+        const auto now = monotonicClockMicros();
+        recordLatency(stage, now - start_us);
+        return now;
+    }
+    std::shared_ptr<LatencyStats> _latency_stats = nullptr;
+};
+
+#endif //UTILS_LATENCY_HPP
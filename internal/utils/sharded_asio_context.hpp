@@ -0,0 +1,162 @@
+//
+// Created by brucegoose on 7/28/23.
+//
+
+#ifndef UTILS_SHARDED_ASIO_CONTEXT_HPP
+#define UTILS_SHARDED_ASIO_CONTEXT_HPP
+
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <boost/lockfree/queue.hpp>
+
+#include "utils/asio_context.hpp"
+
+struct ShardedAsioContextConfig {
+    /* 0 keeps every session on the shared AsioContext pool */
+    [[nodiscard]] virtual int get_asio_shard_count() const = 0;
+};
+
+/*
+ * hands work to a shard from any thread; a push is lock free, and the shard only gets woken up by the first push
+ * since it last emptied the box, so a camera fanning out to a dozen headsets on one shard costs one wakeup
+ */
+class ShardMailbox {
+public:
+    explicit ShardMailbox(net::io_context &context):
+        _context(context),
+        _queue(128)
+    {}
+    ShardMailbox(const ShardMailbox&) = delete;
+    ShardMailbox& operator= (const ShardMailbox&) = delete;
+    void Post(std::function<void()> &&work) {
+        auto *boxed = new std::function<void()>(std::move(work));
+        _queue.push(boxed);
+        if (!_is_scheduled.exchange(true)) {
+            net::post(_context, [this]() { drain(); });
+        }
+    }
+    ~ShardMailbox() {
+        std::function<void()> *boxed = nullptr;
+        while (_queue.pop(boxed)) {
+            delete boxed;
+        }
+    }
+private:
+    void drain() {
+        // cleared first, so anything pushed from here on schedules another drain
+        _is_scheduled = false;
+        std::function<void()> *boxed = nullptr;
+        while (_queue.pop(boxed)) {
+            (*boxed)();
+            delete boxed;
+        }
+    }
+    net::io_context &_context;
+    boost::lockfree::queue<std::function<void()> *> _queue;
+    std::atomic<bool> _is_scheduled = { false };
+};
+
+/*
+ * one single threaded io_context per shard, each thread pinned to its own core; sessions live on one shard for good,
+ * so their handlers never hop threads and never need a strand. Anything that crosses shards goes through the target
+ * shard's mailbox
+ */
+class ShardedAsioContext: public std::enable_shared_from_this<ShardedAsioContext> {
+public:
+
+    static std::shared_ptr<ShardedAsioContext> Create(const ShardedAsioContextConfig &config) {
+        return std::make_shared<ShardedAsioContext>(config);
+    }
+
+    explicit ShardedAsioContext(const ShardedAsioContextConfig &config) {
+        const int shard_count = std::max(config.get_asio_shard_count(), 1);
+        for (int i = 0; i < shard_count; i++) {
+            _shards.push_back(std::make_unique<Shard>());
+        }
+    }
+
+    void Start() noexcept {
+        if (_started) {
+            return;
+        }
+        _started = true;
+        _stop = false;
+        const auto core_count = std::max(std::thread::hardware_concurrency(), 1u);
+        for (std::size_t i = 0; i < _shards.size(); i++) {
+            auto &shard = *_shards[i];
+            shard.thread = std::thread([&context = shard.context, &stop = this->_stop]() {
+                while (!stop) {
+                    try {
+                        context.run();
+                    } catch (std::exception const &e) {
+                        std::cout << e.what() << std::endl;
+                    } catch (...) {
+                        std::cout << "WTF Error" << std::endl;
+                    }
+                }
+            });
+            // best effort; more shards than cores just share
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(i % core_count, &cpu_set);
+            if (pthread_setaffinity_np(shard.thread.native_handle(), sizeof(cpu_set), &cpu_set) != 0) {
+                std::cout << "ShardedAsioContext: couldn't pin shard " << i << std::endl;
+            }
+        }
+    }
+
+    void Stop() {
+        if (!_started) {
+            return;
+        }
+        _stop = true;
+        for (auto &shard : _shards) {
+            shard->guard.reset();
+            shard->context.stop();
+        }
+        for (auto &shard : _shards) {
+            if (shard->thread.joinable()) {
+                shard->thread.join();
+            }
+        }
+        _started = false;
+    }
+
+    [[nodiscard]] std::size_t ShardCount() const {
+        return _shards.size();
+    }
+    /* round robin, for whoever connects next */
+    [[nodiscard]] std::size_t NextShard() {
+        return _next_shard++ % _shards.size();
+    }
+    net::io_context &GetContext(const std::size_t shard) {
+        return _shards[shard]->context;
+    }
+    ShardMailbox &GetMailbox(const std::size_t shard) {
+        return _shards[shard]->mailbox;
+    }
+    ~ShardedAsioContext() {
+        Stop();
+    }
+private:
+    struct Shard {
+        // a concurrency hint of 1 lets asio skip most of its scheduler locking
+        net::io_context context = net::io_context(1);
+        net::executor_work_guard<net::io_context::executor_type> guard = net::make_work_guard(context);
+        ShardMailbox mailbox = ShardMailbox(context);
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Shard>> _shards;
+    std::atomic<std::size_t> _next_shard = { 0 };
+    std::atomic<bool> _stop = { false };
+    std::atomic<bool> _started = { false };
+};
+
+#endif //UTILS_SHARDED_ASIO_CONTEXT_HPP
@@ -9,6 +9,8 @@
 
 #include <mutex>
 #include <deque>
+#include <vector>
+#include <atomic>
 
 class DecoderSizedBuffer: public SizedBuffer {
 public:
@@ -27,6 +29,34 @@ public:
     const unsigned int _buffer_size;
 };
 
+/* stands in for the tcp client's receive buffer: posted again every time more of the frame lands */
+class DecoderStreamingBuffer: public SizedBuffer {
+public:
+    explicit DecoderStreamingBuffer(std::size_t buffer_size):
+        _buffer(buffer_size)
+    {}
+    [[nodiscard]] void *GetMemory() override {
+        return _buffer.data();
+    };
+    [[nodiscard]] std::size_t GetSize() override {
+        return _size.load(std::memory_order_relaxed);
+    };
+    void SetSize(std::size_t size) {
+        _size.store(size, std::memory_order_relaxed);
+    }
+    [[nodiscard]] FrameMetadata *GetMetadata() override {
+        return &_metadata;
+    }
+    [[nodiscard]] FrameProgress *GetProgress() override {
+        return &_progress;
+    }
+private:
+    std::vector<char> _buffer;
+    std::atomic<std::size_t> _size = { 0 };
+    FrameMetadata _metadata;
+    FrameProgress _progress;
+};
+
 class DecoderSizedBufferPool: public SizedBufferPool {
 public:
     explicit DecoderSizedBufferPool(
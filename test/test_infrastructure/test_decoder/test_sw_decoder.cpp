@@ -11,6 +11,13 @@
 using namespace std::literals;
 typedef std::chrono::high_resolution_clock Clock;
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <condition_variable>
+#include <jpeglib.h>
+
 #include "infrastructure/decoder/decoder.hpp"
 
 #include "fake_buffer_pool.hpp"
@@ -18,6 +25,14 @@ typedef std::chrono::high_resolution_clock Clock;
 #include <atomic>
 
 class TestSwDecoderConfig: public infrastructure::DecoderConfig {
+public:
+    explicit TestSwDecoderConfig(
+        unsigned int thread_count = 1, unsigned int frames_in_flight = 1, unsigned int output_scale = 1
+    ):
+        _thread_count(thread_count),
+        _frames_in_flight(frames_in_flight),
+        _output_scale(output_scale)
+    {}
     [[nodiscard]] infrastructure::DecoderType get_decoder_type() const override {
         return infrastructure::DecoderType::SW;
     };
@@ -27,8 +42,50 @@ class TestSwDecoderConfig: public infrastructure::DecoderConfig {
     [[nodiscard]] std::pair<int, int> get_decoder_width_height() const override {
         return { 1536, 864 };
     };
+    [[nodiscard]] unsigned int get_decoder_thread_count() const override {
+        return _thread_count;
+    };
+    [[nodiscard]] unsigned int get_decoder_frames_in_flight() const override {
+        return _frames_in_flight;
+    };
+    [[nodiscard]] infrastructure::DecoderAllocatorType get_decoder_allocator_type() const override {
+        return infrastructure::DecoderAllocatorType::AUTO;
+    };
+    [[nodiscard]] unsigned int get_decoder_output_scale() const override {
+        return _output_scale;
+    };
+private:
+    const unsigned int _thread_count;
+    const unsigned int _frames_in_flight;
+    const unsigned int _output_scale;
 };
 
+TEST_CASE("INFRASTRUCTURE_DECODER_SW_DECODER-Allocator") {
+    const std::pair<int, int> width_height = { 1536, 864 };
+    const std::size_t frame_size = width_height.first * width_height.second * 3 / 2;
+
+    // AUTO lands on whatever this box has, but it always lands somewhere
+    for (const auto type : { infrastructure::DecoderAllocatorType::AUTO, infrastructure::DecoderAllocatorType::HEAP }) {
+        auto allocator = infrastructure::DecoderAllocator::Create(type, width_height);
+        auto t1 = Clock::now();
+        auto buffers = allocator->Allocate(4);
+        auto t2 = Clock::now();
+        REQUIRE(buffers.size() == 4);
+        for (auto *buffer : buffers) {
+            REQUIRE(buffer->GetSize() >= frame_size);
+            allocator->StartWrite(buffer);
+            memset(buffer->GetMemory(), 0x80, frame_size);
+            allocator->FinishWrite(buffer);
+        }
+        allocator->Free(buffers);
+        REQUIRE(buffers.empty());
+
+        auto d1 = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1);
+        std::cout << "test_infrastructure/decoder/sw_decoder " << allocator->GetName() << " allocator: " <<
+            d1.count() << "us for 4 buffers" << std::endl;
+    }
+}
+
 TEST_CASE("INFRASTRUCTURE_DECODER_SW_DECODER-Start_And_Stop") {
     TestSwDecoderConfig conf;
     std::chrono::time_point< std::chrono::high_resolution_clock> t1, t2, t3, t4, t5;
@@ -169,4 +226,572 @@ TEST_CASE("INFRASTRUCTURE_DECODER_SW_DECODER-Stress_test") {
     std::cout << "Time to decode 10s of data at 30fps: " << d1.count() << std::endl;
 
     std::cout << "Used frames: " << counter << std::endl;
-}
\ No newline at end of file
+}
+
+TEST_CASE("INFRASTRUCTURE_DECODER_SW_DECODER-Streaming_Frame") {
+    std::filesystem::path this_dir = TEST_DIR;
+    this_dir /= "test_infrastructure";
+    this_dir /= "test_decoder";
+
+    auto in_frame = this_dir;
+    in_frame /= "in.jpeg";
+
+    std::ifstream test_in_file(in_frame, std::ios::in | std::ios::binary);
+    test_in_file.seekg(0, std::ios::end);
+    size_t input_size = test_in_file.tellg();
+    test_in_file.seekg(0, std::ios::beg);
+    std::vector<char> in_buf(input_size);
+    test_in_file.read(in_buf.data(), input_size);
+
+    std::mutex out_mutex;
+    std::vector<std::vector<uint8_t>> out_frames;
+    std::chrono::time_point<std::chrono::high_resolution_clock> out_time;
+    auto callback = [&out_mutex, &out_frames, &out_time](std::shared_ptr<DecoderBuffer> &&buffer) mutable {
+        std::unique_lock<std::mutex> lock(out_mutex);
+        out_time = Clock::now();
+        auto *memory = (uint8_t *) buffer->GetMemory();
+        out_frames.emplace_back(memory, memory + buffer->GetSize());
+    };
+    auto frame_count = [&out_mutex, &out_frames]() {
+        std::unique_lock<std::mutex> lock(out_mutex);
+        return out_frames.size();
+    };
+
+    const std::size_t chunk_size = 16384;
+    const auto chunk_gap = 1ms;
+    // lands the frame a chunk at a time, the way the tcp client hands it over; returns when its last byte landed
+    auto stream_frame = [&](infrastructure::Decoder &decoder, bool abort_halfway) {
+        auto buffer = std::make_shared<DecoderStreamingBuffer>(input_size);
+        auto *progress = buffer->GetProgress();
+        progress->Reset();
+        buffer->SetSize(0);
+        std::size_t landed = 0;
+        while (landed + chunk_size < input_size) {
+            memcpy((char *) buffer->GetMemory() + landed, in_buf.data() + landed, chunk_size);
+            landed += chunk_size;
+            progress->Land(landed);
+            decoder.PostJpegBuffer(std::shared_ptr<SizedBuffer>(buffer));
+            std::this_thread::sleep_for(chunk_gap);
+            if (abort_halfway && landed > input_size / 2) {
+                progress->Abort();
+                decoder.PostJpegBuffer(std::shared_ptr<SizedBuffer>(buffer));
+                return Clock::now();
+            }
+        }
+        memcpy((char *) buffer->GetMemory() + landed, in_buf.data() + landed, input_size - landed);
+        buffer->SetSize(input_size);
+        progress->Complete(input_size);
+        auto last_byte_time = Clock::now();
+        decoder.PostJpegBuffer(std::shared_ptr<SizedBuffer>(buffer));
+        return last_byte_time;
+    };
+    auto wait_for_frames = [&frame_count](std::size_t count) {
+        for (int i = 0; i < 200 && frame_count() < count; i++) {
+            std::this_thread::sleep_for(5ms);
+        }
+        return frame_count();
+    };
+
+    TestSwDecoderConfig conf;
+    auto decoder = infrastructure::Decoder::Create(conf, std::move(callback));
+    decoder->Start();
+
+    // whole frame, landed the same way, but only handed over once it's all there
+    DecoderSizedBufferPool pool(input_size, 1);
+    std::chrono::time_point<std::chrono::high_resolution_clock> whole_last_byte;
+    {
+        auto buffer = pool.GetSizedBuffer();
+        for (std::size_t landed = 0; landed < input_size; landed += chunk_size) {
+            const auto size = std::min(chunk_size, input_size - landed);
+            memcpy((char *) buffer->GetMemory() + landed, in_buf.data() + landed, size);
+            std::this_thread::sleep_for(chunk_gap);
+        }
+        whole_last_byte = Clock::now();
+        decoder->PostJpegBuffer(std::move(buffer));
+    }
+    REQUIRE(wait_for_frames(1) == 1);
+    const auto whole_us = std::chrono::duration_cast<std::chrono::microseconds>(out_time - whole_last_byte);
+
+    const auto stream_last_byte = stream_frame(*decoder, false);
+    REQUIRE(wait_for_frames(2) == 2);
+    const auto stream_us = std::chrono::duration_cast<std::chrono::microseconds>(out_time - stream_last_byte);
+
+    // a frame cut off partway never comes out, gives its decoder buffer back, and doesn't hold up the next one
+    for (int i = 0; i < 5; i++) {
+        stream_frame(*decoder, true);
+    }
+    std::this_thread::sleep_for(50ms);
+    REQUIRE(frame_count() == 2);
+    stream_frame(*decoder, false);
+    REQUIRE(wait_for_frames(3) == 3);
+
+    decoder->Stop();
+
+    REQUIRE(out_frames[0] == out_frames[1]);
+    REQUIRE(out_frames[0] == out_frames[2]);
+
+    std::cout << "test_infrastructure/decoder/sw_decoder last byte to decoded frame: whole " << whole_us.count() <<
+        "us, streaming " << stream_us.count() << "us" << std::endl;
+}
+
+// the same frame, coefficient for coefficient, with a restart marker after every row of MCUs
+static std::vector<uint8_t> addRestartMarkers(const std::vector<char> &in_buf) {
+    struct jpeg_decompress_struct dinfo;
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr djerr, cjerr;
+    dinfo.err = jpeg_std_error(&djerr);
+    cinfo.err = jpeg_std_error(&cjerr);
+    jpeg_create_decompress(&dinfo);
+    jpeg_create_compress(&cinfo);
+
+    jpeg_mem_src(&dinfo, (const unsigned char *) in_buf.data(), in_buf.size());
+    jpeg_read_header(&dinfo, TRUE);
+    auto *coefficients = jpeg_read_coefficients(&dinfo);
+
+    unsigned char *out_memory = nullptr;
+    unsigned long out_size = 0;
+    jpeg_mem_dest(&cinfo, &out_memory, &out_size);
+    jpeg_copy_critical_parameters(&dinfo, &cinfo);
+    cinfo.restart_in_rows = 1;
+    jpeg_write_coefficients(&cinfo, coefficients);
+    jpeg_finish_compress(&cinfo);
+    jpeg_finish_decompress(&dinfo);
+
+    std::vector<uint8_t> out(out_memory, out_memory + out_size);
+    jpeg_destroy_compress(&cinfo);
+    jpeg_destroy_decompress(&dinfo);
+    free(out_memory);
+    return out;
+}
+
+TEST_CASE("INFRASTRUCTURE_DECODER_SW_DECODER-Restart_Parallel") {
+    std::filesystem::path this_dir = TEST_DIR;
+    this_dir /= "test_infrastructure";
+    this_dir /= "test_decoder";
+
+    auto in_frame = this_dir;
+    in_frame /= "in.jpeg";
+
+    std::ifstream test_in_file(in_frame, std::ios::in | std::ios::binary);
+    test_in_file.seekg(0, std::ios::end);
+    size_t input_size = test_in_file.tellg();
+    test_in_file.seekg(0, std::ios::beg);
+    std::vector<char> in_buf(input_size);
+    test_in_file.read(in_buf.data(), input_size);
+
+    const auto restart_frame = addRestartMarkers(in_buf);
+
+    std::mutex out_mutex;
+    std::vector<std::vector<uint8_t>> out_frames;
+    std::chrono::time_point<std::chrono::high_resolution_clock> out_time;
+    auto callback = [&out_mutex, &out_frames, &out_time](std::shared_ptr<DecoderBuffer> &&buffer) mutable {
+        std::unique_lock<std::mutex> lock(out_mutex);
+        out_time = Clock::now();
+        auto *memory = (uint8_t *) buffer->GetMemory();
+        out_frames.emplace_back(memory, memory + buffer->GetSize());
+    };
+    auto wait_for_frames = [&out_mutex, &out_frames](std::size_t count) {
+        for (int i = 0; i < 400; i++) {
+            {
+                std::unique_lock<std::mutex> lock(out_mutex);
+                if (out_frames.size() >= count) {
+                    break;
+                }
+            }
+            std::this_thread::sleep_for(5ms);
+        }
+        std::unique_lock<std::mutex> lock(out_mutex);
+        return out_frames.size();
+    };
+    auto decode_whole = [](infrastructure::Decoder &decoder, const uint8_t *data, std::size_t size) {
+        auto buffer = std::make_shared<DecoderStreamingBuffer>(size);
+        memcpy(buffer->GetMemory(), data, size);
+        buffer->SetSize(size);
+        auto in_time = Clock::now();
+        decoder.PostJpegBuffer(std::move(buffer));
+        return in_time;
+    };
+
+    // the reference: the original frame, on one thread
+    {
+        TestSwDecoderConfig conf(1);
+        auto decoder = infrastructure::Decoder::Create(conf, callback);
+        decoder->Start();
+        decode_whole(*decoder, (const uint8_t *) in_buf.data(), input_size);
+        REQUIRE(wait_for_frames(1) == 1);
+        decoder->Stop();
+    }
+
+    TestSwDecoderConfig conf(4);
+    auto decoder = infrastructure::Decoder::Create(conf, callback);
+    decoder->Start();
+
+    const int frames = 30;
+    std::chrono::microseconds total_us(0);
+    for (int i = 0; i < frames; i++) {
+        const auto in_time = decode_whole(*decoder, restart_frame.data(), restart_frame.size());
+        REQUIRE(wait_for_frames(2 + i) == 2 + i);
+        total_us += std::chrono::duration_cast<std::chrono::microseconds>(out_time - in_time);
+    }
+
+    // and once more, landing a chunk at a time so bands go out before the frame is done
+    {
+        const std::size_t chunk_size = 16384;
+        auto buffer = std::make_shared<DecoderStreamingBuffer>(restart_frame.size());
+        auto *progress = buffer->GetProgress();
+        progress->Reset();
+        buffer->SetSize(0);
+        std::size_t landed = 0;
+        while (landed + chunk_size < restart_frame.size()) {
+            memcpy((char *) buffer->GetMemory() + landed, restart_frame.data() + landed, chunk_size);
+            landed += chunk_size;
+            progress->Land(landed);
+            decoder->PostJpegBuffer(std::shared_ptr<SizedBuffer>(buffer));
+            std::this_thread::sleep_for(1ms);
+        }
+        memcpy(
+            (char *) buffer->GetMemory() + landed, restart_frame.data() + landed, restart_frame.size() - landed
+        );
+        buffer->SetSize(restart_frame.size());
+        progress->Complete(restart_frame.size());
+        decoder->PostJpegBuffer(std::shared_ptr<SizedBuffer>(buffer));
+        REQUIRE(wait_for_frames(2 + frames) == 2 + frames);
+    }
+
+    decoder->Stop();
+
+    for (std::size_t i = 1; i < out_frames.size(); i++) {
+        REQUIRE(out_frames[0] == out_frames[i]);
+    }
+
+    std::cout << "test_infrastructure/decoder/sw_decoder restart parallel decode: " <<
+        total_us.count() / frames << "us per frame over " << std::thread::hardware_concurrency() <<
+        " cores" << std::endl;
+}
+
+TEST_CASE("INFRASTRUCTURE_DECODER_SW_DECODER-Output_Scale") {
+    std::filesystem::path this_dir = TEST_DIR;
+    this_dir /= "test_infrastructure";
+    this_dir /= "test_decoder";
+
+    auto in_frame = this_dir;
+    in_frame /= "in.jpeg";
+
+    std::ifstream test_in_file(in_frame, std::ios::in | std::ios::binary);
+    test_in_file.seekg(0, std::ios::end);
+    size_t input_size = test_in_file.tellg();
+    test_in_file.seekg(0, std::ios::beg);
+    std::vector<char> in_buf(input_size);
+    test_in_file.read(in_buf.data(), input_size);
+
+    const auto restart_frame = addRestartMarkers(in_buf);
+
+    std::mutex out_mutex;
+    std::condition_variable out_cv;
+    std::vector<std::vector<uint8_t>> out_frames;
+    std::vector<std::pair<int, int>> out_sizes;
+    auto callback = [&out_mutex, &out_cv, &out_frames, &out_sizes](std::shared_ptr<DecoderBuffer> &&buffer) mutable {
+        std::unique_lock<std::mutex> lock(out_mutex);
+        auto *memory = (uint8_t *) buffer->GetMemory();
+        out_frames.emplace_back(memory, memory + buffer->GetSize());
+        out_sizes.emplace_back(buffer->GetMetadata()->width, buffer->GetMetadata()->height);
+        out_cv.notify_one();
+    };
+    auto decode = [&](unsigned int thread_count, unsigned int scale, const uint8_t *data, std::size_t size, int frames) {
+        {
+            std::unique_lock<std::mutex> lock(out_mutex);
+            out_frames.clear();
+            out_sizes.clear();
+        }
+        TestSwDecoderConfig conf(thread_count, 1, scale);
+        auto decoder = infrastructure::Decoder::Create(conf, callback);
+        // graphics imports these before the first frame, so they have to describe what frames come back in
+        const auto layouts = decoder->GetBufferLayouts();
+        REQUIRE(layouts.size() == conf.get_decoder_downstream_buffer_count());
+        decoder->Start();
+        const auto t1 = Clock::now();
+        for (int i = 0; i < frames; i++) {
+            auto buffer = std::make_shared<DecoderStreamingBuffer>(size);
+            memcpy(buffer->GetMemory(), data, size);
+            buffer->SetSize(size);
+            decoder->PostJpegBuffer(std::move(buffer));
+            std::unique_lock<std::mutex> lock(out_mutex);
+            out_cv.wait_for(lock, 2s, [&out_frames, i]() { return out_frames.size() > (std::size_t) i; });
+        }
+        const auto t2 = Clock::now();
+        decoder->Stop();
+        std::unique_lock<std::mutex> lock(out_mutex);
+        REQUIRE(out_frames.size() == (std::size_t) frames);
+        for (const auto &layout : layouts) {
+            REQUIRE(out_sizes[0] == std::make_pair(layout.width, layout.height));
+            REQUIRE(out_frames[0].size() <= layout.size);
+        }
+        return std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / frames;
+    };
+
+    const int width = 1536;
+    const int height = 864;
+    const int frames = 20;
+    const auto full_us = decode(1, 1, (const uint8_t *) in_buf.data(), input_size, frames);
+    const auto full = out_frames[0];
+    std::cout << "test_infrastructure/decoder/sw_decoder scale 1/1: " << full_us << "us per frame" << std::endl;
+
+    for (const unsigned int scale : { 2u, 4u, 8u }) {
+        const auto scaled_us = decode(1, scale, (const uint8_t *) in_buf.data(), input_size, frames);
+        const int out_width = width / (int) scale;
+        const int out_height = height / (int) scale;
+        REQUIRE(out_sizes[0] == std::make_pair(out_width, out_height));
+        const auto scaled = out_frames[0];
+
+        // the DCT's idea of a smaller frame should be close to just averaging the full one down
+        const auto plane_error = [&](std::size_t full_at, std::size_t scaled_at, int plane_width, int plane_height) {
+            const int s = (int) scale;
+            uint64_t error = 0;
+            for (int y = 0; y < plane_height / s; y++) {
+                for (int x = 0; x < plane_width / s; x++) {
+                    int sum = 0;
+                    for (int dy = 0; dy < s; dy++) {
+                        for (int dx = 0; dx < s; dx++) {
+                            sum += full[full_at + (y * s + dy) * plane_width + x * s + dx];
+                        }
+                    }
+                    error += std::abs(sum / (s * s) - scaled[scaled_at + y * (plane_width / s) + x]);
+                }
+            }
+            return (double) error / ((plane_width / s) * (plane_height / s));
+        };
+        const auto y_error = plane_error(0, 0, width, height);
+        const auto u_error = plane_error(width * height, out_width * out_height, width / 2, height / 2);
+        REQUIRE(y_error < 4.0);
+        REQUIRE(u_error < 4.0);
+
+        // cut into bands, the same frame comes out the same
+        decode(4, scale, restart_frame.data(), restart_frame.size(), 1);
+        REQUIRE(out_sizes[0] == std::make_pair(out_width, out_height));
+        const std::size_t frame_size = out_width * out_height * 3 / 2;
+        const auto banded = out_frames[0];
+        decode(1, scale, restart_frame.data(), restart_frame.size(), 1);
+        REQUIRE(std::equal(banded.begin(), banded.begin() + frame_size, out_frames[0].begin()));
+
+        std::cout << "test_infrastructure/decoder/sw_decoder scale 1/" << scale << ": " << scaled_us <<
+            "us per frame, mean error y " << y_error << ", u " << u_error << std::endl;
+    }
+}
+
+TEST_CASE("INFRASTRUCTURE_DECODER_SW_DECODER-Latest_Wins") {
+    std::filesystem::path this_dir = TEST_DIR;
+    this_dir /= "test_infrastructure";
+    this_dir /= "test_decoder";
+
+    auto in_frame = this_dir;
+    in_frame /= "in.jpeg";
+
+    std::ifstream test_in_file(in_frame, std::ios::in | std::ios::binary);
+    test_in_file.seekg(0, std::ios::end);
+    size_t input_size = test_in_file.tellg();
+    test_in_file.seekg(0, std::ios::beg);
+    std::vector<char> in_buf(input_size);
+    test_in_file.read(in_buf.data(), input_size);
+
+    std::mutex out_mutex;
+    std::condition_variable out_cv;
+    int out_count = 0;
+    int64_t last_sequence = -1;
+    auto callback = [&](std::shared_ptr<DecoderBuffer> &&buffer) mutable {
+        std::unique_lock<std::mutex> lock(out_mutex);
+        out_count += 1;
+        last_sequence = buffer->GetMetadata()->sequence_number;
+        out_cv.notify_one();
+    };
+
+    // a burst far faster than one worker can decode; everything but what it's on and the newest should be skipped
+    const int frame_count = 100;
+    TestSwDecoderConfig conf;
+    auto decoder = infrastructure::Decoder::Create(conf, callback);
+    decoder->Start();
+    std::vector<std::weak_ptr<SizedBuffer>> posted;
+    int released_on_post = 0;
+    const auto t1 = Clock::now();
+    for (uint32_t i = 0; i < frame_count; i++) {
+        auto buffer = std::make_shared<DecoderStreamingBuffer>(input_size);
+        memcpy(buffer->GetMemory(), in_buf.data(), input_size);
+        buffer->SetSize(input_size);
+        buffer->GetMetadata()->sequence_number = i;
+        posted.emplace_back(buffer);
+        decoder->PostJpegBuffer(std::move(buffer));
+        // a skipped frame is let go by the post that replaced it, not whenever the decoder gets around to it
+        if (i > 0 && posted[i - 1].expired()) {
+            released_on_post += 1;
+        }
+    }
+    {
+        std::unique_lock<std::mutex> lock(out_mutex);
+        out_cv.wait_for(lock, 2s, [&]() { return last_sequence == frame_count - 1; });
+    }
+    const auto t2 = Clock::now();
+    decoder->Stop();
+
+    const auto skipped = (int) decoder->GetSkippedFrameCount();
+    REQUIRE(last_sequence == frame_count - 1);
+    REQUIRE(skipped > 0);
+    REQUIRE(out_count + skipped == frame_count);
+    REQUIRE(released_on_post >= skipped);
+
+    const auto d1 = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1);
+    std::cout << "test_infrastructure/decoder/sw_decoder latest wins: " << out_count << " decoded, " << skipped <<
+        " skipped, newest out after " << d1.count() << "ms" << std::endl;
+}
+
+TEST_CASE("INFRASTRUCTURE_DECODER_SW_DECODER-Frames_In_Flight") {
+    std::filesystem::path this_dir = TEST_DIR;
+    this_dir /= "test_infrastructure";
+    this_dir /= "test_decoder";
+
+    auto in_frame = this_dir;
+    in_frame /= "in.jpeg";
+
+    std::ifstream test_in_file(in_frame, std::ios::in | std::ios::binary);
+    test_in_file.seekg(0, std::ios::end);
+    size_t input_size = test_in_file.tellg();
+    test_in_file.seekg(0, std::ios::beg);
+    std::vector<char> in_buf(input_size);
+    test_in_file.read(in_buf.data(), input_size);
+
+    const auto restart_frame = addRestartMarkers(in_buf);
+    const int frame_count = 60;
+    std::vector<uint8_t> reference;
+
+    // one at a time first, as the baseline; then a pool, and a pool whose frames are also split into bands
+    for (const auto &[frames_in_flight, thread_count] : { std::pair{ 1u, 1u }, { 3u, 1u }, { 2u, 2u } }) {
+        std::mutex out_mutex;
+        int out_count = 0;
+        int64_t last_sequence = -1;
+        bool is_in_order = true;
+        bool is_identical = true;
+        Clock::time_point out_time;
+        auto callback = [&](std::shared_ptr<DecoderBuffer> &&buffer) mutable {
+            const auto now = Clock::now();
+            auto *memory = (uint8_t *) buffer->GetMemory();
+            const auto sequence = (int64_t) buffer->GetMetadata()->sequence_number;
+            std::unique_lock<std::mutex> lock(out_mutex);
+            is_in_order = is_in_order && sequence > last_sequence;
+            last_sequence = sequence;
+            out_count += 1;
+            out_time = now;
+            if (reference.empty()) {
+                reference.assign(memory, memory + buffer->GetSize());
+            } else {
+                is_identical = is_identical && std::equal(reference.begin(), reference.end(), memory);
+            }
+        };
+
+        double fps = 0;
+        {
+            TestSwDecoderConfig conf(thread_count, frames_in_flight);
+            auto decoder = infrastructure::Decoder::Create(conf, std::move(callback));
+            decoder->Start();
+            const auto *frame = thread_count == 1 ? (const uint8_t *) in_buf.data() : restart_frame.data();
+            const auto frame_size = thread_count == 1 ? input_size : restart_frame.size();
+            const auto start = Clock::now();
+            for (uint32_t i = 0; i < frame_count; i++) {
+                auto buffer = std::make_shared<DecoderStreamingBuffer>(frame_size);
+                memcpy(buffer->GetMemory(), frame, frame_size);
+                buffer->SetSize(frame_size);
+                buffer->GetMetadata()->sequence_number = i;
+                decoder->PostJpegBuffer(std::move(buffer));
+                // about as fast as one worker can keep up with
+                std::this_thread::sleep_for(3ms);
+            }
+            std::this_thread::sleep_for(200ms);
+            {
+                std::unique_lock<std::mutex> lock(out_mutex);
+                fps = out_count / std::chrono::duration<double>(out_time - start).count();
+            }
+            decoder->Stop();
+        }
+
+        REQUIRE(out_count > 0);
+        REQUIRE(is_in_order);
+        REQUIRE(is_identical);
+
+        std::cout << "test_infrastructure/decoder/sw_decoder " << frames_in_flight << " frames in flight, " <<
+            thread_count << " threads each: " << out_count << " of " << frame_count << " frames out, " <<
+            fps << " fps" << std::endl;
+    }
+}
+
+#ifdef _TURBOJPEG_
+
+class TestTurboDecoderConfig: public TestSwDecoderConfig {
+    [[nodiscard]] infrastructure::DecoderType get_decoder_type() const override {
+        return infrastructure::DecoderType::TURBO;
+    };
+};
+
+TEST_CASE("INFRASTRUCTURE_DECODER_SW_DECODER-Turbo_Benchmark") {
+    std::filesystem::path this_dir = TEST_DIR;
+    this_dir /= "test_infrastructure";
+    this_dir /= "test_decoder";
+
+    auto in_frame = this_dir;
+    in_frame /= "in.jpeg";
+
+    std::ifstream test_in_file(in_frame, std::ios::in | std::ios::binary);
+    test_in_file.seekg(0, std::ios::end);
+    size_t input_size = test_in_file.tellg();
+    test_in_file.seekg(0, std::ios::beg);
+    std::vector<char> in_buf(input_size);
+    test_in_file.read(in_buf.data(), input_size);
+
+    const int frame_count = 60;
+    std::vector<std::vector<uint8_t>> out_frames;
+
+    // the raw libjpeg api first, as the baseline
+    for (const bool is_turbo : { false, true }) {
+        std::mutex out_mutex;
+        std::condition_variable out_cv;
+        int out_count = 0;
+        Clock::time_point out_time;
+        std::vector<uint8_t> out_frame;
+        auto callback = [&](std::shared_ptr<DecoderBuffer> &&buffer) mutable {
+            const auto now = Clock::now();
+            auto *memory = (uint8_t *) buffer->GetMemory();
+            std::unique_lock<std::mutex> lock(out_mutex);
+            out_count += 1;
+            out_time = now;
+            out_frame.assign(memory, memory + buffer->GetSize());
+            out_cv.notify_one();
+        };
+
+        TestSwDecoderConfig sw_conf;
+        TestTurboDecoderConfig turbo_conf;
+        const infrastructure::DecoderConfig &conf = is_turbo ?
+            (const infrastructure::DecoderConfig &) turbo_conf : sw_conf;
+        long total_us = 0;
+        {
+            auto decoder = infrastructure::Decoder::Create(conf, std::move(callback));
+            decoder->Start();
+            for (int i = 0; i < frame_count; i++) {
+                auto buffer = std::make_shared<DecoderStreamingBuffer>(input_size);
+                memcpy(buffer->GetMemory(), in_buf.data(), input_size);
+                buffer->SetSize(input_size);
+                const auto posted = Clock::now();
+                decoder->PostJpegBuffer(std::move(buffer));
+                std::unique_lock<std::mutex> lock(out_mutex);
+                REQUIRE(out_cv.wait_for(lock, 1s, [&out_count, i]() { return out_count > i; }));
+                total_us += std::chrono::duration_cast<std::chrono::microseconds>(out_time - posted).count();
+            }
+            decoder->Stop();
+        }
+        out_frames.push_back(std::move(out_frame));
+
+        std::cout << "test_infrastructure/decoder/sw_decoder " <<
+            (is_turbo ? "turbojpeg planes" : "libjpeg raw") << ": " << total_us / frame_count << "us per frame" <<
+            std::endl;
+    }
+
+    // both come out of the same raw decode, just driven differently
+    REQUIRE(out_frames[0] == out_frames[1]);
+}
+
+#endif
@@ -9,15 +9,44 @@
 #include <cstring>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 #include <chrono>
 using namespace std::literals;
 typedef std::chrono::high_resolution_clock Clock;
 
+#include <jpeglib.h>
+
 #include "infrastructure/encoder/encoder.hpp"
 
 #include "fake_camera.hpp"
 
 class TestEncoderConfig : public infrastructure::EncoderConfig {
+public:
+    explicit TestEncoderConfig(
+        unsigned int stream_chunk_size = 0, infrastructure::EncoderType encoder_type = infrastructure::EncoderType::SW,
+        unsigned int strip_count = 0, unsigned int frames_in_flight = 1
+    ):
+        _stream_chunk_size(stream_chunk_size),
+        _encoder_type(encoder_type),
+        _strip_count(strip_count),
+        _frames_in_flight(frames_in_flight)
+    {}
+private:
+    const unsigned int _stream_chunk_size;
+    const infrastructure::EncoderType _encoder_type;
+    const unsigned int _strip_count;
+    const unsigned int _frames_in_flight;
+    [[nodiscard]] unsigned int get_encoder_stream_chunk_size() const override {
+        return _stream_chunk_size;
+    };
+    [[nodiscard]] unsigned int get_encoder_strip_count() const override {
+        return _strip_count;
+    };
+    [[nodiscard]] unsigned int get_encoder_frames_in_flight() const override {
+        return _frames_in_flight;
+    };
     [[nodiscard]] unsigned int get_encoder_downstream_buffer_count() const override {
         return 4;
     };
@@ -25,7 +54,7 @@ class TestEncoderConfig : public infrastructure::EncoderConfig {
         return { 1536, 864 };
     };
     [[nodiscard]] infrastructure::EncoderType get_encoder_type() const override {
-        return infrastructure::EncoderType::SW;
+        return _encoder_type;
     };
 };
 
@@ -164,3 +193,340 @@ TEST_CASE("INFRASTRUCTURE_ENCODER_SW_ENCODER-StressTest") {
 
     std::cout << "Used frames: " << counter << std::endl;
 }
+
+TEST_CASE("INFRASTRUCTURE_ENCODER_SW_ENCODER-Streaming_Latency") {
+    std::filesystem::path in_frame = TEST_DIR;
+    in_frame /= "test_infrastructure";
+    in_frame /= "test_encoder";
+    in_frame /= "in.yuv";
+
+    std::ifstream test_file_in(in_frame, std::ios::out | std::ios::binary);
+    std::vector<char> in_buf(1990656);
+    test_file_in.read(in_buf.data(), 1990656);
+    FakeCamera camera(5);
+
+    const int frame_count = 30;
+    std::vector<char> whole_frame;
+    std::vector<char> streamed_frame;
+
+    // whole frames first, so there's something to hold the streamed ones up against
+    for (const unsigned int chunk_size : { 0u, 16384u }) {
+        TestEncoderConfig conf(chunk_size);
+        std::mutex frame_mutex;
+        std::condition_variable frame_cv;
+        bool is_started = false;
+        bool is_done = false;
+        int post_count = 0;
+        Clock::time_point first_bytes, last_bytes;
+        auto &out_frame = chunk_size == 0 ? whole_frame : streamed_frame;
+
+        SizedBufferCallback callback = [&](std::shared_ptr<SizedBuffer> &&ptr) {
+            const auto now = Clock::now();
+            auto *progress = ptr->GetProgress();
+            std::unique_lock<std::mutex> lock(frame_mutex);
+            post_count += 1;
+            if (!is_started) {
+                first_bytes = now;
+                is_started = true;
+            }
+            if (progress == nullptr || !progress->IsFilling()) {
+                last_bytes = now;
+                out_frame.assign((char *) ptr->GetMemory(), (char *) ptr->GetMemory() + ptr->GetSize());
+                is_done = true;
+                frame_cv.notify_one();
+            }
+        };
+
+        long first_total_us = 0;
+        long last_total_us = 0;
+        {
+            auto encoder = infrastructure::Encoder::Create(conf, std::move(callback));
+            encoder->Start();
+            for (int i = 0; i < frame_count; i++) {
+                auto buffer = camera.GetBuffer();
+                REQUIRE_NE(buffer, nullptr);
+                memcpy((char *)buffer->GetMemory(), in_buf.data(), 1990656);
+                {
+                    std::unique_lock<std::mutex> lock(frame_mutex);
+                    is_started = false;
+                    is_done = false;
+                }
+                const auto posted = Clock::now();
+                encoder->PostCameraBuffer(std::move(buffer));
+                std::unique_lock<std::mutex> lock(frame_mutex);
+                REQUIRE(frame_cv.wait_for(lock, 1s, [&is_done]() { return is_done; }));
+                first_total_us += std::chrono::duration_cast<std::chrono::microseconds>(first_bytes - posted).count();
+                last_total_us += std::chrono::duration_cast<std::chrono::microseconds>(last_bytes - posted).count();
+            }
+            encoder->Stop();
+        }
+
+        std::cout << "test_infrastructure/encoder/sw_encoder " <<
+            (chunk_size == 0 ? "whole frame" : "streaming " + std::to_string(chunk_size)) << ": " <<
+            "first bytes downstream after " << first_total_us / frame_count << "us, " <<
+            "whole frame after " << last_total_us / frame_count << "us, " <<
+            ((double) post_count / frame_count) << " posts per frame" << std::endl;
+    }
+
+    // streaming only changes when the bytes go out, not what they are
+    REQUIRE_FALSE(whole_frame.empty());
+    REQUIRE(whole_frame == streamed_frame);
+}
+
+/* full size YCbCr out of a jpeg, so two encodes can be held up against each other */
+static std::vector<uint8_t> decodeJpeg(const std::vector<char> &jpeg, int &width, int &height) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *) jpeg.data(), jpeg.size());
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_YCbCr;
+    jpeg_start_decompress(&cinfo);
+    width = (int) cinfo.output_width;
+    height = (int) cinfo.output_height;
+    std::vector<uint8_t> pixels(cinfo.output_width * cinfo.output_height * cinfo.output_components);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = pixels.data() + cinfo.output_scanline * cinfo.output_width * cinfo.output_components;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return pixels;
+}
+
+TEST_CASE("INFRASTRUCTURE_ENCODER_SW_ENCODER-Strip_Parallel") {
+    std::filesystem::path in_frame = TEST_DIR;
+    in_frame /= "test_infrastructure";
+    in_frame /= "test_encoder";
+    in_frame /= "in.yuv";
+
+    std::ifstream test_file_in(in_frame, std::ios::out | std::ios::binary);
+    std::vector<char> in_buf(1990656);
+    test_file_in.read(in_buf.data(), 1990656);
+    FakeCamera camera(5);
+
+    const int frame_count = 30;
+    const auto throughput_window = 1s;
+    std::vector<uint8_t> reference;
+
+    // the single threaded encoder first, as the baseline
+    for (const unsigned int strip_count : { 0u, 2u, 4u }) {
+        TestEncoderConfig conf(
+            0, strip_count == 0 ? infrastructure::EncoderType::SW : infrastructure::EncoderType::SW_STRIPS, strip_count
+        );
+        std::mutex frame_mutex;
+        std::condition_variable frame_cv;
+        int out_count = 0;
+        Clock::time_point out_time;
+        std::vector<char> out_frame;
+
+        SizedBufferCallback callback = [&](std::shared_ptr<SizedBuffer> &&ptr) {
+            const auto now = Clock::now();
+            std::unique_lock<std::mutex> lock(frame_mutex);
+            out_count += 1;
+            out_time = now;
+            if (out_frame.empty()) {
+                out_frame.assign((char *) ptr->GetMemory(), (char *) ptr->GetMemory() + ptr->GetSize());
+            }
+            frame_cv.notify_one();
+        };
+
+        long total_us = 0;
+        double fps = 0;
+        {
+            auto encoder = infrastructure::Encoder::Create(conf, std::move(callback));
+            encoder->Start();
+
+            // latency: one frame at a time
+            for (int i = 0; i < frame_count; i++) {
+                auto buffer = camera.GetBuffer();
+                REQUIRE_NE(buffer, nullptr);
+                memcpy((char *)buffer->GetMemory(), in_buf.data(), 1990656);
+                const auto posted = Clock::now();
+                encoder->PostCameraBuffer(std::move(buffer));
+                std::unique_lock<std::mutex> lock(frame_mutex);
+                REQUIRE(frame_cv.wait_for(lock, 1s, [&out_count, i]() { return out_count > i; }));
+                total_us += std::chrono::duration_cast<std::chrono::microseconds>(out_time - posted).count();
+            }
+
+            // throughput: a new frame whenever the camera has a buffer free
+            int start_count;
+            {
+                std::unique_lock<std::mutex> lock(frame_mutex);
+                start_count = out_count;
+            }
+            const auto start = Clock::now();
+            while (Clock::now() - start < throughput_window) {
+                auto buffer = camera.GetBuffer();
+                if (buffer == nullptr) {
+                    std::this_thread::sleep_for(100us);
+                    continue;
+                }
+                encoder->PostCameraBuffer(std::move(buffer));
+            }
+            {
+                std::unique_lock<std::mutex> lock(frame_mutex);
+                fps = (out_count - start_count) / std::chrono::duration<double>(out_time - start).count();
+            }
+            encoder->Stop();
+        }
+
+        // splitting the frame changes how it's packed, not what it looks like
+        int width = 0, height = 0;
+        const auto pixels = decodeJpeg(out_frame, width, height);
+        REQUIRE_EQ(width, 1536);
+        REQUIRE_EQ(height, 864);
+        if (strip_count == 0) {
+            reference = pixels;
+        } else {
+            REQUIRE(pixels == reference);
+        }
+
+        std::cout << "test_infrastructure/encoder/sw_encoder " <<
+            (strip_count == 0 ? "single thread" : std::to_string(strip_count) + " strips") << ": " <<
+            total_us / frame_count << "us per frame, " << fps << " fps sustained" << std::endl;
+    }
+}
+
+TEST_CASE("INFRASTRUCTURE_ENCODER_SW_ENCODER-Frames_In_Flight") {
+    std::filesystem::path in_frame = TEST_DIR;
+    in_frame /= "test_infrastructure";
+    in_frame /= "test_encoder";
+    in_frame /= "in.yuv";
+
+    std::ifstream test_file_in(in_frame, std::ios::out | std::ios::binary);
+    std::vector<char> in_buf(1990656);
+    test_file_in.read(in_buf.data(), 1990656);
+    FakeCamera camera(5);
+
+    const auto throughput_window = 1s;
+    std::vector<char> reference;
+
+    // one at a time first, as the baseline; then a pool, whole and streaming
+    for (const auto &[frames_in_flight, chunk_size] : { std::pair{ 1u, 0u }, { 3u, 0u }, { 3u, 16384u } }) {
+        TestEncoderConfig conf(chunk_size, infrastructure::EncoderType::SW, 0, frames_in_flight);
+        std::mutex frame_mutex;
+        int out_count = 0;
+        bool is_in_order = true;
+        bool is_identical = true;
+        int64_t last_sequence = -1;
+        Clock::time_point out_time;
+
+        SizedBufferCallback callback = [&](std::shared_ptr<SizedBuffer> &&ptr) {
+            const auto now = Clock::now();
+            auto *progress = ptr->GetProgress();
+            const auto sequence = (int64_t) ptr->GetMetadata()->sequence_number;
+            std::unique_lock<std::mutex> lock(frame_mutex);
+            // a streamed frame posts more than once, but never after a newer frame has started posting
+            is_in_order = is_in_order && sequence >= last_sequence;
+            last_sequence = sequence;
+            if (progress != nullptr && progress->IsFilling()) {
+                return;
+            }
+            out_count += 1;
+            out_time = now;
+            std::vector<char> out_frame((char *) ptr->GetMemory(), (char *) ptr->GetMemory() + ptr->GetSize());
+            if (reference.empty()) {
+                reference = std::move(out_frame);
+            } else {
+                is_identical = is_identical && out_frame == reference;
+            }
+        };
+
+        double fps = 0;
+        {
+            auto encoder = infrastructure::Encoder::Create(conf, std::move(callback));
+            encoder->Start();
+            uint32_t sequence = 0;
+            const auto start = Clock::now();
+            while (Clock::now() - start < throughput_window) {
+                auto buffer = camera.GetBuffer();
+                if (buffer == nullptr) {
+                    std::this_thread::sleep_for(100us);
+                    continue;
+                }
+                memcpy((char *)buffer->GetMemory(), in_buf.data(), 1990656);
+                buffer->GetMetadata()->sequence_number = sequence++;
+                encoder->PostCameraBuffer(std::move(buffer));
+            }
+            std::this_thread::sleep_for(200ms);
+            {
+                std::unique_lock<std::mutex> lock(frame_mutex);
+                fps = out_count / std::chrono::duration<double>(out_time - start).count();
+            }
+            encoder->Stop();
+        }
+
+        REQUIRE(out_count > 0);
+        REQUIRE(is_in_order);
+        REQUIRE(is_identical);
+
+        std::cout << "test_infrastructure/encoder/sw_encoder " << frames_in_flight << " frames in flight" <<
+            (chunk_size == 0 ? "" : ", streaming " + std::to_string(chunk_size)) << ": " <<
+            fps << " fps sustained" << std::endl;
+    }
+}
+
+#ifdef _TURBOJPEG_
+
+TEST_CASE("INFRASTRUCTURE_ENCODER_SW_ENCODER-Turbo_Benchmark") {
+    std::filesystem::path in_frame = TEST_DIR;
+    in_frame /= "test_infrastructure";
+    in_frame /= "test_encoder";
+    in_frame /= "in.yuv";
+
+    std::ifstream test_file_in(in_frame, std::ios::out | std::ios::binary);
+    std::vector<char> in_buf(1990656);
+    test_file_in.read(in_buf.data(), 1990656);
+    FakeCamera camera(5);
+
+    const int frame_count = 60;
+
+    // the raw libjpeg api first, as the baseline
+    for (const auto encoder_type : { infrastructure::EncoderType::SW, infrastructure::EncoderType::TURBO }) {
+        TestEncoderConfig conf(0, encoder_type);
+        std::mutex frame_mutex;
+        std::condition_variable frame_cv;
+        int out_count = 0;
+        Clock::time_point out_time;
+        std::vector<char> out_frame;
+
+        SizedBufferCallback callback = [&](std::shared_ptr<SizedBuffer> &&ptr) {
+            const auto now = Clock::now();
+            std::unique_lock<std::mutex> lock(frame_mutex);
+            out_count += 1;
+            out_time = now;
+            out_frame.assign((char *) ptr->GetMemory(), (char *) ptr->GetMemory() + ptr->GetSize());
+            frame_cv.notify_one();
+        };
+
+        long total_us = 0;
+        {
+            auto encoder = infrastructure::Encoder::Create(conf, std::move(callback));
+            encoder->Start();
+            for (int i = 0; i < frame_count; i++) {
+                auto buffer = camera.GetBuffer();
+                REQUIRE_NE(buffer, nullptr);
+                memcpy((char *)buffer->GetMemory(), in_buf.data(), 1990656);
+                const auto posted = Clock::now();
+                encoder->PostCameraBuffer(std::move(buffer));
+                std::unique_lock<std::mutex> lock(frame_mutex);
+                REQUIRE(frame_cv.wait_for(lock, 1s, [&out_count, i]() { return out_count > i; }));
+                total_us += std::chrono::duration_cast<std::chrono::microseconds>(out_time - posted).count();
+            }
+            encoder->Stop();
+        }
+
+        int width = 0, height = 0;
+        decodeJpeg(out_frame, width, height);
+        REQUIRE_EQ(width, 1536);
+        REQUIRE_EQ(height, 864);
+
+        std::cout << "test_infrastructure/encoder/sw_encoder " <<
+            (encoder_type == infrastructure::EncoderType::SW ? "libjpeg raw" : "turbojpeg planes") << ": " <<
+            total_us / frame_count << "us per frame, " << out_frame.size() << " bytes" << std::endl;
+    }
+}
+
+#endif
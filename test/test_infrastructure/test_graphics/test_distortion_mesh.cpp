@@ -0,0 +1,159 @@
+//
+// Created by brucegoose on 7/26/23.
+//
+
+#include <doctest.h>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+using namespace std::literals;
+typedef std::chrono::high_resolution_clock Clock;
+
+#include "infrastructure/graphics/distortion_mesh.hpp"
+
+namespace {
+    constexpr int F = infrastructure::DistortionMesh::VERTEX_FLOATS;
+
+    const float *vertexAt(
+        const infrastructure::DistortionMesh &mesh, const infrastructure::LensDistortion &lens,
+        int eye, int row, int column
+    ) {
+        const auto eye_vertices = (lens.columns + 1) * (lens.rows + 1);
+        return &mesh.vertices[(eye * eye_vertices + row * (lens.columns + 1) + column) * F];
+    }
+}
+
+TEST_CASE("INFRASTRUCTURE_GRAPHICS_DISTORTION_MESH-Flat_And_Barrel") {
+    const std::pair<int, int> screen = { 1920, 1080 };
+    const std::pair<int, int> image = { 1536, 864 };
+    infrastructure::LensDistortion lens;
+    lens.enabled = true;
+    lens.columns = 20;
+    lens.rows = 10;
+
+    // no distortion: each eye gets the image letterboxed, straight
+    lens.k1 = 0.0f;
+    lens.k2 = 0.0f;
+    const auto flat = infrastructure::GenerateDistortionMesh(lens, screen, image);
+    REQUIRE(flat.VertexCount() == 2 * 21 * 11);
+    REQUIRE(flat.indices.size() == 2 * 20 * 10 * 6);
+    for (const auto index : flat.indices) {
+        REQUIRE(index < flat.VertexCount());
+    }
+    for (int eye = 0; eye < 2; eye++) {
+        // the middle of each eye samples the middle of the frame
+        const auto *center = vertexAt(flat, lens, eye, 5, 10);
+        REQUIRE(center[0] == doctest::Approx(eye == 0 ? -0.5f : 0.5f));
+        REQUIRE(center[3] == 1.0f);
+        REQUIRE(center[6] == doctest::Approx(0.5f));
+        REQUIRE(center[7] == doctest::Approx(0.5f));
+        // the eye is narrower than the frame, so its left and right edges land exactly on the frame's
+        const auto *left = vertexAt(flat, lens, eye, 5, 0);
+        const auto *right = vertexAt(flat, lens, eye, 5, 20);
+        REQUIRE(left[0] == doctest::Approx(eye == 0 ? -1.0f : 0.0f));
+        REQUIRE(right[0] == doctest::Approx(eye == 0 ? 0.0f : 1.0f));
+        REQUIRE(left[6] == doctest::Approx(0.0f));
+        REQUIRE(right[6] == doctest::Approx(1.0f));
+        // and it's letterboxed top and bottom, masked out
+        const auto *top = vertexAt(flat, lens, eye, 10, 10);
+        REQUIRE(top[3] == 0.0f);
+    }
+
+    // barrel: the further out, the further past the flat texture coordinate it samples
+    lens.k1 = 0.22f;
+    lens.k2 = 0.24f;
+    const auto barrel = infrastructure::GenerateDistortionMesh(lens, screen, image);
+    REQUIRE(barrel.VertexCount() == flat.VertexCount());
+    REQUIRE(barrel.indices == flat.indices);
+    float last_offset = 0.0f;
+    for (int column = 10; column <= 20; column++) {
+        const auto *flat_vertex = vertexAt(flat, lens, 0, 5, column);
+        const auto *barrel_vertex = vertexAt(barrel, lens, 0, 5, column);
+        // positions never move, only what they sample
+        REQUIRE(barrel_vertex[0] == flat_vertex[0]);
+        REQUIRE(barrel_vertex[1] == flat_vertex[1]);
+        const float offset = barrel_vertex[6] - 0.5f;
+        REQUIRE(offset >= flat_vertex[6] - 0.5f);
+        REQUIRE(offset >= last_offset);
+        last_offset = offset;
+    }
+    // the edge samples past the frame, so it's masked
+    REQUIRE(vertexAt(barrel, lens, 0, 5, 20)[3] == 0.0f);
+
+    // scaling down brings it back on screen
+    lens.scale = 2.0f;
+    const auto scaled = infrastructure::GenerateDistortionMesh(lens, screen, image);
+    REQUIRE(vertexAt(scaled, lens, 0, 5, 20)[3] == 1.0f);
+
+    // offset lenses lean toward the nose, mirrored between the eyes
+    lens.lens_center_offset = 0.1f;
+    const auto offset = infrastructure::GenerateDistortionMesh(lens, screen, image);
+    for (int row = 0; row <= lens.rows; row++) {
+        for (int column = 0; column <= lens.columns; column++) {
+            const auto *left = vertexAt(offset, lens, 0, row, column);
+            const auto *right = vertexAt(offset, lens, 1, row, lens.columns - column);
+            REQUIRE(left[6] == doctest::Approx(1.0f - right[6]));
+            REQUIRE(left[7] == doctest::Approx(right[7]));
+        }
+    }
+}
+
+TEST_CASE("INFRASTRUCTURE_GRAPHICS_DISTORTION_MESH-Disk_Cache") {
+    const auto cache_dir = std::filesystem::temp_directory_path() / "an_test_distortion_mesh";
+    std::filesystem::remove_all(cache_dir);
+
+    const std::pair<int, int> screen = { 1920, 1080 };
+    const std::pair<int, int> image = { 1536, 864 };
+    infrastructure::LensDistortion lens;
+    lens.enabled = true;
+    lens.columns = 64;
+    lens.rows = 64;
+
+    bool is_cached = true;
+    auto t1 = Clock::now();
+    const auto generated = infrastructure::LoadDistortionMesh(lens, screen, image, cache_dir, &is_cached);
+    auto t2 = Clock::now();
+    REQUIRE_FALSE(is_cached);
+    const auto loaded = infrastructure::LoadDistortionMesh(lens, screen, image, cache_dir, &is_cached);
+    auto t3 = Clock::now();
+    REQUIRE(is_cached);
+    REQUIRE(loaded == generated);
+    REQUIRE(loaded == infrastructure::GenerateDistortionMesh(lens, screen, image));
+
+    // different lenses don't pick up each other's mesh
+    auto other_lens = lens;
+    other_lens.k1 = 0.3f;
+    const auto other = infrastructure::LoadDistortionMesh(other_lens, screen, image, cache_dir, &is_cached);
+    REQUIRE_FALSE(is_cached);
+    REQUIRE_FALSE(other == generated);
+    std::size_t files = 0;
+    for (const auto &entry : std::filesystem::directory_iterator(cache_dir)) {
+        REQUIRE(entry.path().extension() == ".bin");
+        files++;
+    }
+    REQUIRE(files == 2);
+
+    // a truncated file gets regenerated, and rewritten whole
+    for (const auto &entry : std::filesystem::directory_iterator(cache_dir)) {
+        std::filesystem::resize_file(entry.path(), 64);
+    }
+    const auto repaired = infrastructure::LoadDistortionMesh(lens, screen, image, cache_dir, &is_cached);
+    REQUIRE_FALSE(is_cached);
+    REQUIRE(repaired == generated);
+    (void) infrastructure::LoadDistortionMesh(lens, screen, image, cache_dir, &is_cached);
+    REQUIRE(is_cached);
+
+    // somewhere it can't write still gets a mesh
+    const auto unwritable = infrastructure::LoadDistortionMesh(lens, screen, image, "/proc/an_no_cache", &is_cached);
+    REQUIRE_FALSE(is_cached);
+    REQUIRE(unwritable == generated);
+
+    std::filesystem::remove_all(cache_dir);
+
+    auto d1 = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1);
+    auto d2 = std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2);
+    std::cout << "test_infrastructure/graphics/distortion_mesh " << generated.VertexCount() << " vertices: " <<
+        d1.count() << "us generated and stored, " << d2.count() << "us loaded" << std::endl;
+}
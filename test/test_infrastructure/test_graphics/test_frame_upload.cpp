@@ -0,0 +1,241 @@
+//
+// Created by brucegoose on 7/27/23.
+//
+
+#include <doctest.h>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <chrono>
+using namespace std::literals;
+typedef std::chrono::high_resolution_clock Clock;
+
+#include <libdrm/drm_fourcc.h>
+
+#include "infrastructure/graphics/plane_uploader.hpp"
+#include "infrastructure/decoder/decoder_allocator.hpp"
+
+/*
+ * pbo uploads against dmabuf import, on whatever gl the box has; for mesa's software rasterizer, run with
+ * LIBGL_ALWAYS_SOFTWARE=1 (and GALLIUM_DRIVER=softpipe or llvmpipe). Needs a display for glfw, so it passes quietly
+ * without one
+ */
+
+namespace {
+    GLuint compileShader(GLenum target, const char *source) {
+        GLuint shader = glCreateShader(target);
+        glShaderSource(shader, 1, &source, nullptr);
+        glCompileShader(shader);
+        GLint ok = 0;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+        REQUIRE(ok);
+        return shader;
+    }
+
+    GLuint linkProgram(const char *fragment_source) {
+        const char *vertex_source =
+            "#version 310 es\n"
+            "layout (location = 0) in vec3 v_pos;\n"
+            "layout (location = 1) in vec3 v_color;\n"
+            "layout (location = 2) in vec2 v_tex;\n"
+            "out vec2 texcoord;\n"
+            "out float c_pos;\n"
+            "void main() {\n"
+            "  gl_Position = vec4(v_pos, 1.0);\n"
+            "  texcoord = vec2(v_tex.x, 1.0 - v_tex.y);\n"
+            "  c_pos = v_color.x;\n"
+            "}\n";
+        GLuint program = glCreateProgram();
+        glAttachShader(program, compileShader(GL_VERTEX_SHADER, vertex_source));
+        glAttachShader(program, compileShader(GL_FRAGMENT_SHADER, fragment_source));
+        glLinkProgram(program);
+        GLint ok = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &ok);
+        REQUIRE(ok);
+        return program;
+    }
+
+    const char *IMPORT_FRAGMENT_SHADER =
+        "#version 310 es\n"
+        "#extension GL_OES_EGL_image_external : enable\n"
+        "precision mediump float;\n"
+        "uniform samplerExternalOES s;\n"
+        "in vec2 texcoord;\n"
+        "in float c_pos;\n"
+        "out vec4 fragColor;\n"
+        "void main() {\n"
+        "  fragColor = vec4(texture2D(s, texcoord).rgb * c_pos, 1.0);\n"
+        "}\n";
+
+    GLuint importDmabuf(EGLDisplay display, int fd, int width, int height) {
+        EGLint attribs[] = {
+            EGL_WIDTH, width,
+            EGL_HEIGHT, height,
+            EGL_LINUX_DRM_FOURCC_EXT, DRM_FORMAT_YUV420,
+            EGL_DMA_BUF_PLANE0_FD_EXT, fd,
+            EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
+            EGL_DMA_BUF_PLANE0_PITCH_EXT, width,
+            EGL_DMA_BUF_PLANE1_FD_EXT, fd,
+            EGL_DMA_BUF_PLANE1_OFFSET_EXT, width * height,
+            EGL_DMA_BUF_PLANE1_PITCH_EXT, width / 2,
+            EGL_DMA_BUF_PLANE2_FD_EXT, fd,
+            EGL_DMA_BUF_PLANE2_OFFSET_EXT, width * height + (width / 2) * (height / 2),
+            EGL_DMA_BUF_PLANE2_PITCH_EXT, width / 2,
+            EGL_YUV_COLOR_SPACE_HINT_EXT, EGL_ITU_REC601_EXT,
+            EGL_SAMPLE_RANGE_HINT_EXT, EGL_YUV_NARROW_RANGE_EXT,
+            EGL_NONE
+        };
+        EGLImage image = eglCreateImageKHR(
+            display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer) nullptr, attribs
+        );
+        if (!image) {
+            return 0;
+        }
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture);
+        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, image);
+        eglDestroyImageKHR(display, image);
+        return texture;
+    }
+
+    void centerPixel(int width, int height, uint8_t *rgba) {
+        glReadPixels(width / 2, height / 2, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    }
+}
+
+TEST_CASE("INFRASTRUCTURE_GRAPHICS_FRAME_UPLOAD-Pbo_Versus_Dmabuf") {
+    if (!glfwInit()) {
+        MESSAGE("no display for glfw; skipping");
+        return;
+    }
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_ES_API);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    const int window_width = 640;
+    const int window_height = 360;
+    auto *window = glfwCreateWindow(window_width, window_height, "frame upload", nullptr, nullptr);
+    if (window == nullptr) {
+        MESSAGE("no gles 3.1 context; skipping");
+        glfwTerminate();
+        return;
+    }
+    glfwMakeContextCurrent(window);
+    REQUIRE(gladLoadGLES2Loader((GLADloadproc) glfwGetProcAddress));
+    REQUIRE(gladLoadEGLLoader((GLADloadproc) glfwGetProcAddress));
+    auto egl_display = glfwGetEGLDisplay();
+    std::cout << "test_infrastructure/graphics/frame_upload on " << glGetString(GL_RENDERER) << std::endl;
+
+    // a solid bt601 red; both paths should come out red in the middle of the window
+    const std::pair<int, int> width_height = { 1536, 864 };
+    const int width = width_height.first;
+    const int height = width_height.second;
+    const std::size_t luma_size = (std::size_t) width * height;
+    auto allocator = infrastructure::DecoderAllocator::Create(
+        infrastructure::DecoderAllocatorType::AUTO, width_height
+    );
+    auto buffers = allocator->Allocate(1);
+    REQUIRE(buffers.size() == 1);
+    auto *buffer = buffers.front();
+    allocator->StartWrite(buffer);
+    auto *memory = (uint8_t *) buffer->GetMemory();
+    memset(memory, 81, luma_size);
+    memset(memory + luma_size, 90, luma_size / 4);
+    memset(memory + luma_size + luma_size / 4, 240, luma_size / 4);
+    allocator->FinishWrite(buffer);
+
+    float vertices[] = {
+        1.0f, 1.0f, 0.0f,     1.0f, 0.0f, 0.0f,     1.0f, 1.0f,
+        1.0f, -1.0f, 0.0f,    1.0f, 0.0f, 0.0f,     1.0f, 0.0f,
+        -1.0f, -1.0f, 0.0f,   1.0f, 0.0f, 0.0f,     0.0f, 0.0f,
+        -1.0f, 1.0f, 0.0f,    1.0f, 0.0f, 0.0f,     0.0f, 1.0f,
+    };
+    unsigned int indices[] = { 0, 1, 3, 1, 2, 3 };
+    GLuint vao, vbo, ebo;
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glViewport(0, 0, window_width, window_height);
+
+    const int frames = 60;
+    uint8_t rgba[4];
+
+    // upload: every frame is copied in, then drawn
+    const auto upload_program = linkProgram(infrastructure::PlaneUploader::UPLOAD_FRAGMENT_SHADER);
+    infrastructure::PlaneUploader::SetSamplers(upload_program);
+    infrastructure::PlaneUploader uploader;
+    uploader.Setup();
+    const auto t1 = Clock::now();
+    for (int i = 0; i < frames; i++) {
+        REQUIRE(uploader.Upload(*buffer, width, height));
+        glUseProgram(upload_program);
+        uploader.Bind();
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        glFinish();
+    }
+    const auto t2 = Clock::now();
+    centerPixel(window_width, window_height, rgba);
+    REQUIRE(rgba[0] > 230);
+    REQUIRE(rgba[1] < 25);
+    REQUIRE(rgba[2] < 25);
+    std::cout << uploader.Report("test_infrastructure/graphics/frame_upload");
+    uploader.Teardown();
+    const auto upload_us = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / frames;
+    std::cout << "test_infrastructure/graphics/frame_upload pbo: " << upload_us << "us per frame" << std::endl;
+
+    // import: the texture is made once, and every frame is only drawn
+    const char *egl_extensions = eglQueryString(egl_display, EGL_EXTENSIONS);
+    const bool can_import = buffer->GetFd() >= 0 && egl_extensions != nullptr &&
+        std::strstr(egl_extensions, "EGL_EXT_image_dma_buf_import") != nullptr;
+    if (can_import) {
+        const auto import_program = linkProgram(IMPORT_FRAGMENT_SHADER);
+        const auto t3 = Clock::now();
+        const auto texture = importDmabuf(egl_display, buffer->GetFd(), width, height);
+        const auto t4 = Clock::now();
+        if (texture != 0) {
+            for (int i = 0; i < frames; i++) {
+                glUseProgram(import_program);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture);
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+                glFinish();
+            }
+            const auto t5 = Clock::now();
+            centerPixel(window_width, window_height, rgba);
+            REQUIRE(rgba[0] > 230);
+            glDeleteTextures(1, &texture);
+            const auto import_us = std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count();
+            const auto draw_us = std::chrono::duration_cast<std::chrono::microseconds>(t5 - t4).count() / frames;
+            std::cout << "test_infrastructure/graphics/frame_upload dmabuf: " << import_us << "us to import, " <<
+                draw_us << "us per frame" << std::endl;
+        } else {
+            std::cout << "test_infrastructure/graphics/frame_upload dmabuf: import refused, " <<
+                eglGetError() << std::endl;
+        }
+    } else {
+        std::cout << "test_infrastructure/graphics/frame_upload dmabuf: not available with " <<
+            allocator->GetName() << " buffers" << std::endl;
+    }
+
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ebo);
+    allocator->Free(buffers);
+    glfwDestroyWindow(window);
+    glfwTerminate();
+}
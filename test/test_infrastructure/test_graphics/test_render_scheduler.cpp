@@ -0,0 +1,97 @@
+//
+// Created by brucegoose on 7/24/23.
+//
+
+#include <doctest.h>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <chrono>
+using namespace std::literals;
+typedef std::chrono::high_resolution_clock Clock;
+
+#include "infrastructure/graphics/render_scheduler.hpp"
+
+TEST_CASE("INFRASTRUCTURE_GRAPHICS_RENDER_SCHEDULER-Wakes_On_Notify_Or_Deadline") {
+    // 10ms frames, so the idle deadline is 50ms out
+    infrastructure::RenderScheduler scheduler(10000, 5);
+    scheduler.Start();
+
+    // the first frame always gets drawn
+    REQUIRE(scheduler.Wait());
+    scheduler.Presented();
+
+    // nothing posted: sleeps to the deadline instead of spinning
+    auto t1 = Clock::now();
+    REQUIRE_FALSE(scheduler.Wait());
+    auto t2 = Clock::now();
+    const auto idle_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+    REQUIRE(idle_ms >= 40);
+
+    // a frame posted from elsewhere wakes it right away
+    std::thread poster([&scheduler]() {
+        std::this_thread::sleep_for(5ms);
+        scheduler.Notify();
+    });
+    t1 = Clock::now();
+    REQUIRE(scheduler.Wait());
+    t2 = Clock::now();
+    poster.join();
+    const auto notify_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+    REQUIRE(notify_ms < idle_ms);
+
+    // and stopping lets a waiting loop go
+    std::thread stopper([&scheduler]() {
+        std::this_thread::sleep_for(5ms);
+        scheduler.Stop();
+    });
+    REQUIRE_FALSE(scheduler.Wait());
+    stopper.join();
+
+    std::cout << "test_infrastructure/graphics/render_scheduler idle wake: " << idle_ms << "ms, notified wake: " <<
+        notify_ms << "ms" << std::endl;
+}
+
+TEST_CASE("INFRASTRUCTURE_GRAPHICS_RENDER_SCHEDULER-Summary") {
+    infrastructure::RenderScheduler scheduler(5000, 4);
+    scheduler.Start();
+
+    // a producer at ~100fps, and a loop that only presents what it's handed
+    std::atomic<bool> is_done = { false };
+    std::thread producer([&scheduler, &is_done]() {
+        for (int i = 0; i < 30; i++) {
+            std::this_thread::sleep_for(10ms);
+            scheduler.Notify();
+        }
+        is_done = true;
+        scheduler.Notify();
+    });
+    int presents = 0;
+    while (!is_done) {
+        if (scheduler.Wait()) {
+            scheduler.Presented();
+            presents += 1;
+        } else {
+            scheduler.Skipped();
+        }
+    }
+    producer.join();
+
+    const auto summary = scheduler.Summary();
+    REQUIRE(presents > 0);
+    REQUIRE(summary.present_interval.count == (uint64_t) presents - 1);
+    REQUIRE(summary.fps > 0);
+    REQUIRE(summary.fps < 200);
+    // almost all of it was spent waiting on the producer
+    REQUIRE(summary.idle_fraction > 0.5);
+    REQUIRE(summary.present_interval.p50_us >= 5000);
+
+    // the window restarts with every summary
+    const auto next = scheduler.Summary();
+    REQUIRE(next.skipped_redraws == 0);
+    REQUIRE(next.present_interval.count == summary.present_interval.count);
+
+    std::cout << "test_infrastructure/graphics/render_scheduler " << presents << " presents, fps " << summary.fps <<
+        ", idle " << summary.idle_fraction << ", skipped " << summary.skipped_redraws << ", jitter p99 " <<
+        summary.present_jitter.p99_us << "us" << std::endl;
+}
@@ -16,17 +16,26 @@ struct TestClientServerConfig:
         public infrastructure::TcpServerConfig
 {
     explicit TestClientServerConfig(
-        int pool_size, int tcp_server_port, std::string tcp_server_host, ConnectionType tcp_client_connection_type
+        int pool_size, int tcp_server_port, std::string tcp_server_host, ConnectionType tcp_client_connection_type,
+        bool tcp_client_stream_receive = false,
+        infrastructure::TcpServerBackend tcp_server_backend = infrastructure::TcpServerBackend::ASIO,
+        bool tcp_headset_session_zero_copy = false
     ):
             _pool_size(pool_size),
             _tcp_server_port(tcp_server_port),
             _tcp_server_host(std::move(tcp_server_host)),
-            _tcp_client_connection_type(tcp_client_connection_type)
+            _tcp_client_connection_type(tcp_client_connection_type),
+            _tcp_client_stream_receive(tcp_client_stream_receive),
+            _tcp_server_backend(tcp_server_backend),
+            _tcp_headset_session_zero_copy(tcp_headset_session_zero_copy)
     {}
     const int _pool_size;
     const int _tcp_server_port;
     const std::string _tcp_server_host;
     const ConnectionType _tcp_client_connection_type;
+    const bool _tcp_client_stream_receive;
+    const infrastructure::TcpServerBackend _tcp_server_backend;
+    const bool _tcp_headset_session_zero_copy;
     [[nodiscard]] int get_asio_pool_size() const override {
         return _pool_size;
     };
@@ -51,11 +60,23 @@ struct TestClientServerConfig:
     [[nodiscard]] int get_tcp_camera_session_buffer_count() const override {
         return 8;
     }
-    [[nodiscard]] int get_tcp_headset_session_buffer_count() const override {
+    [[nodiscard]] int get_tcp_headset_session_queue_depth() const override {
         return 5;
     }
+    [[nodiscard]] bool get_tcp_headset_session_queue_conflating() const override {
+        return false;
+    }
     [[nodiscard]] int get_tcp_server_buffer_size() const override {
-        return 5;
+        return 1536 * 864 * 3 / 2;
+    }
+    [[nodiscard]] bool get_tcp_server_cut_through() const override {
+        return true;
+    }
+    [[nodiscard]] infrastructure::TcpServerBackend get_tcp_server_backend() const override {
+        return _tcp_server_backend;
+    }
+    [[nodiscard]] bool get_tcp_headset_session_zero_copy() const override {
+        return _tcp_headset_session_zero_copy;
     }
     [[nodiscard]] int get_tcp_client_read_buffer_count() const override {
         return 5;
@@ -63,6 +84,15 @@ struct TestClientServerConfig:
     [[nodiscard]] int get_tcp_client_read_buffer_size() const override {
         return 1536 * 864 * 3 / 2;
     };
+    [[nodiscard]] int get_tcp_client_send_queue_depth() const override {
+        return 0;
+    };
+    [[nodiscard]] bool get_tcp_client_send_queue_conflating() const override {
+        return false;
+    };
+    [[nodiscard]] bool get_tcp_client_stream_receive() const override {
+        return _tcp_client_stream_receive;
+    };
 };
 
 class TcpClientManager: public infrastructure::TcpClientManager {
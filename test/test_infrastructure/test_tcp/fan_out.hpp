@@ -0,0 +1,121 @@
+//
+// Created by brucegoose on 7/2/23.
+//
+
+#ifndef AUGMENTEDNORMALCY_TEST_TCP_FAN_OUT_HPP
+#define AUGMENTEDNORMALCY_TEST_TCP_FAN_OUT_HPP
+
+#include <vector>
+#include <algorithm>
+#include <set>
+
+#include "infrastructure/tcp/tcp_client.hpp"
+#include "infrastructure/tcp/tcp_server.hpp"
+
+
+/* server side; every connection is a headset, and buffers get pushed to all of them like the connection manager */
+
+class TcpFanOutServerManager: public infrastructure::TcpServerManager {
+public:
+    [[nodiscard]] ConnectionType GetConnectionType(const tcp::endpoint &endpoint) override {
+        return ConnectionType::HEADSET_CONNECTION;
+    }
+    [[nodiscard]] unsigned long CreateHeadsetServerConnection(
+        std::shared_ptr<infrastructure::WritableTcpSession> &&session
+    ) override {
+        std::unique_lock<std::mutex> lock(_session_mutex);
+        _sessions.push_back(std::move(session));
+        return _sessions.size();
+    }
+    void DestroyHeadsetServerConnection(std::shared_ptr<infrastructure::WritableTcpSession> &&session) override {
+        std::unique_lock<std::mutex> lock(_session_mutex);
+        _sessions.erase(std::remove(_sessions.begin(), _sessions.end(), session), _sessions.end());
+    }
+    void PostToAll(const std::shared_ptr<SizedBuffer> &buffer) {
+        std::unique_lock<std::mutex> lock(_session_mutex);
+        for (auto &session : _sessions) {
+            auto copy_buffer = buffer;
+            session->Write(std::move(copy_buffer));
+        }
+    }
+    std::size_t SessionCount() {
+        std::unique_lock<std::mutex> lock(_session_mutex);
+        return _sessions.size();
+    }
+    void Clear() {
+        std::unique_lock<std::mutex> lock(_session_mutex);
+        for (auto &session : _sessions) {
+            session->TryClose(false);
+        }
+        _sessions.clear();
+    }
+    std::mutex _session_mutex;
+    std::vector<std::shared_ptr<infrastructure::WritableTcpSession>> _sessions;
+
+    /* dummy for camera server */
+    [[nodiscard]]  unsigned long CreateCameraServerConnection(
+        std::shared_ptr<infrastructure::TcpSession> &&session
+    ) override {
+        return 0;
+    };
+    void PostCameraServerBuffer(const tcp_addr &addr, std::shared_ptr<ResizableBuffer> &&buffer) override {}
+    void DestroyCameraServerConnection(std::shared_ptr<infrastructure::TcpSession> &&session) override {}
+};
+
+/*
+ * same, but connections from the camera ports, or the next few after ExpectCamera, are cameras; every buffer they post
+ * goes straight to the headsets
+ */
+
+class TcpRelayServerManager: public TcpFanOutServerManager {
+public:
+    explicit TcpRelayServerManager(std::set<unsigned short> camera_ports = {}):
+        _camera_ports(std::move(camera_ports))
+    {}
+    void ExpectCamera() {
+        _cameras_expected += 1;
+    }
+    [[nodiscard]] ConnectionType GetConnectionType(const tcp::endpoint &endpoint) override {
+        if (_camera_ports.count(endpoint.port()) != 0) {
+            return ConnectionType::CAMERA_CONNECTION;
+        } else if (_cameras_expected > 0) {
+            _cameras_expected -= 1;
+            return ConnectionType::CAMERA_CONNECTION;
+        }
+        return ConnectionType::HEADSET_CONNECTION;
+    }
+    [[nodiscard]]  unsigned long CreateCameraServerConnection(
+        std::shared_ptr<infrastructure::TcpSession> &&session
+    ) override {
+        return ++_camera_count;
+    };
+    void PostCameraServerBuffer(const tcp_addr &addr, std::shared_ptr<ResizableBuffer> &&buffer) override {
+        PostToAll(buffer);
+    }
+    const std::set<unsigned short> _camera_ports;
+    std::atomic_int _cameras_expected = 0;
+    std::atomic_ulong _camera_count = 0;
+};
+
+/* client side; shared by every headset client so it only counts what comes in */
+
+class TcpFanOutClientManager: public infrastructure::TcpClientManager {
+public:
+    void CreateHeadsetClientConnection() override {
+        connected_count += 1;
+    };
+    void PostHeadsetClientBuffer(std::shared_ptr<SizedBuffer> &&buffer) override {
+        receive_count += 1;
+    }
+    void DestroyHeadsetClientConnection() override {
+        connected_count -= 1;
+    };
+    std::atomic_int connected_count = 0;
+    std::atomic_long receive_count = 0;
+
+    /* dummy for camera client */
+    void CreateCameraClientConnection() override {};
+    void DestroyCameraClientConnection() override {};
+};
+
+#endif //AUGMENTEDNORMALCY_TEST_TCP_FAN_OUT_HPP
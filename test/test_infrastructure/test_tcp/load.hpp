@@ -0,0 +1,146 @@
+//
+// Created by brucegoose on 7/29/23.
+//
+
+#ifndef AUGMENTEDNORMALCY_TEST_TCP_LOAD_HPP
+#define AUGMENTEDNORMALCY_TEST_TCP_LOAD_HPP
+
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "client.hpp"
+#include "fan_out.hpp"
+
+
+/* a frame that says when it was sent; cameras and headsets share CLOCK_MONOTONIC across the fork */
+class StampedBuffer: public SizedBuffer {
+public:
+    explicit StampedBuffer(std::size_t size): _memory(size) {
+        const int64_t now = monotonicClockMicros();
+        std::memcpy(_memory.data(), &now, sizeof(now));
+    }
+    [[nodiscard]] void *GetMemory() override {
+        return _memory.data();
+    }
+    [[nodiscard]] std::size_t GetSize() override {
+        return _memory.size();
+    }
+private:
+    std::vector<char> _memory;
+};
+
+class LoadClientManager: public TcpFanOutClientManager {
+public:
+    void CreateCameraClientConnection() override {
+        camera_count += 1;
+    };
+    void PostHeadsetClientBuffer(std::shared_ptr<SizedBuffer> &&buffer) override {
+        int64_t sent_us = 0;
+        std::memcpy(&sent_us, buffer->GetMemory(), sizeof(sent_us));
+        latency_us.Record(monotonicClockMicros() - sent_us);
+        receive_count += 1;
+    }
+    std::atomic_int camera_count = 0;
+    LatencyHistogram latency_us;
+};
+
+struct LoadShape {
+    int camera_count = 4;
+    int headset_count = 32;
+    int frame_size = 64 * 1024;
+    std::chrono::milliseconds load_time = std::chrono::seconds(2);
+};
+
+struct LoadResult {
+    long sent = 0;
+    long received = 0;
+    int64_t p50_us = 0;
+    int64_t p99_us = 0;
+};
+
+/*
+ * the loopback load generator, forked so it doesn't eat the server's cores in the numbers; the cameras connect
+ * first so the server can tell them apart, then the headsets, then every camera streams at 60fps
+ */
+[[noreturn]] inline void runLoad(const LoadShape &shape, const int port, const int reply_fd) {
+    using namespace std::literals;
+    typedef std::chrono::high_resolution_clock Clock;
+    TestClientServerConfig camera_conf(2, port, "127.0.0.1", ConnectionType::CAMERA_CONNECTION);
+    TestClientServerConfig headset_conf(2, port, "127.0.0.1", ConnectionType::HEADSET_CONNECTION);
+    auto ctx = AsioContext::Create(headset_conf);
+    ctx->Start();
+    auto manager = std::make_shared<LoadClientManager>();
+    auto client_manager = std::static_pointer_cast<infrastructure::TcpClientManager>(manager);
+    LoadResult result;
+
+    std::vector<std::shared_ptr<infrastructure::TcpClient>> cameras;
+    std::vector<std::shared_ptr<infrastructure::TcpClient>> headsets;
+    const auto wait_for = [](const std::atomic_int &count, const int target) {
+        const auto deadline = Clock::now() + 5s;
+        while (count < target && Clock::now() < deadline) {
+            std::this_thread::sleep_for(10ms);
+        }
+        return count >= target;
+    };
+    bool is_connected = true;
+    for (int i = 0; i < shape.camera_count && is_connected; i++) {
+        cameras.push_back(infrastructure::TcpClient::Create(camera_conf, ctx->GetContext(), client_manager));
+        cameras.back()->Start();
+        is_connected = wait_for(manager->camera_count, i + 1);
+    }
+    for (int i = 0; i < shape.headset_count && is_connected; i++) {
+        headsets.push_back(infrastructure::TcpClient::Create(headset_conf, ctx->GetContext(), client_manager));
+        headsets.back()->Start();
+    }
+    is_connected = is_connected && wait_for(manager->connected_count, shape.headset_count);
+
+    if (is_connected) {
+        std::this_thread::sleep_for(100ms);
+        const auto t1 = Clock::now();
+        auto next_frame = t1;
+        while (Clock::now() - t1 < shape.load_time) {
+            for (auto &camera : cameras) {
+                camera->Post(std::make_shared<StampedBuffer>(shape.frame_size));
+                result.sent += 1;
+            }
+            next_frame += 16ms;
+            std::this_thread::sleep_until(next_frame);
+        }
+        // let the tail drain
+        std::this_thread::sleep_for(250ms);
+        result.received = manager->receive_count;
+        result.p50_us = manager->latency_us.Percentile(50);
+        result.p99_us = manager->latency_us.Percentile(99);
+    }
+    (void) !write(reply_fd, &result, sizeof result);
+    _exit(0);
+}
+
+/* runs the load against a server already listening on port; false if the load never got its clients up */
+inline bool forkLoad(const LoadShape &shape, const int port, LoadResult &result) {
+    int reply_pipe[2];
+    if (pipe(reply_pipe) != 0) {
+        return false;
+    }
+    std::cout.flush();
+    const pid_t load_pid = fork();
+    if (load_pid == -1) {
+        return false;
+    } else if (load_pid == 0) {
+        close(reply_pipe[0]);
+        runLoad(shape, port, reply_pipe[1]);
+    }
+    close(reply_pipe[1]);
+    const bool is_replied = read(reply_pipe[0], &result, sizeof result) == sizeof result;
+    waitpid(load_pid, nullptr, 0);
+    close(reply_pipe[0]);
+    return is_replied;
+}
+
+#endif //AUGMENTEDNORMALCY_TEST_TCP_LOAD_HPP
@@ -30,12 +30,24 @@ struct TestServerConfig:
     [[nodiscard]] int get_tcp_camera_session_buffer_count() const override {
         return 1;
     };
-    [[nodiscard]] int get_tcp_headset_session_buffer_count() const override {
+    [[nodiscard]] int get_tcp_headset_session_queue_depth() const override {
         return 1;
     };
+    [[nodiscard]] bool get_tcp_headset_session_queue_conflating() const override {
+        return false;
+    };
     [[nodiscard]] int get_tcp_server_buffer_size() const override {
         return 5;
     };
+    [[nodiscard]] bool get_tcp_server_cut_through() const override {
+        return false;
+    }
+    [[nodiscard]] infrastructure::TcpServerBackend get_tcp_server_backend() const override {
+        return infrastructure::TcpServerBackend::ASIO;
+    }
+    [[nodiscard]] bool get_tcp_headset_session_zero_copy() const override {
+        return false;
+    }
 };
 
 /* Used to test bringing up and tearing down the server */
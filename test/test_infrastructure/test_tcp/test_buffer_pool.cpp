@@ -0,0 +1,152 @@
+//
+// Created by brucegoose on 7/29/23.
+//
+
+#include <doctest.h>
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#include "infrastructure/tcp/tcp_utils.hpp"
+
+namespace {
+    // a camera session's pool, sized like the server's defaults
+    const int buffer_count = 8;
+    const int buffer_size = 1990656;
+
+    /* jpegs off the cameras: mostly a couple hundred kB, sometimes a busy scene several times that */
+    class FrameSizes {
+    public:
+        explicit FrameSizes(const double median_bytes): _sizes(std::log(median_bytes), 0.35) {}
+        std::size_t Next() {
+            return (std::size_t) std::clamp(_sizes(_random), 4096.0, (double) buffer_size);
+        }
+    private:
+        std::mt19937 _random{ 2038 };
+        std::lognormal_distribution<double> _sizes;
+    };
+
+    /* frames stay held while the headsets are still sending them, the last few at a time */
+    struct Replay {
+        int frames = 0;
+        int leaked = 0;
+        int too_small = 0;
+        int max_slabs = 0;
+        std::size_t max_reserved = 0;
+        std::chrono::nanoseconds elapsed{ 0 };
+    };
+
+    Replay replay(
+        const std::shared_ptr<infrastructure::TcpReadBufferPool> &pool, FrameSizes &sizes, const int frame_count,
+        const std::size_t held_count
+    ) {
+        typedef std::chrono::high_resolution_clock Clock;
+        Replay result;
+        std::deque<std::shared_ptr<infrastructure::TcpBuffer>> held;
+        for (int i = 0; i < frame_count; i++) {
+            const auto frame_size = sizes.Next();
+            const auto t1 = Clock::now();
+            auto buffer = pool->GetReadBuffer(frame_size);
+            result.elapsed += Clock::now() - t1;
+            result.frames += 1;
+            if (buffer->IsLeakyBuffer()) {
+                result.leaked += 1;
+                continue;
+            }
+            result.too_small += buffer->GetCapacity() < frame_size ? 1 : 0;
+            held.push_back(std::move(buffer));
+            if (held.size() > held_count) {
+                held.pop_front();
+            }
+            const auto stats = pool->GetStats();
+            result.max_slabs = std::max(result.max_slabs, stats.slabs);
+            result.max_reserved = std::max(result.max_reserved, stats.reserved_bytes);
+        }
+        return result;
+    }
+}
+
+TEST_CASE("INFRASTRUCTURE_TCP-Read-Buffer-Pool-Size-Classes") {
+    auto pool = infrastructure::TcpReadBufferPool::Create(buffer_count, buffer_size);
+    const std::size_t fixed_bytes = (std::size_t) buffer_count * buffer_size;
+
+    // 1536x864 at quality 75 is about 200kB
+    FrameSizes small_frames(200 * 1024);
+    auto result = replay(pool, small_frames, 4000, 3);
+    REQUIRE_EQ(result.too_small, 0);
+    REQUIRE_EQ(result.leaked, 0);
+    REQUIRE_LE(result.max_slabs, buffer_count);
+    REQUIRE_LT(result.max_reserved, fixed_bytes / 2);
+    std::cout << "test_infrastructure/test_tcp/buffer_pool 200kB frames: " << result.max_slabs << " slabs, " <<
+        result.max_reserved / 1024 << "kB reserved at most against " << fixed_bytes / 1024 << "kB fixed, " <<
+        (double) result.elapsed.count() / result.frames << "ns per buffer, " << pool->GetStats().allocations <<
+        " allocations" << std::endl;
+
+    // the scene gets busy; the small class gives its slabs back, but not all at once
+    FrameSizes big_frames(900 * 1024);
+    const auto before = pool->GetStats();
+    result = replay(pool, big_frames, 4000, 3);
+    const auto after = pool->GetStats();
+    REQUIRE_EQ(result.too_small, 0);
+    REQUIRE_EQ(result.leaked, 0);
+    REQUIRE_LE(result.max_slabs, buffer_count);
+    REQUIRE_LE(result.max_reserved, fixed_bytes);
+    REQUIRE_GT(after.frees, before.frees);
+    std::cout << "test_infrastructure/test_tcp/buffer_pool 900kB frames: " << result.max_slabs << " slabs, " <<
+        result.max_reserved / 1024 << "kB reserved at most, " << after.reserved_bytes / 1024 << "kB at the end, " <<
+        after.allocations - before.allocations << " allocations and " << after.frees - before.frees <<
+        " frees on the way over" << std::endl;
+
+    // headsets that don't let go: everything past buffer_count goes to the leaky buffer
+    result = replay(pool, small_frames, 100, buffer_count + 4);
+    REQUIRE_EQ(result.too_small, 0);
+    REQUIRE_GT(result.leaked, 0);
+    REQUIRE_LE(result.max_slabs, buffer_count);
+
+    // a header that doesn't say how long the frame is gets the biggest class
+    auto open_ended = pool->GetReadBuffer();
+    REQUIRE((open_ended->IsLeakyBuffer() || open_ended->GetCapacity() == (std::size_t) buffer_size));
+}
+
+TEST_CASE("INFRASTRUCTURE_TCP-Read-Buffer-Pool-Hysteresis") {
+    auto pool = infrastructure::TcpReadBufferPool::Create(buffer_count, buffer_size);
+    // frames that straddle a class boundary shouldn't make the pool give back what it'll want again next frame
+    const std::size_t boundary = 256 * 1024;
+    uint64_t allocations = 0;
+    for (int i = 0; i < 2000; i++) {
+        auto buffer = pool->GetReadBuffer(i % 2 == 0 ? boundary - 1024 : boundary + 1024);
+        REQUIRE_FALSE(buffer->IsLeakyBuffer());
+        if (i == 100) {
+            allocations = pool->GetStats().allocations;
+        }
+    }
+    const auto stats = pool->GetStats();
+    REQUIRE_EQ(stats.allocations, allocations);
+    REQUIRE_LE(stats.slabs, buffer_count);
+    std::cout << "test_infrastructure/test_tcp/buffer_pool straddling " << boundary / 1024 << "kB: " <<
+        stats.allocations << " allocations, " << stats.frees << " frees over 2000 frames" << std::endl;
+}
+
+TEST_CASE("INFRASTRUCTURE_TCP-Read-Buffer-Pool-Buffer-Count") {
+    auto pool = infrastructure::TcpReadBufferPool::Create(buffer_count, buffer_size);
+    // a headset joins that can hold on to a few frames; the pool makes room for them instead of leaking
+    pool->SetBufferCount(buffer_count + 6);
+    std::vector<std::shared_ptr<infrastructure::TcpBuffer>> held;
+    for (int i = 0; i < buffer_count + 6; i++) {
+        held.push_back(pool->GetReadBuffer(200 * 1024));
+        REQUIRE_FALSE(held.back()->IsLeakyBuffer());
+    }
+    REQUIRE(pool->GetReadBuffer(200 * 1024)->IsLeakyBuffer());
+
+    // it leaves; the extra slabs go as they come back
+    pool->SetBufferCount(buffer_count);
+    held.clear();
+    const auto stats = pool->GetStats();
+    REQUIRE_LE(stats.slabs, buffer_count);
+    std::cout << "test_infrastructure/test_tcp/buffer_pool back down to " << buffer_count << ": " << stats.slabs <<
+        " slabs, " << stats.frees << " frees" << std::endl;
+}
@@ -266,4 +266,116 @@ TEST_CASE("INFRASTRUCTURE_TCP-Server-to-Headset-Stress"){
     client->Stop();
     srv->Stop();
     ctx->Stop();
-}
\ No newline at end of file
+}
+TEST_CASE("INFRASTRUCTURE_TCP-Send-Queue-Conflating") {
+    std::vector<std::string> samples { "hello", "world", "bar__", "baz__", "foo__", "bax__" };
+    const auto front_string = [](infrastructure::TcpSendQueue &queue) {
+        auto &buffer = queue.Front();
+        return std::string((char *) buffer->GetMemory(), buffer->GetSize());
+    };
+
+    // the frame in flight always finishes, and only the newest frame waits behind it
+    infrastructure::TcpSendQueue conflating_queue(1, true);
+    REQUIRE(conflating_queue.Push(std::make_shared<FakeSizedBuffer>(samples[0])));
+    for (std::size_t i = 1; i < samples.size(); i++) {
+        REQUIRE_FALSE(conflating_queue.Push(std::make_shared<FakeSizedBuffer>(samples[i])));
+    }
+    REQUIRE_EQ(front_string(conflating_queue), samples.front());
+    REQUIRE(conflating_queue.Pop());
+    REQUIRE_EQ(front_string(conflating_queue), samples.back());
+    REQUIRE_FALSE(conflating_queue.Pop());
+    REQUIRE_EQ(conflating_queue.DroppedFrames(), samples.size() - 2);
+
+    // a plain bounded queue keeps the oldest frames and drops the newest
+    infrastructure::TcpSendQueue bounded_queue(2, false);
+    REQUIRE(bounded_queue.Push(std::make_shared<FakeSizedBuffer>(samples[0])));
+    for (std::size_t i = 1; i < samples.size(); i++) {
+        REQUIRE_FALSE(bounded_queue.Push(std::make_shared<FakeSizedBuffer>(samples[i])));
+    }
+    for (int i = 0; i < 3; i++) {
+        REQUIRE_EQ(front_string(bounded_queue), samples[i]);
+        REQUIRE_EQ(bounded_queue.Pop(), i < 2);
+    }
+    REQUIRE_EQ(bounded_queue.DroppedFrames(), samples.size() - 3);
+}
+TEST_CASE("INFRASTRUCTURE_TCP-Send-Queue-Reposts") {
+    std::vector<std::string> samples { "hello", "world", "bar__" };
+    // with cut-through, a frame that's still landing gets pushed again for every chunk
+    auto writing = std::make_shared<FakeSizedBuffer>(samples[0]);
+    auto waiting = std::make_shared<FakeSizedBuffer>(samples[1]);
+    auto landing = std::make_shared<FakeSizedBuffer>(samples[2]);
+
+    // a frame dropped by a full queue stays dropped, and only counts once, however many chunks follow it
+    infrastructure::TcpSendQueue bounded_queue(1, false);
+    REQUIRE(bounded_queue.Push(std::shared_ptr<SizedBuffer>(writing)));
+    REQUIRE_FALSE(bounded_queue.Push(std::shared_ptr<SizedBuffer>(waiting)));
+    for (int i = 0; i < 16; i++) {
+        REQUIRE_FALSE(bounded_queue.Push(std::shared_ptr<SizedBuffer>(landing)));
+    }
+    REQUIRE_EQ(bounded_queue.DroppedFrames(), 1ul);
+    // once there's room, the rest of it still doesn't get let in partway through
+    REQUIRE(bounded_queue.Pop());
+    REQUIRE_FALSE(bounded_queue.Push(std::shared_ptr<SizedBuffer>(landing)));
+    REQUIRE_EQ(bounded_queue.Size(), (std::size_t) 1);
+    REQUIRE_EQ(bounded_queue.Front(), waiting);
+    REQUIRE_EQ(bounded_queue.DroppedFrames(), 1ul);
+
+    // a frame that's already waiting isn't queued twice either
+    infrastructure::TcpSendQueue conflating_queue(1, true);
+    REQUIRE(conflating_queue.Push(std::shared_ptr<SizedBuffer>(writing)));
+    for (int i = 0; i < 16; i++) {
+        REQUIRE_FALSE(conflating_queue.Push(std::shared_ptr<SizedBuffer>(landing)));
+    }
+    REQUIRE_EQ(conflating_queue.Size(), (std::size_t) 2);
+    REQUIRE_EQ(conflating_queue.DroppedFrames(), 0ul);
+    // and one swapped out for a newer frame stays out
+    REQUIRE_FALSE(conflating_queue.Push(std::shared_ptr<SizedBuffer>(waiting)));
+    REQUIRE_FALSE(conflating_queue.Push(std::shared_ptr<SizedBuffer>(landing)));
+    REQUIRE_EQ(conflating_queue.DroppedFrames(), 1ul);
+    REQUIRE(conflating_queue.Pop());
+    REQUIRE_EQ(conflating_queue.Front(), waiting);
+}
+TEST_CASE("INFRASTRUCTURE_TCP-Packet-Header-Versions") {
+    FrameMetadata metadata;
+    metadata.sequence_number = 42;
+    metadata.width = 1536;
+    metadata.height = 864;
+    metadata.pixel_format = FOURCC_MJPEG;
+    metadata.sensor_timestamp_us = 1000;
+    metadata.encode_timestamp_us = 2000;
+
+    // old readers never say hello, so they only ever see the 24 byte header
+    infrastructure::PacketHeader silent;
+    REQUIRE_EQ(silent.HelloVersion(), 1);
+    infrastructure::PacketHeader v1;
+    v1.SetupHeader(1024, silent.HelloVersion(), &metadata);
+    REQUIRE(v1.Ok());
+    REQUIRE_EQ(v1.Size(), infrastructure::PacketHeader::HeaderSize);
+    REQUIRE_EQ(v1.ReadSize(v1.Size()), infrastructure::PacketHeader::HeaderSize);
+    REQUIRE_EQ(v1.GetMetadata().sequence_number, 0);
+
+    // new readers say hello, and the writer answers with the extended header
+    infrastructure::PacketHeader hello;
+    hello.SetupHello();
+    REQUIRE_EQ(hello.HelloVersion(), infrastructure::PacketHeader::LatestVersion);
+    infrastructure::PacketHeader v2;
+    v2.SetupHeader(1024, hello.HelloVersion(), &metadata);
+    REQUIRE(v2.Ok());
+    REQUIRE_EQ(v2.Size(), infrastructure::PacketHeader::ExtendedHeaderSize);
+
+    // a reader only learns it needs the extension once the base header is in
+    infrastructure::PacketHeader received;
+    std::memcpy(received.Data(), v2.Data(), infrastructure::PacketHeader::HeaderSize);
+    REQUIRE_EQ(received.ReadSize(0), infrastructure::PacketHeader::HeaderSize);
+    REQUIRE_EQ(
+        received.ReadSize(infrastructure::PacketHeader::HeaderSize), infrastructure::PacketHeader::ExtendedHeaderSize
+    );
+    std::memcpy(received.Data(), v2.Data(), v2.Size());
+    const auto out = received.GetMetadata();
+    REQUIRE_EQ(out.sequence_number, metadata.sequence_number);
+    REQUIRE_EQ(out.width, metadata.width);
+    REQUIRE_EQ(out.height, metadata.height);
+    REQUIRE_EQ(out.pixel_format, metadata.pixel_format);
+    REQUIRE_EQ(out.sensor_timestamp_us, metadata.sensor_timestamp_us);
+    REQUIRE_EQ(out.encode_timestamp_us, metadata.encode_timestamp_us);
+}
@@ -0,0 +1,454 @@
+//
+// Created by brucegoose on 7/9/23.
+//
+
+#include <doctest.h>
+#include <iostream>
+#include <chrono>
+using namespace std::literals;
+typedef std::chrono::high_resolution_clock Clock;
+
+#include "utils/asio_context.hpp"
+#include "client.hpp"
+#include "communication.hpp"
+#include "fan_out.hpp"
+
+using infrastructure::PacketHeader;
+
+/* blocking read with a deadline, so a frame that never gets forwarded fails the test instead of hanging it */
+static bool readWithin(
+    net::io_context &context, tcp::socket &socket, const net::mutable_buffer &buffer,
+    const std::chrono::milliseconds timeout
+) {
+    bool is_done = false;
+    error_code result;
+    net::async_read(socket, buffer, [&](error_code ec, std::size_t) {
+        is_done = true;
+        result = ec;
+    });
+    context.restart();
+    context.run_for(timeout);
+    if (!is_done) {
+        error_code ec;
+        socket.cancel(ec);
+        context.restart();
+        context.run();
+        return false;
+    }
+    return !result;
+}
+
+TEST_CASE("INFRASTRUCTURE_TCP-Server-Cut-Through") {
+    const unsigned short server_port = 42071;
+    const unsigned short first_camera_port = 42171;
+    const unsigned short second_camera_port = 42172;
+
+    TestClientServerConfig conf(3, server_port, "127.0.0.1", ConnectionType::HEADSET_CONNECTION);
+    auto ctx = AsioContext::Create(conf);
+    ctx->Start();
+    auto manager = std::make_shared<TcpRelayServerManager>(
+        std::set<unsigned short>{ first_camera_port, second_camera_port }
+    );
+    auto srv_manager = std::static_pointer_cast<infrastructure::TcpServerManager>(manager);
+    auto srv = infrastructure::TcpServer::Create(conf, ctx->GetContext(), srv_manager);
+    srv->Start();
+
+    // a real headset client, which should only ever hand whole frames up
+    auto client_manager = std::make_shared<TcpFanOutClientManager>();
+    auto client = infrastructure::TcpClient::Create(
+        conf, ctx->GetContext(), std::static_pointer_cast<infrastructure::TcpClientManager>(client_manager)
+    );
+    client->Start();
+
+    // and a raw one, to look at exactly what goes over the wire
+    net::io_context context;
+    const tcp::endpoint server_endpoint(net::ip::address_v4::loopback(), server_port);
+    tcp::socket headset(context);
+    headset.connect(server_endpoint);
+    PacketHeader hello;
+    hello.SetupHello();
+    net::write(headset, net::buffer(hello.Data(), PacketHeader::HeaderSize));
+
+    const auto connect_deadline = Clock::now() + 5s;
+    while (
+        (manager->SessionCount() < 2 || client_manager->connected_count < 1) && Clock::now() < connect_deadline
+    ) {
+        std::this_thread::sleep_for(10ms);
+    }
+    REQUIRE_EQ(manager->SessionCount(), 2);
+    REQUIRE_EQ(client_manager->connected_count, 1);
+    // let both hellos land before any frame does
+    std::this_thread::sleep_for(100ms);
+
+    const auto connect_camera = [&](const unsigned short port) {
+        tcp::socket camera(context);
+        camera.open(tcp::v4());
+        camera.set_option(tcp::socket::reuse_address(true));
+        camera.bind(tcp::endpoint(net::ip::address_v4::loopback(), port));
+        camera.connect(server_endpoint);
+        camera.set_option(tcp::no_delay(true));
+        return camera;
+    };
+
+    const int chunk_count = 4;
+    const auto chunk_size = PacketHeader::MaxSize;
+    std::string frame_data(chunk_count * chunk_size, '\0');
+    for (std::size_t i = 0; i < frame_data.size(); i++) {
+        frame_data[i] = static_cast<char>(i * 7);
+    }
+    std::shared_ptr<SizedBuffer> buffer = std::make_shared<FakeSizedBuffer>(frame_data);
+
+    std::vector<char> chunk(chunk_size);
+    const auto readChunk = [&](const int index) {
+        PacketHeader received;
+        REQUIRE(readWithin(context, headset, net::buffer(received.Data(), PacketHeader::ExtendedHeaderSize), 2000ms));
+        REQUIRE(received.Ok());
+        REQUIRE_FALSE(received.IsAborted());
+        REQUIRE_EQ(received.IsFrameStart(), index == 0);
+        REQUIRE_EQ(received.TotalBytes(), frame_data.size());
+        REQUIRE_EQ(received.DataLength(), chunk_size);
+        REQUIRE(readWithin(context, headset, net::buffer(chunk), 2000ms));
+        REQUIRE_EQ(std::memcmp(chunk.data(), frame_data.data() + index * chunk_size, chunk_size), 0);
+    };
+
+    // the camera sends half a frame, and the headsets get that half without waiting on the rest
+    PacketHeader header;
+    infrastructure::PacketFrame frame;
+    frame.Setup(header, buffer);
+    const auto &buffers = frame.Buffers();
+    auto camera = connect_camera(first_camera_port);
+    const auto t1 = Clock::now();
+    net::write(camera, std::vector<net::const_buffer>(buffers.begin(), buffers.begin() + 4));
+    readChunk(0);
+    const auto t2 = Clock::now();
+    readChunk(1);
+    REQUIRE_EQ(client_manager->receive_count, 0);
+
+    // then it drops, and the headsets are told to throw the half away
+    camera.close();
+    PacketHeader aborted;
+    REQUIRE(readWithin(context, headset, net::buffer(aborted.Data(), PacketHeader::ExtendedHeaderSize), 2000ms));
+    REQUIRE(aborted.Ok());
+    REQUIRE(aborted.IsAborted());
+    REQUIRE_EQ(aborted.DataLength(), 0);
+
+    // a new camera's whole frame comes through clean
+    auto second_camera = connect_camera(second_camera_port);
+    frame.Setup(header, buffer);
+    net::write(second_camera, frame.Buffers());
+    for (int i = 0; i < chunk_count; i++) {
+        readChunk(i);
+    }
+    const auto receive_deadline = Clock::now() + 2s;
+    while (client_manager->receive_count < 1 && Clock::now() < receive_deadline) {
+        std::this_thread::sleep_for(10ms);
+    }
+    REQUIRE_EQ(client_manager->receive_count, 1);
+
+    const auto first_chunk = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1);
+    std::cout << "test_infrastructure/test_tcp/cut_through first chunk at the headset after " <<
+        first_chunk.count() << " microseconds" << std::endl;
+
+    second_camera.close();
+    headset.close();
+    client->Stop();
+    manager->Clear();
+    srv->Stop();
+    ctx->Stop();
+}
+
+/* stands in for a streaming encoder's output; it goes out before anyone knows how big it will be */
+class StreamingSizedBuffer: public SizedBuffer {
+public:
+    explicit StreamingSizedBuffer(std::size_t max_size): _memory(max_size) {}
+    [[nodiscard]] void *GetMemory() override {
+        return _memory.data();
+    }
+    [[nodiscard]] std::size_t GetSize() override {
+        return _size;
+    }
+    [[nodiscard]] FrameProgress *GetProgress() override {
+        return &_progress;
+    }
+    std::vector<char> _memory;
+    std::atomic<std::size_t> _size = { 0 };
+    FrameProgress _progress;
+};
+
+TEST_CASE("INFRASTRUCTURE_TCP-Open-Ended-Frames") {
+    const unsigned short server_port = 42072;
+
+    TestClientServerConfig camera_conf(3, server_port, "127.0.0.1", ConnectionType::CAMERA_CONNECTION);
+    TestClientServerConfig headset_conf(3, server_port, "127.0.0.1", ConnectionType::HEADSET_CONNECTION);
+    auto ctx = AsioContext::Create(headset_conf);
+    ctx->Start();
+    auto manager = std::make_shared<TcpRelayServerManager>();
+    auto srv_manager = std::static_pointer_cast<infrastructure::TcpServerManager>(manager);
+    auto srv = infrastructure::TcpServer::Create(headset_conf, ctx->GetContext(), srv_manager);
+    srv->Start();
+
+    auto client_manager = std::make_shared<TcpFanOutClientManager>();
+    auto tcp_client_manager = std::static_pointer_cast<infrastructure::TcpClientManager>(client_manager);
+    manager->ExpectCamera();
+    auto camera = infrastructure::TcpClient::Create(camera_conf, ctx->GetContext(), tcp_client_manager);
+    camera->Start();
+    const auto camera_deadline = Clock::now() + 5s;
+    while (manager->_camera_count < 1 && Clock::now() < camera_deadline) {
+        std::this_thread::sleep_for(10ms);
+    }
+    REQUIRE_EQ(manager->_camera_count, 1);
+
+    // a real headset, a raw one that says hello, and a raw one too old to
+    auto headset = infrastructure::TcpClient::Create(headset_conf, ctx->GetContext(), tcp_client_manager);
+    headset->Start();
+    net::io_context context;
+    const tcp::endpoint server_endpoint(net::ip::address_v4::loopback(), server_port);
+    tcp::socket new_headset(context);
+    new_headset.connect(server_endpoint);
+    PacketHeader hello;
+    hello.SetupHello();
+    net::write(new_headset, net::buffer(hello.Data(), PacketHeader::HeaderSize));
+    tcp::socket old_headset(context);
+    old_headset.connect(server_endpoint);
+
+    const auto connect_deadline = Clock::now() + 5s;
+    while (manager->SessionCount() < 3 && Clock::now() < connect_deadline) {
+        std::this_thread::sleep_for(10ms);
+    }
+    REQUIRE_EQ(manager->SessionCount(), 3);
+    std::this_thread::sleep_for(100ms);
+
+    const std::size_t frame_size = 200000;
+    std::string frame_data(frame_size, '\0');
+    for (std::size_t i = 0; i < frame_data.size(); i++) {
+        frame_data[i] = static_cast<char>(i * 13);
+    }
+    auto streaming = std::make_shared<StreamingSizedBuffer>(frame_size);
+    std::shared_ptr<SizedBuffer> buffer = streaming;
+    streaming->_progress.Reset();
+    const auto land = [&](const std::size_t landed) {
+        std::memcpy(streaming->_memory.data(), frame_data.data(), landed);
+        streaming->_progress.Land(landed);
+        auto copy_buffer = buffer;
+        camera->Post(std::move(copy_buffer));
+    };
+
+    std::vector<char> received(frame_size);
+    std::size_t received_bytes = 0;
+    bool is_received = false;
+    const auto readChunk = [&](tcp::socket &socket, const std::size_t header_size) {
+        PacketHeader header;
+        REQUIRE(readWithin(context, socket, net::buffer(header.Data(), header_size), 2000ms));
+        REQUIRE(header.Ok());
+        REQUIRE_EQ(header.Size(), header_size);
+        REQUIRE_EQ(header.IsFrameStart(), received_bytes == 0);
+        REQUIRE_LE(received_bytes + header.DataLength(), frame_size);
+        REQUIRE(readWithin(
+            context, socket, net::buffer(received.data() + received_bytes, header.DataLength()), 2000ms
+        ));
+        received_bytes += header.DataLength();
+        if (header.IsOpenEnded() && header.TotalBytes() != 0) {
+            REQUIRE_EQ(header.TotalBytes(), received_bytes);
+        }
+        is_received = header.TotalBytes() != 0 && received_bytes == header.TotalBytes();
+        return header;
+    };
+
+    // the first bit of the frame makes it all the way through on its own
+    land(16384);
+    const auto first = readChunk(new_headset, PacketHeader::ExtendedHeaderSize);
+    REQUIRE(first.IsOpenEnded());
+    REQUIRE_EQ(first.TotalBytes(), 0);
+    REQUIRE_EQ(first.DataLength(), 16384);
+
+    land(100000);
+    while (received_bytes < 100000) {
+        static_cast<void>(readChunk(new_headset, PacketHeader::ExtendedHeaderSize));
+    }
+    REQUIRE_FALSE(is_received);
+    REQUIRE_EQ(client_manager->receive_count, 0);
+
+    // finishing it sends the total along with whatever is left
+    std::memcpy(streaming->_memory.data(), frame_data.data(), frame_size);
+    streaming->_size = frame_size;
+    streaming->_progress.Complete(frame_size);
+    camera->Post(std::move(buffer));
+    while (!is_received) {
+        static_cast<void>(readChunk(new_headset, PacketHeader::ExtendedHeaderSize));
+    }
+    REQUIRE_EQ(std::memcmp(received.data(), frame_data.data(), frame_size), 0);
+
+    // the old headset only ever sees it whole, with its size up front
+    received_bytes = 0;
+    is_received = false;
+    const auto old_first = readChunk(old_headset, PacketHeader::HeaderSize);
+    REQUIRE_EQ(old_first.TotalBytes(), frame_size);
+    while (received_bytes < frame_size) {
+        static_cast<void>(readChunk(old_headset, PacketHeader::HeaderSize));
+    }
+    REQUIRE_EQ(std::memcmp(received.data(), frame_data.data(), frame_size), 0);
+
+    const auto receive_deadline = Clock::now() + 2s;
+    while (client_manager->receive_count < 1 && Clock::now() < receive_deadline) {
+        std::this_thread::sleep_for(10ms);
+    }
+    REQUIRE_EQ(client_manager->receive_count, 1);
+
+    new_headset.close();
+    old_headset.close();
+    headset->Stop();
+    camera->Stop();
+    manager->Clear();
+    srv->Stop();
+    ctx->Stop();
+}
+
+/* remembers what state the frame was in every time the client handed it over */
+class TcpStreamReceiveClientManager: public TcpFanOutClientManager {
+public:
+    struct Post {
+        bool is_filling;
+        bool is_aborted;
+        std::size_t landed;
+    };
+    void PostHeadsetClientBuffer(std::shared_ptr<SizedBuffer> &&buffer) override {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto *progress = buffer->GetProgress();
+        _posts.push_back({ progress->IsFilling(), progress->IsAborted(), progress->Landed() });
+        if (!progress->IsFilling() && !progress->IsAborted()) {
+            auto *memory = (char *) buffer->GetMemory();
+            _frame.assign(memory, memory + buffer->GetSize());
+        }
+    }
+    std::vector<Post> Posts() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _posts;
+    }
+    std::vector<char> Frame() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _frame;
+    }
+    void Clear() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _posts.clear();
+        _frame.clear();
+    }
+private:
+    std::mutex _mutex;
+    std::vector<Post> _posts;
+    std::vector<char> _frame;
+};
+
+TEST_CASE("INFRASTRUCTURE_TCP-Client-Stream-Receive") {
+    const unsigned short server_port = 42073;
+
+    TestClientServerConfig camera_conf(3, server_port, "127.0.0.1", ConnectionType::CAMERA_CONNECTION);
+    TestClientServerConfig headset_conf(3, server_port, "127.0.0.1", ConnectionType::HEADSET_CONNECTION, true);
+    auto ctx = AsioContext::Create(headset_conf);
+    ctx->Start();
+    auto manager = std::make_shared<TcpRelayServerManager>();
+    auto srv_manager = std::static_pointer_cast<infrastructure::TcpServerManager>(manager);
+    auto srv = infrastructure::TcpServer::Create(headset_conf, ctx->GetContext(), srv_manager);
+    srv->Start();
+
+    auto camera_manager = std::make_shared<TcpFanOutClientManager>();
+    manager->ExpectCamera();
+    auto camera = infrastructure::TcpClient::Create(
+        camera_conf, ctx->GetContext(), std::static_pointer_cast<infrastructure::TcpClientManager>(camera_manager)
+    );
+    camera->Start();
+    const auto camera_deadline = Clock::now() + 5s;
+    while (manager->_camera_count < 1 && Clock::now() < camera_deadline) {
+        std::this_thread::sleep_for(10ms);
+    }
+    REQUIRE_EQ(manager->_camera_count, 1);
+
+    auto headset_manager = std::make_shared<TcpStreamReceiveClientManager>();
+    auto headset = infrastructure::TcpClient::Create(
+        headset_conf, ctx->GetContext(), std::static_pointer_cast<infrastructure::TcpClientManager>(headset_manager)
+    );
+    headset->Start();
+    const auto connect_deadline = Clock::now() + 5s;
+    while (manager->SessionCount() < 1 && Clock::now() < connect_deadline) {
+        std::this_thread::sleep_for(10ms);
+    }
+    REQUIRE_EQ(manager->SessionCount(), 1);
+    std::this_thread::sleep_for(100ms);
+
+    const std::size_t frame_size = 200000;
+    std::string frame_data(frame_size, '\0');
+    for (std::size_t i = 0; i < frame_data.size(); i++) {
+        frame_data[i] = static_cast<char>(i * 7);
+    }
+    const auto wait_for_posts = [&](const std::size_t count) {
+        const auto deadline = Clock::now() + 2s;
+        while (headset_manager->Posts().size() < count && Clock::now() < deadline) {
+            std::this_thread::sleep_for(5ms);
+        }
+        return headset_manager->Posts();
+    };
+
+    // the headset hands the frame on while it's still landing, and again once it's whole
+    {
+        auto streaming = std::make_shared<StreamingSizedBuffer>(frame_size);
+        std::shared_ptr<SizedBuffer> buffer = streaming;
+        streaming->_progress.Reset();
+        std::memcpy(streaming->_memory.data(), frame_data.data(), 50000);
+        streaming->_progress.Land(50000);
+        auto copy_buffer = buffer;
+        camera->Post(std::move(copy_buffer));
+
+        const auto early = wait_for_posts(1);
+        REQUIRE_GE(early.size(), 1);
+        REQUIRE(early.back().is_filling);
+        REQUIRE_GT(early.back().landed, 0);
+        REQUIRE_LE(early.back().landed, 50000);
+        REQUIRE(headset_manager->Frame().empty());
+
+        std::memcpy(streaming->_memory.data(), frame_data.data(), frame_size);
+        streaming->_size = frame_size;
+        streaming->_progress.Complete(frame_size);
+        camera->Post(std::move(buffer));
+    }
+    const auto deadline = Clock::now() + 2s;
+    while (headset_manager->Frame().empty() && Clock::now() < deadline) {
+        std::this_thread::sleep_for(5ms);
+    }
+    const auto frame = headset_manager->Frame();
+    REQUIRE_EQ(frame.size(), frame_size);
+    REQUIRE_EQ(std::memcmp(frame.data(), frame_data.data(), frame_size), 0);
+    const auto posts = headset_manager->Posts();
+    for (std::size_t i = 1; i < posts.size(); i++) {
+        REQUIRE_LE(posts[i - 1].landed, posts[i].landed);
+    }
+    REQUIRE_FALSE(posts.back().is_filling);
+    REQUIRE_FALSE(posts.back().is_aborted);
+
+    // a frame the camera gives up on reaches the headset as aborted, never as whole
+    headset_manager->Clear();
+    {
+        auto streaming = std::make_shared<StreamingSizedBuffer>(frame_size);
+        std::shared_ptr<SizedBuffer> buffer = streaming;
+        streaming->_progress.Reset();
+        std::memcpy(streaming->_memory.data(), frame_data.data(), 50000);
+        streaming->_progress.Land(50000);
+        auto copy_buffer = buffer;
+        camera->Post(std::move(copy_buffer));
+        REQUIRE_GE(wait_for_posts(1).size(), 1);
+
+        streaming->_progress.Abort();
+        camera->Post(std::move(buffer));
+    }
+    const auto abort_deadline = Clock::now() + 2s;
+    while (!headset_manager->Posts().back().is_aborted && Clock::now() < abort_deadline) {
+        std::this_thread::sleep_for(5ms);
+    }
+    REQUIRE(headset_manager->Posts().back().is_aborted);
+    REQUIRE(headset_manager->Frame().empty());
+
+    headset->Stop();
+    camera->Stop();
+    manager->Clear();
+    srv->Stop();
+    ctx->Stop();
+}
@@ -0,0 +1,243 @@
+//
+// Created by brucegoose on 7/2/23.
+//
+
+#include <doctest.h>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <functional>
+using namespace std::literals;
+typedef std::chrono::high_resolution_clock Clock;
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "load.hpp"
+
+
+static long cpuTimeMicroseconds() {
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000L +
+        usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static long residentSetKilobytes() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmRSS:", 0) == 0) {
+            return std::stol(line.substr(6));
+        }
+    }
+    return 0;
+}
+
+/*
+ * runs in a forked process so the headset clients don't show up in the server's cpu / rss numbers; every command is
+ * a headset count to scale up to, and the reply is how many frames were received since the last reply
+ */
+[[noreturn]] static void runHeadsetClients(const int command_fd, const int reply_fd) {
+    TestClientServerConfig conf(2, 42069, "127.0.0.1", ConnectionType::HEADSET_CONNECTION);
+    auto ctx = AsioContext::Create(conf);
+    ctx->Start();
+    auto manager = std::make_shared<TcpFanOutClientManager>();
+    auto client_manager = std::static_pointer_cast<infrastructure::TcpClientManager>(manager);
+    std::vector<std::shared_ptr<infrastructure::TcpClient>> clients;
+
+    int headset_count = 0;
+    while (read(command_fd, &headset_count, sizeof headset_count) == sizeof headset_count && headset_count > 0) {
+        while (clients.size() < (std::size_t) headset_count) {
+            auto client = infrastructure::TcpClient::Create(conf, ctx->GetContext(), client_manager);
+            client->Start();
+            clients.push_back(std::move(client));
+        }
+        const auto connect_deadline = Clock::now() + 5s;
+        while (manager->connected_count < headset_count && Clock::now() < connect_deadline) {
+            std::this_thread::sleep_for(10ms);
+        }
+        long receive_count = manager->receive_count.exchange(0);
+        (void) !write(reply_fd, &receive_count, sizeof receive_count);
+    }
+    _exit(0);
+}
+
+TEST_CASE("INFRASTRUCTURE_TCP-Server-Fan-Out-Scaling") {
+    int command_pipe[2];
+    int reply_pipe[2];
+    REQUIRE_EQ(pipe(command_pipe), 0);
+    REQUIRE_EQ(pipe(reply_pipe), 0);
+    std::cout.flush();
+    const pid_t client_pid = fork();
+    REQUIRE_NE(client_pid, -1);
+    if (client_pid == 0) {
+        close(command_pipe[1]);
+        close(reply_pipe[0]);
+        runHeadsetClients(command_pipe[0], reply_pipe[1]);
+    }
+    close(command_pipe[0]);
+    close(reply_pipe[1]);
+
+    const auto send_command = [&](int headset_count) {
+        (void) !write(command_pipe[1], &headset_count, sizeof headset_count);
+        if (headset_count == 0) {
+            return 0L;
+        }
+        long receive_count = 0;
+        (void) !read(reply_pipe[0], &receive_count, sizeof receive_count);
+        return receive_count;
+    };
+
+    TestClientServerConfig conf(3, 42069, "127.0.0.1", ConnectionType::HEADSET_CONNECTION);
+    auto ctx = AsioContext::Create(conf);
+    ctx->Start();
+    auto manager = std::make_shared<TcpFanOutServerManager>();
+    auto srv_manager = std::static_pointer_cast<infrastructure::TcpServerManager>(manager);
+    auto srv = infrastructure::TcpServer::Create(conf, ctx->GetContext(), srv_manager);
+    srv->Start();
+
+    // stand in for a camera session; roughly the size of a 1536x864 jpeg at quality 75
+    const int frame_size = 256 * 1024;
+    auto camera_pool = infrastructure::TcpReadBufferPool::Create(8, frame_size);
+
+    for (const int headset_count : { 1, 4, 16, 32 }) {
+        send_command(headset_count);
+        const auto connect_deadline = Clock::now() + 5s;
+        while (manager->SessionCount() < (std::size_t) headset_count && Clock::now() < connect_deadline) {
+            std::this_thread::sleep_for(10ms);
+        }
+        REQUIRE_EQ(manager->SessionCount(), headset_count);
+
+        int send_count = 0;
+        int source_drop_count = 0;
+        const long cpu_start = cpuTimeMicroseconds();
+        const auto t1 = Clock::now();
+        auto next_frame = t1;
+        while (Clock::now() - t1 < 3s) {
+            auto buffer = camera_pool->GetReadBuffer();
+            if (buffer->IsLeakyBuffer()) {
+                source_drop_count += 1;
+            } else {
+                std::memset(buffer->GetMemory(), send_count & 0xff, 64);
+                buffer->SetSize(frame_size);
+                manager->PostToAll(buffer);
+                send_count += 1;
+            }
+            buffer.reset();
+            next_frame += 33ms;
+            std::this_thread::sleep_until(next_frame);
+        }
+        const auto t2 = Clock::now();
+        const long cpu_used = cpuTimeMicroseconds() - cpu_start;
+        const long receive_count = send_command(headset_count);
+
+        const auto wall_used = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+        std::cout << "test_infrastructure/test_tcp/fan_out " << headset_count << " headsets: " <<
+            "sent " << send_count << " frames (" << source_drop_count << " dropped at the camera pool), " <<
+            "received " << receive_count << " of " << send_count * headset_count << "; " <<
+            "server cpu " << (100.0 * cpu_used / wall_used) << "%, " <<
+            "rss " << residentSetKilobytes() << "kB" << std::endl;
+    }
+
+    send_command(0);
+    waitpid(client_pid, nullptr, 0);
+    close(command_pipe[1]);
+    close(reply_pipe[0]);
+
+    manager->Clear();
+    srv->Stop();
+    ctx->Stop();
+}
+
+TEST_CASE("INFRASTRUCTURE_TCP-Server-Stalled-Headset") {
+    TestClientServerConfig conf(3, 42075, "127.0.0.1", ConnectionType::HEADSET_CONNECTION);
+    TestClientServerConfig camera_conf(3, 42075, "127.0.0.1", ConnectionType::CAMERA_CONNECTION);
+    auto ctx = AsioContext::Create(conf);
+    ctx->Start();
+    auto manager = std::make_shared<TcpRelayServerManager>();
+    manager->ExpectCamera();
+    auto srv_manager = std::static_pointer_cast<infrastructure::TcpServerManager>(manager);
+    auto srv = infrastructure::TcpServer::Create(conf, ctx->GetContext(), srv_manager);
+    srv->Start();
+
+    const auto wait_until = [](const std::function<bool()> &is_done) {
+        const auto deadline = Clock::now() + 5s;
+        while (!is_done() && Clock::now() < deadline) {
+            std::this_thread::sleep_for(10ms);
+        }
+        return is_done();
+    };
+    auto camera_manager = std::make_shared<TcpFanOutClientManager>();
+    auto camera = infrastructure::TcpClient::Create(
+        camera_conf, ctx->GetContext(), std::static_pointer_cast<infrastructure::TcpClientManager>(camera_manager)
+    );
+    camera->Start();
+    REQUIRE(wait_until([&]() { return manager->_camera_count == 1; }));
+
+    std::vector<std::shared_ptr<TcpFanOutClientManager>> live_managers;
+    std::vector<std::shared_ptr<infrastructure::TcpClient>> live;
+    for (int i = 0; i < 2; i++) {
+        live_managers.push_back(std::make_shared<TcpFanOutClientManager>());
+        live.push_back(infrastructure::TcpClient::Create(
+            conf, ctx->GetContext(),
+            std::static_pointer_cast<infrastructure::TcpClientManager>(live_managers.back())
+        ));
+        live.back()->Start();
+    }
+    REQUIRE(wait_until([&]() { return manager->SessionCount() == live.size(); }));
+    for (auto &live_manager : live_managers) {
+        REQUIRE(wait_until([&]() { return live_manager->connected_count == 1; }));
+    }
+
+    /*
+     * headsets that connect and then never read; once their socket buffers fill, each one's queue holds on to the
+     * frames that were going out when it stalled. They join a second apart, so they don't hold on to the same ones
+     */
+    const int stalled_count = 2;
+    std::vector<tcp::socket> stalled;
+    const auto stall_headset = [&]() {
+        stalled.emplace_back(ctx->GetContext());
+        stalled.back().open(tcp::v4());
+        stalled.back().set_option(net::socket_base::receive_buffer_size(4096));
+        stalled.back().connect(tcp::endpoint(net::ip::make_address("127.0.0.1"), 42075));
+        return wait_until([&]() { return manager->SessionCount() == live.size() + stalled.size(); });
+    };
+
+    // a couple hundred kB a frame at 30fps
+    const int frame_count = 120;
+    auto next_frame = Clock::now();
+    for (int i = 0; i < frame_count; i++) {
+        if (i % 30 == 0 && (int) stalled.size() < stalled_count) {
+            REQUIRE(stall_headset());
+            next_frame = Clock::now();
+        }
+        camera->Post(std::make_shared<StampedBuffer>(256 * 1024));
+        next_frame += 33ms;
+        std::this_thread::sleep_until(next_frame);
+    }
+    for (auto &live_manager : live_managers) {
+        wait_until([&]() { return live_manager->receive_count == frame_count; });
+    }
+    std::cout << "test_infrastructure/test_tcp/fan_out with " << stalled_count << " stalled headsets: ";
+    for (auto &live_manager : live_managers) {
+        std::cout << live_manager->receive_count << " ";
+    }
+    std::cout << "of " << frame_count << " frames received" << std::endl;
+    for (auto &live_manager : live_managers) {
+        REQUIRE_EQ(live_manager->receive_count, frame_count);
+    }
+
+    for (auto &socket : stalled) {
+        error_code ec;
+        socket.close(ec);
+    }
+    for (auto &client : live) {
+        client->Stop();
+    }
+    camera->Stop();
+    manager->Clear();
+    srv->Stop();
+    ctx->Stop();
+}
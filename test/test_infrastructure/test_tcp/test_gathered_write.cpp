@@ -0,0 +1,118 @@
+//
+// Created by brucegoose on 7/4/23.
+//
+
+#include <doctest.h>
+#include <iostream>
+#include <chrono>
+using namespace std::literals;
+typedef std::chrono::high_resolution_clock Clock;
+
+#include "utils/asio_context.hpp"
+#include "infrastructure/tcp/tcp_utils.hpp"
+
+#include "communication.hpp"
+
+/*
+ * every write_some below is exactly one sendmsg, so counting them gives the syscalls per frame for the old
+ * header-then-body pattern and the gathered frame write
+ */
+
+static int writeAll(tcp::socket &socket, std::vector<net::const_buffer> buffers) {
+    int calls = 0;
+    while (!buffers.empty()) {
+        auto bytes_written = socket.write_some(buffers);
+        calls += 1;
+        while (bytes_written > 0) {
+            if (bytes_written >= buffers.front().size()) {
+                bytes_written -= buffers.front().size();
+                buffers.erase(buffers.begin());
+            } else {
+                buffers.front() += bytes_written;
+                bytes_written = 0;
+            }
+        }
+        while (!buffers.empty() && buffers.front().size() == 0) {
+            buffers.erase(buffers.begin());
+        }
+    }
+    return calls;
+}
+
+static int writeChunked(tcp::socket &socket, infrastructure::PacketHeader &header, std::shared_ptr<SizedBuffer> &buffer) {
+    int calls = 0;
+    header.SetupHeader(buffer->GetSize());
+    while (true) {
+        calls += writeAll(socket, { net::buffer(header.Data(), header.Size()) });
+        calls += writeAll(
+            socket, { net::buffer((uint8_t *) buffer->GetMemory() + header.BytesWritten(), header.DataLength()) }
+        );
+        if (header.IsFinished()) {
+            return calls;
+        }
+        header.SetupNextHeader();
+    }
+}
+
+TEST_CASE("INFRASTRUCTURE_TCP-Gathered-Write-Syscalls") {
+    net::io_context context;
+    tcp::acceptor acceptor(context, tcp::endpoint(net::ip::address_v4::loopback(), 42070));
+    tcp::socket sender(context);
+    sender.connect(acceptor.local_endpoint());
+    sender.set_option(tcp::no_delay(true));
+    tcp::socket receiver = acceptor.accept();
+
+    std::atomic_long receive_total = 0;
+    std::atomic_bool receive_stop = false;
+    std::thread drain([&]() {
+        std::vector<char> sink(1 << 20);
+        error_code ec;
+        while (!receive_stop) {
+            auto bytes_read = receiver.read_some(net::buffer(sink), ec);
+            if (ec) {
+                break;
+            }
+            receive_total += (long) bytes_read;
+        }
+    });
+
+    const int frame_count = 500;
+    for (const int frame_size : { 32 * 1024, 256 * 1024, 1536 * 864 * 3 / 2 }) {
+        std::shared_ptr<SizedBuffer> buffer = std::make_shared<FakeSizedBuffer>(frame_size);
+        std::memset(buffer->GetMemory(), 0x42, frame_size);
+        infrastructure::PacketHeader header;
+        infrastructure::PacketFrame frame;
+        const long chunk_count = (frame_size + infrastructure::PacketHeader::MaxSize - 1) /
+            infrastructure::PacketHeader::MaxSize;
+        const long bytes_per_frame = frame_size + chunk_count * (long) infrastructure::PacketHeader::HeaderSize;
+
+        for (const bool is_gathered : { false, true }) {
+            const long expected_total = receive_total + bytes_per_frame * frame_count;
+            long calls = 0;
+            const auto t1 = Clock::now();
+            for (int i = 0; i < frame_count; i++) {
+                if (is_gathered) {
+                    frame.Setup(header, buffer);
+                    calls += writeAll(sender, frame.Buffers());
+                } else {
+                    calls += writeChunked(sender, header, buffer);
+                }
+            }
+            while (receive_total < expected_total) {
+                std::this_thread::yield();
+            }
+            const auto t2 = Clock::now();
+            const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+            REQUIRE_EQ(receive_total, expected_total);
+            std::cout << "test_infrastructure/test_tcp/gathered_write " << (is_gathered ? "gathered" : "chunked ") <<
+                " frame size " << frame_size << ": " << ((double) calls / frame_count) << " syscalls per frame, " <<
+                ((double) bytes_per_frame * frame_count / duration) << " MB/s" << std::endl;
+        }
+    }
+
+    receive_stop = true;
+    error_code ec;
+    sender.shutdown(tcp::socket::shutdown_both, ec);
+    sender.close(ec);
+    drain.join();
+}
@@ -0,0 +1,79 @@
+//
+// Created by brucegoose on 7/28/23.
+//
+
+#include <doctest.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+#include "load.hpp"
+#include "utils/sharded_asio_context.hpp"
+
+
+namespace {
+    struct ShardConfig: public ShardedAsioContextConfig {
+        explicit ShardConfig(int shard_count): _shard_count(shard_count) {}
+        [[nodiscard]] int get_asio_shard_count() const override {
+            return _shard_count;
+        }
+        const int _shard_count;
+    };
+    // 4 cameras at 60fps into 32 headsets, 64KB frames
+    const LoadShape shape;
+}
+
+TEST_CASE("INFRASTRUCTURE_TCP-Server-Shard-Scaling") {
+    const int core_count = (int) std::max(std::thread::hardware_concurrency(), 1u);
+    // 0 is the shared pool as it's always been, with a thread per core
+    std::vector<int> shard_counts = { 0 };
+    for (int shards = 1; shards < core_count; shards *= 2) {
+        shard_counts.push_back(shards);
+    }
+    shard_counts.push_back(core_count);
+
+    int port = 42080;
+    for (const int shard_count : shard_counts) {
+        port += 1;
+        TestClientServerConfig conf(
+            shard_count == 0 ? core_count : 1, port, "127.0.0.1", ConnectionType::HEADSET_CONNECTION
+        );
+        auto ctx = AsioContext::Create(conf);
+        std::shared_ptr<ShardedAsioContext> shards = nullptr;
+        if (shard_count > 0) {
+            shards = ShardedAsioContext::Create(ShardConfig(shard_count));
+            REQUIRE_EQ(shards->ShardCount(), shard_count);
+            shards->Start();
+        }
+        ctx->Start();
+        auto manager = std::make_shared<TcpRelayServerManager>();
+        for (int i = 0; i < shape.camera_count; i++) {
+            manager->ExpectCamera();
+        }
+        auto srv_manager = std::static_pointer_cast<infrastructure::TcpServerManager>(manager);
+        auto srv = infrastructure::TcpServer::Create(conf, ctx->GetContext(), srv_manager, shards);
+        srv->Start();
+
+        LoadResult result;
+        const bool is_replied = forkLoad(shape, port, result);
+
+        manager->Clear();
+        srv->Stop();
+        ctx->Stop();
+        if (shards) {
+            shards->Stop();
+        }
+
+        REQUIRE(is_replied);
+        REQUIRE_EQ(manager->_camera_count, shape.camera_count);
+        REQUIRE_GT(result.sent, 0);
+        REQUIRE_GT(result.received, 0);
+        const auto seconds = std::chrono::duration<double>(shape.load_time).count();
+        std::cout << "test_infrastructure/test_tcp/sharding " <<
+            (shard_count == 0 ? "shared pool of " + std::to_string(core_count) : std::to_string(shard_count) + " shards")
+            << ": " << shape.camera_count << " cameras -> " << shape.headset_count << " headsets, " <<
+            (long) (result.received / seconds) << " of " << (long) (result.sent * shape.headset_count / seconds) <<
+            " frames/s delivered, p50=" << result.p50_us << "us, p99=" << result.p99_us << "us" << std::endl;
+    }
+}
@@ -0,0 +1,142 @@
+//
+// Created by brucegoose on 7/29/23.
+//
+
+#include <doctest.h>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <type_traits>
+
+#include <dlfcn.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "load.hpp"
+
+/*
+ * asio's reactor goes through libc for its socket io, so the server's half of the syscalls can be counted by
+ * standing in for it; the load generator is forked, so none of its calls land in these counts. These stand-ins
+ * replace libc's for the whole binary, which is why this file builds into uring_tests and not the main test binary
+ */
+namespace {
+    /* asio does single buffers with send and recv, and the rest with sendmsg and recvmsg */
+    std::atomic<uint64_t> send_calls = { 0 };
+    std::atomic<uint64_t> receive_calls = { 0 };
+    std::atomic<uint64_t> epoll_wait_calls = { 0 };
+
+    template<typename F>
+    F *next(const char *symbol) {
+        static_assert(std::is_function<F>::value);
+        return (F *) dlsym(RTLD_NEXT, symbol);
+    }
+
+    int64_t cpuMicros() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return (int64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+            usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    }
+}
+
+extern "C" {
+    ssize_t send(int fd, const void *data, size_t size, int flags) {
+        static auto *libc_send = next<ssize_t(int, const void *, size_t, int)>("send");
+        send_calls.fetch_add(1, std::memory_order_relaxed);
+        return libc_send(fd, data, size, flags);
+    }
+    ssize_t sendmsg(int fd, const msghdr *message, int flags) {
+        static auto *libc_sendmsg = next<ssize_t(int, const msghdr *, int)>("sendmsg");
+        send_calls.fetch_add(1, std::memory_order_relaxed);
+        return libc_sendmsg(fd, message, flags);
+    }
+    ssize_t recv(int fd, void *data, size_t size, int flags) {
+        static auto *libc_recv = next<ssize_t(int, void *, size_t, int)>("recv");
+        receive_calls.fetch_add(1, std::memory_order_relaxed);
+        return libc_recv(fd, data, size, flags);
+    }
+    ssize_t recvmsg(int fd, msghdr *message, int flags) {
+        static auto *libc_recvmsg = next<ssize_t(int, msghdr *, int)>("recvmsg");
+        receive_calls.fetch_add(1, std::memory_order_relaxed);
+        return libc_recvmsg(fd, message, flags);
+    }
+    int epoll_wait(int epfd, epoll_event *events, int max_events, int timeout) {
+        static auto *libc_epoll_wait = next<int(int, epoll_event *, int, int)>("epoll_wait");
+        epoll_wait_calls.fetch_add(1, std::memory_order_relaxed);
+        return libc_epoll_wait(epfd, events, max_events, timeout);
+    }
+}
+
+TEST_CASE("INFRASTRUCTURE_TCP-Server-Uring-Fan-Out") {
+    // one camera; the relay posts every camera to every headset, and interleaved cameras read as a switch
+    LoadShape shape;
+    shape.camera_count = 1;
+    shape.headset_count = 64;
+    shape.frame_size = 128 * 1024;
+    const int core_count = (int) std::max(std::thread::hardware_concurrency(), 1u);
+
+    int port = 42180;
+    for (const auto backend : { infrastructure::TcpServerBackend::ASIO, infrastructure::TcpServerBackend::URING }) {
+        port += 1;
+        const bool is_uring = backend == infrastructure::TcpServerBackend::URING;
+        TestClientServerConfig conf(
+            core_count, port, "127.0.0.1", ConnectionType::HEADSET_CONNECTION, false, backend
+        );
+        auto ctx = AsioContext::Create(conf);
+        ctx->Start();
+        auto manager = std::make_shared<TcpRelayServerManager>();
+        for (int i = 0; i < shape.camera_count; i++) {
+            manager->ExpectCamera();
+        }
+        auto srv_manager = std::static_pointer_cast<infrastructure::TcpServerManager>(manager);
+        auto srv = infrastructure::TcpServer::Create(conf, ctx->GetContext(), srv_manager);
+        auto uring = srv->GetUring();
+        if (is_uring && uring == nullptr) {
+            std::cout << "test_infrastructure/test_tcp/uring: io_uring unavailable here, nothing to compare"
+                << std::endl;
+            srv.reset();
+            ctx->Stop();
+            break;
+        }
+        srv->Start();
+
+        const uint64_t sends_before = send_calls;
+        const uint64_t receives_before = receive_calls;
+        const uint64_t epoll_wait_before = epoll_wait_calls;
+        const int64_t cpu_before = cpuMicros();
+        LoadResult result;
+        const bool is_replied = forkLoad(shape, port, result);
+        const int64_t cpu_us = cpuMicros() - cpu_before;
+        const uint64_t sends = send_calls - sends_before;
+        const uint64_t receives = receive_calls - receives_before;
+        const uint64_t waits = epoll_wait_calls - epoll_wait_before;
+
+        manager->Clear();
+        srv->Stop();
+        ctx->Stop();
+
+        REQUIRE(is_replied);
+        REQUIRE_EQ(manager->_camera_count, shape.camera_count);
+        REQUIRE_GT(result.sent, 0);
+        REQUIRE_GT(result.received, 0);
+        uint64_t syscalls = sends + receives + waits;
+        if (uring) {
+            const auto counters = uring->GetCounters();
+            syscalls += counters.submits + counters.wakes;
+            // every headset's frame went out through the ring; only the hellos to the cameras went around it
+            REQUIRE_LE(sends, (uint64_t) shape.camera_count);
+            REQUIRE_GT(counters.sends, 0);
+            std::cout << uring->Report("test_infrastructure/test_tcp/uring");
+        }
+        const auto seconds = std::chrono::duration<double>(shape.load_time).count();
+        std::cout << "test_infrastructure/test_tcp/uring " << (is_uring ? "io_uring" : "asio") << ": " <<
+            shape.camera_count << " cameras -> " << shape.headset_count << " headsets, " <<
+            (long) (result.received / seconds) << " of " << (long) (result.sent * shape.headset_count / seconds) <<
+            " frames/s delivered, " << (double) syscalls / (double) result.sent << " syscalls per camera frame (" <<
+            "sends=" << sends << ", receives=" << receives << ", epoll_wait=" << waits << "), cpu " <<
+            cpu_us / 1000 << "ms, " << (double) cpu_us / (double) std::max(result.received, 1l) <<
+            "us per delivered frame, p50=" << result.p50_us << "us, p99=" << result.p99_us << "us" << std::endl;
+    }
+}
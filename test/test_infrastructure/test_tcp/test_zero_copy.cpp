@@ -0,0 +1,118 @@
+//
+// Created by brucegoose on 7/29/23.
+//
+
+#include <doctest.h>
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+#include <sys/resource.h>
+
+#include "load.hpp"
+
+namespace {
+    int64_t cpuMicros() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return (int64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+            usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    }
+
+    /* headsets go away as soon as the load generator exits, so their zero copy stats get added up on the way out */
+    class ZeroCopyRelayServerManager: public TcpRelayServerManager {
+    public:
+        void DestroyHeadsetServerConnection(std::shared_ptr<infrastructure::WritableTcpSession> &&session) override {
+            add(session);
+            TcpRelayServerManager::DestroyHeadsetServerConnection(std::move(session));
+        }
+        void AddRemaining() {
+            std::unique_lock<std::mutex> lock(_session_mutex);
+            for (auto &session : _sessions) {
+                add(session);
+            }
+        }
+        uint64_t sends = 0;
+        uint64_t bytes = 0;
+        uint64_t completions = 0;
+        uint64_t copied = 0;
+        int fallen_back = 0;
+    private:
+        void add(const std::shared_ptr<infrastructure::WritableTcpSession> &session) {
+            auto headset = std::dynamic_pointer_cast<infrastructure::TcpHeadsetSession>(session);
+            if (headset == nullptr) {
+                return;
+            }
+            std::unique_lock<std::mutex> lock(_stats_mutex);
+            const auto &stats = headset->GetZeroCopyStats();
+            sends += stats.sends;
+            bytes += stats.bytes;
+            completions += stats.completions;
+            copied += stats.copied;
+            fallen_back += stats.is_fallen_back ? 1 : 0;
+        }
+        std::mutex _stats_mutex;
+    };
+}
+
+TEST_CASE("INFRASTRUCTURE_TCP-Server-Zero-Copy-Fan-Out") {
+    LoadShape shape;
+    shape.camera_count = 1;
+    shape.headset_count = 8;
+    shape.frame_size = 512 * 1024;
+    const int core_count = (int) std::max(std::thread::hardware_concurrency(), 1u);
+
+    int port = 42280;
+    double copy_us_per_gb = 0;
+    for (const bool zero_copy : { false, true }) {
+        port += 1;
+        TestClientServerConfig conf(
+            core_count, port, "127.0.0.1", ConnectionType::HEADSET_CONNECTION, false,
+            infrastructure::TcpServerBackend::ASIO, zero_copy
+        );
+        auto ctx = AsioContext::Create(conf);
+        ctx->Start();
+        auto manager = std::make_shared<ZeroCopyRelayServerManager>();
+        manager->ExpectCamera();
+        auto srv_manager = std::static_pointer_cast<infrastructure::TcpServerManager>(manager);
+        auto srv = infrastructure::TcpServer::Create(conf, ctx->GetContext(), srv_manager);
+        srv->Start();
+
+        const int64_t cpu_before = cpuMicros();
+        LoadResult result;
+        const bool is_replied = forkLoad(shape, port, result);
+        const int64_t cpu_us = cpuMicros() - cpu_before;
+
+        manager->AddRemaining();
+        manager->Clear();
+        srv->Stop();
+        ctx->Stop();
+
+        REQUIRE(is_replied);
+        REQUIRE_GT(result.sent, 0);
+        REQUIRE_GT(result.received, 0);
+        const double gigabytes = (double) result.received * shape.frame_size / (1024.0 * 1024.0 * 1024.0);
+        const double us_per_gb = (double) cpu_us / gigabytes;
+        std::cout << "test_infrastructure/test_tcp/zero_copy " << (zero_copy ? "zero copy" : "copy") << ": " <<
+            shape.headset_count << " headsets, " << result.received << " of " << result.sent * shape.headset_count <<
+            " frames of " << shape.frame_size / 1024 << "kB, server cpu " << cpu_us / 1000 << "ms, " <<
+            (long) (us_per_gb / 1000) << "ms per GB sent";
+        if (!zero_copy) {
+            REQUIRE_EQ(manager->sends, 0);
+            copy_us_per_gb = us_per_gb;
+            std::cout << std::endl;
+            continue;
+        }
+        if (manager->sends == 0) {
+            std::cout << "; the kernel won't zero copy here" << std::endl;
+            continue;
+        }
+        // nothing the kernel finished with is still being held, and nothing still held was finished
+        REQUIRE_LE(manager->completions, manager->sends);
+        REQUIRE_LE(manager->copied, manager->completions);
+        std::cout << ", " << (long) ((copy_us_per_gb - us_per_gb) / 1000) << "ms per GB saved; " << manager->sends <<
+            " zero copy sends (" << manager->bytes / (1024 * 1024) << "MB), the kernel copied " << manager->copied <<
+            " of " << manager->completions << " anyway, " << manager->fallen_back << " of " << shape.headset_count <<
+            " headsets fell back to copying" << std::endl;
+    }
+}
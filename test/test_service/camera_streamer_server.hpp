@@ -33,12 +33,24 @@ struct TestServerConfig:
     [[nodiscard]] int get_tcp_camera_session_buffer_count() const override {
         return 4;
     };
-    [[nodiscard]] int get_tcp_headset_session_buffer_count() const override {
+    [[nodiscard]] int get_tcp_headset_session_queue_depth() const override {
         return 4;
     }
+    [[nodiscard]] bool get_tcp_headset_session_queue_conflating() const override {
+        return false;
+    }
     [[nodiscard]] int get_tcp_server_buffer_size() const override {
         return 1990656;
     };
+    [[nodiscard]] bool get_tcp_server_cut_through() const override {
+        return true;
+    }
+    [[nodiscard]] infrastructure::TcpServerBackend get_tcp_server_backend() const override {
+        return infrastructure::TcpServerBackend::ASIO;
+    }
+    [[nodiscard]] bool get_tcp_headset_session_zero_copy() const override {
+        return false;
+    }
 };
 
 
@@ -35,7 +35,7 @@ TEST_CASE("SERVICE_CAMERA-STREAMER_Setup-and-teardown") {
         10.0f,
 #endif
         infrastructure::EncoderType::SW,
-        5
+        5, 16384, 4, 2
     );
 
     std::chrono::time_point< std::chrono::high_resolution_clock> t1, t2, t3, t4;
@@ -73,7 +73,7 @@ TEST_CASE("SERVICE_CAMERA-STREAMER_Holding-pattern") {
             10.0f,
 #endif
             infrastructure::EncoderType::SW,
-            5
+            5, 16384, 4, 2
     );
 
 
@@ -103,7 +103,7 @@ TEST_CASE("SERVICE_CAMERA-STREAMER_Transmit-a-usable-frame") {
             10.0f,
             infrastructure::EncoderType::NONE,
 #endif
-            5
+            5, 16384, 4, 2
     );
 
     std::filesystem::path test_dir = TEST_DIR;
@@ -180,7 +180,7 @@ TEST_CASE("SERVICE_CAMERA-STREAMER_Transmit-a-usable-frame") {
 TEST_CASE("SERVICE_CAMERA-STREAMER_Transmit-10-seconds") {
     service::CameraStreamerConfig streamer_conf(
         "127.0.0.1", 6969, false, infrastructure::CameraType::LIBCAMERA, { 1536, 864 }, 0.5, 30.0f,
-        infrastructure::EncoderType::SW, 5
+        infrastructure::EncoderType::SW, 5, 16384, 4, 2
     );
 
     std::filesystem::path test_dir = TEST_DIR;
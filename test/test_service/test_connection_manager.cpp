@@ -0,0 +1,215 @@
+//
+// Created by brucegoose on 7/28/23.
+//
+
+#include <doctest.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+using namespace std::literals;
+typedef std::chrono::high_resolution_clock Clock;
+
+#include "service/server/connection_manager.hpp"
+#include "test_infrastructure/test_tcp/communication.hpp"
+
+namespace {
+    tcp_addr fakeAddr(const unsigned int host) {
+        return tcp_addr(0x0A000000 + host);
+    }
+
+    class FakeCamera: public infrastructure::TcpSession {
+    public:
+        FakeCamera(const tcp_addr addr, const unsigned long session_id):
+            _addr(addr), _session_id(session_id)
+        {}
+        void TryClose(bool internal_close) override {}
+        tcp_addr GetAddr() override {
+            return _addr;
+        }
+        unsigned long GetSessionId() override {
+            return _session_id;
+        }
+        [[nodiscard]] const LatencyStats &GetLatencyStats() override {
+            return _stats;
+        }
+    private:
+        const tcp_addr _addr;
+        const unsigned long _session_id;
+        LatencyStats _stats;
+    };
+
+    class FakeHeadset: public infrastructure::WritableTcpSession {
+    public:
+        FakeHeadset(const tcp_addr addr, const unsigned long session_id):
+            _addr(addr), _session_id(session_id)
+        {}
+        void TryClose(bool internal_close) override {}
+        tcp_addr GetAddr() override {
+            return _addr;
+        }
+        unsigned long GetSessionId() override {
+            return _session_id;
+        }
+        [[nodiscard]] const LatencyStats &GetLatencyStats() override {
+            return _stats;
+        }
+        void Write(std::shared_ptr<SizedBuffer> &&send_buffer) override {
+            _writes.fetch_add(1, std::memory_order_relaxed);
+        }
+        unsigned long GetDroppedFrameCount() override {
+            return _dropped_frames;
+        }
+        void SetDroppedFrameCount(const unsigned long dropped_frames) {
+            _dropped_frames = dropped_frames;
+        }
+        [[nodiscard]] unsigned long GetWrites() const {
+            return _writes.load();
+        }
+    private:
+        const tcp_addr _addr;
+        const unsigned long _session_id;
+        LatencyStats _stats;
+        std::atomic<unsigned long> _writes = { 0 };
+        std::atomic<unsigned long> _dropped_frames = { 0 };
+    };
+}
+
+TEST_CASE("SERVICE_SERVER_CONNECTION_MANAGER-Routing_Under_Rotation") {
+    const int camera_count = 10;
+    const int headset_count = 100;
+    const auto run_time = 2s;
+
+    service::ConnectionManager manager;
+    std::vector<tcp_addr> camera_addrs;
+    std::vector<std::shared_ptr<FakeHeadset>> headsets;
+    for (int i = 0; i < camera_count; i++) {
+        camera_addrs.push_back(fakeAddr(i + 1));
+        (void) manager.AddReaderSession(std::make_shared<FakeCamera>(camera_addrs.back(), i + 1));
+    }
+    for (int i = 0; i < headset_count; i++) {
+        headsets.push_back(std::make_shared<FakeHeadset>(fakeAddr(1000 + i), 1000 + i));
+        auto headset = headsets.back();
+        (void) manager.AddWriterSession(std::move(headset));
+    }
+    REQUIRE(manager.GetConnectionCounts() == std::pair<int, int>{ camera_count, headset_count });
+
+    // every headset starts on the first camera
+    auto buffer = std::make_shared<FakeResizableBuffer>(1024);
+    for (const auto &addr : camera_addrs) {
+        auto b_copy = std::static_pointer_cast<ResizableBuffer>(buffer);
+        manager.PostMessage(addr, std::move(b_copy));
+    }
+    for (const auto &headset : headsets) {
+        REQUIRE(headset->GetWrites() == 1);
+    }
+
+    // each camera thread posts as fast as it can, while control hops headsets around underneath it
+    std::atomic_bool is_running = { true };
+    std::atomic<unsigned long> rotations = { 0 };
+    // doctest can't throw out of another thread; count, and check after
+    std::atomic<unsigned long> failed_rotations = { 0 };
+    std::vector<LatencyHistogram> post_us(camera_count);
+    std::vector<std::thread> cameras;
+    for (int i = 0; i < camera_count; i++) {
+        cameras.emplace_back([&, i]() {
+            const auto addr = camera_addrs[i];
+            while (is_running) {
+                auto b_copy = std::static_pointer_cast<ResizableBuffer>(buffer);
+                const auto t1 = monotonicClockMicros();
+                manager.PostMessage(addr, std::move(b_copy));
+                post_us[i].Record(monotonicClockMicros() - t1);
+            }
+        });
+    }
+    std::thread control([&]() {
+        unsigned long step = 0;
+        while (is_running) {
+            switch (step % 4) {
+                case 0:
+                    failed_rotations += !manager.RotateAllConnections();
+                    break;
+                case 1:
+                    failed_rotations += !manager.RotateWriterConnection(headsets[step % headset_count]->GetAddr());
+                    break;
+                case 2:
+                    failed_rotations += !manager.ResetWriterConnection(headsets[step % headset_count]->GetAddr());
+                    break;
+                default:
+                    failed_rotations += !manager.PointReaderAtWriters(camera_addrs[step % camera_count]);
+                    break;
+            }
+            step++;
+            rotations++;
+            std::this_thread::sleep_for(100us);
+        }
+    });
+    std::this_thread::sleep_for(run_time);
+    is_running = false;
+    control.join();
+    for (auto &camera : cameras) {
+        camera.join();
+    }
+    REQUIRE(failed_rotations == 0);
+
+    // once it's quiet, a frame from every camera reaches each headset exactly once
+    std::vector<unsigned long> before;
+    for (const auto &headset : headsets) {
+        before.push_back(headset->GetWrites());
+    }
+    for (const auto &addr : camera_addrs) {
+        auto b_copy = std::static_pointer_cast<ResizableBuffer>(buffer);
+        manager.PostMessage(addr, std::move(b_copy));
+    }
+    for (int i = 0; i < headset_count; i++) {
+        REQUIRE(headsets[i]->GetWrites() == before[i] + 1);
+    }
+    // and nobody was holding onto the frame
+    REQUIRE(buffer.use_count() == 1);
+
+    uint64_t posts = 0;
+    int64_t max_us = 0;
+    std::vector<int64_t> p99s;
+    for (const auto &histogram : post_us) {
+        posts += histogram.Count();
+        max_us = std::max(max_us, histogram.Max());
+        p99s.push_back(histogram.Percentile(99));
+    }
+    std::cout << "test_service/connection_manager " << camera_count << " cameras, " << headset_count << " headsets: "
+        << posts << " posts and " << rotations << " rotations in " << run_time.count() << "s; worst camera p99="
+        << *std::max_element(p99s.begin(), p99s.end()) << "us, max=" << max_us << "us" << std::endl;
+
+    manager.Clear();
+    REQUIRE(manager.GetConnectionCounts() == std::pair<int, int>{ 0, 0 });
+}
+
+TEST_CASE("SERVICE_SERVER_CONNECTION_MANAGER-Latency_Report") {
+    service::ConnectionManager manager;
+    (void) manager.AddReaderSession(std::make_shared<FakeCamera>(fakeAddr(1), 1));
+    const std::vector<unsigned long> dropped_frames = { 0, 3, 12 };
+    std::vector<std::shared_ptr<FakeHeadset>> headsets;
+    for (std::size_t i = 0; i < dropped_frames.size(); i++) {
+        headsets.push_back(std::make_shared<FakeHeadset>(fakeAddr(1000 + i), 1000 + i));
+        headsets.back()->SetDroppedFrameCount(dropped_frames[i]);
+        auto writer = std::static_pointer_cast<infrastructure::WritableTcpSession>(headsets.back());
+        (void) manager.AddWriterSession(std::move(writer));
+    }
+
+    // every headset says how many frames its send queue dropped, even before it has any latency to report
+    const auto report = manager.GetLatencyReport();
+    for (std::size_t i = 0; i < headsets.size(); i++) {
+        const auto expected = "headset " + headsets[i]->GetAddr().to_string() + " dropped frames: n=" +
+            std::to_string(dropped_frames[i]) + "\n";
+        REQUIRE_NE(report.find(expected), std::string::npos);
+    }
+    unsigned long total = 0;
+    const std::string label = " dropped frames: n=";
+    for (auto at = report.find(label); at != std::string::npos; at = report.find(label, at + 1)) {
+        total += std::stoul(report.substr(at + label.size()));
+    }
+    REQUIRE_EQ(total, 15ul);
+
+    manager.Clear();
+}
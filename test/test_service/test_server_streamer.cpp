@@ -11,8 +11,8 @@ typedef std::chrono::high_resolution_clock Clock;
 
 TEST_CASE("SERVICE_SERVER-ENCODER_Setup-and-teardown") {
     service::ServerStreamerConfig conf(
-        2, 69691, 3, 6, 4, 5, 4269, 5, service::ClientAssignmentStrategy::CAMERA_THEN_HEADSET,
-        service::CameraSwitchingStrategy::NONE, 30
+        2, 0, 69691, 3, 6, 4, true, true, 5, infrastructure::TcpServerBackend::ASIO, false, 4269, 5,
+        service::ClientAssignmentStrategy::CAMERA_THEN_HEADSET, service::CameraSwitchingStrategy::NONE, 30
     );
 
     std::chrono::time_point< std::chrono::high_resolution_clock> t1, t2, t3, t4;
@@ -0,0 +1,76 @@
+//
+// Created by brucegoose on 6/10/23.
+//
+
+#include <doctest.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <cmath>
+
+#include "utils/latency.hpp"
+
+TEST_CASE("UTILS_LATENCY-Histogram-Percentiles") {
+    LatencyHistogram histogram;
+    REQUIRE_EQ(histogram.Percentile(50), 0);
+
+    // 1us to 100ms, evenly
+    const int64_t max_value = 100000;
+    for (int64_t i = 1; i <= max_value; i++) {
+        histogram.Record(i);
+    }
+    REQUIRE_EQ(histogram.Count(), max_value);
+    REQUIRE_EQ(histogram.Max(), max_value);
+    REQUIRE_EQ(histogram.Mean(), max_value / 2);
+    for (const double percentile : { 10.0, 50.0, 90.0, 99.0, 99.9 }) {
+        const double expected = percentile / 100.0 * max_value;
+        const double error = std::abs(histogram.Percentile(percentile) - expected) / expected;
+        REQUIRE_LT(error, 0.04);
+    }
+    REQUIRE_EQ(histogram.Percentile(100), max_value);
+
+    // small values are exact, and skewed clocks count as instant
+    LatencyHistogram small;
+    small.Record(-50);
+    small.Record(7);
+    small.Record(7);
+    REQUIRE_EQ(small.Percentile(0), 0);
+    REQUIRE_EQ(small.Percentile(50), 7);
+    REQUIRE_EQ(small.Max(), 7);
+
+    small.Reset();
+    REQUIRE_EQ(small.Count(), 0);
+    REQUIRE_EQ(small.Max(), 0);
+}
+
+TEST_CASE("UTILS_LATENCY-Stats-Record-Cost") {
+    LatencyStats stats;
+    const int thread_count = 4;
+    const int records_per_thread = 1000000;
+
+    // every stage of every frame records from whatever thread it finished on, so hammer one stage from a few
+    std::vector<std::thread> threads;
+    const auto start = Clock::now();
+    for (int t = 0; t < thread_count; t++) {
+        threads.emplace_back([&stats, t]() {
+            for (int i = 0; i < records_per_thread; i++) {
+                stats.Record(LatencyStage::FAN_OUT, (i * 37 + t) % 50000);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+
+    REQUIRE_EQ(stats.Get(LatencyStage::FAN_OUT).Count(), thread_count * records_per_thread);
+    REQUIRE_EQ(stats.Get(LatencyStage::DECODE).Count(), 0);
+
+    const auto report = stats.Report("test");
+    REQUIRE_NE(report.find("test fan_out"), std::string::npos);
+    REQUIRE_EQ(report.find("decode"), std::string::npos);
+
+    std::cout << "test_utils/latency " << thread_count << " threads: "
+              << duration.count() / (thread_count * records_per_thread) << " ns per record" << std::endl;
+    std::cout << report;
+}